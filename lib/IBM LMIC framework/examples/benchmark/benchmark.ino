@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This example measures the execution time of the LMIC hot paths on the
+ * target: AES MIC/CTR at several frame sizes, airtime calculation,
+ * uplink frame crypto, join accept processing, channel selection and
+ * the job scheduler. Nothing is transmitted.
+ *
+ * Every result is printed as one line, in the format of the host
+ * benchmark (test/Makefile, make bench):
+ *
+ *   BENCH,<name>,<iterations>,<ns/op>,<allocations>,<allocated bytes>
+ *
+ * The heap is only visible through mallinfo() here, so <allocated bytes>
+ * is the growth of the heap in use and <allocations> is 1 if it grew.
+ * Save the serial log and compare it with a baseline of the same board:
+ *
+ *   test/bench/compare.py serial.log baseline-wle5.csv [--update]
+ *
+ * Run once with USE_IDEETRON_AES and once with USE_ORIGINAL_AES in
+ * target-config.h to compare the AES engines. decodeFrame() and the
+ * MAC side of the join accept are static in lmic.c and only covered by
+ * the host benchmark.
+ *******************************************************************************/
+
+#include <lmic.h>
+#include <lmic/aes.h>
+#include <hal/hal.h>
+#include <malloc.h>
+#include <SPI.h>
+
+#if defined(USE_IDEETRON_AES)
+static const char* aes_engine = "ideetron";
+#elif defined(USE_ORIGINAL_AES)
+static const char* aes_engine = "original";
+#else
+static const char* aes_engine = "other";
+#endif
+
+// Keys and EUIs are dummies, nothing is sent.
+static const u1_t KEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                              0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+
+// Join accept with a CFList (867.1 to 867.9 MHz), JoinNonce 030201,
+// NetID 000013, DevAddr 26011234, RX1 delay 1 s, encrypted with KEY as
+// the NwkKey by join_accept_encrypt() of tools/lns/lwcrypto.py.
+static const u1_t JACC[LEN_JAEXT] = {
+    0x20, 0x66, 0xF1, 0xE7, 0x4E, 0x08, 0x2C, 0xD4, 0x1E, 0x73, 0x85, 0x34, 0x91, 0xA7, 0x80, 0x35,
+    0x49, 0x1A, 0xD7, 0xAB, 0xFD, 0x90, 0xE8, 0x94, 0xD1, 0x19, 0xA9, 0x5C, 0x3F, 0x29, 0x48, 0x1A,
+    0xF4
+};
+
+void os_getJoinEui (u1_t* buf) { memset(buf, 0, 8); }
+void os_getDevEui (u1_t* buf) { memset(buf, 1, 8); }
+void os_getNwkKey (u1_t* buf) { memcpy(buf, KEY, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+
+void onLmicEvent (ev_t ev) {
+}
+
+static u1_t buf[MAX_LEN_FRAME];
+static osjob_t jobs[16];
+static unsigned jobsrun;
+
+static void job_func (osjob_t* job) {
+    jobsrun++;
+}
+
+static int32_t heap_used (void) {
+    return mallinfo().uordblks;
+}
+
+// Print result line
+static void report (const char* name, uint32_t iterations, uint32_t us, int32_t heap) {
+    char line[96];
+    uint32_t ns = (uint32_t)((uint64_t)us * 1000 / iterations);
+
+    if (heap < 0)
+        heap = 0;
+    snprintf(line, sizeof(line), "BENCH,%s,%lu,%lu,%d,%lu", name,
+             (unsigned long)iterations, (unsigned long)ns, heap > 0, (unsigned long)heap);
+    Serial.println(line);
+}
+
+// Run stmt for n iterations and report
+#define BENCH(name, n, stmt) do {                          \
+        int32_t h0 = heap_used();                           \
+        uint32_t t0 = micros();                             \
+        for (uint32_t it = 0; it < (n); it++) { stmt; }     \
+        uint32_t t1 = micros();                             \
+        report(name, n, t1 - t0, heap_used() - h0);         \
+    } while (0)
+
+static void bench_aes (void) {
+    static const u1_t sizes[] = { 16, 51, 115, 242 };
+    char name[32];
+
+    for (unsigned i = 0; i < sizeof(sizes); i++) {
+        u1_t len = sizes[i];
+        snprintf(name, sizeof(name), "aes_mic_%s_%u", aes_engine, len);
+        BENCH(name, 200, { memcpy(AESkey, KEY, 16); memset(AESaux, 0x49, 16); os_aes(AES_MIC, buf, len); });
+        snprintf(name, sizeof(name), "aes_ctr_%s_%u", aes_engine, len);
+        BENCH(name, 200, { memcpy(AESkey, KEY, 16); memset(AESaux, 0x01, 16); os_aes(AES_CTR, buf, len); });
+    }
+}
+
+static void bench_airtime (void) {
+    char name[32];
+
+    for (dr_t dr = 0; dr <= 5; dr++) {
+        volatile rps_t rps = LMIC_updr2rps(dr);     // not hoisted out of the loop
+        volatile u1_t plen = 51;
+        volatile ostime_t t;
+        snprintf(name, sizeof(name), "calcAirTime_dr%u", dr);
+        BENCH(name, 1000, { t = LMIC_calcAirTime(rps, plen); });
+        (void)t;
+    }
+}
+
+// Crypto part of buildDataFrame: cipher payload and append MIC
+static void bench_dataframe (void) {
+    u1_t len = 13 + 51;
+    BENCH("dataframe_cipher_mic_51", 200, {
+        lce_cipher(LCE_APPSKEY, LMIC.devaddr, it, LCE_SCC_UP, buf + 9, 51);
+        lce_addMic(LCE_NWKSKEY, LMIC.devaddr, it, buf, len - 4);
+    });
+}
+
+static void bench_joinaccept (void) {
+    BENCH("lce_processJoinAccept_cflist", 200, {
+        memcpy(buf, JACC, sizeof(JACC));
+        if (!lce_processJoinAccept(buf, sizeof(JACC), 1))
+            Serial.println("join accept rejected");
+    });
+}
+
+static void bench_nexttx (void) {
+    volatile ostime_t t;
+    BENCH("nextTx", 1000, { t = LMIC_nextTx(os_getTime()); });
+    (void)t;
+}
+
+static void bench_scheduler (void) {
+    BENCH("sched_16jobs", 100, {
+        ostime_t now = os_getTime();
+        jobsrun = 0;
+        for (unsigned j = 0; j < 16; j++)
+            os_setTimedCallback(&jobs[j], now + (j * 7) % 16, job_func);
+        while (jobsrun < 16)
+            os_runstep();
+    });
+}
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("Starting");
+
+    os_init(NULL);
+    LMIC_reset();
+    LMIC_setSession(0x1, 0x26011234, KEY, KEY);
+    // Avoid the MAC engine running jobs between benchmarks
+    LMIC_shutdown();
+
+    bench_aes();
+    bench_airtime();
+    bench_dataframe();
+    bench_joinaccept();
+    bench_nexttx();
+    bench_scheduler();
+    Serial.println("Done");
+}
+
+void loop() {
+}
@@ -24,7 +24,13 @@
  *      extern "C" void lmic_aes_encrypt(u1_t *data, u1_t *key);
  *
  *  That takes a single 16-byte buffer and encrypts it wit the given
- *  16-byte key.
+ *  16-byte key. For keys expanded with os_aesExpandKey() it also needs:
+ *
+ *      extern "C" void lmic_aes_expand_key(const u1_t *key, u1_t *rk);
+ *      extern "C" void lmic_aes_encrypt_rk(u1_t *data, const u1_t *rk);
+ *
+ *  The first makes the 11 round keys (176 bytes), the second encrypts
+ *  with them.
  */
 
 #include "../lmic/aes.h"
@@ -33,10 +39,23 @@
 
 // This should be defined elsewhere
 void lmic_aes_encrypt(u1_t *data, u1_t *key);
+void lmic_aes_expand_key(const u1_t *key, u1_t *rk);
+void lmic_aes_encrypt_rk(u1_t *data, const u1_t *rk);
 
 // global area for passing parameters (aux, key) and for storing round keys
 u4_t AESAUX[16/sizeof(u4_t)];
-u4_t AESKEY[11*16/sizeof(u4_t)];
+u4_t AESKEY[AES_EXPKEYLEN/sizeof(u4_t)];
+
+// AESKEY holds an expanded key: round keys followed by CMAC subkey K1
+static u1_t expanded;
+#define EXP_K1 (AESkey + 11*16)
+
+static void encrypt(u1_t *block) {
+    if (expanded)
+        lmic_aes_encrypt_rk(block, AESkey);
+    else
+        lmic_aes_encrypt(block, AESkey);
+}
 
 // Shift the given buffer left one bit
 static void shift_left(u1_t *buf, u1_t len) {
@@ -55,7 +74,7 @@ static void shift_left(u1_t *buf, u1_t len) {
 // in any case. The CMAC result is returned in AESAUX as well.
 static void os_aes_cmac(u1_t *buf, u2_t len, u1_t prepend_aux) {
     if (prepend_aux)
-        lmic_aes_encrypt(AESaux, AESkey);
+        encrypt(AESaux);
     else
         memset (AESaux, 0, 16);
 
@@ -76,16 +95,21 @@ static void os_aes_cmac(u1_t *buf, u2_t len, u1_t prepend_aux) {
         if (len == 0) {
             // Final block, xor with K1 or K2. K1 and K2 are calculated
             // by encrypting the all-zeroes block and then applying some
-            // shifts and xor on that.
+            // shifts and xor on that. An expanded key brings K1 along.
             u1_t final_key[16];
-            memset(final_key, 0, sizeof(final_key));
-            lmic_aes_encrypt(final_key, AESkey);
-
-            // Calculate K1
-            u1_t msb = final_key[0] & 0x80;
-            shift_left(final_key, sizeof(final_key));
-            if (msb)
-                final_key[sizeof(final_key)-1] ^= 0x87;
+            u1_t msb;
+            if (expanded) {
+                memcpy(final_key, EXP_K1, sizeof(final_key));
+            } else {
+                memset(final_key, 0, sizeof(final_key));
+                lmic_aes_encrypt(final_key, AESkey);
+
+                // Calculate K1
+                msb = final_key[0] & 0x80;
+                shift_left(final_key, sizeof(final_key));
+                if (msb)
+                    final_key[sizeof(final_key)-1] ^= 0x87;
+            }
 
             // If the final block was not complete, calculate K2 from K1
             if (need_padding) {
@@ -100,7 +124,7 @@ static void os_aes_cmac(u1_t *buf, u2_t len, u1_t prepend_aux) {
                 AESaux[i] ^= final_key[i];
         }
 
-        lmic_aes_encrypt(AESaux, AESkey);
+        encrypt(AESaux);
     }
 }
 
@@ -112,7 +136,7 @@ static void os_aes_ctr (u1_t *buf, u2_t len) {
     while (len) {
         // Encrypt the counter block with the selected key
         memcpy(ctr, AESaux, sizeof(ctr));
-        lmic_aes_encrypt(ctr, AESkey);
+        encrypt(ctr);
 
         // Xor the payload with the resulting ciphertext
         for (u1_t i = 0; i < 16 && len > 0; i++, len--, buf++)
@@ -123,8 +147,21 @@ static void os_aes_ctr (u1_t *buf, u2_t len) {
     }
 }
 
+void os_aesExpandKey (const u1_t *key, u1_t *exp) {
+    u1_t* k1 = exp + 11*16;
+
+    lmic_aes_expand_key(key, exp);
+    memset(k1, 0, 16);
+    lmic_aes_encrypt_rk(k1, exp);
+    u1_t msb = k1[0] & 0x80;
+    shift_left(k1, 16);
+    if (msb)
+        k1[15] ^= 0x87;
+}
+
 u4_t os_aes (u1_t mode, u1_t *buf, u2_t len) {
-    switch (mode & ~AES_MICNOAUX) {
+    expanded = (mode & AES_EXPKEY) != 0;
+    switch (mode & ~(AES_MICNOAUX|AES_EXPKEY)) {
         case AES_MIC:
             os_aes_cmac(buf, len, /* prepend_aux */ !(mode & AES_MICNOAUX));
             return os_rmsbf4(AESaux);
@@ -132,7 +169,7 @@ u4_t os_aes (u1_t mode, u1_t *buf, u2_t len) {
         case AES_ENC:
             // TODO: Check / handle when len is not a multiple of 16
             for (u1_t i = 0; i < len; i += 16)
-                lmic_aes_encrypt(buf+i, AESkey);
+                encrypt(buf+i);
             break;
 
         case AES_CTR:
@@ -39,6 +39,8 @@
 //  - All other functions and variables were made static
 //  - Tabs were converted to 2 spaces
 //  - An #include and #if guard was added
+//  - The round keys are calculated up front (lmic_aes_expand_key) so
+//    they can be reused for several blocks (lmic_aes_encrypt_rk)
 
 #include "../lmic/oslmic.h"
 
@@ -72,7 +74,9 @@ static unsigned char S_Table[16][16] = {
 };
 
 void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key);
-static void AES_Add_Round_Key(unsigned char *Round_Key);
+void lmic_aes_expand_key(const unsigned char *Key, unsigned char *Round_Keys);
+void lmic_aes_encrypt_rk(unsigned char *Data, const unsigned char *Round_Keys);
+static void AES_Add_Round_Key(const unsigned char *Round_Key);
 static unsigned char AES_Sub_Byte(unsigned char Byte);
 static void AES_Shift_Rows();
 static void AES_Mix_Collums();
@@ -87,11 +91,55 @@ static void AES_Calculate_Round_Key(unsigned char Round, unsigned char *Round_Ke
 *****************************************************************************************
 */
 void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
+{
+  unsigned char Round_Keys[11*16];
+
+  lmic_aes_expand_key(Key, Round_Keys);
+  lmic_aes_encrypt_rk(Data, Round_Keys);
+}
+
+/*
+*****************************************************************************************
+* Description : Function that calculates all round keys of a key
+*
+* Arguments   : *Key          Key, a 16 byte long arry
+*               *Round_Keys   11 round keys, a 176 byte long arry
+*****************************************************************************************
+*/
+void lmic_aes_expand_key(const unsigned char *Key, unsigned char *Round_Keys)
 {
   unsigned char i;
+  unsigned char Round;
+
+  //Copy key to first round key
+  for(i = 0; i < 16; i++)
+  {
+    Round_Keys[i] = Key[i];
+  }
+
+  //Every round key is calculated from the previous one
+  for(Round = 1; Round < 11; Round++)
+  {
+    for(i = 0; i < 16; i++)
+    {
+      Round_Keys[16*Round + i] = Round_Keys[16*(Round-1) + i];
+    }
+    AES_Calculate_Round_Key(Round, Round_Keys + 16*Round);
+  }
+}
+
+/*
+*****************************************************************************************
+* Description : Function for encrypting data using AES-128 with precalculated round keys
+*
+* Arguments   : *Data         Data to encrypt is a 16 byte long arry
+*               *Round_Keys   Round keys from lmic_aes_expand_key()
+*****************************************************************************************
+*/
+void lmic_aes_encrypt_rk(unsigned char *Data, const unsigned char *Round_Keys)
+{
   unsigned char Row,Collum;
   unsigned char Round = 0x00;
-  unsigned char Round_Key[16];
 
   //Copy input to State arry
   for(Collum = 0; Collum < 4; Collum++)
@@ -102,14 +150,8 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
     }
   }
 
-  //Copy key to round key
-  for(i = 0; i < 16; i++)
-  {
-    Round_Key[i] = Key[i];
-  }
-
   //Add round key
-  AES_Add_Round_Key(Round_Key);
+  AES_Add_Round_Key(Round_Keys);
 
   //Preform 9 full rounds
   for(Round = 1; Round < 10; Round++)
@@ -129,11 +171,8 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
     //Mix Collums
     AES_Mix_Collums();
 
-    //Calculate new round key
-    AES_Calculate_Round_Key(Round,Round_Key);
-
     //Add round key
-    AES_Add_Round_Key(Round_Key);
+    AES_Add_Round_Key(Round_Keys + 16*Round);
   }
 
   //Last round whitout mix collums
@@ -149,11 +188,8 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
   //Shift rows
   AES_Shift_Rows();
 
-  //Calculate new round key
-  AES_Calculate_Round_Key(Round,Round_Key);
-
   //Add round Key
-  AES_Add_Round_Key(Round_Key);
+  AES_Add_Round_Key(Round_Keys + 16*Round);
 
   //Copy the State into the data array
   for(Collum = 0; Collum < 4; Collum++)
@@ -173,7 +209,7 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
 * Arguments   : *Round_Key    16 byte long array holding the Round Key
 *****************************************************************************************
 */
-static void AES_Add_Round_Key(unsigned char *Round_Key)
+static void AES_Add_Round_Key(const unsigned char *Round_Key)
 {
   unsigned char Row,Collum;
 
@@ -11,7 +11,7 @@
 
 // global area for passing parameters (aux, key) and for storing round keys
 u4_t AESAUX[16/sizeof(u4_t)];
-u4_t AESKEY[11*16/sizeof(u4_t)];
+u4_t AESKEY[AES_EXPKEYLEN/sizeof(u4_t)];
 
 
 #if defined(CFG_bootloader) && defined(CFG_bootloader_aes)
@@ -19,7 +19,13 @@ u4_t AESKEY[11*16/sizeof(u4_t)];
 #include "boot/bootloader.h"
 
 u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
-    return HAL_boottab->aes(mode, buf, len, AESKEY, AESAUX);
+    return HAL_boottab->aes(mode & ~AES_EXPKEY, buf, len, AESKEY, AESAUX);
+}
+
+// the boot loader expands the key itself
+void os_aesExpandKey (const u1_t* key, u1_t* exp) {
+    os_clearMem(exp, AES_EXPKEYLEN);
+    os_copyMem(exp, key, 16);
 }
 
 #else
@@ -236,11 +242,21 @@ static void aesroundkeys () {
     }
 }
 
+// round keys only, the CMAC subkey is derived inline in os_aes()
+void os_aesExpandKey (const u1_t* key, u1_t* exp) {
+    os_copyMem(AESkey, key, 16);
+    aesroundkeys();
+    os_copyMem(exp, AESkey, 11*16);
+    os_clearMem(exp + 11*16, AES_EXPKEYLEN - 11*16);
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
         
-        aesroundkeys();
+        if( (mode & AES_EXPKEY) == 0 ) {
+            aesroundkeys();
+        }
 
         if( mode & AES_MICNOAUX ) {
             AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
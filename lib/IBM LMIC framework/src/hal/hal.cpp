@@ -37,6 +37,7 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include "../lmic.h"
+#include "../lmic/peripherals.h"
 #include "hal.h"
 #if defined(BRD_LoRa_E5_radio)
   #include <stm32wlxx_hal_subghz.h>               // Interface to radio module
@@ -128,6 +129,7 @@ void hal_ant_switch ( u1_t val )
         digitalWrite ( PA4, val == HAL_ANTSW_RX ) ;
         digitalWrite ( PA5, val == HAL_ANTSW_TX ) ;
         digitalWrite ( PB0, val != HAL_ANTSW_OFF ) ;    // TCXO usually on
+        energy_tcxo ( val != HAL_ANTSW_OFF ) ;          // Account TCXO consumption
     #else
         // TODO: Support separate pin for TX2 (PA_BOOST output)
         if (lmic_pins.tx < LMIC_UNUSED_PIN)
@@ -213,6 +215,7 @@ bool hal_pin_tcxo (u1_t val) {
 #if defined(BRD_LoRa_E5_radio)
 bool hal_pin_tcxo (u1_t val) {
     digitalWrite ( PB0, val ) ;
+    energy_tcxo ( val ) ;
     return true ;
 }
 #endif // defined(BRD_LoRa_E5_radio)
@@ -499,8 +502,7 @@ void hal_failed () {
 }
 
 void hal_reboot (void) {
-    // TODO
-    hal_failed();
+    NVIC_SystemReset();
 }
 
 u1_t hal_getBattLevel (void) {
@@ -516,38 +518,154 @@ void hal_fwinfo (hal_fwi* /* fwi */) {
     // Not implemented
 }
 
+// -----------------------------------------------------------------------------
+// Personalization data
+
+// The identity and keys of a device are written at production by
+// tools/perso/perso.py, so all devices run the same image. The record goes
+// into OTP, which cannot be erased: a device is provisioned again by adding
+// a record after the last one, the last valid record is used. Without one
+// in OTP the record at PERSODATA_FLASH is used. Without any the functions
+// below return NULL or 0 and the application uses its compiled-in keys.
+// EUIs are little endian (LMIC order). A DevEUI left all 0xFF is the
+// 64-bit UID of the STM32WL, which is an EUI-64 with the ST OUI.
+#define PERSODATA_MAGIC     0x4F535250      // "PRSO"
+#define OTP_AREA            0x1FFF7000
+#define OTP_SIZE            0x400
+
+typedef struct {
+    uint32_t    magic;          // PERSODATA_MAGIC
+    uint32_t    hwid;           // hardware ID
+    uint32_t    region;         // REGCODE_xxx, 0 for the application's
+    uint32_t    reserved;       // 0
+    uint8_t     serial[16];     // production serial number
+    uint8_t     deveui[8];      // all 0xFF: the UID
+    uint8_t     joineui[8];
+    uint8_t     nwkkey[16];
+    uint8_t     appkey[16];
+    uint32_t    crc;            // CRC-32 (as zlib) of the fields above
+    uint32_t    pad;            // 0xFFFFFFFF, size in double words
+} persodata_t;
+
+static const persodata_t* perso;
+static uint8_t perso_deveui[8];
+
+static uint32_t perso_crc (const uint8_t* p, int len) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (len-- > 0) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static bool perso_valid (const persodata_t* p) {
+    return p->magic == PERSODATA_MAGIC
+        && p->crc == perso_crc((const uint8_t*)p, offsetof(persodata_t, crc));
+}
+
+// The record is looked up once, the hal_ functions return pointers into it
+static const persodata_t* perso_get (void) {
+    static bool done;
+    if (done)
+        return perso;
+    done = true;
+    for (uint32_t a = OTP_AREA; a + sizeof(persodata_t) <= OTP_AREA + OTP_SIZE; a += sizeof(persodata_t)) {
+        if (perso_valid((const persodata_t*)a))
+            perso = (const persodata_t*)a;
+    }
+    if (perso == NULL && perso_valid((const persodata_t*)PERSODATA_FLASH))
+        perso = (const persodata_t*)PERSODATA_FLASH;
+    if (perso != NULL) {
+        static const uint8_t blank[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+        memcpy(perso_deveui, memcmp(perso->deveui, blank, 8) ? perso->deveui
+                                                             : (const uint8_t*)UID64_BASE, 8);
+    }
+    return perso;
+}
+
 u1_t* hal_joineui (void) {
-    return nullptr;
+    return perso_get() ? (u1_t*)perso->joineui : nullptr;
 }
 
 u1_t* hal_deveui (void) {
-    return nullptr;
+    return perso_get() ? perso_deveui : nullptr;
 }
 
 u1_t* hal_nwkkey (void) {
-    return nullptr;
+    return perso_get() ? (u1_t*)perso->nwkkey : nullptr;
 }
 
 u1_t* hal_appkey (void) {
-    return nullptr;
+    return perso_get() ? (u1_t*)perso->appkey : nullptr;
 }
 
 u1_t* hal_serial (void) {
-    return nullptr;
+    return perso_get() ? (u1_t*)perso->serial : nullptr;
 }
 
 u4_t  hal_region (void) {
-    return 0;
+    return perso_get() ? perso->region : 0;
 }
 
 u4_t  hal_hwid (void) {
-    return 0;
+    return perso_get() ? perso->hwid : 0;
 }
 
+// 96-bit unique ID of the MCU folded to 32 bits, with or without a record
 u4_t  hal_unique (void) {
-    return 0;
+    return HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
 }
 
 u4_t hal_dnonce_next (void) {
     return os_getRndU2();
 }
+
+// -----------------------------------------------------------------------------
+// Flash
+
+bool flash_write (void* dst, const void* src, unsigned int nwords, bool erase) {
+    const uint32_t* s = (const uint32_t*)src;
+    uint32_t addr = (uint32_t)dst;
+    FLASH_EraseInitTypeDef page;
+    uint32_t err;
+    bool ok = true;
+
+    // the STM32WL programs 64-bit double words, once per erase
+    ASSERT((addr & 7) == 0);
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    for (unsigned int i = 0; ok && i < nwords; i += 2, addr += 8) {
+        if (erase && (addr & (FLASH_PAGE_SZ - 1)) == 0) {
+            page.TypeErase = FLASH_TYPEERASE_PAGES;
+            page.Page      = (addr - FLASH_BASE) / FLASH_PAGE_SZ;
+            page.NbPages   = 1;
+            ok = HAL_FLASHEx_Erase(&page, &err) == HAL_OK;
+        }
+        if (s == NULL || !ok)
+            continue;
+        uint64_t dw = s[i] | ((uint64_t)(i + 1 < nwords ? s[i + 1] : 0xFFFFFFFF) << 32);
+        // leave erased double words alone, so they can still be programmed
+        if (dw != ~(uint64_t)0)
+            ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, dw) == HAL_OK;
+    }
+    HAL_FLASH_Lock();
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// Firmware update
+
+// There is no bootloader in this build. The address of a received update
+// image is left in RTC backup registers for a bootloader to pick up after
+// hal_reboot(). NULL cancels a pending update.
+#define BKP_R_UPDATE        RTC_BKP_DR9         // DR9 and DR19, clear of the registers of main.cpp
+#define BKP_R_UPDATEVALID   RTC_BKP_DR19
+#define UPDATE_VALID        0x55504454      // "UPDT"
+
+bool hal_set_update (void* ptr) {
+    setBackupRegister(BKP_R_UPDATE, (uint32_t)ptr);
+    setBackupRegister(BKP_R_UPDATEVALID, ptr ? UPDATE_VALID : 0);
+    return true;
+}
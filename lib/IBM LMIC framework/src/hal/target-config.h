@@ -32,7 +32,9 @@
 
 // This defines the region(s) to use. You can enable more than one and
 // then select the right region at runtime using os_getRegion() and/or
-// LMIC_reset_ex().
+// LMIC_reset_ex(). Every region costs flash (its parameters, and for the
+// fixed channel plans of us915/au915 the channel mask and hopping code),
+// enable only the ones the devices are provisioned for.
 #if !defined(CFG_eu868) && !defined(CFG_us915)
 #define CFG_eu868 1
 //#define CFG_us915 1
@@ -75,7 +77,7 @@
 // Debug output (and assertion failures) are printed to this Stream
 #define CFG_DEBUG_STREAM Serial
 // Define these to add some TX or RX specific debug output (needs
-// CFG_DEBUG)
+// CFG_DEBUG, without it they take no flash)
 #define DEBUG_TX
 #define DEBUG_RX
 // Define these to add some job scheduling specific debug output (needs
@@ -89,9 +91,103 @@
 // instead, though.
 //#define LMIC_PRINTF_TO Serial
 
+// When this is defined, time and charge spent in each radio and MCU
+// state are accounted (see lmic/energy.h). This also fills in
+// LMIC.radioPwr_ua for the current radio operation.
+#define CFG_energy
+
+// When this is defined, the last radio operations and their outcome
+// (frames, timestamps, rssi, snr) are recorded and a recorded trace can
+// be replayed instead of using the radio (see lmic/radiotrace.h). Use
+// CFG_radiotrace_framelen 255 if the trace is to be replayed.
+//#define CFG_radiotrace
+//#define CFG_radiotrace_depth 16
+//#define CFG_radiotrace_framelen 64
+
+// When this is defined, data blocks larger than one downlink (firmware
+// images) can be received with the LoRaWAN fragmented data block transport
+// on port 201 (see lmic/fuota.h). Fragments go straight to flash, lost
+// ones are recovered from coded fragments. The decoder uses about
+// CFG_fuota_maxfrags/4 + CFG_fuota_maxmissing^2/4 bytes of RAM.
+//#define CFG_fuota
+//#define CFG_fuota_maxfrags 2048
+//#define CFG_fuota_maxmissing 128
+
+// When this is defined, byte streams can be uplinked with LMIC_dseStart()
+// (see lmic/dse.h): frames of the maximal size for the data rate, sent
+// unconfirmed and once, with fountain coded frames per block to make up
+// for lost ones. tools/lns/lns.py --dse reassembles the streams.
+//#define CFG_dse
+
+// When this is defined, multicast groups and their class C sessions can be
+// set up by the network with the LoRaWAN remote multicast setup package on
+// port 200 (see lmic/mcast.h). The application keeps the device awake
+// while LMIC_mcastClassC() reports a session.
+//#define CFG_mcast
+// Multicast groups, each takes 424 bytes of RAM in LMIC (expanded keys and
+// session). Default 2 with CFG_mcast, 0 without: LMIC_setMultiCastSession()
+// then refuses all groups.
+//#define CFG_mcast_sessions 2
+
+// When this is defined, the network time can be requested with
+// LMIC_requestDeviceTime() (DeviceTimeReq) and is set by the application
+// layer clock synchronization package on port 202 (see lmic/timesync.h).
+// LMIC_gpsTime()/LMIC_utcTime() give the time for local timestamps.
+//#define CFG_timesync
+//#define CFG_timesync_leapsecs 18
+
+// When this is defined, the airtime of all transmissions is kept in a
+// rolling 24 hour ledger (see lmic/budget.h) for fair use budgets such as
+// 30 s/day. The application keeps the ledger across deep sleep, asks how
+// long a frame has to wait, and can let LMIC_setTxData2() refuse frames
+// over budget.
+#define CFG_budget
+
+// When this is defined, the application can place each uplink at a time
+// within its interval derived from a hash of the DevAddr and the period
+// number in the network time (see lmic/txslot.h), instead of sleeping a
+// fixed interval. This keeps a fleet that wakes up together from sending
+// together.
+#define CFG_txslot
+
+// When this is defined, the application can keep timestamped records in a
+// flash ring buffer while uplinks fail (see lmic/backlog.h) and upload them
+// later, packed into as few frames as the payload size allows. Needs
+// flash_write() (PERIPH_FLASH).
+#define CFG_backlog
+
+// When this is defined, the application keeps its configuration (keys,
+// frame counter) as versioned, CRC protected blocks in flash (see
+// lmic/persist.h) instead of byte by byte in the emulated EEPROM. A commit
+// never erases the last valid copy. Needs flash_write() (PERIPH_FLASH).
+#define CFG_persist
+
+// Largest uplink payload the application sends. LMIC buffers the pending
+// uplink in RAM with this size (default 242, the largest of all regions)
+// and LMIC_maxAppPayload() does not go above it. 115 is enough up to DR3
+// in EU868 and saves 128 bytes.
+//#define CFG_max_payload 115
+
+// Flash page with the personalization data (DevEUI, JoinEUI, keys, see
+// hal/hal.cpp) of a device that has none in OTP. Written at production by
+// tools/perso/perso.py. The application keeps its flash areas clear of it.
+#define PERSODATA_FLASH 0x0803B800
+
+// Continuous class C reception on the LoRa-E5 uses the radio's RX duty
+// cycle mode (sleeping between preamble checks). Define this to keep the
+// receiver on all the time instead.
+//#define DISABLE_RXDUTYCYCLE
+
 // Remove/comment this to enable code related to beacon tracking.
+// Class B (LMIC_setPingable()) keeps the device awake while it tracks
+// the beacon. The beacon and ping slot state takes 48 bytes of RAM in
+// LMIC, the application needs it only with CLASSB_PINGEXP.
 #define DISABLE_CLASSB
 
+// Clock error in ppm assumed for the first beacon windows, later windows
+// follow the measured drift. Default 30 on the LoRa-E5, 100 otherwise.
+//#define CFG_bcnppm 30
+
 // This allows choosing between multiple included AES implementations.
 // Make sure exactly one of these is uncommented.
 //
@@ -105,6 +201,9 @@
 // own LoRaWAN library. It also uses lookup tables, but smaller
 // byte-oriented ones, making it use a lot less flash space (but it is
 // also about twice as slow as the original).
+// A build with -DUSE_ORIGINAL_AES uses the original one instead.
+#ifndef USE_ORIGINAL_AES
 #define USE_IDEETRON_AES
+#endif
 
 #endif // _lmic_arduino_hal_config_h_
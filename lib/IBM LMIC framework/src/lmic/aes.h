@@ -24,6 +24,10 @@ extern "C"{
 #define AES_CTR       0x04
 #define AES_MICNOAUX  0x08
 #endif
+#define AES_EXPKEY    0x40  // AESkey holds a key expanded by os_aesExpandKey()
+
+// Size of an expanded key: 11 round keys and the CMAC subkey K1
+#define AES_EXPKEYLEN (12*16)
 #ifndef AESkey  // if AESkey is defined as macro all other values must be too
 extern u1_t* AESkey;
 extern u1_t* AESaux;
@@ -31,6 +35,10 @@ extern u1_t* AESaux;
 #ifndef os_aes
 u4_t os_aes (u1_t mode, u1_t* buf, u2_t len);
 #endif
+// Expand key into exp (AES_EXPKEYLEN bytes). To use it, copy exp to AESkey
+// and call os_aes() with AES_EXPKEY, this saves the key schedule (and for
+// AES_MIC the subkey) on every call. Uses AESkey as working memory.
+void os_aesExpandKey (const u1_t* key, u1_t* exp);
 
 #ifdef __cplusplus
 } // extern "C"
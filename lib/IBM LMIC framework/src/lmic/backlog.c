@@ -0,0 +1,277 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "peripherals.h"
+
+#ifdef CFG_backlog
+
+#ifndef PERIPH_FLASH
+#error "CFG_backlog needs flash_write() (PERIPH_FLASH)"
+#endif
+
+// The area is a ring of flash pages written in order. Each page starts
+// with a header (magic, page sequence number) and holds records that are
+// only appended, so every double word is programmed once per erase. A
+// page is erased when the ring comes around to it again, dropping the
+// oldest records if they were not sent: every page wears at the same rate
+// and a record costs its header and its data rounded up to 8 bytes.
+// Records sent are not marked one by one: a SENT record appended after
+// every frame holds the position of the oldest record not yet sent.
+//
+// Record: crc(2) type(1) len(1) time(4) data(len), padded to 8 bytes.
+// The CRC covers type to the end of the data, a record torn by a reset
+// fails it and ends the records of its page.
+
+#define BACKLOG_MAGIC   0x474C4B42      // "BKLG"
+#define PAGE_HDR        8
+#define REC_HDR         8
+#define REC_DATA        0xDA
+#define REC_SENT        0x5E
+#define NOPOS           0xFFFFFFFF
+
+static struct {
+    u1_t*   area;
+    u4_t    size;       // multiple of FLASH_PAGE_SZ
+    u4_t    hpage;      // offset of the head page
+    u4_t    pseq;       // sequence number of the head page
+    u4_t    head;       // offset for the next record
+    u4_t    tail;       // offset of the oldest record not sent
+    u4_t    count;      // data records not sent
+    u4_t    fend;       // offset after the records of the last frame
+    u2_t    fcount;     // data records in the last frame
+} B;
+
+// Offsets are never at a page start (page header), so off-1 is in the page
+static u4_t pageEnd (u4_t off) {
+    return ((off - 1) & ~(u4_t)(FLASH_PAGE_SZ - 1)) + FLASH_PAGE_SZ;
+}
+
+static bit_t erased8 (u4_t off) {
+    const u4_t* w = (const u4_t*)(B.area + off);
+    return w[0] == 0xFFFFFFFF && w[1] == 0xFFFFFFFF;
+}
+
+static u4_t pageSeq (u4_t page) {
+    const u1_t* p = B.area + page;
+    return os_rlsbf4(p) == BACKLOG_MAGIC ? os_rlsbf4(p + 4) : 0;
+}
+
+// Size of the valid record at off, 0 if the records of its page end there
+static u4_t recLen (u4_t off) {
+    if( off + REC_HDR > pageEnd(off) || erased8(off) )
+        return 0;
+    u1_t* h = B.area + off;
+    u4_t n = REC_HDR + ((h[3] + 7) & ~7u);
+    if( h[3] > BACKLOG_MAXREC || off + n > pageEnd(off) || os_rlsbf2(h) != os_crc16(h + 2, 6 + h[3]) )
+        return 0;
+    return n;
+}
+
+// Position after the record at off of size len, in ring order
+static u4_t nextOff (u4_t off, u4_t len) {
+    u4_t n = off + len;
+    if( n == B.head || (len != 0 && recLen(n) != 0) )
+        return n;
+    n = pageEnd(off);           // rest of the page unused
+    return (n == B.size ? 0 : n) + PAGE_HDR;
+}
+
+static void recount (void) {
+    u4_t off = B.tail, len;
+    B.count = 0;
+    for( u4_t i = B.size / REC_HDR; off != B.head && i != 0; i-- ) {
+        len = recLen(off);
+        if( len && B.area[off + 2] == REC_DATA )
+            B.count++;
+        off = nextOff(off, len);
+    }
+}
+
+// Erase the page after the head page and continue there. Records not
+// sent in it are lost. Returns 0 if the erase or the header write failed.
+static bit_t newPage (void) {
+    u4_t pg = B.hpage + FLASH_PAGE_SZ;
+    u4_t hdr[2];
+    if( pg == B.size )
+        pg = 0;
+    os_wlsbf4((u1_t*)hdr, BACKLOG_MAGIC);
+    os_wlsbf4((u1_t*)hdr + 4, ++B.pseq);
+    bit_t ok = flash_write(B.area + pg, hdr, 2, true);
+    B.hpage = pg;
+    B.head = pg + PAGE_HDR;
+    if( B.count == 0 ) {
+        B.tail = B.head;
+    } else if( B.tail > pg && B.tail < pg + FLASH_PAGE_SZ ) {
+        u4_t next = pg + FLASH_PAGE_SZ;
+        B.tail = (next == B.size ? 0 : next) + PAGE_HDR;
+        recount();
+    }
+    B.fcount = 0;
+    return ok;
+}
+
+// Returns 0 if the record could not be written. The next record goes to a
+// new page then, as after a torn record (LMIC_backlogInit).
+static bit_t append (u1_t type, u4_t time, const u1_t* data, u1_t len) {
+    u4_t rec[(REC_HDR + BACKLOG_MAXREC) / 4];
+    u1_t* r = (u1_t*)rec;
+    u4_t n = REC_HDR + ((len + 7) & ~7u);
+    if( B.head + n > B.hpage + FLASH_PAGE_SZ && !newPage() )
+        return 0;
+    memset(r, 0xFF, n);
+    r[2] = type;
+    r[3] = len;
+    os_wlsbf4(r + 4, time);
+    if( len )
+        os_copyMem(r + 8, data, len);
+    os_wlsbf2(r, os_crc16(r + 2, 6 + len));
+    if( !flash_write(B.area + B.head, rec, n / 4, false) || recLen(B.head) != n ) {
+        newPage();              // do not program over it
+        return 0;
+    }
+    B.head += n;
+    return 1;
+}
+
+// Position in a SENT record: page sequence number and offset / 8
+static u4_t posCode (u4_t off) {
+    u4_t page = pageEnd(off) - FLASH_PAGE_SZ;
+    return (pageSeq(page) << 9) | ((off - page) >> 3);
+}
+
+static u4_t posOff (u4_t code) {
+    u4_t back = B.pseq - (code >> 9);
+    if( back >= B.size / FLASH_PAGE_SZ )
+        return NOPOS;           // page erased since
+    u4_t page = (B.hpage + B.size - back * FLASH_PAGE_SZ) % B.size;
+    if( pageSeq(page) != code >> 9 )
+        return NOPOS;
+    return page + ((code & 0x1FF) << 3);
+}
+
+//! Use size bytes of flash at area (page aligned, at least 2 pages) for
+//! the ring. Records stored before the reset are found again.
+void LMIC_backlogInit (void* area, u4_t size) {
+    ASSERT(((uintptr_t)area & (FLASH_PAGE_SZ - 1)) == 0);
+    os_clearMem(&B, sizeof(B));
+    B.area = area;
+    B.size = size & ~(u4_t)(FLASH_PAGE_SZ - 1);
+    ASSERT(B.size >= 2 * FLASH_PAGE_SZ);
+    u4_t npages = B.size / FLASH_PAGE_SZ, pg, s, len;
+    for( pg = 0; pg < B.size; pg += FLASH_PAGE_SZ ) {
+        s = pageSeq(pg);
+        if( s > B.pseq ) {
+            B.pseq = s;
+            B.hpage = pg;
+        }
+    }
+    if( B.pseq == 0 ) {         // new area
+        B.hpage = B.size - FLASH_PAGE_SZ;
+        newPage();
+        return;
+    }
+    B.head = B.hpage + PAGE_HDR;
+    while( (len = recLen(B.head)) != 0 )
+        B.head += len;
+    // oldest page: the first after the head page that belongs to the ring
+    pg = B.hpage;
+    do {
+        pg = (pg + FLASH_PAGE_SZ) % B.size;
+        s = pageSeq(pg);
+    } while( s == 0 || s > B.pseq || B.pseq - s >= npages );
+    B.tail = pg + PAGE_HDR;
+    // the last SENT record tells the oldest record not sent
+    u4_t off = B.tail, pos = B.tail;
+    for( u4_t i = B.size / REC_HDR; off != B.head && i != 0; i-- ) {
+        len = recLen(off);
+        if( len && B.area[off + 2] == REC_SENT ) {
+            u4_t p = posOff(os_rlsbf4(B.area + off + 4));
+            if( p != NOPOS )
+                pos = p;
+        }
+        off = nextOff(off, len);
+    }
+    B.tail = pos;
+    recount();
+    if( B.head + REC_HDR <= B.hpage + FLASH_PAGE_SZ && !erased8(B.head) ) {
+        // torn record, do not program over it. If it is the first of the
+        // head page, that page is erased again instead of the oldest one.
+        if( B.head == B.hpage + PAGE_HDR ) {
+            B.hpage = (B.hpage + B.size - FLASH_PAGE_SZ) % B.size;
+            B.pseq--;
+        }
+        newPage();
+    }
+}
+
+//! Store a record of len bytes (at most BACKLOG_MAXREC) with its time.
+//! When the ring is full the oldest page of records is dropped. Returns 0
+//! if the record could not be written.
+bit_t LMIC_backlogPut (u4_t time, const u1_t* data, u1_t len) {
+    if( B.area == NULL || len > BACKLOG_MAXREC || !append(REC_DATA, time, data, len) )
+        return 0;
+    B.count++;
+    return 1;
+}
+
+//! Records not sent yet.
+u4_t LMIC_backlogCount (void) {
+    return B.count;
+}
+
+//! Pack the oldest records not sent into a frame of at most max bytes
+//! (see backlog.h). Returns the length, 0 if there is nothing to send or
+//! the oldest record does not fit. The records stay stored until
+//! LMIC_backlogSent().
+u1_t LMIC_backlogFrame (u1_t* buf, u1_t max) {
+    u4_t off = B.tail, prev = 0, len;
+    u2_t cnt = 0;
+    u1_t n = 0;
+    for( u4_t i = B.size / REC_HDR; off != B.head && i != 0; i-- ) {
+        len = recLen(off);
+        const u1_t* h = B.area + off;
+        if( len && h[2] == REC_DATA ) {
+            u4_t t = os_rlsbf4(h + 4);
+            u1_t dl = h[3];
+            if( cnt == 0 ) {
+                if( 5 + dl > max )
+                    break;
+                os_wlsbf4(buf, t);
+                n = 4;
+            } else {
+                if( t - prev > 0xFFFF || n + 3 + dl > max )
+                    break;
+                os_wlsbf2(buf + n, t - prev);
+                n += 2;
+            }
+            buf[n++] = dl;
+            os_copyMem(buf + n, h + 8, dl);
+            n += dl;
+            prev = t;
+            cnt++;
+        }
+        off = nextOff(off, len);
+    }
+    B.fend = off;
+    B.fcount = cnt;
+    return n;
+}
+
+//! The frame of the last LMIC_backlogFrame() has been delivered (acked):
+//! its records are done with.
+void LMIC_backlogSent (void) {
+    if( B.fcount == 0 )
+        return;
+    B.tail = B.fend;
+    B.count -= B.fcount;
+    B.fcount = 0;
+    // without the SENT record they are sent again after a reset
+    if( !append(REC_SENT, posCode(B.tail), NULL, 0) )
+        debug_printf("backlog: SENT record not written\r\n");
+}
+
+#endif // CFG_backlog
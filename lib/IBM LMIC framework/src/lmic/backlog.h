@@ -0,0 +1,44 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Store and forward: flash ring buffer of timestamped records, uploaded in packed frames
+
+#ifndef _backlog_h_
+#define _backlog_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define BACKLOG_MAXREC          40      //!< max data bytes per record, fits a frame at any EU868 DR
+
+//! Frame built by LMIC_backlogFrame(), records in the order they were
+//! stored, all numbers little endian:
+//!
+//!     time(4) len(1) data(len)  [ dt(2) len(1) data(len) ]...
+//!
+//! time is the time of the first record, dt the seconds since the record
+//! before.
+
+#ifdef CFG_backlog
+
+// Application API
+void  LMIC_backlogInit (void* area, u4_t size);
+bit_t LMIC_backlogPut (u4_t time, const u1_t* data, u1_t len);
+u4_t  LMIC_backlogCount (void);
+u1_t  LMIC_backlogFrame (u1_t* buf, u1_t max);
+void  LMIC_backlogSent (void);
+
+#endif // CFG_backlog
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _backlog_h_
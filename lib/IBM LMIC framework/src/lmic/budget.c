@@ -0,0 +1,126 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_budget
+
+#define FRAME_OVERHEAD  13      // MHDR, FHDR without FOpts, FPort, MIC
+
+// The window is the current slot and the BUDGET_SLOTS-1 before it, so it
+// covers the last 21 to 24 hours. Time is counted in the application's
+// time base (RTC seconds), which goes on while LMIC sleeps.
+static struct {
+    budget_ledger_t l;
+    u4_t            budget;     // ms per window
+    u4_t            base;       // time base secs at os time 0
+    u1_t            gate;       // LMIC_setTxData2 refuses frames over budget
+} B;
+
+static u4_t nowSec (void) {
+    return B.base + (u4_t)(os_getXTime() / OSTICKS_PER_SEC);
+}
+
+// Move the window to the current slot, slots that left it start empty
+static void advance (void) {
+    u4_t cur = nowSec() / BUDGET_SLOT_sec;
+    u4_t n = cur - B.l.slot;
+    if( (s4_t)n > 0 ) {
+        for( u4_t i = 1; i <= n && i <= BUDGET_SLOTS; i++ )
+            B.l.ms[(B.l.slot + i) % BUDGET_SLOTS] = 0;
+    }
+    B.l.slot = cur;     // clock set back: keep what was spent
+}
+
+static u4_t used (void) {
+    u4_t ms = 0;
+    for( u1_t i = 0; i < BUDGET_SLOTS; i++ )
+        ms += B.l.ms[i];
+    return ms;
+}
+
+// Seconds until a frame with dlen payload bytes at dr fits the budget
+static u4_t budgetWait (u1_t dlen, dr_t dr) {
+    u4_t need = (u4_t)osticks2ms(LMIC_calcAirTime(LMIC_updr2rps(dr), dlen + FRAME_OVERHEAD));
+    if( need > B.budget )
+        return BUDGET_NONE;
+    s4_t excess = (s4_t)(used() + need - B.budget);
+    u4_t wait = 0;
+    // the oldest slots leave the window first, slot cur+k at the start of slot cur+k
+    for( u1_t k = 1; excess > 0 && k <= BUDGET_SLOTS; k++ ) {
+        excess -= B.l.ms[(B.l.slot + k) % BUDGET_SLOTS];
+        wait = (B.l.slot + k) * BUDGET_SLOT_sec - nowSec();
+    }
+    return wait;
+}
+
+// called by lmic.c for every transmission
+void budget_tx (ostime_t airtime) {
+    advance();
+    u2_t* slot = &B.l.ms[B.l.slot % BUDGET_SLOTS];
+    u4_t ms = *slot + (u4_t)osticks2ms(airtime + ms2osticks(1) - 1);
+    *slot = ms > 0xFFFF ? 0xFFFF : ms;
+}
+
+// called by LMIC_setTxData2: 0 if a frame of dlen bytes is over budget
+bit_t budget_gate (u1_t dlen) {
+    if( !B.gate )
+        return 1;
+    advance();
+    return budgetWait(dlen, LMIC.datarate) == 0;
+}
+
+//! Set the budget in ms of airtime per 24 hours. now_sec is the current
+//! time in a time base that goes on during deep sleep (RTC seconds), saved
+//! is the ledger kept from before the sleep or NULL. With gate set
+//! LMIC_setTxData2() returns -3 for a frame that does not fit the budget.
+void LMIC_budgetInit (u4_t budget_ms, u4_t now_sec, const budget_ledger_t* saved, u1_t gate) {
+    os_clearMem(&B, sizeof(B));
+    B.budget = budget_ms;
+    B.gate   = gate;
+    B.base   = now_sec - (u4_t)(os_getXTime() / OSTICKS_PER_SEC);
+    if( saved )
+        B.l = *saved;
+    else
+        B.l.slot = now_sec / BUDGET_SLOT_sec;
+    advance();
+}
+
+//! Ledger to be kept by the application during deep sleep.
+budget_ledger_t* LMIC_budgetLedger (void) {
+    advance();
+    return &B.l;
+}
+
+//! Airtime in ms spent in the window.
+u4_t LMIC_budgetUsed_ms (void) {
+    advance();
+    return used();
+}
+
+//! Airtime in ms left in the window, negative if the budget is overrun.
+s4_t LMIC_budgetLeft_ms (void) {
+    advance();
+    return (s4_t)(B.budget - used());
+}
+
+//! Seconds until a frame with dlen payload bytes at data rate dr fits the
+//! budget and the duty cycle allows the next uplink (at the current data
+//! rate), 0 if it can be sent now, BUDGET_NONE if it never fits.
+u4_t LMIC_budgetWait_sec (u1_t dlen, dr_t dr) {
+    advance();
+    u4_t wait = budgetWait(dlen, dr);
+    if( wait != BUDGET_NONE && (LMIC.opmode & OP_TXRXPEND) == 0 ) {
+        ostime_t now = os_getTime();
+        ostime_t dc = LMIC_nextTx(now) - now;
+        u4_t dcsec = dc > 0 ? (u4_t)((dc + OSTICKS_PER_SEC - 1) / OSTICKS_PER_SEC) : 0;
+        if( dcsec > wait )
+            wait = dcsec;
+    }
+    return wait;
+}
+
+#endif // CFG_budget
@@ -0,0 +1,55 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Airtime budget: rolling 24 hour ledger of the airtime spent (fair use policies)
+
+#ifndef _budget_h_
+#define _budget_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define BUDGET_SLOTS            8                       //!< slots of the 24 hour window
+#define BUDGET_SLOT_sec         (86400 / BUDGET_SLOTS)  //!< 3 hours
+#define BUDGET_NONE             0xFFFFFFFF              //!< frame never fits the budget
+
+//! Airtime spent per slot. The application keeps it across deep sleep
+//! (20 bytes, e.g. in 5 RTC backup registers) and hands it back to
+//! LMIC_budgetInit().
+typedef struct {
+    u4_t    slot;                   //!< number of the current slot (time base secs / BUDGET_SLOT_sec)
+    u2_t    ms[BUDGET_SLOTS];       //!< airtime in ms, index slot % BUDGET_SLOTS
+} budget_ledger_t;
+
+#ifdef CFG_budget
+
+// Hooks used by lmic.c
+void  budget_tx (ostime_t airtime);
+bit_t budget_gate (u1_t dlen);
+
+// Application API
+void             LMIC_budgetInit (u4_t budget_ms, u4_t now_sec, const budget_ledger_t* saved, u1_t gate);
+budget_ledger_t* LMIC_budgetLedger (void);
+u4_t             LMIC_budgetUsed_ms (void);
+s4_t             LMIC_budgetLeft_ms (void);
+u4_t             LMIC_budgetWait_sec (u1_t dlen, dr_t dr);
+
+#else
+
+#define budget_tx(t)        do { } while (0)
+#define budget_gate(l)      1
+
+#endif // CFG_budget
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _budget_h_
@@ -0,0 +1,184 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_dse
+
+DEFINE_DSE;
+
+// The stream is cut into blocks of up to DSE_MAXK symbols, each symbol
+// filling a frame at the data rate of the block. The K source symbols of
+// a block are followed by coded symbols (random XOR combinations), any K
+// (or a few more) frames of a block received suffice to recover it. The
+// frames are unconfirmed, sent once (IGN_NBTRANS) and only the last frame
+// of a block opens RX windows, so the stream goes at the rate the duty
+// cycle allows.
+
+enum { PEND_NONE, PEND_DATA, PEND_POLL };
+
+//! Coefficients of coded symbol esi of a block, bit i selects source symbol i
+u4_t dse_coeffs (u2_t block, u1_t esi) {
+    u4_t x = 0x9E3779B9 ^ ((u4_t)block << 8 | esi);
+    // murmur3 finalizer, neighbouring seeds give unrelated masks
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+static void startblock (void) {
+    u4_t left = DSE.len - DSE.off;
+    u4_t k;
+
+    DSE.symsz  = LMIC_maxAppPayload() - DSE_HDRLEN;
+    k          = (left + DSE.symsz - 1) / DSE.symsz;
+    DSE.k      = k > DSE_MAXK ? DSE_MAXK : k;
+    DSE.last   = DSE.off + (u4_t)DSE.k * DSE.symsz >= DSE.len;
+    DSE.pad    = DSE.last ? DSE.off + (u4_t)DSE.k * DSE.symsz - DSE.len : 0;
+    DSE.ncoded = (DSE.k * DSE.redundancy + 99) / 100;
+    DSE.esi    = 0;
+}
+
+static void xorsym (u1_t* dst, u1_t i) {
+    u4_t o = DSE.off + (u4_t)i * DSE.symsz;
+    u4_t n = DSE.len - o < DSE.symsz ? DSE.len - o : DSE.symsz;
+    for( u4_t j = 0; j < n; j++ )
+        dst[j] ^= DSE.data[o + j];
+}
+
+static void sendframe (osjob_t* job) {
+    (void)job; // unused
+    u1_t* sym = DSE.frame + DSE_HDRLEN;
+
+    if( !DSE.active )
+        return;
+    if( LMIC.opmode & (OP_TXRXPEND|OP_JOINING) ) {
+        os_setTimedCallback(&DSE.job, os_getTime() + ms2osticks(100), sendframe);
+        return;
+    }
+    if( DSE_HDRLEN + DSE.symsz > LMIC_maxAppPayload() ) {
+        // data rate was lowered, resend the block with smaller symbols
+        debug_printf("dse: block %d restarted at DR%d\r\n", DSE.block, LMIC.datarate);
+        startblock();
+    }
+    if( DSE_HDRLEN + DSE.symsz + LMIC.foptsUpLen > LMIC_maxAppPayload() ) {
+        // pending MAC commands would push out the payload, send them alone
+        DSE.pending = PEND_POLL;
+        LMIC_sendAlive();
+        return;
+    }
+    DSE.frame[0] = DSE.stream;
+    os_wlsbf2(DSE.frame + 1, DSE.block);
+    DSE.frame[3] = (DSE.last ? 0x80 : 0) | DSE.k;
+    DSE.frame[4] = DSE.esi;
+    DSE.frame[5] = DSE.pad;
+    os_clearMem(sym, DSE.symsz);
+    if( DSE.esi < DSE.k ) {
+        xorsym(sym, DSE.esi);
+    } else {
+        u4_t c = dse_coeffs(DSE.block, DSE.esi);
+        if( DSE.k < 32 )
+            c &= (1u << DSE.k) - 1;
+        if( c == 0 )
+            c = 1u << ((DSE.esi - DSE.k) % DSE.k);
+        for( u1_t i = 0; i < DSE.k; i++ ) {
+            if( (c >> i) & 1 )
+                xorsym(sym, i);
+        }
+    }
+    DSE.pending = PEND_DATA;
+    LMIC.pendTxNoRx = DSE.esi + 1 < DSE.k + DSE.ncoded;
+    LMIC.nbTrans |= IGN_NBTRANS;
+    int err = LMIC_setTxData2(DSE.port, DSE.frame, DSE_HDRLEN + DSE.symsz, 0);
+    if( err == 0 )
+        return;
+    // not queued, the flags must not stick to the next uplink
+    DSE.pending = PEND_NONE;
+    LMIC.pendTxNoRx = 0;
+    LMIC.nbTrans &= ~IGN_NBTRANS;
+#ifdef CFG_budget
+    if( err == -3 ) {
+        // over the airtime budget: same frame again when it fits
+        u4_t wait = LMIC_budgetWait_sec(DSE_HDRLEN + DSE.symsz, LMIC.datarate);
+        if( wait != BUDGET_NONE ) {
+            if( wait > BUDGET_SLOT_sec )
+                wait = BUDGET_SLOT_sec;     // ostime_t range, checked again then
+            debug_printf("dse: over airtime budget, next frame in %d s\r\n", wait);
+            os_setTimedCallback(&DSE.job, os_getTime() + sec2osticks(wait + 1), sendframe);
+            return;
+        }
+    }
+#endif
+    debug_printf("dse: stream %d stopped, frame not accepted (%d)\r\n", DSE.stream, err);
+    DSE.active = 0;
+    if( DSE.done )
+        DSE.done(DSE.sent);
+}
+
+// called by lmic.c before the application sees the event
+void dse_event (ev_t ev) {
+    if( !DSE.active || ev != EV_TXCOMPLETE || DSE.pending == PEND_NONE )
+        return;
+    if( DSE.pending == PEND_DATA ) {
+        DSE.sent++;
+        if( ++DSE.esi >= DSE.k + DSE.ncoded ) {
+            DSE.off += (u4_t)DSE.k * DSE.symsz;
+            DSE.block++;
+            if( DSE.last ) {
+                DSE.active = 0;
+                DSE.pending = PEND_NONE;
+                debug_printf("dse: stream %d done, %d frames\r\n", DSE.stream, DSE.sent);
+                if( DSE.done )
+                    DSE.done(DSE.sent);
+                return;
+            }
+            startblock();
+        }
+    }
+    DSE.pending = PEND_NONE;
+    os_setCallback(&DSE.job, sendframe);
+}
+
+// uplinks of the stream are ciphered in their own category
+int dse_txcat (u1_t port) {
+    return (DSE.active && port == DSE.port) ? LCE_SCC_DSE : LCE_SCC_UP;
+}
+
+//! Send len bytes at data (must stay valid) as a stream on port, with
+//! redundancy % coded frames per block. The application must not send
+//! other uplinks until done is called or LMIC_dseStop().
+void LMIC_dseStart (u1_t port, const u1_t* data, u4_t len, u1_t redundancy, dse_donecb_t done) {
+    os_clearCallback(&DSE.job);
+    DSE.data       = data;
+    DSE.len        = len;
+    DSE.off        = 0;
+    DSE.sent       = 0;
+    DSE.done       = done;
+    DSE.block      = 0;
+    DSE.port       = port;
+    DSE.redundancy = redundancy;
+    DSE.stream    += 1;
+    DSE.pending    = PEND_NONE;
+    DSE.active     = len != 0;
+    if( DSE.active ) {
+        startblock();
+        os_setCallback(&DSE.job, sendframe);
+    }
+}
+
+void LMIC_dseStop (void) {
+    os_clearCallback(&DSE.job);
+    DSE.active = 0;
+}
+
+int LMIC_dseActive (void) {
+    return DSE.active;
+}
+
+#endif // CFG_dse
@@ -0,0 +1,80 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Data streaming engine: uplink of a byte stream with fountain coded redundancy
+
+#ifndef _dse_h_
+#define _dse_h_
+
+#include "oslmic.h"
+#include "lce.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define DSE_MAXK        32      //!< source symbols per block
+#define DSE_HDRLEN      6       //!< stream header in every frame
+
+//! Frame layout (FRMPayload, ciphered with LCE_SCC_DSE):
+//!   stream id (1), block (2, LE), last block flag (bit 7) | K (1),
+//!   ESI (1), padding of the last block (1), symbol.
+//! ESI < K carries source symbol ESI of the block, ESI >= K carries the
+//! XOR of the source symbols selected by dse_coeffs(block, ESI).
+
+//! Called when the whole stream has been sent. sent is the number of frames.
+//! Also called when the stream stops early because a frame is not accepted
+//! (never fits the airtime budget), sent is then less than the stream needs.
+typedef void (*dse_donecb_t) (u4_t sent);
+
+#ifdef CFG_dse
+
+struct dse_t {
+    const u1_t*     data;
+    u4_t            len;
+    u4_t            off;        // start of current block
+    u4_t            sent;       // frames sent
+    dse_donecb_t    done;
+    osjob_t         job;
+    u2_t            block;
+    u1_t            port;
+    u1_t            redundancy; // coded symbols in % of K
+    u1_t            stream;
+    u1_t            active;
+    u1_t            pending;    // uplink queued by the engine
+    u1_t            k;          // source symbols in current block
+    u1_t            ncoded;     // coded symbols for current block
+    u1_t            esi;        // next symbol to send
+    u1_t            symsz;      // symbol size of current block
+    u1_t            last;
+    u1_t            pad;
+    u1_t            frame[MAX_LEN_PAYLOAD];
+};
+DECLARE_DSE;
+
+// Hooks used by lmic.c
+void dse_event (ev_t ev);
+int  dse_txcat (u1_t port);
+
+// Application API
+void LMIC_dseStart (u1_t port, const u1_t* data, u4_t len, u1_t redundancy, dse_donecb_t done);
+void LMIC_dseStop (void);
+int  LMIC_dseActive (void);
+u4_t dse_coeffs (u2_t block, u1_t esi);
+
+#else
+
+#define dse_event(e)        do { } while (0)
+#define dse_txcat(p)        LCE_SCC_UP
+
+#endif // CFG_dse
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _dse_h_
@@ -0,0 +1,186 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_energy
+
+// ----------------------------------------
+// ENERGY LEDGER STATE
+static struct {
+    ostime_t        last;       // time of last integration
+    u1_t            radio;      // current radio state (EN_RADIO_*)
+    u1_t            tcxo;       // TCXO powered
+    u4_t            radio_ua;   // current consumption of radio state
+    energy_ledger_t total;      // since energy_init()
+    energy_ledger_t uplink;     // since last energy_startUplink()
+    u8_t            upcharge;   // charge of the uplinks completed since init
+    u2_t            ups;        // number of uplinks completed since init
+} E;
+
+// Supply current in TX mode. The HP PA is configured for +22 dBm (see
+// SetTxPower in the radio driver) and lower powers are obtained by the
+// tx params only, so efficiency drops less than the output power.
+static u4_t txCurrent_ua (s1_t pw) {
+    static const u4_t TXPOW_UA[] = { /* 10,12,..,22 dBm */
+        58000, 64000, 71000, 79000, 89000, 102000, 118000
+    };
+    if( pw < 10 ) pw = 10;
+    if( pw > 22 ) pw = 22;
+    return TXPOW_UA[(pw - 10) / 2];
+}
+
+static void account (energy_ledger_t* l, int state, u4_t dt, u4_t ua) {
+    l->ticks[state]  += dt;
+    l->charge[state] += (u8_t) dt * ua;
+}
+
+// integrate all active consumers since last call
+static void integrate (void) {
+    ostime_t now = os_getTime();
+    u4_t dt = (u4_t) (now - E.last);
+    E.last = now;
+
+    account(&E.total,  EN_MCU_RUN, dt, EN_MCU_RUN_ua);
+    account(&E.uplink, EN_MCU_RUN, dt, EN_MCU_RUN_ua);
+    account(&E.total,  E.radio, dt, E.radio_ua);
+    account(&E.uplink, E.radio, dt, E.radio_ua);
+    if( E.tcxo ) {
+        account(&E.total,  EN_TCXO, dt, EN_TCXO_ua);
+        account(&E.uplink, EN_TCXO, dt, EN_TCXO_ua);
+    }
+}
+
+void energy_init (void) {
+    // MCU has been running since boot (ticks start at zero)
+    os_clearMem(&E, sizeof(E));
+    E.radio    = EN_RADIO_SLEEP;
+    E.radio_ua = EN_RADIO_SLEEP_ua;
+    integrate();
+}
+
+// called by radio driver on every radio state change
+void energy_radio (u1_t state, s1_t txpow) {
+    // for RX, txpow is the rx share in % of the radio duty cycle mode (0: always rx)
+    integrate();
+    E.radio = state;
+    switch( state ) {
+        case EN_RADIO_STDBY: E.radio_ua = EN_RADIO_STDBY_ua;    break;
+        case EN_RADIO_FS:    E.radio_ua = EN_RADIO_FS_ua;       break;
+        case EN_RADIO_RX:    E.radio_ua = (txpow > 0 && txpow < 100)
+                                 ? (EN_RADIO_RX_ua * txpow + EN_RADIO_SLEEP_ua * (100 - txpow)) / 100
+                                 : EN_RADIO_RX_ua;              break;
+        case EN_RADIO_TX:    E.radio_ua = txCurrent_ua(txpow);  break;
+        default:             E.radio_ua = EN_RADIO_SLEEP_ua;    break;
+    }
+    // power consumption of current radio operation for statistics
+    LMIC.radioPwr_ua = E.radio_ua;
+}
+
+// called by HAL when TCXO power is switched
+void energy_tcxo (u1_t on) {
+    integrate();
+    E.tcxo = on;
+}
+
+// called by MAC when a new uplink is queued
+void energy_startUplink (void) {
+    integrate();
+    os_clearMem(&E.uplink, sizeof(E.uplink));
+}
+
+// Return ledgers since init and since the last uplink was queued.
+// Either pointer may be NULL.
+void LMIC_getEnergy (energy_ledger_t* total, energy_ledger_t* uplink) {
+    hal_disableIRQs();
+    integrate();
+    if( total )
+        *total = E.total;
+    if( uplink )
+        *uplink = E.uplink;
+    hal_enableIRQs();
+}
+
+// Charge in uC of given state, or of all states if state < 0.
+u4_t LMIC_energyCharge_uC (const energy_ledger_t* ledger, int state) {
+    u8_t q = 0;
+    for( int i = 0; i < EN_NSTATES; i++ ) {
+        if( state < 0 || state == i )
+            q += ledger->charge[i];
+    }
+    return (u4_t) (q / OSTICKS_PER_SEC);
+}
+
+// Encode ledger of current uplink for a diagnostic uplink:
+// 1 byte number of states, then 4 bytes (MSBF) charge in uC per state.
+// Returns the number of bytes written or 0 if buf is too small.
+u1_t LMIC_energyReport (u1_t* buf, u1_t len) {
+    energy_ledger_t up;
+    if( len < 1 + 4 * EN_NSTATES )
+        return 0;
+    LMIC_getEnergy(NULL, &up);
+    buf[0] = EN_NSTATES;
+    for( int i = 0; i < EN_NSTATES; i++ ) {
+        os_wmsbf4(buf + 1 + 4 * i, LMIC_energyCharge_uC(&up, i));
+    }
+    return 1 + 4 * EN_NSTATES;
+}
+
+// called by MAC when an uplink has completed (EV_TXCOMPLETE)
+void energy_endUplink (void) {
+    integrate();
+    for( int i = 0; i < EN_NSTATES; i++ )
+        E.upcharge += E.uplink.charge[i];
+    E.ups += 1;
+}
+
+// symbol time in ticks, a guess for FSK
+static u4_t symTicks (rps_t rps) {
+    if( isFsk(rps) )
+        return us2osticks(160);
+    return ((u4_t) OSTICKS_PER_SEC << (getSf(rps) - SF7 + 7)) / (125000 << getBw(rps));
+}
+
+// Charge in uC of one uplink of plen payload bytes at dr and txpow
+// without a downlink: the frame, both receive windows open for
+// EN_RXWIN_syms symbols with the TCXO on, and the MCU running from the
+// start of the frame to the end of RX2 (RX1 at dr, RX2 at the RX2 DR).
+u4_t LMIC_energyUplinkModel_uC (u1_t plen, dr_t dr, s1_t txpow) {
+    ostime_t air = LMIC_calcAirTime(LMIC_updr2rps(dr), plen + 13);   // MHDR, FHDR, FPort, MIC
+    u4_t rx = EN_RXWIN_syms * (symTicks(LMIC_updr2rps(dr)) + symTicks(LMIC_updr2rps(LMIC.dn2Dr)));
+    u4_t run = air + (LMIC.dn1Dly + 1) * OSTICKS_PER_SEC + EN_RXWIN_syms * symTicks(LMIC_updr2rps(LMIC.dn2Dr));
+    u8_t q = (u8_t) air * txCurrent_ua(txpow)
+           + (u8_t) rx * (EN_RADIO_RX_ua + EN_TCXO_ua)
+           + (u8_t) air * EN_TCXO_ua
+           + (u8_t) run * EN_MCU_RUN_ua;
+    return (u4_t) (q / OSTICKS_PER_SEC);
+}
+
+// Charge in uC of an uplink of plen payload bytes: the mean of the uplinks
+// completed since init (retries, downlinks and drained polls included), or
+// the model at the current DR and power if none has completed yet.
+u4_t LMIC_energyUplink_uC (u1_t plen) {
+    hal_disableIRQs();
+    u8_t q = E.upcharge;
+    u2_t n = E.ups;
+    hal_enableIRQs();
+    if( n == 0 )
+        return LMIC_energyUplinkModel_uC(plen, LMIC.datarate, LMIC.txpow);
+    return (u4_t) (q / n / OSTICKS_PER_SEC);
+}
+
+// Project battery lifetime in hours for a wakeup every interval_sec that
+// costs cycle_uC (e.g. LMIC_energyUplink_uC() plus boot and sensors), with
+// sleep_ua for the whole interval.
+u4_t LMIC_energyLifetimeHours (u4_t capacity_mAh, u4_t interval_sec, u4_t sleep_ua, u4_t cycle_uC) {
+    u8_t q = (u8_t) cycle_uC + (u8_t) sleep_ua * interval_sec;
+    if( q == 0 )
+        return 0;
+    u8_t cycles = (u8_t) capacity_mAh * 3600000 / q;    // 1 mAh = 3.6e6 uC
+    return (u4_t) (cycles * interval_sec / 3600);
+}
+
+#endif // CFG_energy
@@ -0,0 +1,93 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Energy accounting of radio and MCU states
+
+#ifndef _energy_h_
+#define _energy_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+//! Components/states for which time and charge are accounted.
+//! The MCU and TCXO are accounted in parallel with the current radio state.
+enum {
+    EN_MCU_RUN = 0,     //!< MCU running (always on while LMIC is active)
+    EN_RADIO_SLEEP,     //!< radio in (cold) sleep
+    EN_RADIO_STDBY,     //!< radio in standby (RC)
+    EN_RADIO_FS,        //!< radio in frequency synthesis
+    EN_RADIO_RX,        //!< radio receiving
+    EN_RADIO_TX,        //!< radio transmitting (current depends on power)
+    EN_TCXO,            //!< TCXO powered
+    EN_NSTATES
+};
+
+//! Ledger of time (osticks) and charge (uA*osticks) spent per state.
+typedef struct {
+    u4_t     ticks[EN_NSTATES];
+    u8_t     charge[EN_NSTATES];
+} energy_ledger_t;
+
+// Typical supply currents in uA (3.3V, SMPS on). Boards may override these.
+#ifndef EN_MCU_RUN_ua
+#define EN_MCU_RUN_ua       3500    // 48 MHz run mode
+#endif
+#ifndef EN_RADIO_SLEEP_ua
+#define EN_RADIO_SLEEP_ua   1
+#endif
+#ifndef EN_RADIO_STDBY_ua
+#define EN_RADIO_STDBY_ua   600
+#endif
+#ifndef EN_RADIO_FS_ua
+#define EN_RADIO_FS_ua      2100
+#endif
+#ifndef EN_RADIO_RX_ua
+#define EN_RADIO_RX_ua      5500    // LoRa 125kHz, boosted gain
+#endif
+#ifndef EN_TCXO_ua
+#define EN_TCXO_ua          1500
+#endif
+// Symbols a receive window stays open when no frame comes (uplink model)
+#ifndef EN_RXWIN_syms
+#define EN_RXWIN_syms       8
+#endif
+
+#ifdef CFG_energy
+
+// Hooks used by the radio driver and HAL
+void energy_init (void);
+void energy_radio (u1_t state, s1_t txpow);
+void energy_tcxo (u1_t on);
+void energy_startUplink (void);
+void energy_endUplink (void);
+
+// Application API
+void LMIC_getEnergy (energy_ledger_t* total, energy_ledger_t* uplink);
+u4_t LMIC_energyCharge_uC (const energy_ledger_t* ledger, int state);
+u1_t LMIC_energyReport (u1_t* buf, u1_t len);
+u4_t LMIC_energyUplinkModel_uC (u1_t plen, dr_t dr, s1_t txpow);
+u4_t LMIC_energyUplink_uC (u1_t plen);
+u4_t LMIC_energyLifetimeHours (u4_t capacity_mAh, u4_t interval_sec, u4_t sleep_ua, u4_t cycle_uC);
+
+#else
+
+#define energy_init()            do { } while (0)
+#define energy_radio(s,p)        do { } while (0)
+#define energy_tcxo(on)          do { } while (0)
+#define energy_startUplink()     do { } while (0)
+#define energy_endUplink()       do { } while (0)
+
+#endif // CFG_energy
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _energy_h_
@@ -0,0 +1,524 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "peripherals.h"
+
+#ifdef CFG_fuota
+
+#ifndef PERIPH_FLASH
+#error "CFG_fuota needs flash_write() (PERIPH_FLASH)"
+#endif
+
+// Fragmented data block transport v1.0.0
+#define FRAG_PACKAGE_ID         3
+#define FRAG_PACKAGE_VERSION    1
+
+enum {
+    FRAG_PKG_VERSION    = 0x00,
+    FRAG_SESS_STATUS    = 0x01,
+    FRAG_SESS_SETUP     = 0x02,
+    FRAG_SESS_DELETE    = 0x03,
+    FRAG_DATA           = 0x08,
+};
+
+// FragSessionSetupAns status bits
+enum {
+    FRAG_ERR_ENCODING   = 0x01,
+    FRAG_ERR_MEMORY     = 0x02,
+    FRAG_ERR_INDEX      = 0x04,
+};
+
+#define ROWSZ       ((CFG_fuota_maxmissing + 7) / 8)
+#define MAXPITCH    256
+
+// ----------------------------------------
+// DECODER STATE
+//
+// Uncoded fragments are written to their slot in the flash area as they
+// arrive. When the first coded fragment arrives, the fragments still
+// missing become the unknowns (columns) of a system of equations. Every
+// coded fragment is reduced by the fragments already known and, if it
+// adds information, stored in flash after the slots. RAM holds only the
+// coefficients of the equations (in reduced row echelon form) and for each
+// equation the set of stored coded fragments it was built from. When there
+// are as many equations as unknowns, every missing fragment is the XOR of
+// its set of stored fragments. Flash is written once per location.
+//
+// The area is erased page by page by a job after the setup, a fragment
+// that arrives before the job got to its location erases up to it. The
+// fragments are compacted by the same job when the block is complete. A
+// failed flash write stops the session (FUOTA_FAILED).
+static struct {
+    u1_t*           area;
+    u4_t            areasz;
+    fuota_donecb_t  done;
+    u1_t            state;
+    u1_t            session;    // FragSession field of the setup request (index, McGroupBitMask)
+    u1_t            status;     // FragSessionStatusAns status (bit 0: out of memory)
+    u1_t            fragsz;
+    u1_t            padding;
+    u1_t            ackdelay;   // BlockAckDelay of the setup request
+    u2_t            nbfrag;
+    u2_t            pitch;      // slot size in flash, multiple of 8 bytes
+    u4_t            descriptor;
+    u2_t            received;   // fragments received (uncoded and coded)
+    u2_t            uncoded;    // distinct uncoded fragments in their slot
+    u2_t            nbmissing;  // unknowns, 0 until the first coded fragment
+    u2_t            rank;       // equations = coded fragments stored
+    u4_t            erased;     // area erased up to this offset
+    u4_t            erasend;    // area used by the session
+    u4_t            cpage;      // next page to compact
+    osjob_t         job;        // erase or compaction
+    u1_t            have[(CFG_fuota_maxfrags + 7) / 8];
+    u2_t            missing[CFG_fuota_maxmissing];  // unknown -> fragment, ascending
+    u1_t            used[ROWSZ];                    // unknown is the pivot of an equation
+    union {
+        struct {
+            u1_t    rows[CFG_fuota_maxmissing][ROWSZ];
+            u1_t    comb[CFG_fuota_maxmissing][ROWSZ];
+        };
+        u4_t        page[FLASH_PAGE_SZ / 4];        // compaction, after decoding
+    };
+    u1_t            line[(CFG_fuota_maxfrags + 7) / 8];
+    u4_t            acc[MAXPITCH / 4];
+} F;
+
+static int getbit (const u1_t* v, u2_t i) {
+    return (v[i >> 3] >> (i & 7)) & 1;
+}
+
+static void setbit (u1_t* v, u2_t i) {
+    v[i >> 3] |= 1 << (i & 7);
+}
+
+static void xorrow (u1_t* dst, const u1_t* src) {
+    for( u1_t i = 0; i < ROWSZ; i++ )
+        dst[i] ^= src[i];
+}
+
+static u1_t* slot (u2_t frag) {
+    return F.area + (u4_t)frag * F.pitch;
+}
+
+static u4_t codedbase (void) {
+    u4_t n = (u4_t)F.nbfrag * F.pitch;
+    return (n + FLASH_PAGE_SZ - 1) & ~(u4_t)(FLASH_PAGE_SZ - 1);
+}
+
+static u1_t* coded (u2_t k) {
+    return F.area + codedbase() + (u4_t)k * F.pitch;
+}
+
+static void xorfrag (const u1_t* src) {
+    const u4_t* s = (const u4_t*)src;
+    for( u2_t i = 0; i < F.pitch / 4; i++ )
+        F.acc[i] ^= s[i];
+}
+
+static void fail (void) {
+    os_clearCallback(&F.job);
+    F.state = FUOTA_FAILED;
+    F.status |= 0x01;
+    debug_printf("fuota: flash write failed, session stopped\r\n");
+}
+
+static bit_t erasepage (void) {
+    bit_t ok = flash_write(F.area + F.erased, NULL, FLASH_PAGE_SZ / 4, true);
+    F.erased += FLASH_PAGE_SZ;
+    return ok;
+}
+
+static void erase_func (osjob_t* j) {
+    if( F.erased >= F.erasend )
+        return;
+    if( !erasepage() )
+        fail();
+    else if( F.erased < F.erasend )
+        os_setCallback(j, erase_func);
+}
+
+static bit_t writefrag (u1_t* dst) {
+    u4_t end = (u4_t)(dst - F.area) + F.pitch;
+    while( F.erased < end ) {
+        if( !erasepage() )
+            return 0;
+    }
+    return flash_write(dst, F.acc, F.pitch / 4, false);
+}
+
+// ----------------------------------------
+// PARITY MATRIX (TS004 reference generator)
+
+static u4_t prbs23 (u4_t x) {
+    u4_t b0 = x & 1;
+    u4_t b1 = (x & 0x20) >> 5;
+    return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+// Fragments combined in coded fragment n (1 = first after the uncoded ones)
+static void matrix_line (u1_t* line, u2_t n, u2_t m) {
+    u4_t x = 1 + 1001 * (u4_t)n;
+    u4_t mod = m + ((m & (m - 1)) == 0);
+    os_clearMem(line, (m + 7) / 8);
+    for( u2_t k = 0; k < m / 2; k++ ) {
+        u4_t r;
+        do {
+            x = prbs23(x);
+            r = x % mod;
+        } while( r >= m );
+        setbit(line, r);
+    }
+}
+
+// ----------------------------------------
+// DECODING
+
+static int column (u2_t frag) {
+    int lo = 0, hi = F.nbmissing - 1;
+    while( lo <= hi ) {
+        int mid = (lo + hi) / 2;
+        if( F.missing[mid] == frag )
+            return mid;
+        if( F.missing[mid] < frag )
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+// Fix the unknowns. Fails if they do not fit in RAM or flash, a later
+// coded fragment will try again.
+static int fixmissing (void) {
+    u2_t nm = F.nbfrag - F.uncoded;
+    if( nm > CFG_fuota_maxmissing || codedbase() + (u4_t)nm * F.pitch > F.areasz ) {
+        F.status |= 0x01;
+        return 0;
+    }
+    F.status &= ~0x01;
+    u2_t k = 0;
+    for( u2_t i = 0; i < F.nbfrag; i++ ) {
+        if( !getbit(F.have, i) )
+            F.missing[k++] = i;
+    }
+    F.nbmissing = nm;
+    F.rank = 0;
+    os_clearMem(F.used, sizeof(F.used));
+    os_clearMem(F.rows, sizeof(F.rows));
+    os_clearMem(F.comb, sizeof(F.comb));
+    return 1;
+}
+
+// Add equation v for the data in F.acc
+static void addeq (u1_t* v) {
+    u1_t cb[ROWSZ];
+    u2_t c, p;
+
+    os_clearMem(cb, sizeof(cb));
+    setbit(cb, F.rank);
+    for( c = 0; c < F.nbmissing; c++ ) {
+        if( getbit(v, c) && getbit(F.used, c) ) {
+            xorrow(v, F.rows[c]);
+            xorrow(cb, F.comb[c]);
+        }
+    }
+    for( p = 0; p < F.nbmissing && !getbit(v, p); p++ );
+    if( p == F.nbmissing )
+        return;     // no new information
+    if( !writefrag(coded(F.rank)) ) {
+        fail();
+        return;
+    }
+    for( c = 0; c < F.nbmissing; c++ ) {
+        if( getbit(F.used, c) && getbit(F.rows[c], p) ) {
+            xorrow(F.rows[c], v);
+            xorrow(F.comb[c], cb);
+        }
+    }
+    os_copyMem(F.rows[p], v, ROWSZ);
+    os_copyMem(F.comb[p], cb, ROWSZ);
+    setbit(F.used, p);
+    F.rank++;
+}
+
+static void uncoded (u2_t i) {
+    if( getbit(F.have, i) )
+        return;
+    if( !writefrag(slot(i)) ) {
+        fail();
+        return;
+    }
+    setbit(F.have, i);
+    F.uncoded++;
+    if( F.nbmissing ) {
+        // arrived after the unknowns were fixed: it is an equation
+        u1_t v[ROWSZ];
+        os_clearMem(v, sizeof(v));
+        setbit(v, column(i));
+        addeq(v);
+    }
+}
+
+static void parity (u2_t n) {
+    u1_t v[ROWSZ];
+
+    if( F.uncoded == F.nbfrag || (F.nbmissing == 0 && !fixmissing()) )
+        return;
+    matrix_line(F.line, n, F.nbfrag);
+    os_clearMem(v, sizeof(v));
+    for( u2_t j = 0; j < F.nbfrag; j++ ) {
+        if( getbit(F.line, j) ) {
+            int c = column(j);
+            if( c >= 0 )
+                setbit(v, c);
+            else
+                xorfrag(slot(j));
+        }
+    }
+    addeq(v);
+}
+
+static void complete (void) {
+    F.state = FUOTA_DONE;
+    debug_printf("fuota: %d fragments complete, %d received\r\n", F.nbfrag, F.received);
+    if( F.done )
+        F.done(F.area, (u4_t)F.nbfrag * F.fragsz - F.padding, F.descriptor);
+}
+
+// Move the fragments from their slots to consecutive addresses, one page
+// per run. The data of a page never comes from an earlier page.
+static void compact_func (osjob_t* j) {
+    u4_t len = (u4_t)F.nbfrag * F.fragsz;
+    u4_t pg = F.cpage;
+    u4_t n = (len - pg < FLASH_PAGE_SZ) ? len - pg : FLASH_PAGE_SZ;
+    u1_t* buf = (u1_t*)F.page;
+
+    memset(buf, 0xFF, FLASH_PAGE_SZ);
+    for( u4_t d = 0; d < n; ) {
+        u4_t o = pg + d;
+        u4_t off = o % F.fragsz;
+        u4_t run = F.fragsz - off;
+        if( run > n - d )
+            run = n - d;
+        os_copyMem(buf + d, F.area + (o / F.fragsz) * F.pitch + off, run);
+        d += run;
+    }
+    if( !flash_write(F.area + pg, buf, FLASH_PAGE_SZ / 4, true) ) {
+        fail();
+        return;
+    }
+    F.cpage += FLASH_PAGE_SZ;
+    if( F.cpage < len )
+        os_setCallback(j, compact_func);
+    else
+        complete();
+}
+
+// Decode the missing fragments, then compact from the job
+static void finish (void) {
+    for( u2_t c = 0; c < F.nbmissing; c++ ) {
+        u2_t i = F.missing[c];
+        if( getbit(F.have, i) )
+            continue;
+        os_clearMem(F.acc, sizeof(F.acc));
+        for( u2_t k = 0; k < F.rank; k++ ) {
+            if( getbit(F.comb[c], k) )
+                xorfrag(coded(k));
+        }
+        if( !writefrag(slot(i)) ) {
+            fail();
+            return;
+        }
+        setbit(F.have, i);
+    }
+    if( F.pitch == F.fragsz ) {
+        os_clearCallback(&F.job);
+        complete();
+    } else {
+        F.cpage = 0;
+        os_setCallback(&F.job, compact_func);
+    }
+}
+
+// group: multicast group the fragment was received on, -1 for unicast
+static void fragment (const u1_t* p, u1_t len, int group) {
+    u2_t in = os_rlsbf2(p);
+    u2_t n = in & 0x3FFF;
+
+    // none after the last one, while the block is compacted
+    if( F.state != FUOTA_RECEIVING || LMIC_fuotaMissing() == 0
+        || (in >> 14) != ((F.session >> 4) & 3) || len != F.fragsz || n == 0 )
+        return;
+    // unicast is always allowed, groups only if in McGroupBitMask
+    if( group >= 0 && !((F.session >> group) & 1) )
+        return;
+    F.received++;
+    memset(F.acc, 0xFF, sizeof(F.acc));
+    os_copyMem(F.acc, p + 2, len);
+    if( n <= F.nbfrag )
+        uncoded(n - 1);
+    else
+        parity(n - F.nbfrag);
+    if( F.state == FUOTA_RECEIVING && LMIC_fuotaMissing() == 0 )
+        finish();
+}
+
+// ----------------------------------------
+// SESSION COMMANDS
+
+static u1_t setup (const u1_t* p) {
+    u1_t idx    = (p[0] >> 4) & 3;
+    u2_t nbfrag = os_rlsbf2(p + 1);
+    u1_t fragsz = p[3];
+    u2_t pitch  = (fragsz + 7) & ~7;
+    u1_t st     = 0;
+
+    if( ((p[4] >> 3) & 7) != 0 )
+        st |= FRAG_ERR_ENCODING;
+    if( F.area == NULL || nbfrag == 0 || nbfrag > CFG_fuota_maxfrags || fragsz == 0
+        || p[5] >= fragsz || (u4_t)nbfrag * pitch > F.areasz )
+        st |= FRAG_ERR_MEMORY;
+    if( idx != 0 )
+        st |= FRAG_ERR_INDEX;
+    if( st )
+        return idx << 6 | st;
+
+    F.state      = FUOTA_RECEIVING;
+    F.session    = p[0];
+    F.nbfrag     = nbfrag;
+    F.fragsz     = fragsz;
+    F.pitch      = pitch;
+    F.padding    = p[5];
+    F.ackdelay   = p[4] & 7;
+    F.descriptor = os_rlsbf4(p + 6);
+    F.status     = 0;
+    F.received   = F.uncoded = F.nbmissing = F.rank = 0;
+    os_clearMem(F.have, sizeof(F.have));
+
+    u4_t need = codedbase() + (u4_t)CFG_fuota_maxmissing * pitch;
+    F.erased  = 0;
+    F.erasend = (need < F.areasz ? need + FLASH_PAGE_SZ - 1 : F.areasz) & ~(u4_t)(FLASH_PAGE_SZ - 1);
+    os_setCallback(&F.job, erase_func);
+    debug_printf("fuota: session %d fragments of %d bytes\r\n", nbfrag, fragsz);
+    return idx << 6;
+}
+
+static u1_t status (u1_t param, u1_t* ans) {
+    u1_t idx = (param >> 1) & 3;
+    u2_t need = LMIC_fuotaMissing();
+
+    if( F.state == FUOTA_IDLE || idx != ((F.session >> 4) & 3) )
+        return 0;
+    if( !(param & 1) && need == 0 )
+        return 0;   // only incomplete sessions answer
+    ans[0] = FRAG_SESS_STATUS;
+    os_wlsbf2(ans + 1, (u2_t)(idx << 14) | (F.received > 0x3FFF ? 0x3FFF : F.received));
+    ans[3] = need > 255 ? 255 : need;
+    ans[4] = F.status;
+    return 5;
+}
+
+static u1_t delsession (u1_t param, u1_t* ans) {
+    u1_t idx = param & 3;
+
+    ans[0] = FRAG_SESS_DELETE;
+    ans[1] = idx;
+    if( F.state == FUOTA_IDLE || idx != ((F.session >> 4) & 3) ) {
+        ans[1] |= 0x04;     // session does not exist
+    } else {
+        os_clearCallback(&F.job);
+        F.state = FUOTA_IDLE;
+    }
+    return 2;
+}
+
+// ----------------------------------------
+// APPLICATION API
+
+//! Use size bytes of flash at area (page aligned) for received data blocks.
+//! done is called when a data block is complete.
+void LMIC_fuotaInit (void* area, u4_t size, fuota_donecb_t done) {
+    ASSERT(((uintptr_t)area & (FLASH_PAGE_SZ - 1)) == 0);
+    os_clearCallback(&F.job);
+    os_clearMem(&F, sizeof(F));
+    F.area   = area;
+    F.areasz = size & ~(u4_t)(FLASH_PAGE_SZ - 1);
+    F.done   = done;
+}
+
+//! Process a downlink received on FUOTA_PORT by multicast group (McGroupID,
+//! index of LMIC.sessions) or by unicast (-1). Answers (if any) are written
+//! to ans and must be sent as an uplink on FUOTA_PORT. Returns their length.
+int LMIC_fuotaRx (const u1_t* data, u1_t len, int group, u1_t* ans, u1_t anslen) {
+    u1_t i = 0, n = 0;
+
+    while( i < len ) {
+        u1_t cid = data[i++];
+        u1_t a[5];
+        u1_t alen = 0;
+        switch( cid ) {
+        case FRAG_DATA:
+            if( len - i >= 2 )
+                fragment(data + i, len - i - 2, group);
+            i = len;    // data fragments are not followed by other commands
+            break;
+        case FRAG_PKG_VERSION:
+            a[0] = FRAG_PKG_VERSION;
+            a[1] = FRAG_PACKAGE_ID;
+            a[2] = FRAG_PACKAGE_VERSION;
+            alen = 3;
+            break;
+        case FRAG_SESS_STATUS:
+            if( i + 1 > len )
+                return n;
+            alen = status(data[i++], a);
+            break;
+        case FRAG_SESS_SETUP:
+            if( i + 10 > len )
+                return n;
+            a[0] = FRAG_SESS_SETUP;
+            a[1] = setup(data + i);
+            alen = 2;
+            i += 10;
+            break;
+        case FRAG_SESS_DELETE:
+            if( i + 1 > len )
+                return n;
+            alen = delsession(data[i++], a);
+            break;
+        default:
+            return n;   // unknown command, rest cannot be parsed
+        }
+        if( alen && n + alen <= anslen ) {
+            os_copyMem(ans + n, a, alen);
+            n += alen;
+        }
+    }
+    return n;
+}
+
+u1_t LMIC_fuotaState (void) {
+    return F.state;
+}
+
+//! Random delay in seconds before answering a command received by
+//! multicast: 0 to 2^(BlockAckDelay+4) seconds, BlockAckDelay from the
+//! FragSessionSetupReq. Answers to unicast commands are not delayed.
+u4_t LMIC_fuotaAnsDelay_sec (void) {
+    return os_getRndU2() % (16u << F.ackdelay);
+}
+
+//! Fragments still needed to complete the data block.
+u2_t LMIC_fuotaMissing (void) {
+    if( F.state != FUOTA_RECEIVING )
+        return 0;
+    if( F.nbmissing )
+        return F.nbmissing - F.rank;
+    return F.nbfrag - F.uncoded;
+}
+
+#endif // CFG_fuota
@@ -0,0 +1,59 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Fragmented data block transport (LoRaWAN TS004) with FEC decoding
+
+#ifndef _fuota_h_
+#define _fuota_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// A data block of 100 kB needs 2134 fragments of 48 bytes, the largest
+// that fit at EU868 DR0-2 (51 bytes payload) and the largest multiple of 8
+// (no padding in flash) at US915/AU915 DR8. Larger blocks need a larger
+// value, each fragment costs 2 bits of RAM.
+#ifndef CFG_fuota_maxfrags
+#define CFG_fuota_maxfrags      2176    // fragments per session
+#endif
+#ifndef CFG_fuota_maxmissing
+#define CFG_fuota_maxmissing    128     // lost fragments that can be recovered
+#endif
+
+#define FUOTA_PORT              201     //!< port of the fragmentation package
+
+//! Session state, see LMIC_fuotaState().
+enum {
+    FUOTA_IDLE,         //!< no session
+    FUOTA_RECEIVING,    //!< session set up, fragments are being received
+    FUOTA_DONE,         //!< data block complete, done callback has been called
+    FUOTA_FAILED,       //!< flash write failed, session stopped
+};
+
+//! Called when the data block has been reassembled in flash.
+//! descriptor is the value of FragSessionSetupReq.
+typedef void (*fuota_donecb_t) (const u1_t* data, u4_t len, u4_t descriptor);
+
+#ifdef CFG_fuota
+
+// Application API
+void LMIC_fuotaInit (void* area, u4_t size, fuota_donecb_t done);
+int  LMIC_fuotaRx (const u1_t* data, u1_t len, int group, u1_t* ans, u1_t anslen);
+u1_t LMIC_fuotaState (void);
+u2_t LMIC_fuotaMissing (void);
+u4_t LMIC_fuotaAnsDelay_sec (void);
+
+#endif // CFG_fuota
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _fuota_h_
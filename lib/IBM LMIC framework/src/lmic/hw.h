@@ -29,7 +29,11 @@
 #ifndef _hw_h_
 #define _hw_h_
 
-// Dummy file, not used by this HAL (but must be present, since other
-// files include it).
+// Peripherals provided by the Arduino HAL (see peripherals.h).
+
+// Internal flash of the STM32WL: 2 KB pages, programmed in 64-bit double
+// words. flash_write() is implemented in hal/hal.cpp.
+#define PERIPH_FLASH
+#define FLASH_PAGE_SZ   2048
 
 #endif
@@ -7,6 +7,7 @@
 #define _lce_h_
 
 #include "oslmic.h"
+#include "aes.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -16,7 +17,15 @@ extern "C"{
 #define LCE_APPSKEY   (-2)
 #define LCE_NWKSKEY   (-1)
 #define LCE_MCGRP_0   ( 0)
+// Multicast groups (CFG_mcast_sessions), each takes 2*AES_EXPKEYLEN bytes
+// here and a session_t in LMIC
+#if defined(CFG_mcast_sessions)
+#define LCE_MCGRP_MAX (CFG_mcast_sessions)
+#elif defined(CFG_mcast)
 #define LCE_MCGRP_MAX ( 2)
+#else
+#define LCE_MCGRP_MAX ( 0)
+#endif
 
 // Stream cipher categories (lce_cipher(..,cat,..):
 // Distinct use of the AppSKey must use different key classes
@@ -41,12 +50,15 @@ void lce_loadSessionKeys (const u1_t* nwkSKey, const u1_t* nwkSKeyDn, const u1_t
 #else
 void lce_loadSessionKeys (const u1_t* nwkSKey, const u1_t* appSKey);
 #endif
+void lce_loadMcGroupKeys (s1_t keyid, const u1_t* nwkSKeyDn, const u1_t* appSKey);
 void lce_init (void);
 
 
+// Group keys are kept expanded (os_aesExpandKey), every multicast frame
+// would need the key schedules again otherwise.
 typedef struct lce_ctx_mcgrp {
-    u1_t nwkSKeyDn[16]; // network session key for down-link
-    u1_t appSKey[16];   // application session key
+    u1_t nwkSKeyDn[AES_EXPKEYLEN];  // network session key for down-link
+    u1_t appSKey[AES_EXPKEYLEN];    // application session key
 } lce_ctx_mcgrp_t;
 
 typedef struct lce_ctx {
@@ -55,7 +67,9 @@ typedef struct lce_ctx {
     u1_t nwkSKeyDn[16]; // network session key for down-link
 #endif
     u1_t appSKey[16];   // application session key
+#if LCE_MCGRP_MAX > 0
     lce_ctx_mcgrp_t mcgroup[LCE_MCGRP_MAX];
+#endif
 } lce_ctx_t;
 
 
@@ -15,7 +15,22 @@
 #define PAMBL_FSK  5
 #define PRERX_FSK  2
 #define RXLEN_FSK  (PRERX_FSK+5+3) // rx preamble and sync word
-#define BCN_100PPM_ms 13   // 13ms = 128sec*100ppm which is roughly +/-100ppm
+#if !defined(CFG_bcnppm)
+#if defined(BRD_LoRa_E5_radio)
+#define CFG_bcnppm 30      // MSI locked to the LSE crystal, radio on the TCXO
+#else
+#define CFG_bcnppm 100
+#endif
+#endif // !defined(CFG_bcnppm)
+#define BCN_TOL_ms ((BCN_INTV_sec * CFG_bcnppm + 999) / 1000)  // clock error over a beacon period
+#define BCN_DDIFF_DECAY 3  // maxDriftDiff recovers 1/8 towards the last difference per beacon
+
+// Lead time of beacon and ping slot receptions
+#if defined(BRD_LoRa_E5_radio)
+#define RXSLOT_RAMPUP  radio_rxrampup()
+#else
+#define RXSLOT_RAMPUP  RX_RAMPUP
+#endif
 
 #define BCN_INTV_osticks       sec2osticks(BCN_INTV_sec)
 #define TXRX_GUARD_osticks     ms2osticks(TXRX_GUARD_ms)
@@ -118,20 +133,20 @@ void os_wmsbf4 (u1_t* buf, u4_t v) {
 #endif
 
 #if !defined(os_crc16)
-// New CRC-16 CCITT(XMODEM) checksum for beacons:
+// CRC-16 CCITT(XMODEM) checksum for beacons (polynomial 0x1021), one
+// nibble at a time: crc16tab[n] is the CRC of the 4-bit value n.
+static const u2_t crc16tab[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
 u2_t os_crc16 (u1_t* data, uint len) {
-    u2_t remainder = 0;
-    u2_t polynomial = 0x1021;
+    u2_t crc = 0;
     for( uint i = 0; i < len; i++ ) {
-        remainder ^= data[i] << 8;
-        for( u1_t bit = 8; bit > 0; bit--) {
-            if( (remainder & 0x8000) )
-                remainder = (remainder << 1) ^ polynomial;
-            else
-                remainder <<= 1;
-        }
+        crc = (crc << 4) ^ crc16tab[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc16tab[(crc >> 12) ^ (data[i] & 0x0F)];
     }
-    return remainder;
+    return crc;
 }
 #endif
 
@@ -229,7 +244,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
         .beaconFreq     = 869525000,
         .rx2Freq        = 869525000,
         .pingFreq       = 869525000,
-        .pingDr         = 0,
+        .pingDr         = 3,
         .rx2Dr          = 0,
         .beaconDr       = 3,
         .beaconOffInfo  = 8,
@@ -626,7 +641,10 @@ static ostime_t calcRxWindow (u1_t secs, dr_t dr) {
     // rxoff is the center of the beacon preamble adjusted by drift
     // rxsyms is the width of the rx window
     // limit for dr2hsym/rxsym: s1_t
-    return rxoff - dr2hsym(dr, rxsyms>127 ? 127 : rxsyms);
+    if( rxsyms > 127 )
+        rxsyms = 127;
+    LMIC.rxsyms = rxsyms;
+    return rxoff - dr2hsym(dr, rxsyms);
 }
 
 
@@ -660,7 +678,7 @@ static void iniRxdErr () {
 }
 
 static void addRxdErr (u1_t rxdelay) {
-    s4_t err = (((LMIC.rxtime0 - LMIC.txend) - sec2osticks(rxdelay)) << RXDERR_SHIFT) / rxdelay;
+    s4_t err = (((LMIC.rxtime0 - LMIC.txend) - sec2osticks(rxdelay)) * (1 << RXDERR_SHIFT)) / rxdelay;  // early frames: err < 0
     if( (u4_t)((err>>20)+1) > 1 )  // overflow?
         return;
     LMIC.rxdErrs[LMIC.rxdErrIdx] = err;
@@ -782,6 +800,190 @@ static void setDrTxpow (u1_t reason, dr_t dr, s1_t powadj) {
 }
 
 
+// Retry policy of confirmed uplinks (LMIC_setTxPolicy)
+static bit_t txPolicy (void) {
+    return LMIC.txpolOn && LMIC.pendTxConf;
+}
+
+static ostime_t attemptAirtime (dr_t dr) {
+    return calcAirTime(setCr(updr2rps(dr), LMIC.errcr), LMIC.txflen);
+}
+
+// Random span of the next retry in secs: doubles with every retry up to
+// 2^backoffExp and ends at the deadline.
+static u1_t retryPeriod (void) {
+    if( !txPolicy() )
+        return RETRY_PERIOD_secs;
+    u1_t n = LMIC.txCnt - 1;
+    if( n > LMIC.txpol.backoffExp )
+        n = LMIC.txpol.backoffExp;
+    u4_t span = (u4_t)RETRY_PERIOD_secs << n;
+    if( LMIC.txpol.deadline ) {
+        ostime_t left = LMIC.txqtime + LMIC.txpol.deadline - LMIC.rxtime;
+        if( span > (u4_t)left / OSTICKS_PER_SEC )
+            span = left > OSTICKS_PER_SEC ? (u4_t)left / OSTICKS_PER_SEC : 1;
+    }
+    return span > 255 ? 255 : span;
+}
+
+// Decide on another attempt of an unacked confirmed uplink. Lowers the DR
+// as the policy says, unless the lower DR would overrun the airtime budget.
+static bit_t retryConf (void) {
+    txpolicy_t* p = &LMIC.txpol;
+    u1_t result = TXEND_NONE;
+    dr_t dr = LMIC.datarate;
+
+    if( LMIC.txCnt >= (p->maxAttempts ? p->maxAttempts : TXCONF_ATTEMPTS) ) {
+        result = TXEND_ATTEMPTS;
+    } else if( p->deadline && LMIC.rxtime - (LMIC.txqtime + p->deadline) >= 0 ) {
+        result = TXEND_DEADLINE;
+    } else {
+        if( p->drSteps && LMIC.txCnt % p->drSteps == 0 && dr > p->minDr && dr != CUSTOM_DR )
+            dr = lowerDR(dr, 1);
+        if( p->maxAirtime && LMIC.txstat.airtime + attemptAirtime(dr) > p->maxAirtime ) {
+            dr = LMIC.datarate;
+            if( LMIC.txstat.airtime + attemptAirtime(dr) > p->maxAirtime )
+                result = TXEND_AIRTIME;
+        }
+    }
+    if( result != TXEND_NONE ) {
+        LMIC.txstat.result = result;
+        return 0;
+    }
+    if( dr != LMIC.datarate ) {
+        if( LMIC.txdrRetry == 0xFF )
+            LMIC.txdr0 = LMIC.datarate;
+        setDrTxpow(DRCHG_NOACK, dr, KEEP_TXPOWADJ);
+        LMIC.txdrRetry = dr;
+    }
+    return 1;
+}
+
+// Account an attempt of a confirmed uplink
+static void confAttempt (dr_t txdr) {
+    LMIC.txflen = LMIC.dataLen;
+    LMIC.txstat.attempts += 1;
+    LMIC.txstat.dr = txdr;
+    LMIC.txstat.airtime += calcAirTime(LMIC.rps, LMIC.dataLen);
+}
+
+// Confirmed uplink acked or given up: record the outcome and go back to
+// the DR from before the retries (unless the network has set another).
+static void confDone (void) {
+    if( LMIC.txstat.attempts == 0 || LMIC.txstat.latency != 0 )
+        return;
+    if( LMIC.txrxFlags & TXRX_ACK )
+        LMIC.txstat.result = TXEND_ACK;
+    else if( LMIC.txstat.result == TXEND_NONE )
+        LMIC.txstat.result = TXEND_ATTEMPTS;
+    LMIC.txstat.latency = os_getTime() - LMIC.txqtime;
+    if( LMIC.txdrRetry != 0xFF && LMIC.datarate == LMIC.txdrRetry )
+        setDrTxpow(DRCHG_SET, LMIC.txdr0, KEEP_TXPOWADJ);
+    LMIC.txdrRetry = 0xFF;
+    debug_printf("Confirmed uplink: %s after %d attempts, airtime %d ms, %d ms\r\n",
+                 LMIC.txstat.result == TXEND_ACK ? "ACK" : "no ACK", LMIC.txstat.attempts,
+                 (int)osticks2ms(LMIC.txstat.airtime), (int)osticks2ms(LMIC.txstat.latency));
+}
+
+
+// Payload-size-aware DR selection (LMIC_setDrFit)
+#define DRFIT_HALFDB_PER_DR  5  // adjacent spreading factors are ~2.5 dB apart
+
+// DR can go out on the channel picked for LMIC.datarate
+static bit_t fitUsable (dr_t dr) {
+    bit_t ok = validDR(dr) && REGION.dr2maxAppPload[dr] != 0;
+#ifdef REG_FIX
+    if( REG_IS_FIX() )
+        ok = ok && (dr == REGION.fixDr) == (LMIC.datarate == REGION.fixDr);
+#endif
+#ifdef REG_DYN
+    if( !REG_IS_FIX() )
+        ok = ok && ((LMIC.dyn.chDrMap[LMIC.txChnl] >> dr) & 1);
+#endif
+    return ok;
+}
+
+// Fastest DR the link allows: with ADR the network's DR, without it the DR
+// the last LinkCheckAns margin (less the reserve) supports. Retries keep
+// LMIC.datarate, so the retry policy's DR fallback holds.
+static dr_t fitTop (void) {
+    dr_t top = LMIC.datarate;
+    if( LMIC.adrEnabled || LMIC.txCnt || LMIC.gwcnt == 0 || LMIC.gwmargin == 255 )
+        return top;
+    int dr = LMIC.gwdr + ((int)LMIC.gwmargin - LMIC.drfitRsv) * 2 / DRFIT_HALFDB_PER_DR;
+    if( dr > LMIC.drfitMax )
+        dr = LMIC.drfitMax;
+    for( ; dr > top; dr-- ) {
+        if( fitUsable(dr) )
+            return dr;
+    }
+    return top;
+}
+
+static u1_t fitRoom (dr_t dr, u1_t foptslen) {
+    u1_t max = REGION.dr2maxAppPload[dr];
+    return max > foptslen ? max - foptslen : 0;
+}
+
+// DR for a frame of dlen payload and foptslen MAC command bytes: the
+// fastest DR within the link margin it fits, else the slowest DR up to
+// drfitMax it fits. DRFIT_SPLIT sends instead the records that fit at the
+// link margin DR now and the rest in a second frame, when both frames
+// take less airtime than the single frame. LMIC.drfitPart is set to the
+// size of the first part.
+static dr_t fitDr (u1_t dlen, u1_t foptslen) {
+    dr_t top = fitTop(), dr;
+    for( dr = top; dr != (dr_t)-1 && dr >= LMIC.datarate; dr-- ) {
+        if( fitUsable(dr) && dlen <= fitRoom(dr, foptslen) )
+            return dr;
+    }
+    dr_t single = top;
+    ostime_t t1 = 0;
+    for( dr = top + 1; dr <= LMIC.drfitMax && dr < 16; dr++ ) {
+        if( fitUsable(dr) && dlen <= fitRoom(dr, foptslen) ) {
+            single = dr;
+            t1 = calcAirTime(setCr(updr2rps(dr), LMIC.errcr), 13 + foptslen + dlen);
+            break;
+        }
+    }
+    if( LMIC.drfit == DRFIT_SPLIT && LMIC.txCnt == 0 ) {
+        u1_t rec = LMIC.drfitRec ? LMIC.drfitRec : 1;
+        u1_t room = fitRoom(top, foptslen);
+        u1_t n = room / rec * rec;
+        if( n != 0 && dlen - n <= room ) {
+            rps_t rps = setCr(updr2rps(top), LMIC.errcr);
+            ostime_t t2 = calcAirTime(rps, 13 + foptslen + n) + calcAirTime(rps, 13 + foptslen + dlen - n);
+            if( t1 == 0 || t2 < t1 ) {
+                LMIC.drfitPart = n;
+                LMIC.drfitConf = LMIC.pendTxConf;
+                return top;
+            }
+        }
+    }
+    return single;
+}
+
+// Second frame of a split payload: queue the rest once the first part is
+// through. A first part lost (no ACK) or cancelled takes the rest with it.
+static bit_t nextPart (void) {
+    u1_t part = LMIC.drfitPart;
+    if( part == 0 )
+        return 0;
+    LMIC.drfitPart = 0;
+    if( LMIC.txrxFlags & (TXRX_NACK|TXRX_NOTX) )
+        return 0;
+    LMIC.pendTxLen -= part;
+    os_moveMem(LMIC.pendTxData, LMIC.pendTxData + part, LMIC.pendTxLen);
+    LMIC.pendTxConf = LMIC.drfitConf;
+    LMIC.txCnt = 0;
+    LMIC.txstat.result = TXEND_NONE;
+    LMIC.txstat.latency = 0;
+    LMIC.opmode |= OP_TXDATA;
+    debug_printf("Split frame: %d bytes sent, %d to go\r\n", part, LMIC.pendTxLen);
+    return 1;
+}
+
+
 #if !defined(DISABLE_CLASSB)
 void LMIC_stopPingable (void) {
     LMIC.opmode &= ~(OP_PINGABLE|OP_PINGINI);
@@ -966,6 +1168,7 @@ static void syncDatarate_dyn (void) {
 
 static void updateTx_dyn (ostime_t txbeg) {
     ostime_t airtime = calcAirTime(LMIC.rps, LMIC.dataLen);
+    budget_tx(airtime);
     freq_t freq = LMIC.dyn.chUpFreq[LMIC.txChnl];
     u1_t b = freq & BAND_MASK;
     // set frequency/power
@@ -1345,7 +1548,7 @@ static u1_t applyChannelMap_fix (u1_t chpage, u2_t chmap, u2_t* dest) {
         for (u1_t u = 0; u < (REGION.numChBlocks >> 1); u++) {
             dest[u] = en125;
         }
-        dest[REGION.numChBlocks >> 1] = chmap;
+        dest[REGION.numChBlocks >> 1] = chmap & 0xFF;   // 500 kHz channels only
     } else if( chpage == MCMD_LADR_CHP_BLK8 )  {
         dest[REGION.numChBlocks >> 1] = chmap & 0xFF;
         for (u1_t u = 0; u < (REGION.numChBlocks >> 1); u++) {
@@ -1368,6 +1571,7 @@ static u1_t applyChannelMap_fix (u1_t chpage, u2_t chmap, u2_t* dest) {
 
 static void updateTx_fix (ostime_t txbeg) {  //XXX:BUG: this is US915/AU915 centric - won't work for CN470
     ostime_t airtime = calcAirTime(LMIC.rps, LMIC.dataLen);
+    budget_tx(airtime);
     u1_t chnl = LMIC.txChnl;
     LMIC.txpow = LMIC.txPowAdj + REGION.maxEirp;
     if( chnl < REGION.numChBlocks*8 ) {
@@ -1498,8 +1702,53 @@ static void opmodePoll (void) {
     }
 }
 
+// Draining of pending downlinks: while the network sets FPending, the poll
+// (OP_POLL, sent as soon as the duty cycle allows) goes out before the
+// application gets EV_TXCOMPLETE, so it does not sleep with a backlog.
+// Returns 1 if the transaction goes on with another poll.
+static bit_t drainMore (void) {
+    if( LMIC.drainMax == 0 )
+        return 0;
+    if( LMIC.moreData && (LMIC.opmode & OP_POLL) ) {
+#if defined(CFG_energy)
+        energy_ledger_t up;
+        LMIC_getEnergy(NULL, &up);  // uplink ledger runs on through the polls
+        bit_t capped = LMIC.drainCap_uC != 0 && LMIC_energyCharge_uC(&up, -1) >= LMIC.drainCap_uC;
+#else
+        bit_t capped = 0;
+#endif
+        if( LMIC.drainCnt < LMIC.drainMax && !capped ) {
+            LMIC.drainCnt += 1;
+            LMIC.drainFlags |= LMIC.txrxFlags & (TXRX_ACK|TXRX_NACK);
+            return 1;
+        }
+        debug_printf("Drain stopped after %d polls, downlinks pending\r\n", LMIC.drainCnt);
+        if( !LMIC.dnConf ) {    // an ACK still goes out, the rest waits for the next uplink
+            LMIC.opmode &= ~OP_POLL;
+            os_clearCallback(&LMIC.polljob);
+        }
+    }
+    LMIC.txrxFlags |= LMIC.drainFlags;
+    LMIC.drainCnt = LMIC.drainFlags = 0;
+    return 0;
+}
+
 static void reportEvent (ev_t ev) {
     TRACE_EV(ev);
+    dse_event(ev);
+    mcast_event(ev);
+    timesync_event(ev);
+    if( ev == EV_TXCOMPLETE && (drainMore() || nextPart()) ) {
+        // payload of a drained downlink (or one received after the first
+        // part of a split frame) is passed on like a class C one
+        if( (LMIC.txrxFlags & TXRX_PORT) == 0 ) {
+            engineUpdate();
+            return;
+        }
+        ev = EV_RXCOMPLETE;
+    }
+    if( ev == EV_TXCOMPLETE )
+        energy_endUplink();
     ON_LMIC_EVENT(ev);
     engineUpdate();
 }
@@ -1584,6 +1833,27 @@ static int maxDnLen (rps_t rps) {
     }
 }
 
+// Length of downlink MAC commands including CID (minimum for variable length ones)
+static const u1_t MCMD_DN_LEN[] = {
+    [0]               = 1,  // padding between FOpts and FPort=0 payload
+    [MCMD_LCHK_ANS]   = 3,
+    [MCMD_LADR_REQ]   = 5,
+    [MCMD_DCAP_REQ]   = 2,
+    [MCMD_DN2P_SET]   = 5,
+    [MCMD_DEVS_REQ]   = 1,
+    [MCMD_SNCH_REQ]   = 6,
+    [MCMD_RXTM_REQ]   = 2,
+    [MCMD_DNFQ_REQ]   = 5,
+    [MCMD_RKEY_CNF]   = 2,
+    [MCMD_ADRP_REQ]   = 2,
+    [MCMD_TIME_ANS]   = 6,
+    [MCMD_PITV_ANS]   = 1,
+    [MCMD_PNGC_REQ]   = 5,
+    [MCMD_BCNI_ANS]   = 4,
+    [MCMD_BCNF_REQ]   = 4,
+    [MCMD_DEVMD_CONF] = 2,
+};
+
 static bit_t decodeFrame (void) {
     u1_t* d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -1655,7 +1925,8 @@ static bit_t decodeFrame (void) {
     // DN frame requested confirmation - provide ACK once with next UP frame
     LMIC.dnConf = (ftype == HDR_FTYPE_DCDN ? FCT_ACK : 0);
 
-    if( LMIC.dnConf || (fct & FCT_MORE) )
+    LMIC.moreData = (fct & FCT_MORE) != 0;
+    if( LMIC.dnConf || LMIC.moreData )
         opmodePoll();
 
     // We heard from network
@@ -1695,6 +1966,11 @@ static bit_t decodeFrame (void) {
     }
     LMIC.foptsUpLen = 0;
     while( oidx < olen ) {
+        // Stop at truncated commands - parameters would be read from MIC/payload bytes.
+        // Also stop if there is no room left for answers.
+        if( (opts[oidx] < sizeof(MCMD_DN_LEN) && oidx + MCMD_DN_LEN[opts[oidx]] > olen) ||
+            LMIC.foptsUpLen + 2 > (int)sizeof(LMIC.foptsUp) )
+            break;
         switch( opts[oidx] ) {
         case 0:  // FPort=0 if we had MAC commands in payload
             oidx += 1;
@@ -1730,7 +2006,7 @@ static bit_t decodeFrame (void) {
                 if( !applyChannelMap(chpage, chmap, dmap) ) {
                     ans &= ~MCMD_LADR_ANS_CHACK;
                 }
-            } while (oidx < olen && opts[oidx] == MCMD_LADR_REQ);
+            } while (oidx + 5 <= olen && opts[oidx] == MCMD_LADR_REQ);
 
             if( (ans & MCMD_LADR_ANS_CHACK) && !checkChannelMap(dmap) ) {
                 ans &= ~MCMD_LADR_ANS_CHACK;
@@ -1777,7 +2053,7 @@ static bit_t decodeFrame (void) {
                 setDrTxpow(DRCHG_NWKCMD, dr, powadj==15 ? KEEP_TXPOWADJ : -2*powadj);
                 reportEvent(EV_DATARATE);
             }
-            while( cnt-- > 0 ) {
+            while( cnt-- > 0 && LMIC.foptsUpLen + 2 <= (int)sizeof(LMIC.foptsUp) ) {
                 LMIC.foptsUp[LMIC.foptsUpLen++] = MCMD_LADR_ANS;
                 LMIC.foptsUp[LMIC.foptsUpLen++] = ans;
             }
@@ -1843,7 +2119,7 @@ static bit_t decodeFrame (void) {
                     if( validDR(mindr) && validDR(maxdr) && mindr <= maxdr &&  //XXX:BUG use a validUPDR?
                         (chidx >= MIN_DYN_CHNLS || (mindr == 0 && maxdr >= fastest125())) ) // XXX: correct?
                         ans |= MCMD_SNCH_ANS_DRACK;
-                    if( chidx <= MAX_DYN_CHNLS && freq >= 0 )
+                    if( chidx < MAX_DYN_CHNLS && freq >= 0 )
                         ans |= MCMD_SNCH_ANS_FQACK;
                     if( ans == (MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK) )
                         setupChannel_dyn(chidx, freq, DR_RANGE_MAP(mindr,maxdr));
@@ -1864,7 +2140,7 @@ static bit_t decodeFrame (void) {
                 u1_t ans = MCMD_DNFQ_ANS_PEND;
                 u1_t chidx = opts[oidx+1];
                 freq_t freq  = rdFreq(&opts[oidx+2]);
-                if( chidx <= MAX_DYN_CHNLS && LMIC.dyn.chUpFreq[chidx] != 0 )
+                if( chidx < MAX_DYN_CHNLS && LMIC.dyn.chUpFreq[chidx] != 0 )
                     ans |= MCMD_DNFQ_ANS_CHACK;
                 if( freq > 0 )
                     ans |= MCMD_DNFQ_ANS_FQACK;
@@ -1892,6 +2168,29 @@ static bit_t decodeFrame (void) {
             oidx += 2;
             continue;
         }
+        case MCMD_TIME_ANS: {
+            // GPS time at the end of the uplink that carried the request
+            u4_t secs = os_rlsbf4(&opts[oidx+1]);
+            u1_t frac = opts[oidx+5];
+            osxtime_t ref = os_time2XTime(LMIC.txend, os_getXTime());
+            LMIC.gpsEpochOff = (osxtime_t)secs * OSTICKS_PER_SEC + ((frac * OSTICKS_PER_SEC + 128) >> 8) - ref;
+            LMIC.devTimeReq = 0;
+            oidx += 6;
+#if !defined(DISABLE_CLASSB)
+            if( LMIC.askForTime == 0 )
+                continue;   // not asked for to track a beacon
+            LMIC.askForTime = 0;   // stop asking for time
+            // Set up tracking of next beacon based on the obtained time:
+            // Accuracy error: 1/512 sec = ~2ms - spec promises +/-100ms
+            LMIC.bcninfo.txtime = LMIC.txend - (secs & 0x7F) * OSTICKS_PER_SEC - (((frac * OSTICKS_PER_SEC) + 128) >> 8);
+            LMIC.bcninfo.time = secs & ~0x7F;   // ping slot offsets until the first beacon
+            LMIC.bcninfo.flags = 0;  // no previous beacon as reference (BCN_PARTIAL|BCN_FULL cleared)
+            calcBcnRxWindowFromMillis(100,1);
+            LMIC.bcnChnl = (1+(secs >> 7)) % numBcnChannels();
+            LMIC.opmode = (LMIC.opmode & ~OP_SCAN) | OP_TRACK;
+#endif
+            continue;
+        }
 #if !defined(DISABLE_CLASSB)
         case MCMD_PITV_ANS: {
             if( (LMIC.ping.intvExp & 0x80) ) {
@@ -1920,24 +2219,6 @@ static bit_t decodeFrame (void) {
             LMIC.foptsUp[i+1] = ans;
             continue;
         }
-        case MCMD_TIME_ANS: {
-            u4_t secs = os_rlsbf4(&opts[oidx+1]);
-            u1_t frac = opts[oidx+5];
-            osxtime_t ref = os_time2XTime(LMIC.txend, os_getXTime());
-            LMIC.gpsEpochOff = secs * OSTICKS_PER_SEC + (((frac * OSTICKS_PER_SEC) >> 8) + 128) - ref;
-            LMIC.askForTime = 0;   // stop asking for time
-            oidx += 6;
-            // Currently, we only ask for time when we want to track a beacon
-            // If there are other reasons for getting MCMD_TIME_ANS we have to discern them here
-            // Set up tracking of next beacon based on the obtained time:
-            // Accuracy error: 1/512 sec = ~2ms - spec promises +/-100ms
-            LMIC.bcninfo.txtime = LMIC.txend - (secs & 0x7F) * OSTICKS_PER_SEC - (((frac * OSTICKS_PER_SEC) + 128) >> 8);
-            LMIC.bcninfo.flags = 0;  // no previous beacon as reference (BCN_PARTIAL|BCN_FULL cleared)
-            calcBcnRxWindowFromMillis(100,1);
-            LMIC.bcnChnl = (1+(secs >> 7)) % numBcnChannels();
-            LMIC.opmode = (LMIC.opmode & ~OP_SCAN) | OP_TRACK;
-            continue;
-        }
         case MCMD_BCNI_ANS: {
             // Ignore if tracking already enabled
             if( (LMIC.opmode & OP_TRACK) == 0 ) {
@@ -2031,6 +2312,7 @@ static bit_t decodeFrame (void) {
     return 1;
 }
 
+#if MAX_MULTICAST_SESSIONS > 0
 static bit_t decodeMultiCastFrame (void) {
     u1_t* d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -2054,8 +2336,8 @@ static bit_t decodeMultiCastFrame (void) {
     // check for multicast session with this address
     session_t* s;
     for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=addr; s++);
-    if( s == LMIC.sessions+MAX_MULTICAST_SESSIONS ) {
-        goto norx;
+    if( s == LMIC.sessions+MAX_MULTICAST_SESSIONS || addr == 0 ) {
+        goto norx;  // unknown group or unused session slot
     }
     // check for short frame
     if( poff > pend ) {
@@ -2108,6 +2390,12 @@ static bit_t decodeMultiCastFrame (void) {
     }
     return 1;
 }
+#else
+static bit_t decodeMultiCastFrame (void) {
+    LMIC.dataLen = 0;   // no multicast sessions
+    return 0;
+}
+#endif // MAX_MULTICAST_SESSIONS > 0
 
 
 // ================================================================================
@@ -2247,6 +2535,10 @@ static bit_t processJoinAccept (void) {
             for (u1_t i=0; i < 8 && i < CHMAP_SZ; i++, dlen += 2) {
                 LMIC.fix.channelMap[i] = os_rlsbf2(&LMIC.frame[dlen]);
             }
+            int nch = numChannels();
+            if (nch & 15) { // no channels past the last one in the partial word
+                LMIC.fix.channelMap[nch >> 4] &= ~(0xffff << (nch & 15));
+            }
         } else
 #endif // REG_FIX
         {
@@ -2371,11 +2663,30 @@ static void setupRx2ClassC () {
     os_radio(RADIO_RXON);
 }
 
+// Continuous RX2 as the second window of a transaction: a frame for us
+// completes it, without one it ends when the class A RX2 slot is over
+// (job at that time, dataLen 0).
+static void processRx2ClassCDnData (osjob_t* osjob);
+
+static void setupRx2ClassCDnData (void) {
+    setupRx2ClassC();
+    // RX2 slot with a frame of the largest size at its data rate
+    os_setTimedCallback(&LMIC.osjob,
+                        LMIC.txend + sec2osticks(LMIC.dn1Dly + DELAY_EXTDNW2)
+                        + calcAirTime(LMIC.rps, REGION.dr2maxAppPload[LMIC.dn2Dr] + 13),
+                        FUNC_ADDR(processRx2ClassCDnData));
+}
+
+static void processRx2ClassCDnData (osjob_t* osjob) {
+    (void)osjob; // unused
+    if( !processDnData() )
+        setupRx2ClassCDnData();     // frame not for us, listen on
+}
+
 static void processRx1ClassC (osjob_t* osjob) {
     (void)osjob; // unused
-    if( !processDnData() ) {
-        setupRx2ClassC();
-    }
+    if( LMIC.dataLen == 0 || !processDnData() )
+        setupRx2ClassCDnData();
 }
 
 static void setupRx1DnData (osjob_t* osjob) {
@@ -2418,9 +2729,10 @@ static void updataDone (osjob_t* osjob) {
 // ========================================
 
 
-static void buildDataFrame (void) {
+static dr_t buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
     u1_t dlen = txdata ? LMIC.pendTxLen : 0;
+    dr_t dr = LMIC.datarate;
 
     // Piggyback MAC options
     // Prioritize by importance
@@ -2491,11 +2803,15 @@ static void buildDataFrame (void) {
         LMIC.devsAns = 0;
         end += 3;
     }
+    if( LMIC.devTimeReq
 #if !defined(DISABLE_CLASSB)
-    if( LMIC.askForTime > 0 ) {
+        || LMIC.askForTime > 0
+#endif
+      ) {
         LMIC.frame[end] = MCMD_TIME_REQ;
         end += 1;
     }
+#if !defined(DISABLE_CLASSB)
     if( LMIC.bcnfAns ) {
         LMIC.frame[end+0] = MCMD_BCNF_ANS;
         LMIC.frame[end+1] = LMIC.bcnfAns;
@@ -2533,9 +2849,21 @@ static void buildDataFrame (void) {
         end = OFF_DAT_OPTS;
     }
 
+    if( LMIC.drfit != DRFIT_OFF && dr != CUSTOM_DR && txdata && LMIC.pendTxPort ) {
+        if( LMIC.txCnt == 0 )
+            LMIC.drfitPart = 0;
+        else if( LMIC.drfitPart )
+            dlen = LMIC.drfitPart;      // retry of the first part of a split frame
+        dr = fitDr(dlen, foptslen);
+        if( LMIC.drfitPart )
+            dlen = LMIC.drfitPart;
+        if( dr != LMIC.datarate || LMIC.drfitPart )
+            debug_printf("Frame of %d/%d bytes at DR%d instead of DR%d\r\n", dlen, LMIC.pendTxLen, dr, LMIC.datarate);
+    }
+
     int flen, flen_max = MAX_LEN_FRAME;
-    if (LMIC.datarate != CUSTOM_DR)
-        flen_max = LMIC_maxAppPayload() + 13;
+    if (dr != CUSTOM_DR)
+        flen_max = REGION.dr2maxAppPload[dr] + 13;
 again:
     flen = end + (txdata ? 5+dlen : 4);
     if( flen > flen_max ) {
@@ -2552,7 +2880,7 @@ again:
                     debug_printf("Frame too large (%u > %u), not sending\n", flen, flen_max);
                     // cancel transmission completely
                     LMIC.dataLen = 0;
-                    return;
+                    return dr;
                 }
             }
         }
@@ -2586,10 +2914,11 @@ again:
         LMIC.frame[end] = LMIC.pendTxPort;
         os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
         lce_cipher(LMIC.pendTxPort==0 ? LCE_NWKSKEY : LCE_APPSKEY,
-                   LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame+end+1, dlen);
+                   LMIC.devaddr, LMIC.seqnoUp-1, dse_txcat(LMIC.pendTxPort), LMIC.frame+end+1, dlen);
     }
     lce_addMic(LCE_NWKSKEY, LMIC.devaddr, LMIC.seqnoUp-1, LMIC.frame, flen-4);
     LMIC.dataLen = flen;
+    return dr;
 }
 
 
@@ -2601,7 +2930,7 @@ static void onBcnScanRx (osjob_t* job) {
     if( decodeBeacon() ) {
         // Found our 1st beacon
         // We don't have a previous beacon to calc some drift - assume some max drift
-        calcBcnRxWindowFromMillis(BCN_100PPM_ms,1);
+        calcBcnRxWindowFromMillis(BCN_TOL_ms,1);
         LMIC.opmode = (LMIC.opmode & ~OP_SCAN) | OP_TRACK;
         reportEvent(EV_BEACON_FOUND);    // can be disabled in callback
         return;
@@ -2822,11 +3151,13 @@ static bit_t processDnData (void) {
       norx:
         // Nothing received - implies no port
         LMIC.txrxFlags = (LMIC.txrxFlags & TXRX_NOTX) | TXRX_NOPORT;
+        LMIC.moreData = 0;
         if( (LMIC.opmode & OP_TXDATA) ) {
             LMIC.txCnt += 1;
-            if( (int8_t)LMIC.txCnt < (int8_t)LMIC.nbTrans ) { // int8_t => implicit check for IGN_NBTRANS
+            if( txPolicy() ? retryConf()
+                : (int8_t)LMIC.txCnt < (int8_t)LMIC.nbTrans ) { // int8_t => implicit check for IGN_NBTRANS
                 // Schedule another retransmission
-                txDelay(LMIC.rxtime, RETRY_PERIOD_secs);
+                txDelay(LMIC.rxtime, retryPeriod());
                 LMIC.opmode = (LMIC.opmode & ~OP_TXRXPEND) | OP_NEXTCHNL;
                 os_setCallback(&LMIC.osjob, FUNC_ADDR(runEngineUpdate));
                 goto txcontinue;
@@ -2847,6 +3178,7 @@ static bit_t processDnData (void) {
         }
         LMIC.nbTrans &= ~IGN_NBTRANS;   // auto clear ignore
         LMIC.opmode &= ~OP_TXRXPEND;
+        confDone();
         reportEvent(EV_TXCOMPLETE);
         // If we haven't heard from NWK in a while although we asked for a sign
         // assume link is dead - notify application and keep going
@@ -2898,7 +3230,8 @@ static bit_t processDnData (void) {
     else
       d = decodeMultiCastFrame(); // checks group address using the multicast session
     if (!d) {
-      if( (LMIC.txrxFlags & TXRX_DNW1) != 0 )
+        // RX1, or the class C RX2 of the transaction: keep listening
+        if( (LMIC.txrxFlags & TXRX_DNW1) != 0 || LMIC.osjob.func == FUNC_ADDR(processRx2ClassCDnData) )
             return 0;
         goto norx;
     }
@@ -2922,7 +3255,7 @@ static void processBeacon (osjob_t* osjob) {
         ev = EV_BEACON_TRACKED;
         if( (flags & (BCN_PARTIAL|BCN_FULL)) == 0 ) {
             // We don't have a previous beacon to calc some drift - assume some max value
-            calcBcnRxWindowFromMillis(BCN_100PPM_ms,0);
+            calcBcnRxWindowFromMillis(BCN_TOL_ms,0);
             goto rev;
         }
         // We have a previous BEACON to calculate some drift
@@ -2936,6 +3269,8 @@ static void processBeacon (osjob_t* osjob) {
             LMIC.lastDriftDiff = diff;
             if( LMIC.maxDriftDiff < diff )
                 LMIC.maxDriftDiff = diff;
+            else    // a single outlier must not widen all later windows
+                LMIC.maxDriftDiff -= (LMIC.maxDriftDiff - diff) >> BCN_DDIFF_DECAY;
             LMIC.bcninfo.flags &= ~BCN_NODDIFF;
         }
         LMIC.drift = drift;
@@ -2957,7 +3292,7 @@ static void processBeacon (osjob_t* osjob) {
             return;
         }
     }
-    LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks - calcRxWindow(0, REGION.beaconDr);
+    LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks + calcRxWindow(0, REGION.beaconDr);
     LMIC.bcnRxsyms = LMIC.rxsyms;
   rev:
     LMIC.bcnChnl = (LMIC.bcnChnl+1) % numBcnChannels();
@@ -3017,16 +3352,19 @@ static void engineUpdate (void) {
     }
     if( (LMIC.opmode & OP_TRACK) != 0 ) {
         // We are tracking a beacon
-        rxtime = LMIC.bcnRxtime - RX_RAMPUP;
+        rxtime = LMIC.bcnRxtime - RXSLOT_RAMPUP;
 #if CFG_simul
         // Simulation is sometimes late - don't die here but keep going.
         // Results in a missed beacon. On the HW this spells a more serious problem.
         if( (ostime_t)(rxtime-now) < 0 ) {
             fprintf(stderr, "ERROR: engineUpdate/OP_TRACK: delta=%d now=0x%X rxtime=0x%X LMIC.bcnRxtime=0x%X RX_RAMPUP=%d\n",
-                    (ostime_t)(rxtime-now),now,rxtime,LMIC.bcnRxtime,RX_RAMPUP);
+                    (ostime_t)(rxtime-now),now,rxtime,LMIC.bcnRxtime,RXSLOT_RAMPUP);
         }
 #else
-        ASSERT( (ostime_t)(rxtime-now) >= 0 );
+        // Late (an uplink ended just before the beacon): the beacon RX
+        // below starts at once and the window catches what it can.
+        if( (ostime_t)(rxtime-now) < 0 )
+            debug_printf("Beacon RX %d ticks late\r\n", now - rxtime);
 #endif
     }
 #endif
@@ -3070,6 +3408,18 @@ static void engineUpdate (void) {
             goto checkrx;
         }
 #endif
+        // A retry the duty cycle pushes past the deadline is given up
+        if( !jacc && LMIC.txCnt && txPolicy() && LMIC.txpol.deadline &&
+            txbeg - (LMIC.txqtime + LMIC.txpol.deadline) > 0 ) {
+            LMIC.txstat.result = TXEND_DEADLINE;
+            LMIC.opmode &= ~OP_TXDATA;
+            LMIC.foptsUpLen = 0;
+            LMIC.txrxFlags = TXRX_NACK | TXRX_NOPORT;
+            LMIC.dataBeg = LMIC.dataLen = 0;
+            confDone();
+            reportEvent(EV_TXCOMPLETE);
+            return;
+        }
         // Earliest possible time vs overhead to setup radio
         if( txbeg - (now + TX_RAMPUP) <= 0 ) {
         debug_verbose_printf("Ready for uplink\r\n");
@@ -3106,7 +3456,9 @@ static void engineUpdate (void) {
                     goto reset;
                 }
                 LMIC.txrxFlags = 0;
-                buildDataFrame();
+                txdr = buildDataFrame();
+                if( LMIC.gwmargin == 255 )
+                    LMIC.gwdr = txdr;   // LinkCheckReq on board
                 if( LMIC.dataLen == 0 ) {
                     debug_printf("Zero data length, not sending\n");
                     txError();
@@ -3122,6 +3474,8 @@ static void engineUpdate (void) {
                 // Calculate dndr to use based on txdr (can be != LMIC.datarate for joins)
                 LMIC.dndr = prepareDnDr(txdr);
             }
+            if( !jacc && (LMIC.opmode & OP_TXDATA) && LMIC.pendTxConf )
+                confAttempt(txdr);
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             updateTx(txbeg);
             reportEvent(EV_TXSTART);
@@ -3150,7 +3504,7 @@ static void engineUpdate (void) {
   checkrx:
     if( (LMIC.opmode & OP_PINGINI) != 0 ) {
         // One more RX slot in this beacon period?
-        if( rxschedNext(&LMIC.ping, now+RX_RAMPUP) ) {
+        if( rxschedNext(&LMIC.ping, now+RXSLOT_RAMPUP) ) {
             if( txbeg != 0  &&  (txbeg - LMIC.ping.rxtime) < 0 )
                 goto txdelay;
             LMIC.rxsyms  = LMIC.ping.rxsyms;
@@ -3158,8 +3512,8 @@ static void engineUpdate (void) {
             LMIC.freq    = LMIC.ping.freq;          // XXX:US like => calc based on beacon time!
             LMIC.rps     = dndr2rps(LMIC.ping.dr);
             LMIC.dataLen = 0;
-            ASSERT(LMIC.rxtime - now+RX_RAMPUP >= 0 );
-            os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startRxPing));
+            ASSERT(LMIC.rxtime - now+RXSLOT_RAMPUP >= 0 );
+            os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RXSLOT_RAMPUP, FUNC_ADDR(startRxPing));
             return;
         }
         // no - just wait for the beacon
@@ -3181,10 +3535,12 @@ static void engineUpdate (void) {
 #endif
 
   txdelay:
+    os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
     if( (LMIC.clmode & CLASS_C) ) {
+        // job/func also used for radio callback! processRx2ClassC runs
+        // engineUpdate at txbeg if nothing has been received until then
         setupRx2ClassC();
     }
-    os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
 }
 
 
@@ -3220,6 +3576,7 @@ void LMIC_selectChannel(u1_t channel) {
 
 void LMIC_shutdown (void) {
     os_clearCallback(&LMIC.osjob);
+    os_clearCallback(&LMIC.polljob);
     os_radio(RADIO_STOP);
     LMIC.opmode |= OP_SHUTDOWN;
 }
@@ -3245,6 +3602,7 @@ u1_t LMIC_regionCode (u1_t regionIdx) {
 void LMIC_reset_ex (u1_t regionCode) {
     os_radio(RADIO_STOP);
     os_clearCallback(&LMIC.osjob);
+    os_clearCallback(&LMIC.polljob);
 
     os_clearMem((u1_t*) &LMIC, sizeof(LMIC));
 
@@ -3260,6 +3618,7 @@ void LMIC_reset_ex (u1_t regionCode) {
     LMIC.netid        = NETID_NONE;
     LMIC.errcr        = CR_4_5;
     LMIC.adrEnabled   = FCT_ADREN;
+    LMIC.txdrRetry    = 0xFF;
     LMIC.datarate     = fastest125();
     LMIC.dn1Dly       = 1;
     LMIC.dn2Dr        = REGION.rx2Dr;    // we need this for 2nd DN window of join accept
@@ -3300,6 +3659,10 @@ void LMIC_setTxData (void) {
     ASSERT((LMIC.opmode & OP_JOINING) == 0);
     LMIC.opmode |= OP_TXDATA;
     LMIC.txCnt = 0;             // reset nbTrans counter
+    LMIC.drfitPart = 0;
+    os_clearMem(&LMIC.txstat, sizeof(LMIC.txstat));
+    LMIC.txqtime = os_getTime();
+    energy_startUplink();
     engineUpdate();
 }
 
@@ -3308,6 +3671,8 @@ void LMIC_setTxData (void) {
 int LMIC_setTxData2 (u1_t port, u1_t* data, u1_t dlen, u1_t confirmed) {
     if( dlen > sizeof(LMIC.pendTxData) )
         return -2;
+    if( !budget_gate(dlen) )
+        return -3;      // over the airtime budget
     if( data != (u1_t*)0 )
         os_copyMem(LMIC.pendTxData, data, dlen);
     LMIC.pendTxConf = confirmed;
@@ -3324,6 +3689,7 @@ void LMIC_sendAlive (void) {
     LMIC.pendTxConf = 0;
     LMIC.pendTxLen = 0;
     LMIC.txCnt = 0;             // reset nbTrans counter
+    energy_startUplink();
     engineUpdate();
 }
 
@@ -3356,10 +3722,34 @@ void LMIC_setClassC (u1_t enabled) {
 #endif
     // LoRaWAN 1.0.2 - switch mode unilaterally
     // Device is provisioned as class C
-    LMIC.clmode = CLASS_C;
+    LMIC.clmode = enabled ? CLASS_C : 0;
+    if( (LMIC.opmode & OP_TXRXPEND) == 0 )
+        os_radio(RADIO_STOP);  // leave continuous RX2, engineUpdate restarts it
     engineUpdate();
 }
 
+//! \brief Check frequency and data rate for the RX2 window.
+//! Returns MCMD_DN2P_ANS_CHACK and MCMD_DN2P_ANS_DRACK for the valid ones.
+u1_t LMIC_checkRx2 (freq_t freq, dr_t dr) {
+    u1_t ans = 0;
+    if( freq >= REGION.minFreq && freq <= REGION.maxFreq )
+        ans |= MCMD_DN2P_ANS_CHACK;
+    if( dr < 16 && validDR(dr) )
+        ans |= MCMD_DN2P_ANS_DRACK;
+    return ans;
+}
+
+//! \brief Set frequency and data rate of the RX2 window.
+//! A running class C receive is restarted with the new parameters.
+void LMIC_setRx2 (freq_t freq, dr_t dr) {
+    LMIC.dn2Freq = freq;
+    LMIC.dn2Dr = dr;
+    if( (LMIC.clmode & CLASS_C) && (LMIC.opmode & OP_TXRXPEND) == 0 ) {
+        os_radio(RADIO_STOP);
+        engineUpdate();
+    }
+}
+
 //! \brief Setup given session keys
 //! and put the MAC in a state as if
 //! a join request/accept would have negotiated just these keys.
@@ -3401,6 +3791,7 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
 }
 
 int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_t* appKey, u4_t seqnoADn) {
+#if MAX_MULTICAST_SESSIONS > 0
     session_t* s;
     for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=0 && s->grpaddr!=grpaddr; s++);
     if (s >= LMIC.sessions+MAX_MULTICAST_SESSIONS)
@@ -3409,16 +3800,15 @@ int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_
     s->grpaddr  = grpaddr;
     s->seqnoADn = seqnoADn;
 
-    if( nwkKeyDn != (u1_t*)0 ) {
+    if( nwkKeyDn != (u1_t*)0 )
         os_copyMem(s->nwkKeyDn, nwkKeyDn, 16);
-        os_copyMem(&LMIC.lceCtx.mcgroup[LCE_MCGRP_0 + (s-LMIC.sessions)].nwkSKeyDn, nwkKeyDn, 16);
-    }
-
-    if( appKey != (u1_t*)0 ) {
+    if( appKey != (u1_t*)0 )
         os_copyMem(s->appKey, appKey, 16);
-        os_copyMem(&LMIC.lceCtx.mcgroup[LCE_MCGRP_0 + (s-LMIC.sessions)].appSKey, appKey, 16);
-    }
+    lce_loadMcGroupKeys(LCE_MCGRP_0 + (s-LMIC.sessions), s->nwkKeyDn, s->appKey);
     return 1;
+#else
+    return 0;
+#endif
 }
 
 // Enable/disable link check validation.
@@ -3433,6 +3823,41 @@ void LMIC_setLinkCheckMode (bit_t enabled) {
     LMIC.adrAckReq = enabled ? LINK_CHECK_INIT : LINK_CHECK_OFF;
 }
 
+// Keep polling while the network signals more downlinks (FPending), for at
+// most maxPolls empty uplinks and, with CFG_energy, until the uplink and its
+// polls used maxCharge_uC (0=no cap). Downlinks received meanwhile are
+// reported as EV_RXCOMPLETE, EV_TXCOMPLETE comes when the backlog is drained.
+// 0 polls turns it off. Must be called after LMIC_reset.
+void LMIC_setDrain (u1_t maxPolls, u4_t maxCharge_uC) {
+    LMIC.drainMax = maxPolls;
+    LMIC.drainCap_uC = maxCharge_uC;
+}
+
+// Retry policy for the following confirmed uplinks: attempts, DR fallback,
+// backoff, airtime budget and deadline (see txpolicy_t). NULL goes back to
+// nbTrans attempts. The outcome of each confirmed uplink is in LMIC.txstat
+// at EV_TXCOMPLETE. Must be called after LMIC_reset.
+void LMIC_setTxPolicy (const txpolicy_t* policy) {
+    LMIC.txpolOn = policy != NULL;
+    if( policy )
+        LMIC.txpol = *policy;
+}
+
+// Pick the DR per frame by its size (DRFIT_FIT): the fastest DR up to
+// maxDr the link allows that fits the frame. Without ADR the link is judged
+// by the LinkCheckAns margin less reserve_dB, else frames go at the ADR DR
+// unless they do not fit. DRFIT_SPLIT also sends a frame too large for the
+// link as two frames, cut at a multiple of recSize bytes (0=anywhere), when
+// they take less airtime than the frame at the DR it fits; EV_TXCOMPLETE
+// comes after the second one. Must be called after LMIC_reset.
+void LMIC_setDrFit (u1_t mode, dr_t maxDr, u1_t reserve_dB, u1_t recSize) {
+    dr_t fastest = LMIC_fastestDr();
+    LMIC.drfit = mode;
+    LMIC.drfitMax = maxDr > fastest ? fastest : maxDr;
+    LMIC.drfitRsv = reserve_dB;
+    LMIC.drfitRec = recSize;
+}
+
 void LMIC_setLinkCheck (u4_t limit, u4_t delay) {
     LMIC.adrAckLimit = limit;
     LMIC.adrAckDelay = delay;
@@ -3490,8 +3915,11 @@ ostime_t LMIC_calcAirTime (rps_t rps, u1_t plen) {
     return calcAirTime(rps, plen);
 }
 
+// With LMIC_setDrFit() the payload that still goes at the fastest DR the
+// link allows, so frames packed to it are sent at that DR.
 u1_t LMIC_maxAppPayload () {
-    return REGION.dr2maxAppPload[LMIC.datarate];
+    u1_t max = REGION.dr2maxAppPload[LMIC.drfit != DRFIT_OFF ? fitTop() : LMIC.datarate];
+    return max < sizeof(LMIC.pendTxData) ? max : sizeof(LMIC.pendTxData);
 }
 
 ostime_t LMIC_nextTx (ostime_t now) {
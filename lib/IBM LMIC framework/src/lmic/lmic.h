@@ -14,6 +14,9 @@
 #include "oslmic.h"
 #include "lorabase.h"
 #include "lce.h"
+#include "energy.h"
+#include "radiotrace.h"
+#include "fuota.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -143,7 +146,7 @@ typedef struct {
 //  END  -- MULTI REGION
 // ------------------------------------------------
 
-enum { TXCONF_ATTEMPTS    =   8 };   //!< Transmit attempts for confirmed frames
+enum { TXCONF_ATTEMPTS    =   8 };   //!< Transmit attempts for confirmed frames (retry policy default)
 enum { MAX_MISSED_BCNS    =  20 };   // threshold for triggering rejoin requests
 enum { MAX_RXSYMS         = 100 };   // stop tracking beacon beyond this
 
@@ -193,9 +196,9 @@ typedef struct {
     s1_t     rssi;    //!< Adjusted RSSI value of last received beacon
     s1_t     snr;     //!< Scaled SNR value of last received beacon
     u1_t     flags;   //!< Last beacon reception and tracking states. See BCN_* values.
+    u1_t     info;    //!< Info field of last beacon (valid only if BCN_FULL set)
     u4_t     time;    //!< GPS time in seconds of last beacon (received or surrogate)
     //
-    u1_t     info;    //!< Info field of last beacon (valid only if BCN_FULL set)
     s4_t     lat;     //!< Lat field of last beacon (valid only if BCN_FULL set)
     s4_t     lon;     //!< Lon field of last beacon (valid only if BCN_FULL set)
 } bcninfo_t;
@@ -279,12 +282,47 @@ typedef struct {
     u4_t        seqnoADn;     // down stream seqno (AFCntDown)
 } session_t;
 
+//! Retry policy of confirmed uplinks, see LMIC_setTxPolicy(). Zero means no limit.
+typedef struct {
+    u1_t        maxAttempts;  //!< transmissions including the first, 0: TXCONF_ATTEMPTS
+    u1_t        drSteps;      //!< lower the DR by one after every drSteps unacked attempts, 0: keep DR
+    dr_t        minDr;        //!< lowest DR the retries may fall back to
+    u1_t        backoffExp;   //!< retry within RETRY_PERIOD_secs * 2^min(retry-1,backoffExp) secs
+    ostime_t    maxAirtime;   //!< airtime of all attempts together
+    ostime_t    deadline;     //!< no attempt starts later than this after queueing
+} txpolicy_t;
+
+//! Outcome of the last confirmed uplink (LMIC.txstat)
+enum { TXEND_NONE, TXEND_ACK, TXEND_ATTEMPTS, TXEND_AIRTIME, TXEND_DEADLINE };
+typedef struct {
+    u1_t        attempts;     // transmissions made
+    u1_t        result;       // TXEND_*
+    dr_t        dr;           // DR of the last attempt
+    ostime_t    airtime;      // airtime of all attempts
+    ostime_t    latency;      // from queueing until ACK or giving up
+} txstats_t;
+
+//! Per frame DR selection by payload size, see LMIC_setDrFit()
+enum {
+    DRFIT_OFF,                //!< frames go at LMIC.datarate
+    DRFIT_FIT,                //!< fastest DR the link allows that fits the frame
+    DRFIT_SPLIT,              //!< DRFIT_FIT, or two frames of whole records if that takes less airtime
+};
+
 // duty cycle/dwell time relative to baseAvail in sec.
 // To avoid roll over this needs to be updated.
 typedef u2_t avail_t;
 
 #define MAX_MULTICAST_SESSIONS LCE_MCGRP_MAX
 
+// Largest uplink payload LMIC_setTxData2() takes (CFG_max_payload), also
+// the limit of LMIC_maxAppPayload()
+#if defined(CFG_max_payload)
+#define MAX_TX_PAYLOAD CFG_max_payload
+#else
+#define MAX_TX_PAYLOAD MAX_LEN_PAYLOAD
+#endif
+
 #define CHMAP_SZ (MAX_FIX_CHNLS+15)/16
 
 struct lmic_t {
@@ -300,14 +338,13 @@ struct lmic_t {
     u1_t        rxsyms;     // Width of RX window
     u1_t        dndr;
     s1_t        txpow;     // dBm -- needs to be combined with brdTxPowOff
+    u1_t        noRXIQinversion;
 
-    osjob_t     osjob;
-
-    osxtime_t   baseAvail;                      // base time for availability
     avail_t     globalAvail;                    // next available DC (global)
-    u1_t        noDC;                           // disable all duty cycle
+    osjob_t     osjob;
 
     const region_t* region;
+    osxtime_t   baseAvail;                      // base time for availability
     union {
 #ifdef REG_DYN
         // ETSI-like (dynamic channels)
@@ -333,6 +370,7 @@ struct lmic_t {
     u1_t        refChnl;         // channel randomizer - search relative to this indicator
     u1_t        txChnl;          // channel for next TX
     u1_t        globalDutyRate;  // max rate: 1/2^k
+    u1_t        noDC;            // disable all duty cycle
     ostime_t    globalDutyAvail; // time device can send again  -- XXX:PROBLEM if no TX for ~18h we have a rollover here!! --> avail_t??
 
     u4_t        netid;        // current network id (~0 - none)
@@ -351,11 +389,12 @@ struct lmic_t {
     osxtime_t   gpsEpochOff;  // gpstime = gpsEpochOff+getXTime(), 0=undefined
     s4_t        rxdErrs[RXDERR_NUM];
     u1_t        rxdErrIdx;
+    u1_t        devTimeReq;   // send DeviceTimeReq with next uplink
 
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
     u1_t        pendTxLen;    // +0x80 = confirmed
-    u1_t        pendTxData[MAX_LEN_PAYLOAD];
+    u1_t        pendTxData[MAX_TX_PAYLOAD];
     u1_t        pendTxNoRx;   // don't listen for down data after tx
 
     u2_t        devNonce;     // last generated nonce
@@ -367,7 +406,6 @@ struct lmic_t {
 #endif
     u4_t        seqnoUp;
 
-    u1_t        dnConf;       // dn frame confirm pending: LORA::FCT_ACK or 0
     s4_t        adrAckReq;    // counter until we reset data rate (0x80000000=off)
     u4_t        adrAckLimit;  // ADR_ACK_LIMIT
     u4_t        adrAckDelay;  // ADR_ACK_DELAY
@@ -384,6 +422,7 @@ struct lmic_t {
     //XXX:old: u1_t        snchAns;      // answer set new channel
     u1_t        dn1Dly;       // delay in secs to DNW1
     s1_t        dn1DrOffIdx;  // index into DR offset table (can be negative in some regions!)
+    u1_t        dnConf;       // dn frame confirm pending: LORA::FCT_ACK or 0
     // 2nd RX window (after up stream)
     u1_t        dn2Dr;
     u4_t        dn2Freq;
@@ -393,8 +432,10 @@ struct lmic_t {
     u1_t        dnfqAnsPend;  // pending ACK bits (2 each)
     u4_t        dnfqAcks;     // ack bit pending
 
+#if MAX_MULTICAST_SESSIONS > 0
     // multicast sessions
     session_t  sessions[MAX_MULTICAST_SESSIONS];
+#endif
 
 #if defined(CFG_lorawan11)
     u1_t        opts;         // negotiated protocol options
@@ -402,10 +443,10 @@ struct lmic_t {
 
 #if !defined(DISABLE_CLASSB)
     // Class B state
+    rxsched_t   ping;         // pingable setup
     u1_t        missedBcns;   // unable to track last N beacons
     s1_t        askForTime;   // how often to ask for time
     //XXX:old: u1_t        pingSetAns;   // answer set cmd and ACK bits
-    rxsched_t   ping;         // pingable setup
 #endif
 
     // Public part of MAC state
@@ -418,19 +459,41 @@ struct lmic_t {
 #if !defined(DISABLE_CLASSB)
     u1_t        bcnfAns;      // mcmd beacon freq: bit7:pending, bit0:ACK/NACK
     u1_t        bcnChnl;
-    u4_t        bcnFreq;      // 0=default, !=0: specific BCN freq/no hopping
     u1_t        bcnRxsyms;    //
+    u4_t        bcnFreq;      // 0=default, !=0: specific BCN freq/no hopping
     ostime_t    bcnRxtime;
     bcninfo_t   bcninfo;      // Last received beacon info
 #endif
 
-    u1_t        noRXIQinversion;
-
     // automatic sending of MAC uplinks without payload
     osjob_t     polljob;      // job to schedule engineUpdate in poll mode
     ostime_t    polltime;     // time when OP_POLL flag was set
     ostime_t    polltimeout;  // timeout when frame will be sent even without payload (default 0)
 
+    // draining of pending downlinks (FPending)
+    u1_t        drainMax;     // max polls before EV_TXCOMPLETE, 0=off
+    u1_t        drainCnt;     // polls sent for the current uplink
+    u1_t        drainFlags;   // TXRX_ACK/TXRX_NACK of the uplink being drained
+    u4_t        drainCap_uC;  // max charge of uplink and polls (CFG_energy), 0=no cap
+
+    // retry policy of confirmed uplinks
+    txpolicy_t  txpol;
+    bit_t       txpolOn;      // 0: nbTrans attempts as for unconfirmed uplinks
+    dr_t        txdr0;        // DR before the retries lowered it
+    dr_t        txdrRetry;    // DR set by the retries, 0xFF: none
+    u1_t        txflen;       // frame length of the last attempt
+    ostime_t    txqtime;      // time the uplink was queued
+    txstats_t   txstat;       // outcome of the last confirmed uplink
+
+    // payload-size-aware DR selection
+    u1_t        drfit;        // DRFIT_*
+    dr_t        drfitMax;     // fastest DR a frame may use
+    u1_t        drfitRsv;     // dB of the LinkCheckAns margin kept in reserve
+    u1_t        drfitRec;     // split only at multiples of this many bytes
+    u1_t        drfitPart;    // bytes of pendTxData in the frame being sent, 0: all
+    u1_t        drfitConf;    // pendTxConf of the split frame
+    dr_t        gwdr;         // DR of the uplink the LinkCheckAns margin refers to
+
     // radio power consumption
     u4_t        radioPwr_ua;  // power consumption of current radio operation in uA
 
@@ -547,6 +610,8 @@ void  LMIC_disableTracking (void);
 #endif
 
 void  LMIC_setClassC     (u1_t enabled);
+u1_t  LMIC_checkRx2      (freq_t freq, dr_t dr);
+void  LMIC_setRx2        (freq_t freq, dr_t dr);
 #if !defined(DISABLE_CLASSB)
 void  LMIC_stopPingable  (void);
 u1_t  LMIC_setPingable   (u1_t intvExp);
@@ -567,6 +632,9 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
 void LMIC_setLinkCheckMode (bit_t enabled);
 void LMIC_setLinkCheck (u4_t limit, u4_t delay);
 void LMIC_askForLinkCheck (void);
+void LMIC_setDrain (u1_t maxPolls, u4_t maxCharge_uC);
+void LMIC_setTxPolicy (const txpolicy_t* policy);
+void LMIC_setDrFit (u1_t mode, dr_t maxDr, u1_t reserve_dB, u1_t recSize);
 
 dr_t     LMIC_fastestDr (); // fastest UP datarate
 dr_t     LMIC_slowestDr (); // slowest UP datarate
@@ -607,6 +675,27 @@ void     LMIC_getRxdErrInfo (s4_t* skew, u4_t* span);
 #define TRACE_ADDR(a)
 #endif
 
+// Data streaming engine
+#include "dse.h"
+
+// Remote multicast setup
+#include "mcast.h"
+
+// Network time
+#include "timesync.h"
+
+// Airtime budget
+#include "budget.h"
+
+// TX slotting
+#include "txslot.h"
+
+// Store and forward
+#include "backlog.h"
+
+// Persistent configuration
+#include "persist.h"
+
 // Definitions for DR_RANGE_MAP
 enum _dr_eu868_t {
         EU868_DR_SF12 = 0,
@@ -0,0 +1,306 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_mcast
+
+#if MAX_MULTICAST_SESSIONS < 1 || MAX_MULTICAST_SESSIONS > 4
+#error "CFG_mcast needs 1 to 4 multicast sessions (CFG_mcast_sessions)"
+#endif
+
+// Remote multicast setup v1.0.0
+#define MC_PACKAGE_ID           2
+#define MC_PACKAGE_VERSION      1
+
+enum {
+    MC_PKG_VERSION      = 0x00,
+    MC_GROUP_STATUS     = 0x01,
+    MC_GROUP_SETUP      = 0x02,
+    MC_GROUP_DELETE     = 0x03,
+    MC_CLASSC_SESSION   = 0x04,
+};
+
+// McClassCSessionAns status bits
+enum {
+    MC_ERR_DR           = 0x04,
+    MC_ERR_FREQ         = 0x08,
+    MC_ERR_UNDEFINED    = 0x10,
+};
+
+#define MC_MAXWAIT      sec2osticks(3600)   // longest single timer wait
+
+// McGroupID is the index into LMIC.sessions and selects the key context
+// LCE_MCGRP_0+id. The session keys are expanded into the key context when
+// the group is set up, frames of the group are verified and deciphered
+// without key schedule.
+static struct {
+    u4_t            maxfcnt[MAX_MULTICAST_SESSIONS];
+    u1_t            limited;    // groups set up by this package (have maxfcnt)
+    u1_t            state;      // class C session, MCAST_*
+    u1_t            group;
+    u1_t            timeout;    // session length 2^timeout s
+    dr_t            dr;
+    freq_t          freq;
+    osxtime_t       start;      // session start, end when running
+    freq_t          savedFreq;  // RX2 parameters and class before the session
+    dr_t            savedDr;
+    u1_t            savedClassC;
+    osjob_t         job;
+} M;
+
+// McRootKey = aes128_encrypt(GenAppKey, 0x00 | pad16), the device root key
+// takes the place of GenAppKey. With LoRaWAN 1.1 McRootKey is derived from
+// AppKey with 0x20.
+// McKEKey   = aes128_encrypt(McRootKey, 0x00 | pad16)
+// McKey     = aes128_encrypt(McKEKey, McKey_encrypted)
+static void deriveKey (u1_t* key, const u1_t* mckeyEnc) {
+    u1_t b[16];
+
+    os_clearMem(b, 16);
+#if defined(CFG_lorawan11)
+    b[0] = 0x20;
+    os_getAppKey(AESkey);
+#else
+    os_getNwkKey(AESkey);
+#endif
+    os_aes(AES_ENC, b, 16);             // McRootKey
+    os_copyMem(AESkey, b, 16);
+    os_clearMem(b, 16);
+    os_aes(AES_ENC, b, 16);             // McKEKey
+    os_copyMem(AESkey, b, 16);
+    os_copyMem(key, mckeyEnc, 16);
+    os_aes(AES_ENC, key, 16);           // McKey
+}
+
+// McAppSKey = aes128_encrypt(McKey, 0x01 | McAddr | pad16)
+// McNwkSKey = aes128_encrypt(McKey, 0x02 | McAddr | pad16)
+static void sessionKey (u1_t* skey, const u1_t* mckey, u1_t type, devaddr_t addr) {
+    os_clearMem(skey, 16);
+    skey[0] = type;
+    os_wlsbf4(skey + 1, addr);
+    os_copyMem(AESkey, mckey, 16);
+    os_aes(AES_ENC, skey, 16);
+}
+
+static u1_t isDefined (u1_t id) {
+    return id < MAX_MULTICAST_SESSIONS && LMIC.sessions[id].grpaddr != 0;
+}
+
+static void stopSession (void) {
+    os_clearCallback(&M.job);
+    if( M.state == MCAST_RUNNING ) {
+        LMIC_setRx2(M.savedFreq, M.savedDr);
+        if( !M.savedClassC )
+            LMIC_setClassC(0);
+        debug_printf("mcast: class C session of group %d ended\r\n", M.group);
+    }
+    M.state = MCAST_IDLE;
+}
+
+static void deleteGroup (u1_t id) {
+    session_t* s = &LMIC.sessions[id];
+
+    if( M.state != MCAST_IDLE && M.group == id )
+        stopSession();
+    os_clearMem(s, sizeof(*s));
+    os_clearMem(&LMIC.lceCtx.mcgroup[id], sizeof(LMIC.lceCtx.mcgroup[id]));
+    M.limited &= ~(1 << id);
+}
+
+static osxtime_t gpsNow (void) {
+    return LMIC.gpsEpochOff + os_getXTime();
+}
+
+static void sessionJob (osjob_t* job) {
+    osxtime_t dt = M.start - os_getXTime();
+
+    if( dt > 0 ) {
+        // start or end is further away than a timer reaches
+        os_setTimedCallback(job, os_getTime() + (dt > MC_MAXWAIT ? MC_MAXWAIT : (ostime_t)dt), sessionJob);
+        return;
+    }
+    if( M.state == MCAST_RUNNING ) {
+        stopSession();
+        return;
+    }
+    M.savedFreq   = LMIC.dn2Freq;
+    M.savedDr     = LMIC.dn2Dr;
+    M.savedClassC = (LMIC.clmode & CLASS_C) != 0;
+    M.state       = MCAST_RUNNING;
+    M.start       = os_getXTime() + ((osxtime_t)OSTICKS_PER_SEC << M.timeout);
+    LMIC_setRx2(M.freq, M.dr);
+    LMIC_setClassC(UNILATERAL_CLASS_C);
+    debug_printf("mcast: class C session of group %d on %F DR%d for %ds\r\n",
+                 M.group, M.freq, 6, M.dr, 1 << M.timeout);
+    sessionJob(job);
+}
+
+static u1_t status (u1_t mask, u1_t* a) {
+    u1_t n = 2, total = 0, found = 0;
+
+    a[0] = MC_GROUP_STATUS;
+    for( u1_t id = 0; id < MAX_MULTICAST_SESSIONS; id++ ) {
+        if( !isDefined(id) )
+            continue;
+        total++;
+        if( mask & (1 << id) ) {
+            found |= 1 << id;
+            a[n] = id;
+            os_wlsbf4(a + n + 1, LMIC.sessions[id].grpaddr);
+            n += 5;
+        }
+    }
+    a[1] = (total << 4) | found;
+    return n;
+}
+
+// McGroupIDHeader (1), McAddr (4), McKey_encrypted (16), minMcFCount (4), maxMcFCount (4)
+static u1_t setup (const u1_t* d) {
+    u1_t id = d[0] & 3;
+    u1_t mckey[16], nwk[16], app[16];
+
+    if( id >= MAX_MULTICAST_SESSIONS )
+        return 0x04 | id;               // IDerror
+    deleteGroup(id);
+    devaddr_t addr = os_rlsbf4(d + 1);
+    deriveKey(mckey, d + 5);
+    sessionKey(app, mckey, 0x01, addr);
+    sessionKey(nwk, mckey, 0x02, addr);
+
+    session_t* s = &LMIC.sessions[id];
+    s->grpaddr  = addr;
+    s->seqnoADn = os_rlsbf4(d + 21);
+    os_copyMem(s->nwkKeyDn, nwk, 16);
+    os_copyMem(s->appKey, app, 16);
+    lce_loadMcGroupKeys(LCE_MCGRP_0 + id, nwk, app);
+    M.maxfcnt[id] = os_rlsbf4(d + 25);
+    M.limited |= 1 << id;
+    debug_printf("mcast: group %d addr %08x fcnt %d..%d\r\n",
+                 id, addr, s->seqnoADn, M.maxfcnt[id]);
+    return id;
+}
+
+// McGroupID (1), SessionTime (4), SessionTimeOut (1), DLFrequ (3), DR (1)
+static u1_t classCSession (const u1_t* d, u1_t* a) {
+    u1_t id = d[0] & 3;
+    freq_t freq = ((freq_t)d[6] | ((freq_t)d[7] << 8) | ((freq_t)d[8] << 16)) * 100;
+    dr_t dr = d[9];
+    u1_t st = id;
+
+    a[0] = MC_CLASSC_SESSION;
+    if( !isDefined(id) )
+        st |= MC_ERR_UNDEFINED;
+    u1_t ok = LMIC_checkRx2(freq, dr);
+    if( !(ok & MCMD_DN2P_ANS_CHACK) )
+        st |= MC_ERR_FREQ;
+    if( !(ok & MCMD_DN2P_ANS_DRACK) )
+        st |= MC_ERR_DR;
+    a[1] = st;
+    if( st != id )
+        return 2;
+
+    // SessionTime is GPS seconds, without network time the session starts now
+    s4_t wait = 0;
+    if( LMIC.gpsEpochOff != 0 ) {
+        wait = (s4_t)(os_rlsbf4(d + 1) - (u4_t)(gpsNow() / OSTICKS_PER_SEC));
+        if( wait < 0 )
+            wait = 0;
+    }
+    stopSession();
+    M.group   = id;
+    M.freq    = freq;
+    M.dr      = dr;
+    M.timeout = d[5] & 0x0F;
+    M.start   = os_getXTime() + (osxtime_t)wait * OSTICKS_PER_SEC;
+    M.state   = MCAST_PENDING;
+    os_setCallback(&M.job, sessionJob);
+    a[2] = wait;
+    a[3] = wait >> 8;
+    a[4] = wait >> 16;
+    return 5;
+}
+
+// called by lmic.c before the application sees the event
+void mcast_event (ev_t ev) {
+    if( ev != EV_RXCOMPLETE || !M.limited )
+        return;
+    // a group is no longer valid once its frame counter reached maxMcFCount
+    for( u1_t id = 0; id < MAX_MULTICAST_SESSIONS; id++ ) {
+        if( (M.limited & (1 << id)) && LMIC.sessions[id].seqnoADn > M.maxfcnt[id] ) {
+            debug_printf("mcast: group %d reached its last frame\r\n", id);
+            deleteGroup(id);
+        }
+    }
+}
+
+//! Process a downlink on MCAST_PORT. Answers are written to ans (up to
+//! anslen bytes), the length of the answer is returned. The application
+//! sends a non-zero answer as uplink on MCAST_PORT.
+int LMIC_mcastRx (const u1_t* data, u1_t len, u1_t* ans, u1_t anslen) {
+    u1_t i = 0, n = 0;
+
+    while( i < len ) {
+        u1_t cid = data[i++];
+        u1_t a[2 + 5 * MAX_MULTICAST_SESSIONS];
+        u1_t alen = 0;
+        switch( cid ) {
+        case MC_PKG_VERSION:
+            a[0] = MC_PKG_VERSION;
+            a[1] = MC_PACKAGE_ID;
+            a[2] = MC_PACKAGE_VERSION;
+            alen = 3;
+            break;
+        case MC_GROUP_STATUS:
+            if( i + 1 > len )
+                return n;
+            alen = status(data[i++] & 0x0F, a);
+            break;
+        case MC_GROUP_SETUP:
+            if( i + 29 > len )
+                return n;
+            a[0] = MC_GROUP_SETUP;
+            a[1] = setup(data + i);
+            alen = 2;
+            i += 29;
+            break;
+        case MC_GROUP_DELETE: {
+            if( i + 1 > len )
+                return n;
+            u1_t id = data[i++] & 3;
+            a[0] = MC_GROUP_DELETE;
+            a[1] = id;
+            if( isDefined(id) )
+                deleteGroup(id);
+            else
+                a[1] |= 0x04;           // McGroupUndefined
+            alen = 2;
+            break;
+        }
+        case MC_CLASSC_SESSION:
+            if( i + 10 > len )
+                return n;
+            alen = classCSession(data + i, a);
+            i += 10;
+            break;
+        default:
+            return n;   // unknown command, rest cannot be parsed
+        }
+        if( alen && n + alen <= anslen ) {
+            os_copyMem(ans + n, a, alen);
+            n += alen;
+        }
+    }
+    return n;
+}
+
+//! Class C session state, the application keeps the device awake
+//! (no deep sleep) while it is not MCAST_IDLE.
+u1_t LMIC_mcastClassC (void) {
+    return M.state;
+}
+
+#endif // CFG_mcast
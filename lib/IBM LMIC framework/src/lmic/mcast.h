@@ -0,0 +1,47 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Remote multicast setup (LoRaWAN TS005) and class C multicast sessions
+
+#ifndef _mcast_h_
+#define _mcast_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define MCAST_PORT              200     //!< port of the multicast setup package
+
+//! Class C session state, see LMIC_mcastClassC().
+enum {
+    MCAST_IDLE,         //!< no class C session
+    MCAST_PENDING,      //!< session set up, waiting for its start time
+    MCAST_RUNNING,      //!< device is in class C on the session channel
+};
+
+#ifdef CFG_mcast
+
+// Hook used by lmic.c
+void mcast_event (ev_t ev);
+
+// Application API
+int  LMIC_mcastRx (const u1_t* data, u1_t len, u1_t* ans, u1_t anslen);
+u1_t LMIC_mcastClassC (void);
+
+#else
+
+#define mcast_event(e)      do { } while (0)
+
+#endif // CFG_mcast
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _mcast_h_
@@ -23,6 +23,7 @@ void rng_init (void);
 void os_init (void* bootarg) {
     memset(&OS, 0x00, sizeof(OS));
     hal_init(bootarg);
+    energy_init();
 #ifndef CFG_noradio
     radio_init(false);
 #endif
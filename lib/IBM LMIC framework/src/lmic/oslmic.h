@@ -372,6 +372,9 @@ void radio_cca (void);
 void radio_cad (void);
 void radio_cw (void);
 void radio_generate_random (u4_t *words, u1_t len);
+#if defined(BRD_LoRa_E5_radio)
+ostime_t radio_rxrampup (void); // (used by class B scheduling)
+#endif
 
 #ifdef __cplusplus
 } // extern "C"
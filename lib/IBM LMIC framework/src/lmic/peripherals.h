@@ -8,6 +8,9 @@
 
 #include "hw.h" // provided by HAL
 
+#ifdef __cplusplus
+extern "C"{
+#endif
 
 #ifdef PERIPH_EEPROM
 // ------------------------------------------------
@@ -22,7 +25,10 @@ void eeprom_copy (void* dest, const void* src, int len);
 // ------------------------------------------------
 // Flash
 
-void flash_write (void* dst, const void* src, unsigned int nwords, bool erase);
+// Program nwords 32-bit words at dst. With erase set, each page is erased
+// when the write reaches its start. src NULL only erases. Returns false if
+// an erase or a program operation failed, the write stops there.
+bool flash_write (void* dst, const void* src, unsigned int nwords, bool erase);
 
 #endif
 
@@ -118,4 +124,8 @@ unsigned int adc_read (unsigned int chnl, unsigned int rate);
 
 #endif
 
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
 #endif
@@ -0,0 +1,194 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "peripherals.h"
+
+#ifdef CFG_persist
+
+#ifndef PERIPH_FLASH
+#error "CFG_persist needs flash_write() (PERIPH_FLASH)"
+#endif
+
+// The area is a ring of at least two flash pages. A commit appends a new
+// copy of the block after the last one, so the last copy is never erased
+// or programmed over while the new one is written. When the head page is
+// full, the next page is erased and the copy goes there; the last copy
+// stays in the page before. A copy torn by a reset fails its CRC and the
+// one before it is used.
+//
+// Page: magic(4) seq(4), then copies
+// Copy: crc(2) version(2) len(2) 0xFFFF data(len), padded to 8 bytes.
+// The CRC covers version to the end of the data.
+
+#define PERSIST_MAGIC   0x47464E43      // "CNFG"
+#define PAGE_HDR        8
+#define REC_HDR         8
+#define NOPOS           0xFFFFFFFF
+
+static struct {
+    u1_t*   area;
+    u4_t    size;       // multiple of FLASH_PAGE_SZ
+    u4_t    hpage;      // offset of the head page
+    u4_t    pseq;       // sequence number of the head page
+    u4_t    head;       // offset for the next copy
+    u4_t    last;       // offset of the last valid copy
+} P;
+
+static u4_t pageOf (u4_t off) {
+    return off & ~(u4_t)(FLASH_PAGE_SZ - 1);
+}
+
+static bit_t erased8 (u4_t off) {
+    const u4_t* w = (const u4_t*)(P.area + off);
+    return w[0] == 0xFFFFFFFF && w[1] == 0xFFFFFFFF;
+}
+
+static u4_t pageSeq (u4_t page) {
+    const u1_t* p = P.area + page;
+    return os_rlsbf4(p) == PERSIST_MAGIC ? os_rlsbf4(p + 4) : 0;
+}
+
+// Size of the valid copy at off, 0 if the copies of its page end there.
+// off is never at a page start (page header), so off-1 is in the page:
+// after a full page off is its end, not the start of the next one.
+static u4_t recLen (u4_t off) {
+    u4_t end = pageOf(off - 1) + FLASH_PAGE_SZ;
+    if( off + REC_HDR > end || erased8(off) )
+        return 0;
+    u1_t* h = P.area + off;
+    u4_t len = os_rlsbf2(h + 4);
+    u4_t n = REC_HDR + ((len + 7) & ~7u);
+    if( len > PERSIST_MAXLEN || off + n > end || os_rlsbf2(h) != os_crc16(h + 2, 6 + len) )
+        return 0;
+    return n;
+}
+
+// Last valid copy in a page, NOPOS if none. end gets the offset after it.
+static u4_t scanPage (u4_t page, u4_t* end) {
+    u4_t off = page + PAGE_HDR, len, last = NOPOS;
+    while( (len = recLen(off)) != 0 ) {
+        last = off;
+        off += len;
+    }
+    *end = off;
+    return last;
+}
+
+// Erase the page after the head page and continue there. The page with the
+// last copy is never the one erased: with a head page that holds no copy
+// (header written, reset before the copy), the head page is used again.
+// Without any copy the head page is used again as well, the next page may
+// still hold data that is being taken over (EEPROM page of src/main.cpp).
+// Returns 0 if the erase or the header write failed.
+static bit_t newPage (void) {
+    u4_t pg = P.hpage + FLASH_PAGE_SZ;
+    u4_t hdr[2];
+    if( pg == P.size )
+        pg = 0;
+    if( P.last == NOPOS || pageOf(P.last) == pg )
+        pg = P.hpage;
+    os_wlsbf4((u1_t*)hdr, PERSIST_MAGIC);
+    os_wlsbf4((u1_t*)hdr + 4, ++P.pseq);
+    bit_t ok = flash_write(P.area + pg, hdr, 2, true);
+    P.hpage = pg;
+    P.head = pg + PAGE_HDR;
+    return ok;
+}
+
+//! Use size bytes of flash at area (page aligned, at least 2 pages) for
+//! the configuration and find the last valid copy in it.
+void LMIC_persistInit (void* area, u4_t size) {
+    ASSERT(((uintptr_t)area & (FLASH_PAGE_SZ - 1)) == 0);
+    os_clearMem(&P, sizeof(P));
+    P.area = area;
+    P.size = size & ~(u4_t)(FLASH_PAGE_SZ - 1);
+    ASSERT(P.size >= 2 * FLASH_PAGE_SZ);
+    u4_t npages = P.size / FLASH_PAGE_SZ, pg, s, end;
+    for( pg = 0; pg < P.size; pg += FLASH_PAGE_SZ ) {
+        s = pageSeq(pg);
+        if( s > P.pseq ) {
+            P.pseq = s;
+            P.hpage = pg;
+        }
+    }
+    P.last = NOPOS;
+    if( P.pseq == 0 ) {         // new area, first commit erases page 0
+        P.hpage = 0;
+        P.head = FLASH_PAGE_SZ;
+        return;
+    }
+    P.last = scanPage(P.hpage, &P.head);
+    if( P.head + REC_HDR <= P.hpage + FLASH_PAGE_SZ && !erased8(P.head) )
+        P.head = P.hpage + FLASH_PAGE_SZ;   // torn copy, do not program over it
+    // no copy in the head page: the last one is in the newest page before
+    // it (not always the page before, see newPage)
+    for( u4_t below = P.pseq, n = 1; P.last == NOPOS && n < npages; n++ ) {
+        u4_t best = NOPOS, bseq = 0;
+        for( pg = 0; pg < P.size; pg += FLASH_PAGE_SZ ) {
+            s = pageSeq(pg);
+            if( s != 0 && s < below && s > bseq ) {
+                bseq = s;
+                best = pg;
+            }
+        }
+        if( best == NOPOS )
+            break;
+        P.last = scanPage(best, &end);
+        below = bseq;
+    }
+}
+
+//! Copy the last committed block to data, at most len bytes; bytes beyond
+//! the length of the block are cleared. Returns its version, 0 if there is
+//! no valid block.
+u2_t LMIC_persistRead (void* data, u2_t len) {
+    os_clearMem(data, len);
+    if( P.area == NULL || P.last == NOPOS )
+        return 0;
+    const u1_t* h = P.area + P.last;
+    u2_t n = os_rlsbf2(h + 4);
+    os_copyMem(data, h + REC_HDR, n < len ? n : len);
+    return os_rlsbf2(h + 2);
+}
+
+//! Commit a block of len bytes (at most PERSIST_MAXLEN) with the version
+//! of its layout (not 0). A block equal to the last one is not written
+//! again. Returns 0 if the block could not be written, the last one is
+//! still valid then.
+bit_t LMIC_persistWrite (const void* data, u2_t len, u2_t version) {
+    u4_t rec[(REC_HDR + PERSIST_MAXLEN) / 4];
+    u1_t* r = (u1_t*)rec;
+    u4_t n = REC_HDR + ((len + 7) & ~7u);
+    if( P.area == NULL || len > PERSIST_MAXLEN || version == 0 )
+        return 0;
+    if( P.last != NOPOS ) {
+        const u1_t* h = P.area + P.last;
+        if( os_rlsbf2(h + 2) == version && os_rlsbf2(h + 4) == len && memcmp(h + REC_HDR, data, len) == 0 )
+            return 1;
+    }
+    memset(r, 0xFF, n);
+    os_wlsbf2(r + 2, version);
+    os_wlsbf2(r + 4, len);
+    os_copyMem(r + REC_HDR, data, len);
+    os_wlsbf2(r, os_crc16(r + 2, 6 + len));
+    for( int tries = 0; tries < 2; tries++ ) {
+        if( P.head + n > P.hpage + FLASH_PAGE_SZ && !newPage() ) {
+            P.head = P.hpage + FLASH_PAGE_SZ;   // page header not valid
+            continue;
+        }
+        if( flash_write(P.area + P.head, rec, n / 4, false)
+            && recLen(P.head) == n && memcmp(P.area + P.head, r, n) == 0 ) {
+            P.last = P.head;
+            P.head += n;
+            return 1;
+        }
+        P.head = P.hpage + FLASH_PAGE_SZ;   // failed, not over it again
+    }
+    return 0;
+}
+
+#endif // CFG_persist
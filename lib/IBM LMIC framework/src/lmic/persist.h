@@ -0,0 +1,34 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Persistent configuration: versioned, CRC protected blocks in flash, committed without erasing the last copy
+
+#ifndef _persist_h_
+#define _persist_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define PERSIST_MAXLEN          248     //!< max bytes of a configuration block
+
+#ifdef CFG_persist
+
+// Application API
+void  LMIC_persistInit (void* area, u4_t size);
+u2_t  LMIC_persistRead (void* data, u2_t len);
+bit_t LMIC_persistWrite (const void* data, u2_t len, u2_t version);
+
+#endif // CFG_persist
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _persist_h_
@@ -161,6 +161,15 @@ void HAL_SUBGHZ_RxTxTimeoutCallback ( SUBGHZ_HandleTypeDef* hsubghz )
 #define IRQ_TIMEOUT             (1 << 9)
 #define IRQ_ALL                 0x3FF
 
+// RX duty cycle for continuous rx
+#define RXDC_PREAMBLE           8       // preamble symbols of downlinks
+#define RXDC_DETECT             3       // rx period in symbols, enough to detect a preamble
+#define RXDC_MINSLEEP           64      // [1/64ms] shorter sleep periods are not worth it
+
+// Beacon and ping slot rx (class B)
+#define RXSLOT_HDRSYMS          16      // window start to header detection: preamble, sync, header
+#define RXSLOT_MARGIN           us2osticks(2000)    // job dispatch before the rx setup
+
 // TCXO voltages (limited to VDD - 200mV)
 #define TCXO_VOLTAGE1_6V        0x00
 #define TCXO_VOLTAGE1_7V        0x01
@@ -213,6 +222,7 @@ static const u2_t LORA_RXDONE_FIXUP_500[] = {
 // radio state
 static struct {
     unsigned int sleeping:1;
+    ostime_t rxsetup;           // measured single rx setup time (plus lateness), 0: none yet
 } state;
 
 // ----------------------------------------
@@ -289,6 +299,7 @@ static void SetSleep ( uint8_t cfg )
 {
     Radio_SMPS_Set ( SMPS_DRIVE_SETTING_DEFAULT ) ;
     writecmd ( CMD_SETSLEEP, &cfg, 1 ) ;
+    energy_radio ( EN_RADIO_SLEEP, 0 ) ;
     delayMicroseconds ( 500 ) ;
 }
 
@@ -296,6 +307,7 @@ static void SetSleep ( uint8_t cfg )
 static void SetStandby ( uint8_t cfg )
 {
     writecmd ( CMD_SETSTANDBY, &cfg, 1 ) ;
+    energy_radio ( EN_RADIO_STDBY, 0 ) ;
 }
 
 // set regulator mode REGMODE_LDO or REGMODE_DCDC
@@ -365,12 +377,14 @@ static void SetTx ( uint32_t timeout64ms )
 {
     uint8_t timeout[3] = { timeout64ms >> 16, timeout64ms >> 8, timeout64ms } ;
     writecmd ( CMD_SETTX, timeout, 3 ) ;
+    energy_radio ( EN_RADIO_TX, LMIC.txpow + LMIC.brdTxPowOff ) ;
 }
 
 // generate continuous (indefinite) wave
 static void SetTxContinuousWave (void)
 {
     writecmd ( CMD_SETTXCONTINUOUSWAVE, NULL, 0 ) ;
+    energy_radio ( EN_RADIO_TX, LMIC.txpow + LMIC.brdTxPowOff ) ;
 }
 
 // set radio in receive mode (abort after timeout [1/64ms], or with timeout=0 after frame received, or continuous with timeout=FFFFFF)
@@ -378,12 +392,26 @@ static void SetRx ( uint32_t timeout64ms )
 {
     uint8_t timeout[3] = { timeout64ms >> 16, timeout64ms >> 8, timeout64ms };
     writecmd ( CMD_SETRX, timeout, 3 ) ;
+    energy_radio ( EN_RADIO_RX, 0 ) ;
+}
+
+#if !defined(DISABLE_RXDUTYCYCLE)
+// set radio in receive duty cycle mode: alternate rx and (warm) sleep periods [1/64ms] until a
+// preamble is detected, then receive the frame
+static void SetRxDutyCycle ( uint32_t rx64ms, uint32_t sleep64ms )
+{
+    uint8_t param[6] = { rx64ms >> 16, rx64ms >> 8, rx64ms,
+                         sleep64ms >> 16, sleep64ms >> 8, sleep64ms } ;
+    writecmd ( CMD_SETRXDUTYCYCLE, param, 6 ) ;
+    energy_radio ( EN_RADIO_RX, rx64ms * 100 / ( rx64ms + sleep64ms ) ) ;
 }
+#endif
 
 // set radio in frequency synthesis mode
 static void SetFs (void)
 {
     writecmd ( CMD_SETFS, NULL, 0 ) ;
+    energy_radio ( EN_RADIO_FS, 0 ) ;
 }
 
 // set radio to PACKET_TYPE_LORA or PACKET_TYPE_FSK mode
@@ -775,6 +803,31 @@ static void rxfsk (bool rxcontinuous) {
     hal_enableIRQs();
 }
 
+// LoRa symbol time [1/64ms]
+static uint32_t symtime (rps_t rps) {
+    return ( (uint32_t)64 << ( getSf(rps) - SF7 + 7 ) ) / ( 125 << ( getBw(rps) - BW125 ) ) ;
+}
+
+// Calibrate the rx lead time from the setup time of a single rx that was started
+// at t0 and ready at now. A late start means the lead was too short by that much.
+static void rxsetup_update (ostime_t t0, ostime_t now) {
+    ostime_t d = now - t0;
+    if (LMIC.rxtime - now < 0) {
+        d += now - LMIC.rxtime;
+    }
+    if (state.rxsetup == 0 || d > state.rxsetup) {
+        state.rxsetup = d;
+    } else {
+        state.rxsetup -= (state.rxsetup - d) >> 4;
+    }
+}
+
+// Lead time for beacon and ping slot rx: the calibrated setup time instead of the
+// worst case RX_RAMPUP, which would keep the MCU busy waiting for each slot.
+ostime_t radio_rxrampup (void) {
+    return state.rxsetup ? state.rxsetup + RXSLOT_MARGIN : RX_RAMPUP;
+}
+
 static void rxlora (bool rxcontinuous) {
     // configure radio (needs rampup time)
     // 30-june-2023, ES: SetLoRaSymbNumTimeout ( LMIC.rxsyms ) causes problems on some models.
@@ -793,7 +846,7 @@ static void rxlora (bool rxcontinuous) {
     //               LMIC.rxsyms ) ;
     //SetLoRaSymbNumTimeout(LMIC.rxsyms);
     SetLoRaSymbNumTimeout(0); // ES: Use normal time-out
-    SetDioIrqParams(IRQ_RXDONE | IRQ_TIMEOUT);
+    SetDioIrqParams(IRQ_RXDONE | IRQ_TIMEOUT | IRQ_CRCERR | IRQ_HEADERERR);
     ClearIrqStatus(IRQ_ALL);
     // enter frequency synthesis mode (become ready for immediate rx)
     SetFs();
@@ -813,11 +866,30 @@ static void rxlora (bool rxcontinuous) {
     // enable antenna switch for RX (and account power consumption)
     hal_ant_switch(HAL_ANTSW_RX);
     if (rxcontinuous) {     // continous rx
+#if !defined(DISABLE_RXDUTYCYCLE)
+        // Class C/scan: a downlink preamble of RXDC_PREAMBLE symbols is caught when the radio
+        // sleeps at most RXDC_PREAMBLE - RXDC_DETECT - 1 symbols between rx periods of
+        // RXDC_DETECT symbols. At DR0 this saves more than half of the rx current.
+        uint32_t sym = symtime(LMIC.rps);
+        uint32_t sleep = ( RXDC_PREAMBLE - RXDC_DETECT - 1 ) * sym ;
+        if (sleep >= RXDC_MINSLEEP) {
+            StopTimerOnPreamble(1);             // stay in rx once a preamble is seen
+            SetRxDutyCycle(RXDC_DETECT * sym, sleep);
+        } else
+#endif
         // rx infinitely (no timeout, until rxdone, will be restarted)
         SetRx(0);
     } else { // single rx
+        rxsetup_update(t0, now);
         // busy wait until exact rx time
         hal_waitUntil(LMIC.rxtime);
+#if !defined(DISABLE_CLASSB)
+        if ((LMIC.opmode & (OP_TRACK | OP_TXRXPEND)) == OP_TRACK) {
+            // beacon or ping slot: rx for the LMIC.rxsyms window of the drift tracking,
+            // the timer stops once the header has been detected
+            SetRx((LMIC.rxsyms + RXSLOT_HDRSYMS) * symtime(LMIC.rps));
+        } else
+#endif
         // rx for max LMIC.rxsyms symbols
         // SetRx(0);        // (infinite, timeout set via SetLoRaSymbNumTimeout)
         SetRx(500 << 6);    // Use normal timeout (half the receive window)
@@ -913,6 +985,7 @@ bool radio_irq_process ( ostime_t irqtime, u1_t diomask )
 
     uint16_t irqflags = GetLastIrqStatus() ;
     debug_printf ( "irq_process, IRQ is 0x%04X\r\n", irqflags ) ;
+    energy_radio ( EN_RADIO_STDBY, 0 ) ;    // radio falls back to standby after TX/RX done or timeout
     // dispatch modem
     if ( isFsk ( LMIC.rps ) )
     {   // FSK modem
@@ -966,6 +1039,14 @@ bool radio_irq_process ( ostime_t irqtime, u1_t diomask )
             // save exact tx time
             LMIC.txend = irqtime - LORA_TXDONE_FIXUP ;
         }
+        else if ( irqflags & ( IRQ_CRCERR | IRQ_HEADERERR ) )
+        {   // corrupted frame, drop it (continuous rx will be restarted)
+            BACKTRACE() ;
+            LMIC.dataLen = 0 ;
+#ifdef DEBUG_RX
+            debug_printf ( "RX: %s error\r\n", ( irqflags & IRQ_CRCERR ) ? "CRC" : "header" ) ;
+#endif
+        }
         else if ( irqflags & IRQ_RXDONE )
         {   // RXDONE
             BACKTRACE();
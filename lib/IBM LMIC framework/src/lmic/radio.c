@@ -62,6 +62,7 @@ static void radio_irq_timeout (osjob_t* j) {
 
     // indicate timeout
     LMIC.dataLen = 0;
+    radiotrace_irq(RT_TMO);
 
     // run os job (use preset func ptr)
     os_setCallback(&LMIC.osjob, LMIC.osjob.func);
@@ -81,6 +82,7 @@ static void radio_irq_func ( osjob_t* j )
     {
         // current radio operation has completed
         radio_stop() ; // (disable antenna switch and HAL irqs, make radio sleep)
+        radiotrace_irq ( RT_IRQ ) ;
         // run LMIC job (use preset func ptr)
         os_setCallback ( &LMIC.osjob, LMIC.osjob.func ) ;
     }
@@ -107,6 +109,10 @@ void radio_irq_handler (u1_t diomask, ostime_t ticks)
 }
 
 void os_radio (u1_t mode) {
+    radiotrace_op(mode);
+    if( radiotrace_replay(mode) ) {
+        return;     // served from recorded trace
+    }
     switch (mode) {
         case RADIO_STOP:
             radio_stop();
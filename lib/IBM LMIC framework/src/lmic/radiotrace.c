@@ -0,0 +1,185 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_radiotrace
+
+// ----------------------------------------
+// RECORDER STATE
+static struct {
+    radiotrace_t    rec[CFG_radiotrace_depth];
+    u2_t            head;       // next record to write
+    u2_t            count;      // valid records
+    u1_t            mode;       // mode of last operation
+} T;
+
+// ----------------------------------------
+// REPLAY STATE
+static struct {
+    const radiotrace_t* trace;
+    u2_t                n;
+    u2_t                pos;        // next record to replay
+    s4_t                diverged;   // first record not matching the MAC, -1 if none
+    const radiotrace_t* pend;       // completion of current operation
+    u1_t                mode;       // current operation
+    ostime_t            done;       // completion time
+    osjob_t             job;
+} R;
+
+static radiotrace_t* newrec (u1_t type) {
+    radiotrace_t* r = &T.rec[T.head];
+    T.head = (T.head + 1) % CFG_radiotrace_depth;
+    if( T.count < CFG_radiotrace_depth )
+        T.count++;
+    os_clearMem(r, sizeof(*r));
+    r->type  = type;
+    r->freq  = LMIC.freq;
+    r->rps   = LMIC.rps;
+    r->txpow = LMIC.txpow;
+    return r;
+}
+
+static void savefrm (radiotrace_t* r) {
+    r->len = LMIC.dataLen;
+    os_copyMem(r->frame, LMIC.frame,
+               r->len < CFG_radiotrace_framelen ? r->len : CFG_radiotrace_framelen);
+}
+
+// called by os_radio() before the operation is started
+void radiotrace_op (u1_t mode) {
+    radiotrace_t* r = newrec(RT_OP | mode);
+    T.mode = mode;
+    r->time = (mode == RADIO_RX) ? LMIC.rxtime : os_getTime();
+    if( mode == RADIO_TX )
+        savefrm(r);
+}
+
+// called by radio.c when an operation has completed or timed out
+void radiotrace_irq (u1_t type) {
+    radiotrace_t* r = newrec(type);
+    if( T.mode == RADIO_TX ) {
+        r->time = LMIC.txend;
+    } else {
+        r->time = LMIC.rxtime;
+        r->rssi = LMIC.rssi;
+        r->snr  = LMIC.snr;
+        if( type == RT_IRQ )
+            savefrm(r);
+    }
+    if( type == RT_TMO )
+        r->time = os_getTime();
+}
+
+u2_t LMIC_radioTraceCount (void) {
+    return T.count;
+}
+
+// Copy record idx (0 = oldest). Returns 0 if idx is out of range.
+int LMIC_radioTraceGet (u2_t idx, radiotrace_t* rec) {
+    if( idx >= T.count )
+        return 0;
+    u2_t i = (T.head + CFG_radiotrace_depth - T.count + idx) % CFG_radiotrace_depth;
+    *rec = T.rec[i];
+    return 1;
+}
+
+void LMIC_radioTraceClear (void) {
+    T.head = T.count = 0;
+}
+
+// ----------------------------------------
+// REPLAY
+
+static int matches (const radiotrace_t* op, u1_t mode) {
+    if( (op->type & 0x0F) != mode )
+        return 0;
+    if( mode != RADIO_TX && mode != RADIO_RX && mode != RADIO_RXON )
+        return 1;
+    if( op->freq != LMIC.freq || op->rps != LMIC.rps )
+        return 0;
+    if( mode == RADIO_TX ) {
+        // uplinks must be bit identical, else the MAC state has diverged
+        u1_t n = op->len < CFG_radiotrace_framelen ? op->len : CFG_radiotrace_framelen;
+        return op->len == LMIC.dataLen && memcmp(op->frame, LMIC.frame, n) == 0;
+    }
+    return 1;
+}
+
+// complete operation with the recorded outcome (run by replay job)
+static void replay_done (osjob_t* j) {
+    (void)j; // unused
+    const radiotrace_t* r = R.pend;
+
+    if( R.mode == RADIO_TX ) {
+        LMIC.txend = R.done;
+    } else if( r->type == RT_IRQ && r->len ) {
+        os_copyMem(LMIC.frame, r->frame,
+                   r->len < CFG_radiotrace_framelen ? r->len : CFG_radiotrace_framelen);
+        LMIC.dataLen = r->len;
+        LMIC.rssi    = r->rssi;
+        LMIC.snr     = r->snr;
+        LMIC.rxtime  = R.done;
+        LMIC.rxtime0 = R.done - LMIC_calcAirTime(LMIC.rps, r->len);
+    } else {
+        LMIC.dataLen = 0;   // RX timeout
+    }
+    R.pend = NULL;
+    radiotrace_irq(r->type);
+    os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+}
+
+// called by os_radio(); returns 1 if the operation is served from the trace
+int radiotrace_replay (u1_t mode) {
+    if( R.trace == NULL )
+        return 0;
+    os_clearCallback(&R.job);
+    R.pend = NULL;
+    while( R.pos < R.n && (R.trace[R.pos].type & 0xF0) != RT_OP )
+        R.pos++;
+    if( R.pos >= R.n ) {
+        // end of trace, continue with the real radio
+        debug_printf("radio replay: end of trace\r\n");
+        R.trace = NULL;
+        return 0;
+    }
+    const radiotrace_t* op = &R.trace[R.pos++];
+    if( R.diverged < 0 && !matches(op, mode) ) {
+        R.diverged = R.pos - 1;
+        debug_printf("radio replay: diverged at record %d\r\n", R.diverged);
+    }
+    if( mode != RADIO_TX && mode != RADIO_RX && mode != RADIO_RXON )
+        return 1;
+    if( R.pos >= R.n || (R.trace[R.pos].type & 0xF0) == RT_OP )
+        return 1;   // aborted before completion
+    R.pend = &R.trace[R.pos++];
+    R.mode = mode;
+    R.done = ((mode == RADIO_RX) ? LMIC.rxtime : os_getTime()) + (R.pend->time - op->time);
+    os_setTimedCallback(&R.job, R.done, replay_done);
+    return 1;
+}
+
+// Serve radio operations from a recorded trace instead of the radio.
+// The MAC must start from the same state (keys, counters, DevNonce) as
+// when the trace was recorded. NULL stops the replay.
+void LMIC_radioReplay (const radiotrace_t* trace, u2_t n) {
+    os_clearCallback(&R.job);
+    R.trace    = trace;
+    R.n        = n;
+    R.pos      = 0;
+    R.diverged = -1;
+    R.pend     = NULL;
+}
+
+// Returns the index of the first record where the MAC behaved differently
+// than recorded, or -1. pos (may be NULL) is set to the replay position.
+int LMIC_radioReplayStatus (u2_t* pos) {
+    if( pos )
+        *pos = R.pos;
+    return R.diverged;
+}
+
+#endif // CFG_radiotrace
@@ -0,0 +1,74 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Record and replay of radio operations at the os_radio() boundary
+
+#ifndef _radiotrace_h_
+#define _radiotrace_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#ifndef CFG_radiotrace_depth
+#define CFG_radiotrace_depth    16      // number of records kept
+#endif
+#ifndef CFG_radiotrace_framelen
+#define CFG_radiotrace_framelen 64      // frame bytes kept per record
+#endif
+
+//! Record types: an operation started by os_radio() or its completion.
+enum {
+    RT_OP  = 0x00,      //!< os_radio() call, low nibble is the RADIO_* mode
+    RT_IRQ = 0x10,      //!< operation completed (len=0: RX timeout)
+    RT_TMO = 0x20,      //!< guard timeout, no completion interrupt
+};
+
+//! One trace record.
+//! For RT_OP time is LMIC.rxtime (RADIO_RX) or the call time, for RT_IRQ
+//! it is LMIC.txend (TX) or LMIC.rxtime (RX).
+typedef struct {
+    ostime_t    time;
+    u4_t        freq;
+    u2_t        rps;
+    u1_t        type;   //!< RT_OP|mode, RT_IRQ or RT_TMO
+    u1_t        len;    //!< frame length (may exceed CFG_radiotrace_framelen)
+    s1_t        txpow;
+    s1_t        rssi;
+    s1_t        snr;
+    u1_t        frame[CFG_radiotrace_framelen];
+} radiotrace_t;
+
+#ifdef CFG_radiotrace
+
+// Hooks used by radio.c
+void radiotrace_op (u1_t mode);
+void radiotrace_irq (u1_t type);
+int  radiotrace_replay (u1_t mode);
+
+// Application API
+u2_t LMIC_radioTraceCount (void);
+int  LMIC_radioTraceGet (u2_t idx, radiotrace_t* rec);
+void LMIC_radioTraceClear (void);
+void LMIC_radioReplay (const radiotrace_t* trace, u2_t n);
+int  LMIC_radioReplayStatus (u2_t* pos);
+
+#else
+
+#define radiotrace_op(m)         do { } while (0)
+#define radiotrace_irq(t)        do { } while (0)
+#define radiotrace_replay(m)     0
+
+#endif // CFG_radiotrace
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _radiotrace_h_
@@ -0,0 +1,180 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_timesync
+
+// Application layer clock synchronization v1.0.0
+#define CS_PACKAGE_ID           1
+#define CS_PACKAGE_VERSION      1
+
+enum {
+    CS_PKG_VERSION      = 0x00,
+    CS_APP_TIME         = 0x01,
+    CS_PERIODICITY      = 0x02,
+    CS_FORCE_RESYNC     = 0x03,
+};
+
+enum { REQ_NONE, REQ_BUILT, REQ_SENT };
+
+// Network time is kept as LMIC.gpsEpochOff: GPS time = gpsEpochOff +
+// os_getXTime(). DeviceTimeAns gives the time at the end of the uplink
+// that carried DeviceTimeReq (LMIC.txend), in 1/256 s. AppTimeAns gives a
+// correction in seconds to the DeviceTime of an AppTimeReq. DeviceTime is
+// taken when the request is built; the corrected time is applied to the
+// end of the uplink that carried it, which takes out the time the frame
+// waited for the duty cycle and its airtime.
+static struct {
+    timesync_cb_t   cb;
+    osxtime_t       off;        // gpsEpochOff reported last
+    osxtime_t       txend;      // end of the uplink with the AppTimeReq
+    osxtime_t       next;       // next periodic AppTimeReq, 0: none
+    u4_t            devtime;    // DeviceTime of the AppTimeReq
+    u1_t            req;        // REQ_*
+    u1_t            token;
+    u1_t            period;     // AppTimeReq every 128*2^period s
+    u1_t            resync;     // AppTimeReqs still to send (ForceDeviceResyncReq)
+} T;
+
+// GPS time if known, else seconds since start (what AppTimeReq reports)
+static u4_t deviceTime (void) {
+    return (u4_t)((LMIC.gpsEpochOff + os_getXTime()) / OSTICKS_PER_SEC);
+}
+
+static void report (void) {
+    T.off = LMIC.gpsEpochOff;
+    debug_printf("timesync: GPS time %d\r\n", LMIC_gpsTime(NULL));
+    if( T.cb )
+        T.cb(LMIC_gpsTime(NULL));
+}
+
+// called by lmic.c before the application sees the event
+void timesync_event (ev_t ev) {
+    if( ev != EV_TXCOMPLETE )
+        return;
+    if( T.req == REQ_BUILT && LMIC.pendTxPort == CLOCKSYNC_PORT ) {
+        T.txend = os_time2XTime(LMIC.txend, os_getXTime());
+        T.req = REQ_SENT;
+    }
+    if( LMIC.gpsEpochOff != T.off )
+        report();       // DeviceTimeAns
+}
+
+//! cb is called whenever the network time is set.
+void LMIC_timeSyncInit (timesync_cb_t cb) {
+    os_clearMem(&T, sizeof(T));
+    T.cb = cb;
+    T.off = LMIC.gpsEpochOff;
+}
+
+//! Ask for the network time with DeviceTimeReq in the next uplink.
+void LMIC_requestDeviceTime (void) {
+    LMIC.devTimeReq = 1;
+}
+
+//! Build an AppTimeReq into buf (6 bytes) when one is due (forced, periodic
+//! or requested by the network), returns its length or 0. The application
+//! sends it as uplink on CLOCKSYNC_PORT.
+int LMIC_clockSyncReq (u1_t* buf, u1_t len, u1_t force) {
+    osxtime_t now = os_getXTime();
+    u1_t periodic = T.next != 0 && now - T.next >= 0;
+
+    if( len < 6 || !(force || periodic || T.resync) )
+        return 0;
+    if( T.resync )
+        T.resync--;
+    if( periodic )
+        T.next = now + (((osxtime_t)128 << T.period) * OSTICKS_PER_SEC);
+    T.token   = (T.token + 1) & 0x0F;
+    T.devtime = deviceTime();
+    T.req     = REQ_BUILT;
+    buf[0] = CS_APP_TIME;
+    os_wlsbf4(buf + 1, T.devtime);
+    buf[5] = T.token | (LMIC.gpsEpochOff == 0 || force ? 0x10 : 0);     // AnsRequired
+    return 6;
+}
+
+//! Process a downlink on CLOCKSYNC_PORT. Answers are written to ans (up
+//! to anslen bytes), the length of the answer is returned.
+int LMIC_clockSyncRx (const u1_t* data, u1_t len, u1_t* ans, u1_t anslen) {
+    u1_t i = 0, n = 0;
+
+    while( i < len ) {
+        u1_t cid = data[i++];
+        u1_t a[6];
+        u1_t alen = 0;
+        switch( cid ) {
+        case CS_PKG_VERSION:
+            a[0] = CS_PKG_VERSION;
+            a[1] = CS_PACKAGE_ID;
+            a[2] = CS_PACKAGE_VERSION;
+            alen = 3;
+            break;
+        case CS_APP_TIME: {             // AppTimeAns
+            if( i + 5 > len )
+                return n;
+            s4_t corr = (s4_t)os_rlsbf4(data + i);
+            u1_t token = data[i + 4] & 0x0F;
+            i += 5;
+            if( T.req != REQ_SENT || token != T.token )
+                break;                  // not the answer to our last request
+            T.req = REQ_NONE;
+            LMIC.gpsEpochOff = (osxtime_t)(T.devtime + corr) * OSTICKS_PER_SEC - T.txend;
+            report();
+            break;
+        }
+        case CS_PERIODICITY: {
+            if( i + 1 > len )
+                return n;
+            T.period = data[i++] & 0x0F;
+            T.next = os_getXTime() + ((osxtime_t)128 << T.period) * OSTICKS_PER_SEC;
+            a[0] = CS_PERIODICITY;
+            a[1] = 0;                   // supported
+            os_wlsbf4(a + 2, deviceTime());
+            alen = 6;
+            break;
+        }
+        case CS_FORCE_RESYNC:
+            if( i + 1 > len )
+                return n;
+            T.resync = data[i++] & 0x07;
+            break;
+        default:
+            return n;   // unknown command, rest cannot be parsed
+        }
+        if( alen && n + alen <= anslen ) {
+            os_copyMem(ans + n, a, alen);
+            n += alen;
+        }
+    }
+    return n;
+}
+
+//! GPS time in seconds (and ms if not NULL), 0 if the time is not known.
+u4_t LMIC_gpsTime (u2_t* ms) {
+    if( LMIC.gpsEpochOff == 0 )
+        return 0;
+    osxtime_t t = LMIC.gpsEpochOff + os_getXTime();
+    if( ms )
+        *ms = (u2_t)((t % OSTICKS_PER_SEC) * 1000 / OSTICKS_PER_SEC);
+    return (u4_t)(t / OSTICKS_PER_SEC);
+}
+
+//! UTC time in unix seconds (and ms if not NULL), 0 if the time is not known.
+u4_t LMIC_utcTime (u2_t* ms) {
+    u4_t t = LMIC_gpsTime(ms);
+    return t ? t + GPS_EPOCH_UNIX - CFG_timesync_leapsecs : 0;
+}
+
+//! Set the time from a local clock (the RTC after a reset), UTC in unix seconds.
+void LMIC_setUtcTime (u4_t secs, u2_t ms) {
+    LMIC.gpsEpochOff = (osxtime_t)(secs - GPS_EPOCH_UNIX + CFG_timesync_leapsecs) * OSTICKS_PER_SEC
+                     + ms2osticks(ms) - os_getXTime();
+    T.off = LMIC.gpsEpochOff;   // not news to the application
+}
+
+#endif // CFG_timesync
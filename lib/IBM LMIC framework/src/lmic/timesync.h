@@ -0,0 +1,53 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief Network time: DeviceTimeReq and application layer clock synchronization (LoRaWAN TS003)
+
+#ifndef _timesync_h_
+#define _timesync_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#ifndef CFG_timesync_leapsecs
+#define CFG_timesync_leapsecs   18          // GPS - UTC leap seconds (since 2017)
+#endif
+
+#define CLOCKSYNC_PORT          202         //!< port of the clock synchronization package
+#define GPS_EPOCH_UNIX          315964800   //!< 1980-01-06 00:00:00 UTC in unix time
+
+//! Called when the network time has been set, gpstime in GPS seconds.
+typedef void (*timesync_cb_t) (u4_t gpstime);
+
+#ifdef CFG_timesync
+
+// Hook used by lmic.c
+void timesync_event (ev_t ev);
+
+// Application API
+void LMIC_timeSyncInit (timesync_cb_t cb);
+void LMIC_requestDeviceTime (void);
+int  LMIC_clockSyncRx (const u1_t* data, u1_t len, u1_t* ans, u1_t anslen);
+int  LMIC_clockSyncReq (u1_t* buf, u1_t len, u1_t force);
+u4_t LMIC_gpsTime (u2_t* ms);
+u4_t LMIC_utcTime (u2_t* ms);
+void LMIC_setUtcTime (u4_t secs, u2_t ms);
+
+#else
+
+#define timesync_event(e)   do { } while (0)
+
+#endif // CFG_timesync
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _timesync_h_
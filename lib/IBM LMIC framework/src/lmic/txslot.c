@@ -0,0 +1,56 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#ifdef CFG_txslot
+
+// Devices sleeping for a fixed interval keep the phase they woke up with,
+// so a fleet started together (power cut) stays together and two devices
+// that collide once collide every interval. Here the time within each
+// period is drawn anew from the DevAddr and the period number, which all
+// devices count alike from the network time (RTC set by CFG_timesync).
+
+// Finalizer of MurmurHash3: every input bit changes half the output bits
+static u4_t mix (u4_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+//! Offset in ms of the device's TX time within period number period (time
+//! base secs / interval_sec), a multiple of slot_ms (0: any ms).
+u4_t LMIC_txSlotOffset_ms (u4_t period, u4_t interval_sec, u2_t slot_ms) {
+    if( slot_ms == 0 )
+        slot_ms = 1;
+    u4_t nslots = (u4_t)((u8_t)interval_sec * 1000 / slot_ms);
+    if( nslots == 0 )
+        return 0;
+    return mix(LMIC.devaddr ^ mix(period)) % nslots * slot_ms;
+}
+
+//! Milliseconds from now (now_sec/now_ms in the network time base, e.g.
+//! the RTC) until the device's next TX time that is at least lead_ms
+//! away. A negative lead_ms accepts a TX time that passed up to -lead_ms
+//! ago, 0 is then returned. Without a session (DevAddr 0) it is always 0.
+u4_t LMIC_txSlotWait_ms (u4_t now_sec, u2_t now_ms, u4_t interval_sec, u2_t slot_ms, s4_t lead_ms) {
+    if( LMIC.devaddr == 0 || interval_sec == 0 )
+        return 0;
+    s8_t now = (s8_t)now_sec * 1000 + now_ms;
+    s8_t earliest = now + lead_ms;
+    s8_t ims = (s8_t)interval_sec * 1000;
+    u4_t period = (u4_t)(earliest / ims);
+    s8_t start;
+    // at most twice: the TX time of the next period is after its start
+    while( (start = period * ims + LMIC_txSlotOffset_ms(period, interval_sec, slot_ms)) < earliest )
+        period += 1;
+    return start > now ? (u4_t)(start - now) : 0;
+}
+
+#endif // CFG_txslot
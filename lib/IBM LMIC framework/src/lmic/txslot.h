@@ -0,0 +1,31 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+//! @file
+//! @brief TX slotting: per period uplink time from a hash of the DevAddr and the network time
+
+#ifndef _txslot_h_
+#define _txslot_h_
+
+#include "oslmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#ifdef CFG_txslot
+
+// Application API
+u4_t LMIC_txSlotOffset_ms (u4_t period, u4_t interval_sec, u2_t slot_ms);
+u4_t LMIC_txSlotWait_ms (u4_t now_sec, u2_t now_ms, u4_t interval_sec, u2_t slot_ms, s4_t lead_ms);
+
+#endif // CFG_txslot
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _txslot_h_
@@ -0,0 +1,119 @@
+//***************************************************************************************************
+// benchmark.ino                                                                                    *
+//***************************************************************************************************
+// Compare encoded size and encode time of a typical sensor report for:                             *
+//  - PayloadCodec schema (bit packed)                                                              *
+//  - sprintf() of ASCII text                                                                       *
+//  - a generic TLV encoding (type, length, big endian value)                                        *
+// Time is measured in CPU cycles with the DWT cycle counter.  Output lines:                        *
+//   CODEC,<name>,<bytes>,<cycles/encode>                                                           *
+//***************************************************************************************************
+#include <Arduino.h>
+#include <PayloadCodec.h>
+
+#define ITERATIONS 1000
+
+using Counter  = payload::Field<16> ;                     // Frame counter
+using Temp     = payload::Field<11, 10, 400> ;            // -40.0 .. 164.7 degC
+using Humidity = payload::Field<7> ;                      // 0 .. 127 %
+using VBat     = payload::Field<8, 1, -2000> ;            // 2000 .. 2255 mV
+using Report   = payload::Schema<Counter, Temp, Humidity, VBat> ;
+
+static const char* const names[] = { "fcnt", "temp", "hum", "vbat" } ;
+
+static uint8_t           buf[64] ;
+static volatile uint32_t sink ;                           // Prevent optimizing away
+
+//***************************************************************************************************
+// Generic TLV: one byte type, one byte length, value big endian in the minimal number of bytes.    *
+//***************************************************************************************************
+static uint8_t tlv_put ( uint8_t* p, uint8_t type, int32_t v )
+{
+  uint8_t n = ( v >= -128 && v < 128 ) ? 1 : ( v >= -32768 && v < 32768 ) ? 2 : 4 ;
+
+  p[0] = type ;
+  p[1] = n ;
+  for ( uint8_t i = 0 ; i < n ; i++ )
+  {
+    p[2 + i] = (uint8_t)( v >> ( 8 * ( n - 1 - i ) ) ) ;
+  }
+  return 2 + n ;
+}
+
+
+static uint8_t tlv_encode ( uint8_t* p, uint16_t fcnt, int16_t temp10, uint8_t hum, uint16_t vbat )
+{
+  uint8_t n = 0 ;
+
+  n += tlv_put ( p + n, 1, fcnt ) ;
+  n += tlv_put ( p + n, 2, temp10 ) ;
+  n += tlv_put ( p + n, 3, hum ) ;
+  n += tlv_put ( p + n, 4, vbat ) ;
+  return n ;
+}
+
+
+static void cycles_init()
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk ;        // Enable trace
+  DWT->CYCCNT = 0 ;
+  DWT->CTRL  |= DWT_CTRL_CYCCNTENA_Msk ;                  // Start cycle counter
+}
+
+
+static void report ( const char* name, uint8_t len, uint32_t cycles )
+{
+  Serial.printf ( "CODEC,%s,%d,%lu\n", name, len, (unsigned long)( cycles / ITERATIONS ) ) ;
+}
+
+
+void setup()
+{
+  uint32_t t0 ;
+  uint8_t  len = 0 ;
+  char     spec[200] ;
+
+  Serial.begin ( 115200 ) ;
+  delay ( 1000 ) ;
+  cycles_init() ;
+
+  t0 = DWT->CYCCNT ;                                      // Bit packed, integer inputs
+  for ( uint16_t i = 0 ; i < ITERATIONS ; i++ )
+  {
+    len = Report::encode ( buf, i, (int16_t)215, (uint8_t)55, (uint16_t)2140 ) ;
+    sink = buf[0] ;
+  }
+  report ( "schema_int", len, DWT->CYCCNT - t0 ) ;
+
+  t0 = DWT->CYCCNT ;                                      // Bit packed, float temperature
+  for ( uint16_t i = 0 ; i < ITERATIONS ; i++ )
+  {
+    len = Report::encode ( buf, i, 21.5f, (uint8_t)55, (uint16_t)2140 ) ;
+    sink = buf[0] ;
+  }
+  report ( "schema_float", len, DWT->CYCCNT - t0 ) ;
+
+  t0 = DWT->CYCCNT ;                                      // ASCII
+  for ( uint16_t i = 0 ; i < ITERATIONS ; i++ )
+  {
+    len = sprintf ( (char*)buf, "%u,%d.%d,%u,%u", i, 215 / 10, 215 % 10, 55, 2140 ) ;
+    sink = buf[0] ;
+  }
+  report ( "sprintf", len, DWT->CYCCNT - t0 ) ;
+
+  t0 = DWT->CYCCNT ;                                      // Generic TLV
+  for ( uint16_t i = 0 ; i < ITERATIONS ; i++ )
+  {
+    len = tlv_encode ( buf, i, 215, 55, 2140 ) ;
+    sink = buf[0] ;
+  }
+  report ( "tlv", len, DWT->CYCCNT - t0 ) ;
+
+  Report::spec ( spec, sizeof(spec), names ) ;            // Decoder spec for the network side
+  Serial.println ( spec ) ;
+}
+
+
+void loop()
+{
+}
@@ -0,0 +1,202 @@
+//***************************************************************************************************
+// PayloadCodec.h                                                                                   *
+//***************************************************************************************************
+// Compact binary payloads with a compile time schema.                                              *
+// A schema is a list of fields, each with a bit width, a scale and an offset:                      *
+//                                                                                                  *
+//   raw = round ( value * Scale ) + Offset,  clamped to 0 .. 2^Bits - 1                            *
+//   value = ( raw - Offset ) / Scale                                                               *
+//                                                                                                  *
+// Fields are packed MSB first without padding.  Sizes and bit positions are compile time          *
+// constants and encoding uses no heap.  Pass integers where possible: the STM32WLE5 has no FPU.    *
+//                                                                                                  *
+// Example:                                                                                         *
+//   using Temp    = payload::Field<11, 10, 400> ;     // -40.0 .. 164.7 degrees, 0.1 resolution    *
+//   using Counter = payload::Field<16> ;                                                           *
+//   using Report  = payload::Schema<Counter, Temp> ;  // 27 bits -> 4 bytes                        *
+//   uint8_t buf[Report::bytes] ;                                                                   *
+//   Report::encode ( buf, fcnt, 21.5f ) ;                                                          *
+//                                                                                                  *
+// Report::spec() writes a JSON description of the schema for the network side decoder             *
+// (see tools/codec/decode.py).                                                                     *
+//***************************************************************************************************
+#ifndef _PAYLOADCODEC_H_
+#define _PAYLOADCODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <type_traits>
+
+namespace payload
+{
+
+template <unsigned Bits, int32_t Scale = 1, int32_t Offset = 0>
+struct Field
+{
+  static_assert ( Bits >= 1 && Bits <= 32, "Field width must be 1..32 bits" ) ;
+  static_assert ( Scale >= 1, "Scale must be positive" ) ;
+
+  static constexpr unsigned bits   = Bits ;
+  static constexpr int32_t  scale  = Scale ;
+  static constexpr int32_t  offset = Offset ;
+  static constexpr int64_t  maxraw = ( (int64_t)1 << Bits ) - 1 ;
+
+  static uint32_t clamp ( int64_t r )
+  {
+    r = r < 0 ? 0 : r ;                                       // Saturate instead of wrapping
+    r = r > maxraw ? maxraw : r ;
+    return (uint32_t)r ;
+  }
+
+  template <typename T>
+  static uint32_t raw ( T v )
+  {
+    return raw ( v, std::is_floating_point<T>() ) ;
+  }
+
+  template <typename T>
+  static uint32_t raw ( T v, std::false_type )                // Integer input: exact
+  {
+    return clamp ( (int64_t)v * Scale + Offset ) ;
+  }
+
+  template <typename T>
+  static uint32_t raw ( T v, std::true_type )                 // Float input: rounded
+  {
+    float s = (float)v * Scale ;
+    return clamp ( (int64_t)( s < 0 ? s - 0.5f : s + 0.5f ) + Offset ) ;
+  }
+
+  static float value ( uint32_t r )
+  {
+    return (float)( (int64_t)r - Offset ) / Scale ;
+  }
+} ;
+
+
+namespace detail
+{
+  // Write the low n bits of v at bit position pos (MSB first).  buf must be zeroed.
+  inline void put ( uint8_t* buf, unsigned pos, unsigned n, uint32_t v )
+  {
+    while ( n )
+    {
+      unsigned room = 8 - ( pos & 7 ) ;                       // Free bits in this byte
+      unsigned take = n < room ? n : room ;
+      buf[pos >> 3] |= (uint8_t)( ( ( v >> ( n - take ) ) & ( ( 1u << take ) - 1 ) )
+                                  << ( room - take ) ) ;
+      pos += take ;
+      n   -= take ;
+    }
+  }
+
+  inline uint32_t get ( const uint8_t* buf, unsigned pos, unsigned n )
+  {
+    uint32_t v = 0 ;
+    while ( n )
+    {
+      unsigned room = 8 - ( pos & 7 ) ;
+      unsigned take = n < room ? n : room ;
+      v = ( v << take ) | ( ( buf[pos >> 3] >> ( room - take ) ) & ( ( 1u << take ) - 1 ) ) ;
+      pos += take ;
+      n   -= take ;
+    }
+    return v ;
+  }
+
+  template <typename... F> struct Sum ;
+  template <> struct Sum<> { static constexpr unsigned bits = 0 ; } ;
+  template <typename F, typename... R> struct Sum<F, R...>
+  {
+    static constexpr unsigned bits = F::bits + Sum<R...>::bits ;
+  } ;
+
+  // Encode fields recursively, bit positions are resolved at compile time
+  template <unsigned Pos, typename... F> struct Packer ;
+  template <unsigned Pos> struct Packer<Pos>
+  {
+    static void pack ( uint8_t* ) {}
+    static void unpack ( const uint8_t*, float* ) {}
+    static int  spec ( char*, size_t, const char* const*, bool ) { return 0 ; }
+  } ;
+  template <unsigned Pos, typename F, typename... R> struct Packer<Pos, F, R...>
+  {
+    template <typename V, typename... VR>
+    static void pack ( uint8_t* buf, V v, VR... rest )
+    {
+      put ( buf, Pos, F::bits, F::raw ( v ) ) ;
+      Packer<Pos + F::bits, R...>::pack ( buf, rest... ) ;
+    }
+
+    static void unpack ( const uint8_t* buf, float* out )
+    {
+      *out = F::value ( get ( buf, Pos, F::bits ) ) ;
+      Packer<Pos + F::bits, R...>::unpack ( buf, out + 1 ) ;
+    }
+
+    static int spec ( char* buf, size_t len, const char* const* names, bool first )
+    {
+      int n = snprintf ( buf, len, "%s{\"name\":\"%s\",\"bits\":%u,\"scale\":%ld,\"offset\":%ld}",
+                         first ? "" : ",", *names, F::bits, (long)F::scale, (long)F::offset ) ;
+      if ( n < 0 || (size_t)n >= len )
+      {
+        return -1 ;
+      }
+      int m = Packer<Pos + F::bits, R...>::spec ( buf + n, len - n, names + 1, false ) ;
+      return m < 0 ? -1 : n + m ;
+    }
+  } ;
+}
+
+
+template <typename... F>
+struct Schema
+{
+  static constexpr unsigned fields = sizeof... ( F ) ;
+  static constexpr unsigned bits   = detail::Sum<F...>::bits ;
+  static constexpr unsigned bytes  = ( bits + 7 ) / 8 ;
+
+  // Encode one value per field into buf (at least 'bytes' long).  Returns the length.
+  template <typename... V>
+  static uint8_t encode ( uint8_t* buf, V... values )
+  {
+    static_assert ( sizeof... ( V ) == sizeof... ( F ), "One value per field expected" ) ;
+    for ( unsigned i = 0 ; i < bytes ; i++ )
+    {
+      buf[i] = 0 ;
+    }
+    detail::Packer<0, F...>::pack ( buf, values... ) ;
+    return bytes ;
+  }
+
+  // Decode into out[fields].
+  static void decode ( const uint8_t* buf, float* out )
+  {
+    detail::Packer<0, F...>::unpack ( buf, out ) ;
+  }
+
+  // JSON description for the network side, names[fields] are the field names.
+  // Returns the length of the string or -1 if buf is too small.
+  static int spec ( char* buf, size_t len, const char* const* names )
+  {
+    int n = snprintf ( buf, len, "{\"bytes\":%u,\"fields\":[", bytes ) ;
+    if ( n < 0 || (size_t)n >= len )
+    {
+      return -1 ;
+    }
+    int m = detail::Packer<0, F...>::spec ( buf + n, len - n, names, true ) ;
+    if ( m < 0 || (size_t)( n + m + 2 ) >= len )
+    {
+      return -1 ;
+    }
+    buf[n + m]     = ']' ;
+    buf[n + m + 1] = '}' ;
+    buf[n + m + 2] = '\0' ;
+    return n + m + 2 ;
+  }
+} ;
+
+} // namespace payload
+
+#endif // _PAYLOADCODEC_H_
@@ -0,0 +1,136 @@
+//***************************************************************************************************
+// ReportFilter.h                                                                                   *
+//***************************************************************************************************
+// Report by exception.  Every interval the application passes its readings (scaled integers, one   *
+// per channel) to check(), which tells if an uplink is due:                                        *
+//                                                                                                  *
+//   REPORT_CHANGE     a reading left the dead band around the last acknowledged report, or there   *
+//                     is no acknowledged report yet.  Send it confirmed.                           *
+//   REPORT_HEARTBEAT  nothing changed, but maxSilence intervals passed without an uplink.          *
+//   REPORT_NONE       skip the uplink: no frame counter, no RX windows, no airtime.                *
+//                                                                                                  *
+// After the uplink, sent() is called with the ACK flag.  The reference only moves to the values    *
+// of an acknowledged change report, so a lost report is sent again in the next interval.  The      *
+// network's last confirmed values are thus never further than the dead band from the readings      *
+// for longer than the link fails, and it hears from the device at least every maxSilence           *
+// intervals.                                                                                       *
+//                                                                                                  *
+// The state is "words" 32 bit words, meant for RTC backup registers across deep sleep.  All zero   *
+// (power loss) restores as "no report yet":                                                        *
+//                                                                                                  *
+//   const int32_t deadband[2] = { 1, 5 } ;                  // 1 degC, 50 mV                       *
+//   payload::ReportFilter<2> filter ( deadband, 6 ) ;       // Heartbeat after 6 intervals         *
+//   filter.restore ( words ) ;                                                                     *
+//   switch ( filter.check ( values ) ) ...                                                         *
+//   filter.sent ( LMIC.txrxFlags & TXRX_ACK ) ;             // At EV_TXCOMPLETE                    *
+//   filter.save ( words ) ;                                 // Before deep sleep                   *
+//                                                                                                  *
+// Simulation on sensor traces: tools/sim/report.py.                                                *
+//***************************************************************************************************
+#ifndef _REPORTFILTER_H_
+#define _REPORTFILTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace payload
+{
+
+enum { REPORT_NONE, REPORT_CHANGE, REPORT_HEARTBEAT } ;
+
+template <uint8_t Channels>
+class ReportFilter
+{
+  static_assert ( Channels >= 1 && Channels <= 15, "1..15 channels supported" ) ;
+
+  static constexpr uint32_t MAGIC = 0x5246 ;              // "RF" in the high half of word 0
+
+public:
+  static constexpr uint8_t words = Channels + 1 ;         // Size of the saved state
+
+  ReportFilter ( const int32_t* deadband, uint16_t maxSilence ) :
+    deadband_ ( deadband ), maxSilence_ ( maxSilence ? maxSilence : 1 )
+  {
+    valid_  = false ;
+    silent_ = 0 ;
+    due_    = REPORT_NONE ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      ref_[c] = pend_[c] = 0 ;
+    }
+  }
+
+  // Decide on the uplink of this interval.  Call once per interval.
+  uint8_t check ( const int32_t* values )
+  {
+    due_ = REPORT_NONE ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      pend_[c] = values[c] ;
+      int64_t d = (int64_t)values[c] - ref_[c] ;
+      if ( ! valid_ || d > deadband_[c] || d < -deadband_[c] )
+      {
+        due_ = REPORT_CHANGE ;
+      }
+    }
+    if ( due_ == REPORT_NONE && silent_ + 1 >= maxSilence_ )
+    {
+      due_ = REPORT_HEARTBEAT ;
+    }
+    if ( due_ == REPORT_NONE )
+    {
+      silent_++ ;
+    }
+    return due_ ;
+  }
+
+  // The uplink of the last check() went out.  acked: the network confirmed it, or the report is
+  // kept for a later delivery (backlog).
+  void sent ( bool acked )
+  {
+    silent_ = 0 ;
+    if ( due_ == REPORT_CHANGE && acked )
+    {
+      for ( uint8_t c = 0 ; c < Channels ; c++ )
+      {
+        ref_[c] = pend_[c] ;
+      }
+      valid_ = true ;
+    }
+    due_ = REPORT_NONE ;
+  }
+
+  uint16_t silent() const { return silent_ ; }            // Intervals since the last uplink
+
+  void save ( uint32_t* w ) const
+  {
+    w[0] = valid_ ? ( MAGIC << 16 ) | silent_ : silent_ ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      w[1 + c] = (uint32_t)ref_[c] ;
+    }
+  }
+
+  void restore ( const uint32_t* w )
+  {
+    valid_  = ( w[0] >> 16 ) == MAGIC ;
+    silent_ = (uint16_t)w[0] ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      ref_[c] = (int32_t)w[1 + c] ;
+    }
+  }
+
+private:
+  const int32_t* deadband_ ;
+  uint16_t       maxSilence_ ;
+  bool           valid_ ;                                 // ref_ holds an acknowledged report
+  uint16_t       silent_ ;
+  uint8_t        due_ ;                                   // Outcome of the last check()
+  int32_t        ref_[Channels] ;                         // Last acknowledged report
+  int32_t        pend_[Channels] ;                        // Readings of the last check()
+} ;
+
+} // namespace payload
+
+#endif // _REPORTFILTER_H_
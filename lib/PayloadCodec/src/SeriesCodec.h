@@ -0,0 +1,185 @@
+//***************************************************************************************************
+// SeriesCodec.h                                                                                    *
+//***************************************************************************************************
+// Compression of batched sensor readings: delta + zigzag + varint.                                 *
+// A reading is a record of Channels integer values (use scaled integers, e.g. 0.1 degC units).     *
+// Every frame is decodable on its own, so a lost uplink only loses its own readings:               *
+//                                                                                                  *
+//   byte 0      : number of channels                                                               *
+//   per record  : per channel zigzag varint of the difference with the previous record             *
+//                 (the first record of a frame is relative to 0)                                   *
+//                                                                                                  *
+// The encoder writes into the caller's buffer and never exceeds the given capacity, so frames      *
+// can be filled up to LMIC_maxAppPayload() exactly:                                                *
+//                                                                                                  *
+//   uint8_t buf[MAX_LEN_PAYLOAD] ;                                                                 *
+//   payload::SeriesEncoder<2> enc ( buf, LMIC_maxAppPayload() ) ;                                  *
+//   if ( ! enc.add ( values ) )                     // Frame full?                                 *
+//   {                                                                                              *
+//     LMIC_setTxData2 ( port, buf, enc.length(), 0 ) ;                                             *
+//     enc.reset ( LMIC_maxAppPayload() ) ;          // Data rate may have changed                  *
+//     enc.add ( values ) ;                                                                         *
+//   }                                                                                              *
+//                                                                                                  *
+// Reference decoder: tools/codec/series.py.                                                        *
+//***************************************************************************************************
+#ifndef _SERIESCODEC_H_
+#define _SERIESCODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace payload
+{
+
+inline uint32_t zigzag ( int32_t v )
+{
+  return ( (uint32_t)v << 1 ) ^ (uint32_t)( v >> 31 ) ;
+}
+
+
+inline int32_t unzigzag ( uint32_t v )
+{
+  return (int32_t)( v >> 1 ) ^ -(int32_t)( v & 1 ) ;
+}
+
+
+inline uint8_t varint_len ( uint32_t v )
+{
+  uint8_t n = 1 ;
+  while ( v >= 0x80 )
+  {
+    v >>= 7 ;
+    n++ ;
+  }
+  return n ;
+}
+
+
+inline uint8_t* varint_put ( uint8_t* p, uint32_t v )
+{
+  while ( v >= 0x80 )
+  {
+    *p++ = (uint8_t)( v | 0x80 ) ;
+    v >>= 7 ;
+  }
+  *p++ = (uint8_t)v ;
+  return p ;
+}
+
+
+// Returns NULL if the varint runs past end.
+inline const uint8_t* varint_get ( const uint8_t* p, const uint8_t* end, uint32_t* v )
+{
+  uint32_t r = 0 ;
+  for ( uint8_t shift = 0 ; p < end && shift < 35 ; shift += 7 )
+  {
+    uint8_t b = *p++ ;
+    r |= (uint32_t)( b & 0x7F ) << shift ;
+    if ( ( b & 0x80 ) == 0 )
+    {
+      *v = r ;
+      return p ;
+    }
+  }
+  return NULL ;
+}
+
+
+template <uint8_t Channels>
+class SeriesEncoder
+{
+  static_assert ( Channels >= 1 && Channels <= 15, "1..15 channels supported" ) ;
+
+public:
+  SeriesEncoder ( uint8_t* buf, uint8_t capacity ) : buf_ ( buf )
+  {
+    reset ( capacity ) ;
+  }
+
+  // Start a new frame, capacity is normally LMIC_maxAppPayload() for the current data rate.
+  void reset ( uint8_t capacity )
+  {
+    cap_    = capacity ;
+    len_    = 1 ;
+    count_  = 0 ;
+    buf_[0] = Channels ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      prev_[c] = 0 ;
+    }
+  }
+
+  // Append one record.  Returns false (and leaves the frame unchanged) if it does not fit.
+  bool add ( const int32_t* values )
+  {
+    uint32_t z[Channels] ;
+    uint16_t need = 0 ;
+
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      z[c]  = zigzag ( (int32_t)( (uint32_t)values[c] - (uint32_t)prev_[c] ) ) ;
+      need += varint_len ( z[c] ) ;
+    }
+    if ( len_ + need > cap_ )
+    {
+      return false ;
+    }
+    uint8_t* p = buf_ + len_ ;
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      p = varint_put ( p, z[c] ) ;
+      prev_[c] = values[c] ;
+    }
+    len_ = (uint8_t)( p - buf_ ) ;
+    count_++ ;
+    return true ;
+  }
+
+  uint8_t length() const { return count_ ? len_ : 0 ; }   // Bytes to send, 0 if empty
+  uint8_t count() const  { return count_ ; }              // Records in this frame
+
+private:
+  uint8_t* buf_ ;
+  uint8_t  cap_ ;
+  uint8_t  len_ ;
+  uint8_t  count_ ;
+  int32_t  prev_[Channels] ;
+} ;
+
+
+// Decode a frame into out[maxrec][Channels].  Returns the number of records, -1 if malformed.
+template <uint8_t Channels>
+int series_decode ( const uint8_t* buf, uint8_t len, int32_t ( *out )[Channels], int maxrec )
+{
+  const uint8_t* end = buf + len ;
+  int32_t        prev[Channels] = { 0 } ;
+  int            n = 0 ;
+
+  if ( len < 1 || buf[0] != Channels )
+  {
+    return -1 ;
+  }
+  for ( const uint8_t* p = buf + 1 ; p < end ; n++ )
+  {
+    if ( n >= maxrec )
+    {
+      return -1 ;
+    }
+    for ( uint8_t c = 0 ; c < Channels ; c++ )
+    {
+      uint32_t z ;
+      if ( ( p = varint_get ( p, end, &z ) ) == NULL )
+      {
+        return -1 ;
+      }
+      prev[c]   = (int32_t)( (uint32_t)prev[c] + (uint32_t)unzigzag ( z ) ) ;
+      out[n][c] = prev[c] ;
+    }
+  }
+  return n ;
+}
+
+} // namespace payload
+
+#endif // _SERIESCODEC_H_
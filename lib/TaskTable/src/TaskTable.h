@@ -0,0 +1,148 @@
+//***************************************************************************************************
+// TaskTable.h                                                                                      *
+//***************************************************************************************************
+// Periodic tasks across deep sleep.  The device shuts down between wakeups, so the table of next   *
+// due times is saved in RTC backup registers before the sleep and restored after the reset:        *
+//                                                                                                  *
+//   const sched::Task list[2] = { { 1, 120, 30 },           // id, period and slack in seconds     *
+//                                 { 2, 600, 0 } } ;                                                *
+//   sched::TaskTable<2> table ( list ) ;                                                           *
+//   table.restore ( words, now ) ;                          // After the reset                     *
+//   due = table.due ( now ) ;                               // Bit i: task i runs in this wakeup   *
+//   table.done ( i, now ) ;                                 // For every task run                  *
+//   table.save ( words ) ;                                                                         *
+//   sleep ( table.next ( now ) ) ;                          // Until the earliest due time         *
+//                                                                                                  *
+// A task may run up to its slack early, so tasks due close together share one wakeup.  The next    *
+// due time is one period after the due time, not after the run, so early or late runs do not       *
+// shift the phase, and periods missed (long wakeup, RTC set forward) are skipped.  After a power   *
+// loss all tasks are due at once.  A due time more than a period and the slack ahead (RTC set      *
+// back, a run up to the slack early puts it a period after the due time) is taken as now.          *
+//                                                                                                  *
+// The state is "words" 32 bit words: a header with a check of the task ids and periods, then the   *
+// due time per task.  A table saved with other tasks or periods (firmware update) restores as all  *
+// due.  Times are seconds of any clock that goes on during the sleep (RTC epoch).  Simulation of   *
+// the wakeups: tools/sim/sched.py.                                                                 *
+//***************************************************************************************************
+#ifndef _TASKTABLE_H_
+#define _TASKTABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace sched
+{
+
+struct Task
+{
+  uint8_t  id ;                                           // Identifies the task in the saved header
+  uint32_t period ;                                       // Seconds
+  uint32_t slack ;                                        // May run this many seconds early
+} ;
+
+template <uint8_t N>
+class TaskTable
+{
+  static_assert ( N >= 1 && N <= 32, "1..32 tasks supported" ) ;
+
+  static constexpr uint32_t MAGIC = 0x5453 ;              // "TS" in the high half of word 0
+
+public:
+  static constexpr uint8_t words = 1 + N ;                // Size of the saved state
+
+  TaskTable ( const Task* tasks ) : tasks_ ( tasks )
+  {
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      due_[i] = 0 ;
+    }
+  }
+
+  void restore ( const uint32_t* w, uint32_t now )
+  {
+    bool valid = w[0] == header() ;
+
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      due_[i] = now ;
+      if ( valid && (int32_t)( w[1 + i] - now ) <= (int32_t)( tasks_[i].period + tasks_[i].slack ) )
+      {
+        due_[i] = w[1 + i] ;
+      }
+    }
+  }
+
+  void save ( uint32_t* w ) const
+  {
+    w[0] = header() ;
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      w[1 + i] = due_[i] ;
+    }
+  }
+
+  // Tasks to run now: bit i is set if task i is due within its slack.
+  uint32_t due ( uint32_t now ) const
+  {
+    uint32_t mask = 0 ;
+
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      if ( (int32_t)( due_[i] - now ) <= (int32_t)tasks_[i].slack )
+      {
+        mask |= (uint32_t)1 << i ;
+      }
+    }
+    return mask ;
+  }
+
+  // Task i has run, it is due again one period after its due time.
+  void done ( uint8_t i, uint32_t now )
+  {
+    uint32_t p    = tasks_[i].period ;
+    int32_t  late = (int32_t)( now - due_[i] ) ;
+
+    due_[i] += ( late > 0 ? (uint32_t)late / p + 1 : 1 ) * p ;
+  }
+
+  // Move the due time of task i, e.g. to a TX time within the period.
+  void set ( uint8_t i, uint32_t at )
+  {
+    due_[i] = at ;
+  }
+
+  uint32_t dueAt ( uint8_t i ) const { return due_[i] ; }
+
+  // Seconds until the earliest due time, 0 if a task is due.
+  uint32_t next ( uint32_t now ) const
+  {
+    int32_t wait = INT32_MAX ;
+
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      int32_t d = (int32_t)( due_[i] - now ) ;
+      wait = d < wait ? d : wait ;
+    }
+    return wait > 0 ? (uint32_t)wait : 0 ;
+  }
+
+private:
+  uint32_t header() const                                 // MAGIC and a check of the task list
+  {
+    uint32_t h = N ;
+
+    for ( uint8_t i = 0 ; i < N ; i++ )
+    {
+      h = h * 31 + tasks_[i].id ;
+      h = h * 31 + tasks_[i].period ;
+    }
+    return ( MAGIC << 16 ) | ( ( h ^ ( h >> 16 ) ) & 0xFFFF ) ;
+  }
+
+  const Task* tasks_ ;
+  uint32_t    due_[N] ;                                   // Next due time per task
+} ;
+
+} // namespace sched
+
+#endif // _TASKTABLE_H_
@@ -7,9 +7,9 @@
 
 // Configuraton end device
 int           JoinMode = JOINMODE_OTAA ;                        // Select join mode for this device
-int           LoraBand = REGION_EU868 ;                         // LoRa band used for this device
+int           LoraBand = REGION_EU868 ;                         // LoRa band, unless set at provisioning
 
-//For OTAA:
+//For OTAA, only used on a device without a provisioning record (see tools/perso):
 uint8_t       JoinEui[] = { 0x12, 0x15, 0x18, 0x78, 0x66, 0x13, 0xA2, 0x11 } ;
 uint8_t       AppKey[]  = { 0x36, 0x9C, 0x9E, 0x8C, 0x5D, 0x68, 0x61, 0x3E,
                             0xD9, 0xB9, 0xDD, 0x55, 0x43, 0x7A, 0xA9, 0x70 } ;
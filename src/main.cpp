@@ -25,8 +25,14 @@
 #include <lmic.h>
 #include <STM32RTC.h>
 #include <STM32LowPower.h>
+#ifndef CFG_persist
 #include <EEPROM.h>                                       // Access to simulated EEPROM in Flash
+#endif
 #include <SPI.h>                                          // Needed for correct compilation
+#include <PayloadCodec.h>                                 // Compact binary payloads
+#include <ReportFilter.h>                                 // Report by exception
+#include <TaskTable.h>                                    // Periodic tasks across deep sleep
+#include "stm32yyxx_ll_adc.h"                             // Internal temperature and Vref
 
 //***************************************************************************************************
 // Configuration of end device.
@@ -43,12 +49,93 @@
 #define BKP_R_DATAVALID  RTC_BKP_DR10                     // Position of data valid register
 #define BKP_R_FCNT       RTC_BKP_DR11                     // Position of uplink frame counter
 #define BKP_R_XMITCNT    RTC_BKP_DR12                     // Count number of transmits for rejoin
+#define BKP_R_GPSTIME    RTC_BKP_DR13                     // GPS time of last clock sync, 0 = never
+#define BKP_R_BUDGET     RTC_BKP_DR14                     // Airtime ledger, 5 registers (DR14..DR18)
+#define BKP_R_REPORT     RTC_BKP_DR2                      // Report filter, 3 registers (DR2..DR4)
+#define BKP_R_TASKS      RTC_BKP_DR5                      // Task table, 3 registers (DR5..DR7)
+#define BKP_R_PEAK       RTC_BKP_DR8                      // Peak readings since the last report
+// DR9 and DR19 hold the firmware update pointer (hal_set_update), DR0 and DR1 are left to the core.
 
 #define REJOIN_LIMIT     300                              // Rejoin after this number of transmits
 
+#define DIAG_PORT        2                                // Port for energy diagnostic uplinks
+#define DIAG_INTERVAL    144                              // Send diagnostics after every 144 uplinks
+#define BATTERY_MAH      2600                             // Battery capacity for life projection
+#define SLEEP_UA         4000                             // Current in shutdown mode (USB chip!)
+#define WAKE_UC          500                              // Charge of a wakeup besides the uplink
+
+#define FUOTA_AREA       0x08020000                       // Flash for received data blocks (110 kB)
+#define FUOTA_AREA_SIZE  0x1B800                          // Next page is PERSODATA_FLASH
+#define FUOTA_POLL_SEC   30                               // Uplink interval during a FUOTA session
+
+#define BACKLOG_AREA     0x0803C000                       // Flash ring for reports not delivered
+#define BACKLOG_AREA_SIZE 0x3000                          // 6 pages
+#define BACKLOG_PORT     3                                // Port for packed stored reports
+#define BACKLOG_FRAMES   8                                // Max catch-up frames per wakeup
+#define BACKLOG_WAIT_MS  5000                             // Max wait for the duty cycle between them
+
+#define CONFIG_AREA      0x0803F000                       // Flash for the config, 2 pages
+#define CONFIG_AREA_SIZE 0x1000
+#define CONFIG_VERSION   1                                // Layout of eepromdata_t
+#define EEPROM_AREA      0x0803F800                       // EEPROM emulation before CFG_persist
+
+#define TIMESYNC_SEC     86400                            // Resynchronize the RTC once a day
+
+#define AIRTIME_MS       30000                            // Airtime budget per 24 hours (TTN fair use)
+
+#define DRAIN_POLLS      8                                // Max polls for pending downlinks per wakeup
+#define DRAIN_UC         500000                           // Max charge of uplink plus polls (0.5 C)
+
+// Retry policy for confirmed uplinks: at most 6 attempts, one DR lower after every 2nd, not below
+// DR2 (SF10), backoff doubling up to 3*2^3 sec, 2 sec airtime and 60 sec in total.
+const txpolicy_t   txPolicy = { 6, 2, 2, 3, ms2osticks ( 2000 ), sec2osticks ( 60 ) } ;
+
+#define TXSLOT_MS        0                                // TX time grid within the interval, 0 = any ms
+#define TXSLOT_WAKE_MS   5000                             // Wake up this long before the TX time
+#define TXSLOT_LATE_MS   3000                             // Still send if the TX time passed this long ago
+
+#define DRFIT_MAX        EU868_DR_SF7                     // Fastest DR for frames too large for the ADR DR
+#define DRFIT_RSV_DB     6                                // Link check margin kept in reserve
+
+#define REPORT_SILENCE   6                                // Heartbeat after 6 intervals without uplink
+
+// Dead bands of the report channels: temperature 1 degC, supply voltage 50 mV.  Readings within
+// them from the last acknowledged report are not sent.
+const int32_t      reportDeadband[] = { 1, 5 } ;
+
+#define SAMPLE_SEC       120                              // Sample temperature and Vdd every 2 minutes
+#define TASK_SLACK_SEC   60                               // A task may run this early to share a wakeup
+#ifdef CFG_txslot
+#define REPORT_SLACK_SEC 0                                // Report at the TX time of the interval
+#else
+#define REPORT_SLACK_SEC TASK_SLACK_SEC
+#endif
+
+// Periodic tasks: id, period and slack in seconds.  Sampling wakes up without LMIC, the report runs
+// the uplink.
+enum { TASK_SAMPLE, TASK_REPORT, TASK_COUNT } ;
+const sched::Task  taskList[TASK_COUNT] = { { 1, SAMPLE_SEC, TASK_SLACK_SEC },
+                                            { 2, tx_interval_sec, REPORT_SLACK_SEC } } ;
+
+//#define CLASSB_PINGEXP   3                              // Class B, ping slot every 2^n sec, no deep sleep
+#if defined(CLASSB_PINGEXP) && defined(DISABLE_CLASSB)
+#error "CLASSB_PINGEXP needs class B, remove DISABLE_CLASSB in target-config.h"
+#endif
+
+//#define DISABLE_DBGPRINT                                // Strip dbgprint() and all its strings from flash
 #define DEBUG_BUFFER_SIZE 150                             // Max line length for debugging
 
-// Data kept in EEPROM
+// Layout of the uplink packet: low 16 bits of the frame counter, projected battery life, MCU
+// temperature and supply voltage.
+using CounterField = payload::Field<16> ;                 // Frame counter, modulo 65536
+using LifeField    = payload::Field<12> ;                 // Battery life in days, max 4095
+using TempField    = payload::Field<8, 1, 40> ;           // Temperature in degC, -40..215
+using VddField     = payload::Field<8, 1, -150> ;         // Supply voltage in 10 mV, 1.50..4.05 V
+using TestPayload  = payload::Schema<CounterField, LifeField, TempField, VddField> ;
+const char* const  testPayloadNames[] = { "fcnt", "life_days", "temp_c", "vdd_10mv" } ;
+
+// Data kept in EEPROM.  With CFG_persist a change of this layout needs a new CONFIG_VERSION and a
+// case in readEEPROMdata() that converts the old one; fields added at the end read as 0.
 struct eepromdata_t
 {
   uint32_t datavalid ;                                    // Code for valid data
@@ -67,9 +154,31 @@ static osjob_t    sendjob ;                               // Handle for send_pac
 eepromdata_t      eepromdata ;                            // Data to and from EEPROM
 STM32RTC&         rtc = STM32RTC::getInstance() ;         // Object for RTC clock (and RTC data)
 bool              tx_finished = false ;                   // True if send finished
+bool              diag_sent = false ;                     // True if diagnostics sent in this wakeup
+bool              report_sent = false ;                   // True if the report frame is under way
+payload::ReportFilter<2> reportFilter ( reportDeadband,   // Decides if a report is due
+                                        REPORT_SILENCE ) ;
+sched::TaskTable<TASK_COUNT> taskTable ( taskList ) ;     // Next due times of the tasks
+#ifdef CFG_backlog
+uint8_t           report_payload[TestPayload::bytes] ;    // Last report, stored if not delivered
+uint32_t          report_time ;                           // RTC time of the last report
+bool              backlog_sent = false ;                  // True if a backlog frame is under way
+bool              backlog_ok = true ;                     // False after an uplink without ACK
+int               backlog_frames = 0 ;                    // Backlog frames sent in this wakeup
+#endif
 int32_t           xmitcount ;                             // Transmitcount from BKP register
 bool              DEBUG = true ;                          // Allow debug using dbgprint()
-#ifndef evnames                                           // Depends on lmic CFG_DEBUG
+#if defined(CFG_fuota) || defined(CFG_mcast) || defined(CFG_timesync)
+u1_t              pkg_ans[16] ;                           // Answers to package commands
+int               pkg_anslen = 0 ;                        // Length of answers to send
+u1_t              pkg_port ;                              // Port to send the answers on
+#endif
+#ifdef CFG_fuota
+static osjob_t    pkgjob ;                                // Handle for pkg_due
+u4_t              pkg_delay = 0 ;                         // Delay of the answers (sec)
+bool              pkg_wait = false ;                      // True while the answers are delayed
+#endif
+#if !defined(evnames) && !defined(DISABLE_DBGPRINT)       // Depends on lmic CFG_DEBUG
   const char* evnames[] =
         {
           "??", "SCAN_TIMEOUT", "BEACON_FOUND", "BEACON_MISSED", "BEACON_TRACKED",
@@ -88,8 +197,11 @@ char* get_rtc_time() ;                                    // Get current time
 //                                          D B G P R I N T                                        *
 //**************************************************************************************************
 // Send a line of info to serial output.  Works like vsprintf(), but checks the DEBUG flag.        *
-// Print only if DEBUG flag is true.                                                               *
+// Print only if DEBUG flag is true.  DISABLE_DBGPRINT removes the calls and their strings.        *
 //**************************************************************************************************
+#ifdef DISABLE_DBGPRINT
+#define dbgprint(...)  do { } while ( 0 )
+#else
 void dbgprint ( const char* format, ... )
 {
   static char sbuf[DEBUG_BUFFER_SIZE] ;                // For debug lines
@@ -105,15 +217,23 @@ void dbgprint ( const char* format, ... )
     Serial.println ( sbuf ) ;                          // and the info
   }
 }
+#endif
 
 
 //***************************************************************************************************
 //                            C A L L B A C K S   F O R   O T A A                                   *
 //***************************************************************************************************
-// These callbacks are only used in over-the-air activation, not for ABP.                           *
+// These callbacks are only used in over-the-air activation, not for ABP.  The EUIs and the key     *
+// come from the provisioning record written at production (tools/perso), the values compiled in   *
+// from LoRa_Device_01.h are only used on a device without one.                                     *
 //***************************************************************************************************
 void os_getJoinEui (u1_t* buf)
 {
+  if ( hal_joineui() )                                      // Provisioned?
+  {
+    memcpy ( buf, hal_joineui(), 8 ) ;                      // Yes, already little endian
+    return ;
+  }
   for ( int i = 0 ; i < 8 ; i++ )
   {
     buf [i] = JoinEui[7 - i] ;
@@ -123,6 +243,11 @@ void os_getJoinEui (u1_t* buf)
 // This should also be in little endian format, see above.
 void os_getDevEui (u1_t* buf)
 {
+  if ( hal_deveui() )                                       // Provisioned?
+  {
+    memcpy ( buf, hal_deveui(), 8 ) ;                       // Yes, from the record or the UID
+    return ;
+  }
   for ( int i = 0 ; i < 8 ; i++ )
   {
     {
@@ -137,7 +262,7 @@ void os_getDevEui (u1_t* buf)
 // The key shown here is the semtech default key.
 void os_getNwkKey (u1_t* buf)
 {
-  memcpy ( buf, AppKey, 16 ) ;
+  memcpy ( buf, hal_nwkkey() ? hal_nwkkey() : AppKey, 16 ) ;
 }
 
 
@@ -148,18 +273,31 @@ u1_t os_getRegion()
 }
 
 
-//**************************************************************************************************
-//                                R E A D E E P R O M D A T A                                      *
-//**************************************************************************************************
-// Read EEPROM data.                                                                               *
-//**************************************************************************************************
-void readEEPROMdata()
+//***************************************************************************************************
+//                                S H O W _ P R O V I S I O N I N G                                 *
+//***************************************************************************************************
+// Show the identity of the device and take the region from the provisioning record, if any.        *
+//***************************************************************************************************
+void show_provisioning()
 {
-  uint8_t* p = (uint8_t*)&eepromdata ;                      // Set pointer to destination
+  char        eui[20] ;
+  u1_t        buf[8] ;
 
-  for ( int i = 0 ; i < sizeof(eepromdata_t) ; i++ )        // Fill destination
+  os_getDevEui ( buf ) ;
+  for ( int i = 0 ; i < 8 ; i++ )                           // Show MSB first, as registered
   {
-    *p++ = EEPROM.read ( i ) ;                              // Copy one byte
+    sprintf ( eui + i * 2, "%02X", buf[7 - i] ) ;
+  }
+  if ( hal_serial() == nullptr )                            // Provisioned at production?
+  {
+    dbgprint ( "Not provisioned, DevEUI %s compiled in", eui ) ;
+    return ;
+  }
+  dbgprint ( "Serial %.16s, hwid %d, DevEUI %s",            // Yes, show it
+             hal_serial(), hal_hwid(), eui ) ;
+  if ( hal_region() && LMIC_regionIdx ( hal_region() ) >= 0 )
+  {
+    LoraBand = LMIC_regionIdx ( hal_region() ) ;            // Region set at production
   }
 }
 
@@ -167,8 +305,18 @@ void readEEPROMdata()
 //**************************************************************************************************
 //                                S A V E E E P R O M D A T A                                      *
 //**************************************************************************************************
-// Save EEPROM data.                                                                               *
+// Save EEPROM data.  With CFG_persist the block is committed after the last one in flash, which    *
+// stays valid until the new one is written completely.                                            *
 //**************************************************************************************************
+#ifdef CFG_persist
+void saveEEPROMdata()
+{
+  if ( ! LMIC_persistWrite ( &eepromdata, sizeof(eepromdata_t), CONFIG_VERSION ) )
+  {
+    dbgprint ( "Flash config write failed" ) ;
+  }
+}
+#else
 void saveEEPROMdata()
 {
   uint8_t* p = (uint8_t*)&eepromdata ;                      // Set pointer to source
@@ -178,6 +326,49 @@ void saveEEPROMdata()
     EEPROM.update ( i, *p++ ) ;                             // Copy one byte
   }
 }
+#endif
+
+
+//**************************************************************************************************
+//                                R E A D E E P R O M D A T A                                      *
+//**************************************************************************************************
+// Read EEPROM data.  With CFG_persist this is the last block committed to flash, validated by its  *
+// CRC.  The first time, the data is taken over from the EEPROM emulation page of the older         *
+// firmware.  Returns false if there is no valid data.                                             *
+//**************************************************************************************************
+#ifdef CFG_persist
+bool readEEPROMdata()
+{
+  switch ( LMIC_persistRead ( &eepromdata, sizeof(eepromdata_t) ) )
+  {
+    case CONFIG_VERSION :                                   // Current layout
+      return eepromdata.datavalid == DATAVALID ;
+    case 0 :                                                // Nothing committed yet
+      memcpy ( &eepromdata, (const void*)EEPROM_AREA,       // Same layout in the EEPROM page
+               sizeof(eepromdata_t) ) ;
+      if ( eepromdata.datavalid != DATAVALID )
+      {
+        return false ;
+      }
+      dbgprint ( "EEPROM data taken over into flash config" ) ;
+      saveEEPROMdata() ;
+      return true ;
+  }
+  return false ;                                            // Layout of another firmware
+}
+#else
+bool readEEPROMdata()
+{
+  uint8_t* p = (uint8_t*)&eepromdata ;                      // Set pointer to destination
+
+  EEPROM.begin() ;                                          // Enable EEPROM access
+  for ( int i = 0 ; i < sizeof(eepromdata_t) ; i++ )        // Fill destination
+  {
+    *p++ = EEPROM.read ( i ) ;                              // Copy one byte
+  }
+  return eepromdata.datavalid == DATAVALID ;
+}
+#endif
 
 
 //***************************************************************************************************
@@ -218,6 +409,110 @@ void showOTAAkeys()
 }
 
 
+//***************************************************************************************************
+//                                H A N D L E _ D O W N L I N K                                     *
+//***************************************************************************************************
+// Show a received payload and pass it to the package on its port.  Answers are sent by the main    *
+// loop.                                                                                            *
+//***************************************************************************************************
+void handle_downlink()
+{
+  u1_t  port ;                                            // Port of the downlink
+
+  if ( LMIC.dataLen == 0 )                                // Any payload?
+  {
+    return ;                                              // No, nothing to do
+  }
+  dbgprint ( "Received %d bytes of payload",
+             LMIC.dataLen ) ;
+  if ( ! ( LMIC.txrxFlags & TXRX_PORT ) )                 // Port present?
+  {
+    return ;
+  }
+  port = LMIC.frame[LMIC.dataBeg - 1] ;
+#ifdef CFG_fuota
+  if ( port == FUOTA_PORT )                               // Fragmentation package?
+  {
+    u4_t addr  = os_rlsbf4 ( &LMIC.frame[OFF_DAT_ADDR] ) ;
+    int  group = -1 ;                                     // Received by unicast
+#if MAX_MULTICAST_SESSIONS > 0
+    for ( int s = 0 ; s < MAX_MULTICAST_SESSIONS ; s++ )  // Or by one of the multicast groups?
+    {
+      if ( addr != LMIC.devaddr && LMIC.sessions[s].grpaddr == addr )
+      {
+        group = s ;                                       // Yes, McGroupID is the session index
+      }
+    }
+#endif
+    pkg_anslen = LMIC_fuotaRx ( LMIC.frame + LMIC.dataBeg,
+                                LMIC.dataLen, group,
+                                pkg_ans, sizeof(pkg_ans) ) ;
+    pkg_port = port ;
+    pkg_delay = 0 ;
+    if ( pkg_anslen && addr != LMIC.devaddr )             // Answer to a multicast command?
+    {
+      pkg_delay = LMIC_fuotaAnsDelay_sec() ;              // Yes, spread the answers of the group
+    }
+  }
+#endif
+#ifdef CFG_mcast
+  if ( port == MCAST_PORT )                               // Multicast setup package?
+  {
+    pkg_anslen = LMIC_mcastRx ( LMIC.frame + LMIC.dataBeg,
+                                LMIC.dataLen,
+                                pkg_ans, sizeof(pkg_ans) ) ;
+    pkg_port = port ;
+  }
+#endif
+#ifdef CFG_timesync
+  if ( port == CLOCKSYNC_PORT )                           // Clock synchronization package?
+  {
+    pkg_anslen = LMIC_clockSyncRx ( LMIC.frame + LMIC.dataBeg,
+                                    LMIC.dataLen,
+                                    pkg_ans, sizeof(pkg_ans) ) ;
+    pkg_port = port ;
+  }
+#endif
+  (void)port ;                                            // Unused without packages
+}
+
+
+//***************************************************************************************************
+//                                P K G _ D U E                                                     *
+//***************************************************************************************************
+// The random delay (BlockAckDelay) of the answers to a multicast FUOTA command is over.  With a     *
+// transmission under way, the answers go after it (EV_TXCOMPLETE).                                 *
+//***************************************************************************************************
+#ifdef CFG_fuota
+void pkg_due ( osjob_t* job )
+{
+  pkg_wait = false ;
+  if ( ! ( LMIC.opmode & ( OP_TXDATA | OP_TXRXPEND ) ) )  // Radio free?
+  {
+    tx_finished = true ;                                  // Yes, let main loop send the answers
+  }
+}
+#endif
+
+
+//***************************************************************************************************
+//                                B A C K L O G _ S T O R E                                         *
+//***************************************************************************************************
+// Keep the last report in the flash ring buffer, it was not delivered.  True if it was stored.     *
+//***************************************************************************************************
+#ifdef CFG_backlog
+bool backlog_store()
+{
+  if ( LMIC_backlogPut ( report_time, report_payload, sizeof(report_payload) ) )
+  {
+    dbgprint ( "Report stored, %d in backlog", LMIC_backlogCount() ) ;
+    return true ;
+  }
+  return false ;
+}
+#endif
+
+
 //***************************************************************************************************
 //                                O N L M I C E V E N T                                             *
 //***************************************************************************************************
@@ -230,7 +525,20 @@ void onLmicEvent (ev_t ev)
     {
         case EV_JOINED:
             LMIC_setLinkCheckMode(0) ;
+#ifdef CLASSB_PINGEXP
+            LMIC_setPingable ( CLASSB_PINGEXP ) ;                     // Find beacon, then ping slots
+#endif
             break;
+#ifdef CLASSB_PINGEXP
+        case EV_BEACON_TRACKED:
+            dbgprint ( "Beacon at GPS %u, rssi %d, snr %d",           // Show beacon
+                       LMIC.bcninfo.time, LMIC.bcninfo.rssi, LMIC.bcninfo.snr ) ;
+            break ;
+        case EV_LOST_TSYNC:                                           // Too many beacons missed
+            LMIC_enableTracking ( 3 ) ;                               // Ask network time, track again
+            LMIC_setPingable ( CLASSB_PINGEXP ) ;
+            break ;
+#endif
         case EV_TXDONE:
             break ;
         case EV_TXCOMPLETE:
@@ -242,11 +550,65 @@ void onLmicEvent (ev_t ev)
             {
               dbgprint ( "Received ack" ) ;
             }
-            if ( LMIC.dataLen )
+            if ( report_sent )                                        // Report frame done?
+            {
+              bool kept = false ;                                     // Delivered later from the backlog?
+              report_sent = false ;
+              setBackupRegister ( BKP_R_XMITCNT, ++xmitcount ) ;      // Count transmits for rejoin
+#ifdef CFG_backlog
+              if ( LMIC.txstat.attempts &&                            // Confirmed and not acked?
+                   ! ( LMIC.txrxFlags & TXRX_ACK ) )
+              {
+                kept = backlog_store() ;                              // Yes, keep it for later
+                backlog_ok = false ;                                  // No catch-up in this wakeup
+              }
+#endif
+              reportFilter.sent ( ( LMIC.txrxFlags & TXRX_ACK ) ||    // Acked or stored change is the new
+                                  kept ) ;                            // reference, not reported again
+            }
+#ifdef CFG_backlog
+            if ( backlog_sent )                                       // Backlog frame done?
+            {
+              backlog_sent = false ;
+              if ( LMIC.txrxFlags & TXRX_ACK )                        // Yes, delivered?
+              {
+                LMIC_backlogSent() ;                                  // Yes, drop its records
+              }
+              else
+              {
+                backlog_ok = false ;                                  // No, try again next wakeup
+              }
+            }
+#endif
+            if ( LMIC.txstat.attempts )                               // Confirmed uplink?
+            {
+              dbgprint ( "Confirmed uplink %s, %d attempts, "         // Yes, show outcome
+                         "DR%d, airtime %d ms, %d ms",
+                         LMIC.txstat.result == TXEND_ACK ? "acked" : "not acked",
+                         LMIC.txstat.attempts, LMIC.txstat.dr,
+                         osticks2ms ( LMIC.txstat.airtime ),
+                         osticks2ms ( LMIC.txstat.latency ) ) ;
+            }
+            handle_downlink() ;                                       // Payload in RX1/RX2?
+            break;
+        case EV_RXCOMPLETE:                                           // Class C, multicast or drained downlink
+            handle_downlink() ;
+#if defined(CFG_fuota) || defined(CFG_mcast) || defined(CFG_timesync)
+            if ( pkg_anslen )                                         // Answer to send?
             {
-              dbgprint ( "Received %d bytes of payload",
-                         LMIC.dataLen ) ;
+#ifdef CFG_fuota
+              if ( pkg_delay )                                        // Yes, after a random delay?
+              {
+                pkg_wait = true ;                                     // Yes, send it from pkg_due
+                os_setTimedCallback ( &pkgjob, os_getTime() + sec2osticks ( pkg_delay ),
+                                      pkg_due ) ;
+                pkg_delay = 0 ;
+                break ;
+              }
+#endif
+              tx_finished = true ;                                    // Let main loop send it
             }
+#endif
             break;
          default:
             break;
@@ -254,6 +616,80 @@ void onLmicEvent (ev_t ev)
 }
 
 
+//***************************************************************************************************
+//                                R E A D _ S E N S O R S                                           *
+//***************************************************************************************************
+// Read the MCU temperature in degC and the supply voltage in 10 mV from the internal ADC channels. *
+//***************************************************************************************************
+void read_sensors ( int32_t* values )
+{
+  int32_t    vref ;                                         // Supply voltage in mV
+
+  analogReadResolution ( 12 ) ;
+  vref = __LL_ADC_CALC_VREFANALOG_VOLTAGE ( analogRead ( AVREF ), LL_ADC_RESOLUTION_12B ) ;
+  values[0] = __LL_ADC_CALC_TEMPERATURE ( vref, analogRead ( ATEMP ), LL_ADC_RESOLUTION_12B ) ;
+  values[1] = ( vref + 5 ) / 10 ;
+}
+
+
+//***************************************************************************************************
+//                                P E A K _ S A M P L E                                             *
+//***************************************************************************************************
+// Read the sensors and fold the readings into the highest temperature and the lowest Vdd since the *
+// last report, kept in a backup register (0 = no samples).  take = true: return the peak values    *
+// and start over for the next report.                                                              *
+//***************************************************************************************************
+void peak_sample ( int32_t* values, bool take )
+{
+  uint32_t   peak = getBackupRegister ( BKP_R_PEAK ) ;      // Temperature + 0x8000, 0xFFFF - Vdd
+  uint32_t   hi ;
+  uint32_t   lo ;
+
+  read_sensors ( values ) ;
+  hi = max ( peak >> 16, (uint32_t)( values[0] + 0x8000 ) ) ;
+  lo = max ( peak & 0xFFFF, (uint32_t)( 0xFFFF - values[1] ) ) ;
+  if ( take )
+  {
+    values[0] = (int32_t)hi - 0x8000 ;
+    values[1] = 0xFFFF - (int32_t)lo ;
+    peak = 0 ;
+  }
+  else
+  {
+    peak = ( hi << 16 ) | lo ;
+  }
+  setBackupRegister ( BKP_R_PEAK, peak ) ;
+}
+
+
+//***************************************************************************************************
+//                                R E P O R T _ S T A T E                                           *
+//***************************************************************************************************
+// The report filter (last acknowledged report, intervals without uplink) is kept in RTC backup     *
+// registers during deep sleep.  save = false: restore.                                             *
+//***************************************************************************************************
+void report_state ( bool save )
+{
+  uint32_t   words[reportFilter.words] ;                    // Filter state as register words
+
+  if ( save )
+  {
+    reportFilter.save ( words ) ;
+    for ( unsigned i = 0 ; i < reportFilter.words ; i++ )
+    {
+      setBackupRegister ( BKP_R_REPORT + i, words[i] ) ;
+    }
+    return ;
+  }
+  for ( unsigned i = 0 ; i < reportFilter.words ; i++ )     // Zero after a power loss,
+  {                                                         // which is "no report yet"
+    words[i] = getBackupRegister ( BKP_R_REPORT + i ) ;
+  }
+  reportFilter.restore ( words ) ;
+  dbgprint ( "Report filter, %d intervals without uplink", reportFilter.silent() ) ;
+}
+
+
 //***************************************************************************************************
 //                                S E N D _ P A C K E T                                             *
 //***************************************************************************************************
@@ -262,18 +698,61 @@ void onLmicEvent (ev_t ev)
 //***************************************************************************************************
 void send_packet(osjob_t* j)
 {
-  char       payload[64] ;                                  // Test data
+  uint8_t    payload[TestPayload::bytes] ;                  // Test data
+  uint32_t   life = 0 ;                                     // Projected battery life in days
+  int32_t    values[2] ;                                    // Temperature and Vdd readings
+  uint8_t    due ;                                          // Kind of report due
 
   if ( LMIC.opmode & OP_TXRXPEND )                          // Current TX/RX job running?
   {
     dbgprint ( "OP_TXRXPEND, not sending" ) ;           // Yes, show error
     return ;                                                // And leave
   }
+  peak_sample ( values, true ) ;                            // Peak temperature and Vdd of the interval
+  due = reportFilter.check ( values ) ;                     // Changed or heartbeat due?
+  if ( due == payload::REPORT_NONE && LMIC.devaddr )        // No, and no join needed?
+  {
+    dbgprint ( "No change, %d degC, %d0 mV, no uplink",     // Skip this interval
+               values[0], values[1] ) ;
+    diag_sent = true ;                                      // Nothing new to diagnose
+    tx_finished = true ;                                    // Sleep
+    return ;
+  }
   digitalWrite ( LED, LOW ) ;                               // Show activity
-  sprintf ( payload, "Test %d", eepromdata.fcnt ) ;         // Format test packet
-  dbgprint ( "Queue package '%s'", payload ) ;        // Show packet to send
-  LMIC_setTxData2 ( 1, (u1_t*)payload,                      // Queue the packet
-                    strlen ( payload ), 0 ) ;
+#ifdef CFG_energy
+  life = LMIC_energyLifetimeHours ( BATTERY_MAH,            // Estimate from the uplinks so far
+                                    tx_interval_sec, SLEEP_UA,
+                                    WAKE_UC + LMIC_energyUplink_uC ( sizeof(payload) ) ) / 24 ;
+#endif
+  TestPayload::encode ( payload,                            // Format test packet
+                        eepromdata.fcnt & 0xFFFF, life,
+                        values[0], values[1] ) ;
+  dbgprint ( "Queue %s fcnt %d, life %d days, %d degC, %d0 mV",
+             due == payload::REPORT_HEARTBEAT ? "heartbeat" : "report",
+             eepromdata.fcnt, life, values[0], values[1] ) ;
+  report_sent = true ;
+#ifdef CFG_backlog
+  memcpy ( report_payload, payload, sizeof(payload) ) ;     // Keep it in case it is not delivered
+  report_time = rtc.getEpoch() ;
+#endif
+  if ( LMIC_setTxData2 ( 1, payload, sizeof(payload),       // Queue the packet, changes confirmed
+                         due != payload::REPORT_HEARTBEAT ) // so they are not lost
+       == -3 )                                              // Over airtime budget?
+  {
+    report_sent = false ;                                   // Report again next interval
+#ifdef CFG_budget
+    dbgprint ( "Airtime budget used up, %d ms left, fits in %d sec",
+               LMIC_budgetLeft_ms(),
+               LMIC_budgetWait_sec ( sizeof(payload), LMIC.datarate ) ) ;
+#endif
+#ifdef CFG_backlog
+    if ( backlog_store() )                                  // Send it when there is budget again
+    {
+      reportFilter.sent ( true ) ;                          // Stored, not reported again
+    }
+#endif
+    tx_finished = true ;                                    // Skip this one, sleep
+  }
   digitalWrite ( LED, HIGH ) ;                              // End of activity
   if ( ( eepromdata.fcnt % 100 ) == 0 )                     // 100 packets sent?
   {
@@ -283,6 +762,117 @@ void send_packet(osjob_t* j)
 }
 
 
+//***************************************************************************************************
+//                                S E N D _ D I A G                                                 *
+//***************************************************************************************************
+// Send the energy ledger of the last uplink as a confirmed diagnostic packet on DIAG_PORT.         *
+// Returns false if there is nothing to send.                                                       *
+//***************************************************************************************************
+bool send_diag()
+{
+#ifdef CFG_energy
+  u1_t       payload[32] ;                                  // Energy report
+  u1_t       len ;                                          // Length of report
+
+  len = LMIC_energyReport ( payload, sizeof(payload) ) ;    // Per state charge in uC
+  if ( len == 0 )
+  {
+    return false ;
+  }
+  dbgprint ( "Queue energy diagnostics, %d bytes", len ) ;
+  LMIC_setTxData2 ( DIAG_PORT, payload, len, 1 ) ;          // Queue the packet, confirmed
+  return true ;
+#else
+  return false ;
+#endif
+}
+
+
+//***************************************************************************************************
+//                                S E N D _ B A C K L O G                                           *
+//***************************************************************************************************
+// Send the oldest stored reports as a confirmed frame on BACKLOG_PORT, packed up to the payload    *
+// size of the fastest DR the link allows.  At most BACKLOG_FRAMES per wakeup, none after an uplink *
+// without ACK, and none if the duty cycle would keep the device awake longer than BACKLOG_WAIT_MS. *
+// Returns false if there is nothing to send.                                                       *
+//***************************************************************************************************
+#ifdef CFG_backlog
+bool send_backlog()
+{
+  uint8_t    frame[sizeof(LMIC.pendTxData)] ;               // Packed records
+  uint8_t    len ;                                          // Length of frame
+  ostime_t   now = os_getTime() ;
+
+  if ( ! backlog_ok || LMIC.devaddr == 0 ||                 // Link down or no session?
+       backlog_frames >= BACKLOG_FRAMES ||                  // Enough for this wakeup?
+       LMIC_backlogCount() == 0 ||                          // Nothing stored?
+       LMIC_nextTx ( now ) - now > ms2osticks ( BACKLOG_WAIT_MS ) )
+  {
+    return false ;
+  }
+  len = LMIC_backlogFrame ( frame, LMIC_maxAppPayload() ) ;
+  if ( len == 0 || LMIC_setTxData2 ( BACKLOG_PORT, frame, len, 1 ) != 0 )
+  {
+    return false ;
+  }
+  backlog_frames++ ;
+  backlog_sent = true ;
+  dbgprint ( "Queue backlog frame, %d bytes, %d records stored", len, LMIC_backlogCount() ) ;
+  return true ;
+}
+#endif
+
+
+//***************************************************************************************************
+//                                F U O T A _ D O N E                                               *
+//***************************************************************************************************
+// Called when a data block received on FUOTA_PORT is complete in flash.  It is handed over as a    *
+// firmware update, the bootloader installs it after the reboot.                                    *
+//***************************************************************************************************
+#ifdef CFG_fuota
+void fuota_done ( const u1_t* data, u4_t len, u4_t descriptor )
+{
+  dbgprint ( "FUOTA data block of %d bytes at %08X, descriptor %08X",
+             len, (uint32_t)data, descriptor ) ;
+  if ( hal_set_update ( (void*)data ) )                     // Hand over to bootloader
+  {
+    delay ( 50 ) ;                                          // Time to print last line
+    hal_reboot() ;
+  }
+}
+#endif
+
+
+//***************************************************************************************************
+//                                D U M P _ R A D I O T R A C E                                     *
+//***************************************************************************************************
+// Print the recorded radio operations, one line per record:                                        *
+// RT,<type>,<time>,<freq>,<rps>,<txpow>,<len>,<rssi>,<snr>,<frame>                                 *
+// tools/trace/trace2c.py converts these lines into a trace for LMIC_radioReplay().                 *
+//***************************************************************************************************
+void dump_radiotrace()
+{
+#ifdef CFG_radiotrace
+  radiotrace_t rec ;                                        // One record
+  int          n ;                                          // Number of frame bytes to show
+
+  for ( u2_t i = 0 ; LMIC_radioTraceGet ( i, &rec ) ; i++ )
+  {
+    Serial.printf ( "RT,%02X,%ld,%lu,%04X,%d,%d,%d,%d,",
+                    rec.type, (long)rec.time, (unsigned long)rec.freq,
+                    rec.rps, rec.txpow, rec.len, rec.rssi, rec.snr ) ;
+    n = min ( (int)rec.len, CFG_radiotrace_framelen ) ;
+    for ( int j = 0 ; j < n ; j++ )
+    {
+      Serial.printf ( "%02X", rec.frame[j] ) ;
+    }
+    Serial.println() ;
+  }
+  LMIC_radioTraceClear() ;
+#endif
+}
+
+
 //**************************************************************************************************
 //                                     S E T C H A N N E L S                                       *
 //**************************************************************************************************
@@ -295,6 +885,7 @@ void setchannels()
   {
     dbgprint ( "LoRa configured for Europe 868 MHz" ) ;
   }
+#ifdef CFG_au915
   if ( LoraBand == REGION_AU915 )
   {
     dbgprint ( "LoRa configured Australia/New Zealand 916.8 to 918.2 MHz" ) ;
@@ -306,6 +897,7 @@ void setchannels()
       }
     }
   }                                                        // to get all the 8 channels
+#endif
 }
 
 
@@ -322,9 +914,7 @@ void retrieve_fcnt()
 
   bckVal = getBackupRegister ( BKP_R_DATAVALID ) ;          // Get datavalid word
   bckValid = ( bckVal == DATAVALID ) ;                      // Set/reset valid flag
-  EEPROM.begin() ;                                          // Enable EEPROM access
-  readEEPROMdata() ;                                        // Read EEPROM data
-  if ( eepromdata.datavalid != DATAVALID )                  // Valid data in EEPROM?
+  if ( ! readEEPROMdata() )                                 // Valid data in EEPROM?
   {
     dbgprint ( "Data in EEPROM is invalid" ) ;              // No, show it
     eepromdata.datavalid = DATAVALID ;                      // Initialize EEPROM
@@ -369,6 +959,141 @@ void retrieve_fcnt()
 }
 
 
+//**************************************************************************************************
+//                                  T I M E S Y N C _ D O N E                                      *
+//**************************************************************************************************
+// Called when the network time has been received.  The RTC is set to UTC and the time of the      *
+// synchronization is kept in a backup register, so the time survives deep sleep.                  *
+//**************************************************************************************************
+#ifdef CFG_timesync
+void timesync_done ( u4_t gpstime )
+{
+  u2_t ms ;                                               // Milliseconds of UTC time
+  u4_t utc = LMIC_utcTime ( &ms ) ;                       // UTC in unix seconds
+
+  rtc.setEpoch ( utc, ms ) ;                              // Set the RTC
+  setBackupRegister ( BKP_R_GPSTIME, gpstime ) ;          // Remember time of synchronization
+  dbgprint ( "RTC synchronized to %s", get_rtc_time() ) ;
+}
+#endif
+
+
+//**************************************************************************************************
+//                                  B U D G E T _ L E D G E R                                      *
+//**************************************************************************************************
+// The airtime ledger is kept in RTC backup registers during deep sleep.  save = false: restore.   *
+//**************************************************************************************************
+#ifdef CFG_budget
+void budget_ledger ( bool save )
+{
+  uint32_t        words[( sizeof(budget_ledger_t) + 3 ) / 4] ;    // Ledger as register words
+  budget_ledger_t ledger ;
+
+  if ( save )
+  {
+    memcpy ( words, LMIC_budgetLedger(), sizeof(budget_ledger_t) ) ;
+    for ( unsigned i = 0 ; i < sizeof(words) / 4 ; i++ )
+    {
+      setBackupRegister ( BKP_R_BUDGET + i, words[i] ) ;
+    }
+    return ;
+  }
+  for ( unsigned i = 0 ; i < sizeof(words) / 4 ; i++ )          // Zero after a power loss,
+  {                                                             // which is an empty ledger
+    words[i] = getBackupRegister ( BKP_R_BUDGET + i ) ;
+  }
+  memcpy ( &ledger, words, sizeof(budget_ledger_t) ) ;
+  LMIC_budgetInit ( AIRTIME_MS, rtc.getEpoch(), &ledger, 1 ) ;  // Refuse uplinks over budget
+  dbgprint ( "Airtime used %d ms of %d ms",
+             LMIC_budgetUsed_ms(), AIRTIME_MS ) ;
+}
+#endif
+
+
+//**************************************************************************************************
+//                                   T X S L O T _ W A I T                                         *
+//**************************************************************************************************
+// Milliseconds until the TX time of this device by the RTC, at least lead_ms from now.            *
+//**************************************************************************************************
+#ifdef CFG_txslot
+uint32_t txslot_wait ( int32_t lead_ms )
+{
+  uint32_t subsec ;                                       // Milliseconds of RTC time
+  uint32_t now = rtc.getEpoch ( &subsec ) ;               // RTC time, network time if synchronized
+
+  return LMIC_txSlotWait_ms ( now, subsec, tx_interval_sec, TXSLOT_MS, lead_ms ) ;
+}
+#endif
+
+
+//**************************************************************************************************
+//                                    D E E P _ S L E E P                                          *
+//**************************************************************************************************
+// Go into shutdown mode for sleeptime msec.  The program restarts with setup() after wake-up.     *
+//**************************************************************************************************
+void deep_sleep ( uint32_t sleeptime )
+{
+  MODIFY_REG ( PWR->CR3, PWR_CR3_EWRFBUSY,                // Prevent radio busy interference with sleep
+               LL_PWR_RADIO_BUSY_TRIGGER_NONE ) ;
+  dbgprint ( "Start deep sleep at %s for %d sec",         // Show go to sleep
+             get_rtc_time(), sleeptime / 1000 ) ;
+  delay ( 50 ) ;                                          // Time to print last line
+  LowPower.begin() ;                                      // Init low power mode
+  LowPower.shutdown ( sleeptime ) ;                       // Sleep till next xmit interval
+  while ( true ) {} ;                                     // Will not be executed
+}
+
+
+//**************************************************************************************************
+//                                     R U N _ T A S K S                                           *
+//**************************************************************************************************
+// Restore the task table and run the tasks due in this wakeup that need no radio.  Returns true    *
+// if the report is due, false if the wakeup was for sampling only.                                *
+//**************************************************************************************************
+bool run_tasks()
+{
+  uint32_t   words[taskTable.words] ;                     // Task table as register words
+  uint32_t   now = rtc.getEpoch() ;                       // RTC time
+  uint32_t   due ;                                        // Tasks to run
+  int32_t    values[2] ;                                  // Temperature and Vdd readings
+
+  for ( unsigned i = 0 ; i < taskTable.words ; i++ )      // Zero after a power loss,
+  {                                                       // which makes all tasks due
+    words[i] = getBackupRegister ( BKP_R_TASKS + i ) ;
+  }
+  taskTable.restore ( words, now ) ;
+  due = taskTable.due ( now ) ;
+  if ( due & ( 1 << TASK_SAMPLE ) )                       // Sample due?
+  {
+    peak_sample ( values, false ) ;                       // Yes, fold into the peak values
+    taskTable.done ( TASK_SAMPLE, now ) ;
+    dbgprint ( "Sample %d degC, %d0 mV", values[0], values[1] ) ;
+  }
+  return ( due & ( 1 << TASK_REPORT ) ) != 0 ;
+}
+
+
+//**************************************************************************************************
+//                                    T A S K _ S L E E P                                          *
+//**************************************************************************************************
+// Save the task table and sleep until the earliest due task.                                      *
+//**************************************************************************************************
+void task_sleep()
+{
+  uint32_t   words[taskTable.words] ;                     // Task table as register words
+  uint32_t   subsec ;                                     // Milliseconds of RTC time
+  uint32_t   now = rtc.getEpoch ( &subsec ) ;             // RTC time
+  uint32_t   wait = taskTable.next ( now ) * 1000 ;       // Time to the earliest task (msec)
+
+  taskTable.save ( words ) ;
+  for ( unsigned i = 0 ; i < taskTable.words ; i++ )
+  {
+    setBackupRegister ( BKP_R_TASKS + i, words[i] ) ;
+  }
+  deep_sleep ( wait > subsec + 50 ? wait - subsec : 50 ) ;
+}
+
+
 //**************************************************************************************************
 //                                  G E T _ R T C _ T I M E                                        *
 //**************************************************************************************************
@@ -421,12 +1146,25 @@ void init_rtc_clock()
 //**************************************************************************************************
 void setup()
 {
-  unsigned    chan ;                                        // For channel selection
+#ifndef DISABLE_DBGPRINT
+  char        spec[128] ;                                   // Payload spec (JSON)
+#endif
+#ifdef CFG_timesync
+  uint32_t    synctime ;                                    // GPS time of last clock sync
+  uint32_t    subsec ;                                      // Milliseconds of RTC time
+#endif
+#ifdef CFG_txslot
+  uint32_t    wait ;                                        // Time to the TX time (msec)
+#endif
 
   Serial.begin ( 115200 ) ;                                 // Start serial IO (RX2/TX2 = PA3,PA2)
   Serial.printf ( "\n" ) ;
   pinMode ( LED,           OUTPUT_OPEN_DRAIN ) ;            // Enable build-in LED
   init_rtc_clock() ;                                        // Initialize the RTC clock
+  if ( ! run_tasks() )                                      // Only sampling in this wakeup?
+  {
+    task_sleep() ;                                          // Yes, sleep until the next task
+  }
   for ( int i = 0 ; i < 31 ; i++ )                          // Loop for 30 LED flashes
   {                                                         // end with LED off
     digitalToggle ( LED ) ;                                 // Turn LED on/off
@@ -434,21 +1172,36 @@ void setup()
   }
   dbgprint ( "Started at %s...",                            // Show alive message
                  get_rtc_time() ) ;
+#ifndef DISABLE_DBGPRINT
+  if ( TestPayload::spec ( spec, sizeof(spec),              // Decoder spec for the network side
+                           testPayloadNames ) > 0 )
+  {
+    dbgprint ( "Payload spec %s", spec ) ;
+  }
+#endif
+  show_provisioning() ;                                     // Identity from OTP/flash
   os_init ( NULL ) ;                                        // Initialize lmic
+#ifdef CFG_persist
+  LMIC_persistInit ( (void*)CONFIG_AREA, CONFIG_AREA_SIZE ) ;     // Keys and fcnt
+#endif
+#ifdef CFG_fuota
+  LMIC_fuotaInit ( (void*)FUOTA_AREA, FUOTA_AREA_SIZE,      // Flash for fragmented data blocks
+                   fuota_done ) ;
+#endif
+#ifdef CFG_backlog
+  LMIC_backlogInit ( (void*)BACKLOG_AREA, BACKLOG_AREA_SIZE ) ;   // Reports kept during outages
+  dbgprint ( "Backlog %d reports", LMIC_backlogCount() ) ;
+#endif
   LMIC_reset() ;                                            // Reset the MAC state
+  LMIC_setDrain ( DRAIN_POLLS, DRAIN_UC ) ;                 // Fetch pending downlinks before sleep
+  LMIC_setTxPolicy ( &txPolicy ) ;                          // Retries of confirmed uplinks
+  LMIC_setDrFit ( DRFIT_FIT, DRFIT_MAX, DRFIT_RSV_DB, 0 ) ; // DR per frame by payload size
+#ifdef CFG_budget
+  budget_ledger ( false ) ;                                 // Airtime spent in the last 24 hours
+#endif
+  report_state ( false ) ;                                  // Last acknowledged report
   setchannels() ;                                           // Set LoRa channels
   retrieve_fcnt() ;                                         // Retrieve Uplink counter from RTC/EEPROM
-  if ( LoraBand == REGION_AU915 )                           // Are we in NZ?
-  {
-    // Default setting is all channels 0..71 are enabled, but we want only 8..15
-    for ( chan = 0 ; chan < 72 ; chan++ )                   // Disable most bands
-    {
-      if ( chan < 8 || chan > 15 )                          // Only leave bands 8..15
-      {
-        LMIC_disableChannel ( chan ) ;                      // Disable others
-      }
-    }
-  }
   dbgprint ( "Start JOIN..." ) ;                            // For ABP this should be fast
   digitalWrite ( LED, LOW ) ;                               // Signal activity
   if ( JoinMode == JOINMODE_OTAA )                          // OTAA method?
@@ -460,7 +1213,6 @@ void setup()
       DevAddr = eepromdata.devaddr ;                        // Yes, use saved devadress and keys
       memcpy ( NwkSKey, eepromdata.nwkSKey, 16 ) ;
       memcpy ( AppSKey, eepromdata.appSKey, 16 ) ;
-      setBackupRegister ( BKP_R_XMITCNT, ++xmitcount ) ;    // Update xmitcount in BKP register
       JoinMode = JOINMODE_ABP ;                             // Force ABP-mode
       dbgprint ( "OTAA join already made" ) ;               // Show for debug
     }
@@ -501,13 +1253,43 @@ void setup()
     LMIC_setupChannel ( 7, 867900000, DR_RANGE_MAP(EU868_DR_SF12, EU868_DR_SF7) ) ;      // g-band
     LMIC_setupChannel ( 8, 868800000, DR_RANGE_MAP(EU868_DR_FSK,  EU868_DR_FSK) ) ;      // g2-band
     // TTN defines an additional channel at 869.525Mhz using SF9 for class B
-    // devices' ping slots. LMIC does not have an easy way to define set this
-    // frequency and support for class B is spotty and untested, so this
-    // frequency is not configured here.
+    // devices' ping slots. This is the regional default of LMIC for the
+    // beacon and the ping slots, so it is not configured here.
     #endif
   }
+#ifdef CFG_timesync
+  LMIC_timeSyncInit ( timesync_done ) ;                       // Network time for the RTC
+  synctime = getBackupRegister ( BKP_R_GPSTIME ) ;            // Time of last synchronization
+  if ( synctime )                                             // RTC synchronized before?
+  {
+    LMIC_setUtcTime ( rtc.getEpoch ( &subsec ), subsec ) ;    // Yes, continue with RTC time
+  }
+  if ( synctime == 0 ||                                       // Never synchronized or too long ago?
+       LMIC_gpsTime ( NULL ) - synctime > TIMESYNC_SEC )
+  {
+    LMIC_requestDeviceTime() ;                                // Yes, DeviceTimeReq in next uplink
+  }
+#endif
+#ifdef CLASSB_PINGEXP
+  if ( JoinMode == JOINMODE_ABP )                             // Session known?
+  {
+    LMIC_setPingable ( CLASSB_PINGEXP ) ;                     // Yes, find beacon, then ping slots
+  }
+#endif
   digitalWrite ( LED, HIGH ) ;                                // End of activity
+#ifdef CFG_txslot
+  wait = txslot_wait ( -TXSLOT_LATE_MS ) ;                    // Realign to the TX time with the RTC
+  if ( wait > TXSLOT_WAKE_MS + TXSLOT_LATE_MS )               // Not woken up for it (power up)?
+  {
+    taskTable.set ( TASK_REPORT, rtc.getEpoch() +           // Yes, report just before it
+                    ( wait - TXSLOT_WAKE_MS ) / 1000 ) ;
+    task_sleep() ;                                          // Sample while waiting for it
+  }
+  dbgprint ( "TX time in %d msec", wait ) ;
+  os_setTimedCallback ( &sendjob, os_getTime() + ms2osticks ( wait ), send_packet ) ;
+#else
   send_packet ( &sendjob ) ;
+#endif
 }
 
 
@@ -518,32 +1300,110 @@ void setup()
 //**************************************************************************************************
 void loop()
 {
-  uint32_t sleeptime ;                                    // Computed time to sleep (msec)
-  uint32_t sleeptime_sec ;                                // Sleeptime in seconds
+#ifdef CFG_txslot
+  uint32_t wait ;                                         // Time to the next TX time (msec)
+#endif
 
   os_runstep() ;                                          // Keep lmic happy
   if ( tx_finished )                                      // Packet sent?
   {
     tx_finished = false ;
-    if ( ! eepromdata.joinedFlag )                        // Need to write the EEPROM?
+    if ( ! eepromdata.joinedFlag && LMIC.devaddr )        // Joined, need to write the EEPROM?
     {
       saveOTAAkeys() ;                                    // Yes, save the keys for later use
       showOTAAkeys() ;                                    // Show the keys
     }
-    MODIFY_REG ( PWR->CR3, PWR_CR3_EWRFBUSY,              // Prevent radio busy interference with sleep
-                 LL_PWR_RADIO_BUSY_TRIGGER_NONE ) ;
-    sleeptime = tx_interval_sec * 1000 - millis() - 50 ;  // Compute sleep time
-    sleeptime_sec = sleeptime / 1000 ;                    // Also in seconds
-    if ( sleeptime_sec > tx_interval_sec )                // Run time > sleep time?
+    if ( ! diag_sent &&                                   // Diagnostics due?
+         ( eepromdata.fcnt % DIAG_INTERVAL ) == 1 )
+    {
+      diag_sent = true ;                                  // Yes, only once per wakeup
+      if ( send_diag() )                                  // Queue diagnostic packet
+      {
+        return ;                                          // Sleep after it has been sent
+      }
+    }
+#if defined(CFG_fuota) || defined(CFG_mcast) || defined(CFG_timesync)
+#ifdef CFG_fuota
+    if ( pkg_anslen && ! pkg_wait )                       // Answer to package command, not delayed?
+#else
+    if ( pkg_anslen )                                     // Answer to package command?
+#endif
+    {
+      LMIC_setTxData2 ( pkg_port, pkg_ans,                // Yes, send it first
+                        pkg_anslen, 0 ) ;
+      pkg_anslen = 0 ;
+      return ;
+    }
+#endif
+#ifdef CFG_timesync
+    pkg_anslen = LMIC_clockSyncReq ( pkg_ans,             // AppTimeReq asked for by the network?
+                                     sizeof(pkg_ans), 0 ) ;
+    if ( pkg_anslen )
+    {
+      LMIC_setTxData2 ( CLOCKSYNC_PORT, pkg_ans,          // Yes, send it
+                        pkg_anslen, 0 ) ;
+      pkg_anslen = 0 ;
+      return ;
+    }
+#endif
+#ifdef CFG_backlog
+    if ( send_backlog() )                                 // Catch up on stored reports
     {
-      sleeptime = tx_interval_sec * 1000 ;                // Adjust to prevent a very long sleep
-      sleeptime_sec = tx_interval_sec ;
+      return ;
     }
-    dbgprint ( "Start deep sleep at %s for %d sec",       // Show go to sleep
-                   get_rtc_time(), sleeptime_sec ) ;
-    delay ( 50 ) ;                                        // Time to print last line
-    LowPower.begin() ;                                    // Init low power mode
-    LowPower.shutdown ( sleeptime ) ;                     // Sleep till next xmit interval
-    while ( true ) {} ;                                   // Will not be executed
+#endif
+#ifdef CFG_fuota
+    if ( LMIC_fuotaState() == FUOTA_RECEIVING )           // Session running?
+    {
+      dbgprint ( "FUOTA %d fragments missing",            // Yes, stay awake and keep polling
+                 LMIC_fuotaMissing() ) ;
+      os_setTimedCallback ( &sendjob, os_getTime() + sec2osticks ( FUOTA_POLL_SEC ),
+                            send_packet ) ;
+      return ;
+    }
+    if ( pkg_wait )                                       // Delayed answers pending?
+    {
+      return ;                                            // Yes, stay awake, pkg_due sends them
+    }
+#endif
+#ifdef CFG_mcast
+    if ( LMIC_mcastClassC() != MCAST_IDLE )               // Class C session pending or running?
+    {
+      dbgprint ( "Multicast class C session %s",          // Yes, stay awake, keep reporting
+                 LMIC_mcastClassC() == MCAST_RUNNING ? "running" : "pending" ) ;
+      os_setTimedCallback ( &sendjob, os_getTime() + sec2osticks ( tx_interval_sec ),
+                            send_packet ) ;
+      return ;
+    }
+#endif
+#ifdef CLASSB_PINGEXP
+    if ( ( LMIC.opmode & ( OP_TRACK | OP_SCAN ) ) ||      // Class B running or starting?
+         LMIC.askForTime )
+    {
+      os_setTimedCallback ( &sendjob, os_getTime() + sec2osticks ( tx_interval_sec ),
+                            send_packet ) ;               // Yes, stay awake for the ping slots
+      return ;
+    }
+#endif
+#ifdef CFG_energy
+    dbgprint ( "Projected battery life %d days",          // Show battery life for this interval
+               LMIC_energyLifetimeHours ( BATTERY_MAH, tx_interval_sec, SLEEP_UA,
+                                          WAKE_UC + LMIC_energyUplink_uC ( TestPayload::bytes ) ) / 24 ) ;
+#endif
+    dump_radiotrace() ;                                   // Show radio trace of this wakeup
+#ifdef CFG_budget
+    budget_ledger ( true ) ;                              // Keep airtime ledger during sleep
+#endif
+    report_state ( true ) ;                               // Keep report filter during sleep
+    taskTable.done ( TASK_REPORT, rtc.getEpoch() ) ;      // Report due again next interval
+#ifdef CFG_txslot
+    wait = txslot_wait ( TXSLOT_WAKE_MS ) ;               // Time to the next TX time of this device
+    if ( wait )                                           // Known (session)?
+    {
+      taskTable.set ( TASK_REPORT, rtc.getEpoch() +       // Yes, wake up just before it
+                      ( wait - TXSLOT_WAKE_MS ) / 1000 ) ;
+    }
+#endif
+    task_sleep() ;                                        // Sleep till the next task
   }
 }
@@ -0,0 +1,337 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Store and forward ring (lmic/backlog.c, CFG_backlog) on the host flash,
+ * 4 pages. A model holds the records not sent: LMIC_backlogCount() must
+ * match it, a lower count is only allowed as the oldest records of a page
+ * dropped by the ring, and every frame must hold the oldest records of the
+ * model. A reset is LMIC_backlogInit() on the same area, it must find the
+ * same records. The cases:
+ *
+ *   wrap       the ring comes around several times with records not sent,
+ *              with frames sent now and then and resets in between
+ *   torn       power cut after every double word and page erase of a
+ *              record, a SENT record and a new page, then a reset
+ *   erased     the last SENT record points into a page erased since
+ *   frame      packing limits of LMIC_backlogFrame()
+ *
+ * The program prints the failed checks and returns 1 if there are any.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "lmic.c"
+#include "backlog.h"
+#include "peripherals.h"
+
+#define PAGES       4
+#define AREA_SIZE   (PAGES * FLASH_PAGE_SZ)
+#define PERPAGE     ((FLASH_PAGE_SZ - 8) / 32)  // records of 24 bytes in a page
+#define MAXMODEL    4096
+
+typedef struct {
+    u4_t time;
+    u1_t len;
+    u1_t data[BACKLOG_MAXREC];
+} rec_t;
+
+static u1_t  area[AREA_SIZE] __attribute__((aligned(FLASH_PAGE_SZ)));
+static rec_t model[MAXMODEL];   // records not sent are model[mtail..mhead-1]
+static int   mtail, mhead;
+static u4_t  seq;               // records put
+static u4_t  dropped;           // records dropped by the ring
+static int   errors;
+
+#define CHECK(c, ...) do { if( !(c) ) { errors++; printf("backlog:%d: ", __LINE__); \
+                                       printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+void onLmicEvent (ev_t ev) { (void)ev; }
+
+static void fresh (void) {
+    memset(area, 0, sizeof(area));      // no page header, not erased
+    LMIC_backlogInit(area, sizeof(area));
+    mtail = mhead = 0;
+    seq = dropped = 0;
+}
+
+// Drop the oldest records of the model down to the count of the ring
+static void sync (const char* what) {
+    int n = mhead - mtail;
+    CHECK(LMIC_backlogCount() <= (u4_t)n, "%s: %u records, %d in the model", what, LMIC_backlogCount(), n);
+    while( mhead - mtail > (int)LMIC_backlogCount() ) {
+        mtail++;
+        dropped++;
+    }
+}
+
+static rec_t next (u1_t len, u4_t dt) {
+    rec_t r;
+    r.time = (mhead ? model[mhead - 1].time : 1000) + dt;
+    r.len = len;
+    for( u1_t i = 0; i < len; i++ )
+        r.data[i] = (seq * 7 + i) & 0x7F;
+    seq++;
+    return r;
+}
+
+static void put (u1_t len, u4_t dt) {
+    rec_t r = next(len, dt);
+    if( mhead == MAXMODEL ) {
+        memmove(model, model + mtail, (mhead - mtail) * sizeof(rec_t));
+        mhead -= mtail;
+        mtail = 0;
+    }
+    CHECK(LMIC_backlogPut(r.time, r.data, r.len), "record %u not stored", seq - 1);
+    model[mhead++] = r;
+    sync("put");
+}
+
+// Frame of at most max bytes, compared with the model, and sent if ack.
+// Returns the records in it.
+static int frame (u1_t max, bit_t ack) {
+    u1_t buf[255];
+    u1_t n = LMIC_backlogFrame(buf, max);
+    int  cnt = 0, i = 0;
+    u4_t t = 0;
+
+    CHECK(n <= max, "frame of %d bytes, max %d", n, max);
+    while( i < n ) {
+        rec_t* r = &model[mtail + cnt];
+        if( cnt == 0 ) {
+            t = os_rlsbf4(buf);
+            i = 4;
+        } else {
+            t += os_rlsbf2(buf + i);
+            i += 2;
+        }
+        u1_t len = buf[i++];
+        if( mtail + cnt >= mhead || t != r->time || len != r->len
+            || i + len > n || memcmp(buf + i, r->data, len) != 0 ) {
+            CHECK(0, "record %d of the frame is not the model's", cnt);
+            return cnt;
+        }
+        i += len;
+        cnt++;
+    }
+    if( ack ) {
+        LMIC_backlogSent();
+        mtail += cnt;
+        sync("frame");          // the SENT record can start a new page
+    }
+    return cnt;
+}
+
+static void reset (void) {
+    LMIC_backlogInit(area, sizeof(area));
+    CHECK(LMIC_backlogCount() == (u4_t)(mhead - mtail), "%u records after the reset, %d in the model",
+          LMIC_backlogCount(), mhead - mtail);
+}
+
+// All records not sent come in frames, in order
+static void drain (void) {
+    while( mhead > mtail ) {
+        if( frame(255, 1) == 0 ) {
+            CHECK(0, "no frame with %d records left", mhead - mtail);
+            return;
+        }
+    }
+    CHECK(LMIC_backlogCount() == 0, "%u records after the drain", LMIC_backlogCount());
+    CHECK(LMIC_backlogFrame((u1_t[8]){ 0 }, 8) == 0, "frame after the drain");
+}
+
+// ----------------------------------------
+// CASES
+
+static void wrap (void) {
+    fresh();
+    // ten times around the ring without a frame: the last full pages stay
+    for( int i = 0; i < 10 * PAGES * PERPAGE; i++ )
+        put(24, 10);
+    CHECK(LMIC_backlogCount() >= (PAGES - 1) * PERPAGE, "only %u records kept", LMIC_backlogCount());
+    reset();
+    drain();
+    reset();
+
+    // records of all sizes, a frame now and then, not always acked
+    u4_t r = 1;
+    for( int i = 0; i < 20000; i++ ) {
+        r = r * 1103515245 + 12345;
+        put((r >> 16) % (BACKLOG_MAXREC + 1), 1 + (r >> 8) % 100);
+        if( (r >> 4) % 13 == 0 )
+            frame(51 + (r >> 20) % 205, (r >> 12) % 4 != 0);
+        if( (r >> 24) % 97 == 0 )
+            reset();
+    }
+    CHECK(dropped > 0, "the ring did not wrap");
+    reset();
+    drain();
+    printf("backlog: wrap, %u records, %u dropped by the ring\n", seq, dropped);
+}
+
+// Power cut at every operation of the step, then a reset. The records
+// must be the ones before the step, or after it (the record stored, the
+// frame sent), less at most maxloss of the oldest ones if the step starts
+// a new page.
+enum { STEP_PUT, STEP_SENT };
+
+static void cutEach (int step, int maxloss, const char* name) {
+    static u1_t  snap[AREA_SIZE];
+    static rec_t msnap[MAXMODEL];
+    int  t0 = mtail, h0 = mhead, k;
+    u4_t s0 = seq, ops = 0;
+    rec_t r = next(24, 10);
+
+    memcpy(snap, area, sizeof(area));
+    memcpy(msnap, model, sizeof(model));
+    for( k = 1; ; k++ ) {
+        memcpy(area, snap, sizeof(area));
+        memcpy(model, msnap, sizeof(model));
+        mtail = t0;
+        mhead = h0;
+        seq = s0 + 1;
+        LMIC_backlogInit(area, sizeof(area));
+        int sent = 0;
+        if( step == STEP_SENT )
+            sent = frame(64, 0);
+        u4_t before = host_flashOps;
+        bit_t done = 0;
+        host_flashCut = k;
+        if( setjmp(host_flashCutJmp) == 0 ) {
+            if( step == STEP_PUT )
+                LMIC_backlogPut(r.time, r.data, r.len);
+            else
+                LMIC_backlogSent();
+            done = 1;
+        }
+        host_flashCut = 0;
+        ops = host_flashOps - before;
+
+        LMIC_backlogInit(area, sizeof(area));
+        u4_t cnt = LMIC_backlogCount();
+        int  n = h0 - t0;
+        if( step == STEP_PUT && done ) {
+            model[mhead++] = r;
+            n++;
+        }
+        if( step == STEP_SENT && done ) {
+            mtail += sent;
+            n -= sent;
+        } else if( step == STEP_SENT && (int)cnt == n - sent ) {
+            mtail += sent;      // SENT record complete, the cut came later
+            n -= sent;
+        } else if( step == STEP_PUT && !done && (int)cnt == n + 1 ) {
+            model[mhead++] = r; // record complete, the cut came later
+            n++;
+        }
+        CHECK((int)cnt <= n && (int)cnt >= n - maxloss,
+              "%s cut %d: %u records after the reset, %d in the model", name, k, cnt, n);
+        sync(name);
+        put(16, 10);            // the ring goes on after the torn record
+        reset();
+        drain();
+        if( done )
+            break;
+    }
+    CHECK(ops == (u4_t)k - 1, "%s: %u flash operations, %d cuts", name, ops, k - 1);
+    printf("backlog: torn %s, power cut before each of its %u flash operations\n", name, ops);
+}
+
+static void torn (void) {
+    // record in the middle of a page
+    fresh();
+    for( int i = 0; i < PERPAGE / 2; i++ )
+        put(24, 10);
+    cutEach(STEP_PUT, 0, "record");
+
+    // record that starts a new page, the ring full: it drops a page
+    fresh();
+    for( int i = 0; i < PAGES * PERPAGE; i++ )
+        put(24, 10);
+    cutEach(STEP_PUT, PERPAGE, "record on a new page");
+
+    // SENT record of a frame
+    fresh();
+    for( int i = 0; i < PERPAGE + 5; i++ )
+        put(24, 10);
+    cutEach(STEP_SENT, 0, "SENT record");
+}
+
+static void erased (void) {
+    fresh();
+    for( int i = 0; i < 2 * PERPAGE + 10; i++ )
+        put(24, 10);
+    // one record per frame: the SENT records in page 2 point into page 0
+    CHECK(frame(5 + 24, 1) == 1, "frame of one record");
+    CHECK(frame(5 + 24, 1) == 1, "frame of one record");
+    int left = mhead - mtail;
+    // until the ring erases page 0, with the records not sent in it
+    while( dropped == 0 )
+        put(24, 10);
+    CHECK(dropped == PERPAGE - 2, "%u records dropped, %d not sent in the page", dropped, PERPAGE - 2);
+    CHECK(left > PERPAGE, "%d records", left);
+    reset();
+    drain();
+    printf("backlog: SENT record into an erased page, %u records dropped\n", dropped);
+}
+
+static void limits (void) {
+    u1_t buf[255];
+    rec_t big = next(BACKLOG_MAXREC + 1, 1);
+
+    fresh();
+    CHECK(LMIC_backlogFrame(buf, 255) == 0, "frame of an empty ring");
+    LMIC_backlogSent();         // nothing to do
+    CHECK(!LMIC_backlogPut(big.time, big.data, big.len), "record of %d bytes stored", big.len);
+    CHECK(LMIC_backlogCount() == 0, "record of %d bytes counted", big.len);
+
+    put(BACKLOG_MAXREC, 10);
+    put(0, 10);
+    put(7, 10);
+    CHECK(frame(5 + BACKLOG_MAXREC - 1, 0) == 0, "oldest record does not fit");
+    CHECK(frame(5 + BACKLOG_MAXREC, 0) == 1, "exact fit of the oldest record");
+    CHECK(frame(5 + BACKLOG_MAXREC + 3 + 0, 0) == 2, "empty record after the first");
+    CHECK(frame(5 + BACKLOG_MAXREC + 3 + 0 + 3 + 7 - 1, 0) == 2, "third record one byte short");
+    CHECK(frame(5 + BACKLOG_MAXREC + 3 + 0 + 3 + 7, 1) == 3, "exact fit of three records");
+    LMIC_backlogSent();         // frame sent already, no second SENT
+    CHECK(LMIC_backlogCount() == 0, "%u records after the frame", LMIC_backlogCount());
+
+    // a gap of more than 0xFFFF s ends the frame, the next one has the time
+    put(3, 10);
+    put(3, 0xFFFF);
+    put(3, 0x10000);
+    put(3, 1);
+    CHECK(frame(255, 1) == 2, "gap of 0xFFFF s");
+    CHECK(frame(255, 1) == 2, "after the gap of 0x10000 s");
+
+    // the largest frame: records of 0 bytes up to 255
+    for( int i = 0; i < 100; i++ )
+        put(0, 1);
+    CHECK(frame(255, 1) == 1 + (255 - 5) / 3, "frame of empty records");
+    reset();
+    drain();
+    printf("backlog: frame limits\n");
+}
+
+int main (void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_reset();
+    os_init(NULL);
+    wrap();
+    torn();
+    erased();
+    limits();
+    if( errors ) {
+        printf("backlog: %d checks failed\n", errors);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Host benchmark of the LMIC hot paths: AES MIC/CTR, airtime, building an
+ * uplink frame (cipher and MIC), decoding downlinks full of MAC commands,
+ * join accept processing with a CFList, channel selection and the job
+ * scheduler. lmic.c is included to reach its static functions.
+ *
+ * Every result is printed as one line, as the target sketch
+ * (examples/benchmark) does:
+ *
+ *   BENCH,<name>,<iterations>,<ns/op>,<allocations>,<allocated bytes>
+ *
+ * test/bench/compare.py compares the lines with baseline.csv. The AES
+ * engine is the one of the build (target-config.h, -DUSE_ORIGINAL_AES),
+ * test/Makefile builds both and runs the second one with -a (AES only).
+ * nextTx runs in a region with dynamic channels (EU868) and in one with
+ * fixed channels (AU915).
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "lmic.c"       // decodeFrame(), buildDataFrame(), processJoinAccept()
+
+#define REPEAT 9        // runs per benchmark, the fastest counts
+
+#if defined(USE_IDEETRON_AES)
+static const char* aes_engine = "ideetron";
+#elif defined(USE_ORIGINAL_AES)
+static const char* aes_engine = "original";
+#else
+static const char* aes_engine = "other";
+#endif
+
+// MAC commands of the downlinks: LinkCheckAns, LinkADRReq (DR5, ch 0-2),
+// DevStatusReq, DutyCycleReq, RXTimingSetupReq in FOpts (15 bytes) ...
+static const u1_t FOPTS[] = {
+    MCMD_LCHK_ANS, 20, 2,
+    MCMD_LADR_REQ, 0x50, 0x07, 0x00, 0x01,
+    MCMD_DEVS_REQ,
+    MCMD_DCAP_REQ, 0,
+    MCMD_RXTM_REQ, 1,
+    MCMD_DCAP_REQ, 0,
+};
+// ... and NewChannelReq for channels 3-7, RXParamSetupReq and DlChannelReq
+// in a port 0 payload
+static const u1_t MACPAYLOAD[] = {
+    MCMD_SNCH_REQ, 3, 0x18, 0x4F, 0x84, 0x50,   // 867.1 MHz, DR0-5
+    MCMD_SNCH_REQ, 4, 0xE8, 0x56, 0x84, 0x50,
+    MCMD_SNCH_REQ, 5, 0xB8, 0x5E, 0x84, 0x50,
+    MCMD_SNCH_REQ, 6, 0x88, 0x66, 0x84, 0x50,
+    MCMD_SNCH_REQ, 7, 0x58, 0x6E, 0x84, 0x50,
+    MCMD_DN2P_SET, 0x00, 0xD2, 0xAD, 0x84,      // RX2 DR0 869.525 MHz
+    MCMD_DNFQ_REQ, 3, 0x18, 0x4F, 0x84,
+};
+
+static u1_t buf[MAX_LEN_FRAME];
+static u1_t region;             // index of os_getRegion()
+static osjob_t jobs[16];
+static unsigned jobsrun;
+
+// ----------------------------------------
+// ALLOCATIONS (linked with -Wl,--wrap=malloc,...)
+
+static unsigned long allocs, allocbytes;
+
+void* __real_malloc (size_t n);
+void* __real_calloc (size_t n, size_t m);
+void* __real_realloc (void* p, size_t n);
+
+void* __wrap_malloc (size_t n) {
+    allocs++;
+    allocbytes += n;
+    return __real_malloc(n);
+}
+
+void* __wrap_calloc (size_t n, size_t m) {
+    allocs++;
+    allocbytes += n * m;
+    return __real_calloc(n, m);
+}
+
+void* __wrap_realloc (void* p, size_t n) {
+    allocs++;
+    allocbytes += n;
+    return __real_realloc(p, n);
+}
+
+// ----------------------------------------
+// APPLICATION CALLBACKS
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(region); }
+
+void onLmicEvent (ev_t ev) {
+    (void)ev; // unused
+}
+
+static void job_func (osjob_t* job) {
+    (void)job; // unused
+    jobsrun++;
+}
+
+// ----------------------------------------
+// RUNNER
+
+static u8_t nsnow (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);   // CPU time, not preemption
+    return (u8_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report (const char* name, u4_t iterations, u8_t ns, unsigned long na, unsigned long nb) {
+    printf("BENCH,%s,%u,%llu,%lu,%lu\n", name, iterations,
+           (unsigned long long) (ns / iterations), na, nb);
+}
+
+// Run stmt for n iterations REPEAT times and report the fastest run
+#define BENCH(name, n, stmt) do {                                   \
+        u8_t best = ~(u8_t) 0;                                      \
+        unsigned long a0 = allocs, b0 = allocbytes;                 \
+        for( int rep = 0; rep < REPEAT; rep++ ) {                   \
+            u8_t t0 = nsnow();                                      \
+            for( u4_t it = 0; it < (n); it++ ) { stmt; }            \
+            u8_t t1 = nsnow();                                      \
+            if( t1 - t0 < best )                                    \
+                best = t1 - t0;                                     \
+        }                                                           \
+        report(name, n, best, (allocs - a0) / REPEAT,               \
+               (allocbytes - b0) / REPEAT);                         \
+    } while (0)
+
+// ----------------------------------------
+// FRAMES
+
+static void decode (const u1_t* f, u1_t len) {
+    os_copyMem(LMIC.frame, f, len);
+    LMIC.dataLen = len;
+    LMIC.seqnoDn = 7;
+    LMIC.txrxFlags = TXRX_DNW1;
+    if( !decodeFrame() )
+        hal_failed();
+}
+
+// ----------------------------------------
+// BENCHMARKS
+
+static void bench_aes (void) {
+    static const u1_t sizes[] = { 16, 51, 115, 242 };
+    char name[32];
+
+    for( unsigned i = 0; i < sizeof(sizes); i++ ) {
+        u1_t len = sizes[i];
+        snprintf(name, sizeof(name), "aes_mic_%s_%u", aes_engine, len);
+        BENCH(name, 5000, { memcpy(AESkey, host_key, 16); memset(AESaux, 0x49, 16); os_aes(AES_MIC, buf, len); });
+        snprintf(name, sizeof(name), "aes_ctr_%s_%u", aes_engine, len);
+        BENCH(name, 5000, { memcpy(AESkey, host_key, 16); memset(AESaux, 0x01, 16); os_aes(AES_CTR, buf, len); });
+    }
+}
+
+static void bench_airtime (void) {
+    char name[32];
+
+    for( dr_t dr = 0; dr <= 5; dr++ ) {
+        volatile rps_t rps = LMIC_updr2rps(dr);     // not hoisted out of the loop
+        volatile u1_t plen = 51;
+        volatile ostime_t t;
+        snprintf(name, sizeof(name), "calcAirTime_dr%u", dr);
+        BENCH(name, 200000, { t = LMIC_calcAirTime(rps, plen); });
+        (void)t;
+    }
+}
+
+// Whole uplink frame: header, FOpts, cipher of the payload and MIC
+static void bench_dataframe (void) {
+    LMIC.pendTxPort = 1;
+    LMIC.pendTxLen  = 51;
+    LMIC.pendTxConf = 0;
+    LMIC.opmode |= OP_TXDATA;
+    BENCH("buildDataFrame_51", 10000, {
+        LMIC.foptsUpLen = 0;
+        buildDataFrame();
+    });
+    LMIC.opmode &= ~OP_TXDATA;
+    BENCH("lce_addMic_64", 10000, {
+        lce_addMic(LCE_NWKSKEY, LMIC.devaddr, it, LMIC.frame, 60);
+    });
+}
+
+// Downlinks with MAC commands in FOpts and in a port 0 payload
+static void bench_decode (void) {
+    u1_t f1[MAX_LEN_FRAME], f2[MAX_LEN_FRAME], f3[MAX_LEN_FRAME];
+    u1_t l1 = host_buildDown(f1, HOST_DEVADDR, 7, FOPTS, sizeof(FOPTS), 1, buf, 20);
+    u1_t l2 = host_buildDown(f2, HOST_DEVADDR, 7, NULL, 0, 0, MACPAYLOAD, sizeof(MACPAYLOAD));
+    u1_t l3 = host_buildDown(f3, HOST_DEVADDR, 7, NULL, 0, 1, buf, 51);
+
+    BENCH("decodeFrame_fopts15_data20", 10000, { decode(f1, l1); });
+    BENCH("decodeFrame_port0_mac37", 10000, { decode(f2, l2); });
+    BENCH("decodeFrame_data51", 10000, { decode(f3, l3); });
+}
+
+static void bench_joinaccept (void) {
+    BENCH("lce_processJoinAccept_cflist", 10000, {
+        memcpy(buf, host_jacc, LEN_JAEXT);
+        if( !lce_processJoinAccept(buf, LEN_JAEXT, 1) )
+            hal_failed();
+    });
+    // MAC side: keys, DevAddr, RX settings and the CFList channels
+    BENCH("processJoinAccept_cflist", 10000, {
+        memcpy(LMIC.frame, host_jacc, LEN_JAEXT);
+        LMIC.dataLen = LEN_JAEXT;
+        LMIC.txrxFlags = TXRX_DNW1;
+        LMIC.opmode |= OP_JOINING | OP_TXRXPEND;
+        if( !processJoinAccept() )
+            hal_failed();
+    });
+}
+
+// Channel selection of the next uplink (OP_NEXTCHNL as after a TX)
+static void bench_nexttx (const char* name) {
+    volatile ostime_t t;
+    BENCH(name, 200000, { LMIC.opmode |= OP_NEXTCHNL; t = LMIC_nextTx(os_getTime()); });
+    (void)t;
+}
+
+static void bench_scheduler (void) {
+    BENCH("sched_16jobs", 10000, {
+        ostime_t now = os_getTime();
+        jobsrun = 0;
+        for( unsigned j = 0; j < 16; j++ )
+            os_setTimedCallback(&jobs[j], now + (j * 7) % 16, job_func);
+        while( jobsrun < 16 )
+            os_runstep();
+    });
+}
+
+static void session (u1_t regionIdx) {
+    region = regionIdx;
+    LMIC_reset();
+    LMIC_setSession(0x13, HOST_DEVADDR, host_key, host_key);
+    // Avoid the MAC engine running jobs between benchmarks
+    LMIC_shutdown();
+}
+
+int main (int argc, char** argv) {
+    bit_t aesonly = 0;
+    int opt;
+
+    while( (opt = getopt(argc, argv, "a")) != -1 ) {
+        switch( opt ) {
+        case 'a': aesonly = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-a]\n", argv[0]);
+            return 2;
+        }
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_reset();
+    os_init(NULL);
+    session(0);
+
+    bench_aes();
+    if( aesonly )
+        return 0;
+    bench_airtime();
+    bench_dataframe();
+    bench_decode();
+    bench_joinaccept();
+    session(0);
+    bench_nexttx("nextTx_dyn");
+#ifdef CFG_au915
+    session(LMIC_regionIdx(REGCODE_AU915));
+    for( u1_t ch = 0; ch < 72; ch++ ) {         // channels 8-15 as src/main.cpp
+        if( ch < 8 || ch > 15 )
+            LMIC_disableChannel(ch);
+    }
+    bench_nexttx("nextTx_fix");
+#endif
+    bench_scheduler();
+    return 0;
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Compare benchmark results with a baseline.
+
+Reads the BENCH lines of the host benchmark (test/Makefile, make bench) or
+of the target sketch (examples/benchmark, serial log), other lines are
+skipped:
+
+  BENCH,<name>,<iterations>,<ns/op>,<allocations>,<allocated bytes>
+
+and compares them with the baseline CSV (same columns, without the BENCH
+tag). A benchmark is a regression if its time per operation grew by more
+than --tolerance percent and by more than --slack nanoseconds (rounding of
+the fastest operations), or if it allocates more than before; the exit
+status is then 1. Benchmarks missing on either side are listed.
+
+  ./build/bench/bench | bench/compare.py - bench/baseline.csv
+  bench/compare.py serial.log bench/baseline-wle5.csv --update
+
+--update writes the results as the new baseline. Only compare results of
+the same machine (or board) and build flags, the committed baseline.csv
+is from the host build with the default CFLAGS. On a shared or virtual
+machine the timing varies by some 30 %, give it a larger --tolerance there.
+"""
+
+import argparse
+import csv
+import sys
+
+FIELDS = ("name", "iterations", "ns_op", "allocs", "bytes")
+
+
+def read_results(f):
+    res = {}
+    for line in f:
+        line = line.strip()
+        if not line.startswith("BENCH,"):
+            continue
+        parts = line.split(",")
+        if len(parts) != 6:
+            sys.exit("compare: bad line: %s" % line)
+        res[parts[1]] = {"iterations": int(parts[2]), "ns_op": int(parts[3]),
+                         "allocs": int(parts[4]), "bytes": int(parts[5])}
+    return res
+
+
+def read_baseline(path):
+    with open(path) as f:
+        return {r["name"]: {k: int(r[k]) for k in FIELDS[1:]} for r in csv.DictReader(f)}
+
+
+def write_baseline(path, res):
+    with open(path, "w", newline="") as f:
+        w = csv.writer(f, lineterminator="\n")
+        w.writerow(FIELDS)
+        for name, r in res.items():
+            w.writerow([name] + [r[k] for k in FIELDS[1:]])
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("results", help="benchmark output, - for stdin")
+    ap.add_argument("baseline", help="baseline CSV")
+    ap.add_argument("--tolerance", type=float, default=20, help="allowed slowdown [%%]")
+    ap.add_argument("--slack", type=int, default=2, help="allowed slowdown [ns/op]")
+    ap.add_argument("--update", action="store_true", help="write the results as baseline")
+    args = ap.parse_args()
+
+    if args.results == "-":
+        res = read_results(sys.stdin)
+    else:
+        with open(args.results) as f:
+            res = read_results(f)
+    if not res:
+        sys.exit("compare: no BENCH lines")
+    if args.update:
+        write_baseline(args.baseline, res)
+        print("compare: %d results written to %s" % (len(res), args.baseline))
+        return 0
+
+    base = read_baseline(args.baseline)
+    bad = 0
+    print("%-32s %10s %10s %8s %7s" % ("benchmark", "base ns", "ns", "change", "allocs"))
+    for name, r in res.items():
+        b = base.get(name)
+        if b is None:
+            print("%-32s %10s %10d %8s %7d  new" % (name, "-", r["ns_op"], "-", r["allocs"]))
+            continue
+        change = 100.0 * (r["ns_op"] - b["ns_op"]) / max(b["ns_op"], 1)
+        flags = []
+        if change > args.tolerance and r["ns_op"] - b["ns_op"] > args.slack:
+            flags.append("SLOWER")
+        if r["allocs"] > b["allocs"] or r["bytes"] > b["bytes"]:
+            flags.append("ALLOCS")
+        bad += bool(flags)
+        print("%-32s %10d %10d %+7.1f%% %7d  %s" % (name, b["ns_op"], r["ns_op"], change,
+                                                    r["allocs"], " ".join(flags)))
+    for name in base:
+        if name not in res:
+            print("%-32s missing" % name)
+    if bad:
+        print("compare: %d regressions" % bad)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
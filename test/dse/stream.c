@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Data streaming engine (lmic/dse.c, CFG_dse) with tools/lns/lns.py --dse
+ * as the receiver. The host radio is the virtual gateway of lns.c, losing
+ * a share of the uplinks (host_upLoss).
+ *
+ *   stream [-p port] [-s size] [-r redundancy] [-l loss] [-D dr] [-d n:dr] dir
+ *
+ * After the OTAA join a stream of size bytes is sent at DR dr with
+ * redundancy % coded frames per block, loss per mille of the uplinks are
+ * lost. -d lowers the data rate after n frames of the stream, as the ADR
+ * backoff does, so the block in progress restarts with smaller symbols
+ * under the same block number. The stream must be saved by lns.py (in its
+ * directory dir) unchanged. Printed are the frames sent, the virtual time
+ * from the start to the last frame and the goodput, stream bytes per
+ * second of it under the duty cycle.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "lmic.c"
+
+#define DSEPORT   10                        // lns.py --dse
+#define MAXSIZE   65536
+#define MAXTIME   sec2osticks(7 * 86400)    // virtual time limit
+
+static u1_t      data[MAXSIZE];
+static u4_t      size = 4000;
+static u1_t      redundancy = 25;
+static u2_t      loss;
+static dr_t      dr = EU868_DR_SF7;
+static u4_t      dropAfter;     // frames of the stream before the DR drop
+static dr_t      dropDr;
+static u4_t      frames;        // frames of the stream completed
+static u4_t      sent;          // as reported to done
+static osxtime_t t0, t1;
+static bit_t     joined;
+static bit_t     done;
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+
+static void streamDone (u4_t n) {
+    sent = n;
+    t1 = host_now;
+    done = 1;
+}
+
+void onLmicEvent (ev_t ev) {
+    switch( ev ) {
+    case EV_JOINED:
+        joined = 1;
+        LMIC_setAdrMode(0);
+        LMIC_setLinkCheckMode(0);
+        LMIC_setDrTxpow(dr, KEEP_TXPOWADJ);
+        host_upLoss = loss;
+        t0 = host_now;
+        LMIC_dseStart(DSEPORT, data, size, redundancy, streamDone);
+        break;
+    case EV_TXCOMPLETE:
+        if( !joined || done )
+            break;
+        if( ++frames == dropAfter ) {
+            printf("dse: DR%d -> DR%d after %u frames\n", LMIC.datarate, dropDr, frames);
+            LMIC_setDrTxpow(dropDr, KEEP_TXPOWADJ);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// The stream as saved by lns.py, 0 if it is not there or differs
+static int received (const char* dir) {
+    char path[512];
+    u1_t buf[MAXSIZE + 1];
+    snprintf(path, sizeof(path), "%s/dse-%08X-%d.bin", dir, LMIC.devaddr, DSE.stream);
+    // lns.py saves it when it gets the frame, give it the time
+    for( int i = 0; i < 20; i++ ) {
+        FILE* f = fopen(path, "rb");
+        if( f ) {
+            size_t n = fread(buf, 1, sizeof(buf), f);
+            fclose(f);
+            return n == size && memcmp(buf, data, size) == 0;
+        }
+        usleep(100000);
+    }
+    return 0;
+}
+
+int main (int argc, char** argv) {
+    int port = 1700;
+    int opt;
+
+    while( (opt = getopt(argc, argv, "p:s:r:l:D:d:")) != -1 ) {
+        switch( opt ) {
+        case 'p': port = atoi(optarg); break;
+        case 's': size = atoi(optarg); break;
+        case 'r': redundancy = atoi(optarg); break;
+        case 'l': loss = atoi(optarg); break;
+        case 'D': dr = atoi(optarg); break;
+        case 'd':
+            if( sscanf(optarg, "%u:%hhu", &dropAfter, &dropDr) != 2 )
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if( optind + 1 != argc || size == 0 || size > MAXSIZE || loss >= 1000 ) {
+    usage:
+        fprintf(stderr, "usage: %s [-p port] [-s size] [-r redundancy] [-l loss] [-D dr] [-d n:dr] dir\n", argv[0]);
+        return 2;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_reset();
+    os_init(NULL);
+    for( u4_t i = 0, x = 0x2545F491; i < size; i++ ) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = x;
+    }
+    if( host_forwarder("127.0.0.1", port) < 0 )
+        return 2;
+    LMIC_reset();
+    LMIC_startJoining();
+    while( !done && !host_idle && host_now < MAXTIME )
+        host_runUntil(host_now + sec2osticks(1));
+    if( !joined ) {
+        printf("dse: no join accept\n");
+        return 1;
+    }
+    if( !done || LMIC_dseActive() ) {
+        printf("dse: stream not sent in time, %u frames\n", frames);
+        return 1;
+    }
+    double secs = (double) (t1 - t0) / OSTICKS_PER_SEC;
+    printf("dse: %u bytes in %u frames, %.0f s, goodput %.1f B/s, %u per mille lost\n",
+           size, sent, secs, size / secs, loss);
+    if( !received(argv[optind]) ) {
+        printf("dse: stream not received by lns.py\n");
+        return 1;
+    }
+    printf("dse: stream received unchanged\n");
+    return 0;
+}
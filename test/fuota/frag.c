@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Fragmented data block transport (lmic/fuota.c, CFG_fuota) on the host
+ * flash, with the frames of tools/lns/frag.py --frames:
+ *
+ *   fuota frames.hex block.bin
+ *
+ * The frames are the setup request and the fragments that were not lost,
+ * one payload on FUOTA_PORT per line in hex. They are received by
+ * multicast group 0 (the McGroupBitMask of frag.py), every 7th one by
+ * unicast. The first fragment is also received by group 1 first, which
+ * must be ignored. Between two frames the erase or compaction job gets one
+ * run. The program fails if the data block in flash is not block.bin or
+ * if it needs other fragments than the decoder model of frag.py
+ * ("# complete" line).
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "lmic.c"
+#include "fuota.h"
+#include "peripherals.h"
+
+#define AREA_SIZE   0x1B800     // FUOTA_AREA_SIZE of src/main.cpp
+
+static u1_t area[AREA_SIZE] __attribute__((aligned(FLASH_PAGE_SZ)));
+static u4_t donelen;
+static u4_t donedesc;
+static int  donecnt;
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+void onLmicEvent (ev_t ev) { (void)ev; }
+
+static void done (const u1_t* data, u4_t len, u4_t descriptor) {
+    if( data == area ) {
+        donelen  = len;
+        donedesc = descriptor;
+    }
+    donecnt++;
+}
+
+static int hex (u1_t* buf, const char* s, int max) {
+    int n = 0;
+    unsigned int b;
+    while( n < max && sscanf(s + 2 * n, "%2x", &b) == 1 )
+        buf[n++] = b;
+    return n;
+}
+
+static int rx (const u1_t* frame, int len, int group) {
+    u1_t ans[16];
+    return LMIC_fuotaRx(frame, len, group, ans, sizeof(ans));
+}
+
+int main (int argc, char** argv) {
+    static u1_t block[AREA_SIZE];
+    char line[2 * 256 + 8];
+    u1_t frame[256];
+    u1_t ans[16];
+    int  frames = 0, complete = -1, last = 0, nbfrag = 0, fragsz = 0;
+
+    if( argc != 3 ) {
+        fprintf(stderr, "usage: %s frames.hex block.bin\n", argv[0]);
+        return 2;
+    }
+    FILE* f = fopen(argv[2], "rb");
+    if( f == NULL ) {
+        perror(argv[2]);
+        return 2;
+    }
+    size_t size = fread(block, 1, sizeof(block), f);
+    fclose(f);
+    if( (f = fopen(argv[1], "r")) == NULL ) {
+        perror(argv[1]);
+        return 2;
+    }
+
+    host_reset();
+    os_init(NULL);
+    memset(area, 0x5A, sizeof(area));   // not erased
+    LMIC_fuotaInit(area, sizeof(area), done);
+
+    while( fgets(line, sizeof(line), f) ) {
+        if( line[0] == '#' ) {
+            sscanf(line, "# complete %d", &complete);
+            continue;
+        }
+        int len = hex(frame, line, sizeof(frame));
+        if( len == 0 )
+            continue;
+        if( frames++ == 0 ) {
+            // setup request
+            if( LMIC_fuotaRx(frame, len, 0, ans, sizeof(ans)) != 2 || (ans[1] & 0x0F) ) {
+                printf("fuota: setup rejected\n");
+                return 1;
+            }
+            nbfrag = os_rlsbf2(frame + 2);
+            fragsz = frame[4];
+            continue;
+        }
+        if( LMIC_fuotaState() != FUOTA_RECEIVING || LMIC_fuotaMissing() == 0 )
+            continue;   // complete, the rest is not needed
+        if( frames == 2 ) {
+            u2_t missing = LMIC_fuotaMissing();
+            rx(frame, len, 1);
+            if( LMIC_fuotaMissing() != missing ) {
+                printf("fuota: fragment of group 1 not ignored\n");
+                return 1;
+            }
+        }
+        rx(frame, len, frames % 7 == 0 ? -1 : 0);
+        last = os_rlsbf2(frame + 1) & 0x3FFF;
+        os_runstep();
+    }
+    fclose(f);
+    host_runUntil(host_now + sec2osticks(10));  // compaction
+
+    if( LMIC_fuotaState() != FUOTA_DONE || donecnt != 1 ) {
+        printf("fuota: not complete after %d frames, %u missing\n", frames - 1, LMIC_fuotaMissing());
+        return 1;
+    }
+    printf("fuota: %d fragments of %d bytes, complete after %d (%d coded), "
+           "%u flash operations\n", nbfrag, fragsz, last, last - nbfrag, host_flashOps);
+    if( donelen != size || donedesc != size || memcmp(area, block, size) != 0 ) {
+        printf("fuota: data block differs from %s\n", argv[2]);
+        return 1;
+    }
+    if( complete >= 0 && last != complete ) {
+        printf("fuota: frag.py complete after %d\n", complete);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Fuzz target of the downlink parsers: decodeFrame() with its MAC
+ * commands, processJoinAccept() with lce_processJoinAccept() and the
+ * CFList, and decodeMultiCastFrame(). Built with CFG_fuzz, so MICs are
+ * not checked and join accepts are plaintext (see lce.c). lmic.c is
+ * included to reach its static functions.
+ *
+ * An input is one selector byte and the frame:
+ *
+ *   bits 0-1   0,3 data downlink, 1 join accept, 2 multicast downlink
+ *   bit  2     region index (os_getRegion())
+ *   bit  3     RX2 instead of RX1
+ *
+ * After each frame the MAC state is checked: answers fit into foptsUp,
+ * the payload (dataBeg/dataLen) lies in the frame, the channel map only
+ * enables defined channels and the next channel is a valid one. A failed
+ * check aborts, as a sanitizer finding does.
+ *
+ * Without a fuzzing engine the program runs the corpus files given and
+ * then mutates them (see main()). With LIBFUZZER=1 in test/Makefile it is
+ * a libFuzzer target, AFL runs it with one file: fuzz @@.
+ *******************************************************************************/
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host.h"
+#include "lmic.c"       // decodeFrame(), processJoinAccept(), decodeMultiCastFrame()
+
+#define MCADDR  0x2601AB00
+
+enum { SEL_DATA = 0, SEL_JACC = 1, SEL_MCAST = 2 };
+#define SEL_REGION 0x04
+#define SEL_RX2    0x08
+
+static u1_t region;
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+#if defined(CFG_lorawan11)
+void os_getAppKey (u1_t* b) { memcpy(b, host_key, 16); }
+#endif
+u1_t os_getRegion (void) { return LMIC_regionCode(region); }
+
+void onLmicEvent (ev_t ev) {
+    (void)ev; // unused
+}
+
+#define CHECK(cond) do {                                                \
+        if( !(cond) ) {                                                 \
+            fprintf(stderr, "fuzz: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                    \
+        }                                                               \
+    } while (0)
+
+static void checkChannels (void) {
+#ifdef REG_FIX
+    if( REG_IS_FIX() ) {
+        u1_t nch = REGION.numChBlocks * 8 + REGION.numChBlocks;   // 125 kHz and 500 kHz
+        for( u1_t ch = nch; ch < CHMAP_SZ * 16; ch++ )
+            CHECK((LMIC.fix.channelMap[ch >> 4] & (1 << (ch & 0xF))) == 0);
+        CHECK(LMIC.txChnl < nch);
+        return;
+    }
+#endif
+#ifdef REG_DYN
+    for( u1_t ch = 0; ch < MAX_DYN_CHNLS; ch++ ) {
+        if( LMIC.dyn.channelMap & (1 << ch) )
+            CHECK(LMIC.dyn.chUpFreq[ch] != 0);
+    }
+    CHECK(LMIC.txChnl < MAX_DYN_CHNLS);
+#endif
+}
+
+// New session before every input, so that inputs do not depend on each other
+static void setup (u1_t sel) {
+    static bit_t init;
+    if( !init ) {
+        host_reset();
+        os_init(NULL);
+        init = 1;
+    }
+    region = (sel & SEL_REGION) ? 1 % REGIONS_COUNT : 0;
+    LMIC_reset();
+#if defined(CFG_lorawan11)
+    LMIC_setSession(0x13, HOST_DEVADDR, host_key, host_key, host_key);
+#else
+    LMIC_setSession(0x13, HOST_DEVADDR, host_key, host_key);
+#endif
+    LMIC_setMultiCastSession(MCADDR, host_key, host_key, 0);
+    LMIC.seqnoDn = 0;
+    LMIC.txend   = os_getTime();
+    LMIC.rxtime0 = LMIC.txend + sec2osticks(LMIC.dn1Dly);
+    LMIC.txrxFlags = (sel & SEL_RX2) ? TXRX_DNW2 : TXRX_DNW1;
+}
+
+int LLVMFuzzerTestOneInput (const uint8_t* data, size_t size) {
+    if( size < 2 || size - 1 > MAX_LEN_FRAME )
+        return 0;
+    u1_t sel = data[0];
+    u1_t len = size - 1;
+
+    setup(sel);
+    os_copyMem(LMIC.frame, data + 1, len);
+    LMIC.dataLen = len;
+
+    bit_t ok;
+    switch( sel & 3 ) {
+    case SEL_JACC:
+        LMIC.opmode |= OP_JOINING | OP_TXRXPEND;
+        ok = processJoinAccept();
+        break;
+    case SEL_MCAST:
+        ok = decodeMultiCastFrame();
+        break;
+    default:
+        ok = decodeFrame();
+        break;
+    }
+    if( ok && (sel & 3) != SEL_JACC ) {
+        CHECK(LMIC.dataBeg >= OFF_DAT_OPTS);
+        CHECK(LMIC.dataBeg + LMIC.dataLen <= len - 4);
+    }
+    CHECK(LMIC.foptsUpLen <= sizeof(LMIC.foptsUp));
+    checkChannels();
+    // The MAC goes on with the new state: pick the next channel
+    LMIC.opmode &= ~(OP_JOINING | OP_TXRXPEND);
+    LMIC_nextTx(os_getTime());
+    checkChannels();
+    return 0;
+}
+
+#if !defined(FUZZ_NO_MAIN)
+// ----------------------------------------
+// STANDALONE DRIVER
+//
+//   fuzz [-n runs] [-s seed] [-o dir] file|dir ...
+//
+// Runs every file, then -n mutations of them (default 0). An input that
+// fails is written to <dir>/crash-<pid> (default .) before the program
+// aborts.
+
+#define MAX_FUZZINS 1024
+#define MAX_FUZZIN  (MAX_LEN_FRAME + 1)
+
+static struct {
+    u1_t   data[MAX_FUZZIN];
+    size_t len;
+} corpus[MAX_FUZZINS];
+static unsigned ncorpus;
+
+static u1_t       cur[MAX_FUZZIN];
+static size_t     curlen;
+static const char* outdir = ".";
+static u4_t       rnd = 1;
+
+static u4_t rand32 (void) {
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+static void onCrash (int sig) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s/crash-%d", outdir, (int)getpid());
+    FILE* f = fopen(name, "wb");
+    if( f ) {
+        fwrite(cur, 1, curlen, f);
+        fclose(f);
+        fprintf(stderr, "fuzz: input saved to %s\n", name);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void run (const u1_t* data, size_t len) {
+    memcpy(cur, data, len);
+    curlen = len;
+    LLVMFuzzerTestOneInput(cur, curlen);
+}
+
+static void addFile (const char* path) {
+    FILE* f = fopen(path, "rb");
+    if( f == NULL || ncorpus == MAX_FUZZINS ) {
+        fprintf(stderr, "fuzz: cannot add %s\n", path);
+        exit(2);
+    }
+    corpus[ncorpus].len = fread(corpus[ncorpus].data, 1, MAX_FUZZIN, f);
+    fclose(f);
+    run(corpus[ncorpus].data, corpus[ncorpus].len);
+    ncorpus++;
+}
+
+static void addPath (const char* path) {
+    struct stat st;
+    if( stat(path, &st) == 0 && S_ISDIR(st.st_mode) ) {
+        DIR* d = opendir(path);
+        struct dirent* e;
+        char name[1024];
+        while( d && (e = readdir(d)) != NULL ) {
+            if( e->d_name[0] == '.' )
+                continue;
+            snprintf(name, sizeof(name), "%s/%s", path, e->d_name);
+            addFile(name);
+        }
+        if( d )
+            closedir(d);
+    } else {
+        addFile(path);
+    }
+}
+
+// Bit flips, interesting bytes, inserts, deletes and splices of corpus inputs
+static void mutate (u1_t* buf, size_t* len) {
+    static const u1_t magic[] = { 0x00, 0x01, 0x03, 0x0F, 0x10, 0x7F, 0x80, 0xFE, 0xFF };
+    unsigned n = 1 + rand32() % 4;
+    while( n-- ) {
+        size_t pos = *len ? rand32() % *len : 0;
+        switch( rand32() % 6 ) {
+        case 0:
+            if( *len ) buf[pos] ^= 1 << (rand32() % 8);
+            break;
+        case 1:
+            if( *len ) buf[pos] = magic[rand32() % sizeof(magic)];
+            break;
+        case 2:
+            if( *len ) buf[pos] = rand32();
+            break;
+        case 3:
+            if( *len < MAX_FUZZIN ) {
+                memmove(buf + pos + 1, buf + pos, *len - pos);
+                buf[pos] = rand32();
+                *len += 1;
+            }
+            break;
+        case 4:
+            if( *len > 1 ) {
+                memmove(buf + pos, buf + pos + 1, *len - pos - 1);
+                *len -= 1;
+            }
+            break;
+        default: {
+            // tail of another corpus input
+            unsigned o = rand32() % ncorpus;
+            size_t from = corpus[o].len ? rand32() % corpus[o].len : 0;
+            size_t cnt = corpus[o].len - from;
+            if( pos + cnt > MAX_FUZZIN )
+                cnt = MAX_FUZZIN - pos;
+            memcpy(buf + pos, corpus[o].data + from, cnt);
+            *len = pos + cnt;
+            break;
+        }
+        }
+    }
+}
+
+int main (int argc, char** argv) {
+    unsigned long runs = 0;
+    int opt;
+
+    while( (opt = getopt(argc, argv, "n:s:o:")) != -1 ) {
+        switch( opt ) {
+        case 'n': runs = strtoul(optarg, NULL, 0); break;
+        case 's': rnd = strtoul(optarg, NULL, 0) | 1; break;
+        case 'o': outdir = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-n runs] [-s seed] [-o dir] file|dir ...\n", argv[0]);
+            return 2;
+        }
+    }
+    signal(SIGABRT, onCrash);
+    signal(SIGSEGV, onCrash);
+
+    for( int i = optind; i < argc; i++ )
+        addPath(argv[i]);
+    printf("fuzz: %u inputs ok\n", ncorpus);
+    if( runs && ncorpus == 0 ) {
+        fprintf(stderr, "fuzz: no inputs to mutate\n");
+        return 2;
+    }
+    for( unsigned long r = 0; r < runs; r++ ) {
+        u1_t buf[MAX_FUZZIN];
+        unsigned c = rand32() % ncorpus;
+        size_t len = corpus[c].len;
+        memcpy(buf, corpus[c].data, len);
+        mutate(buf, &len);
+        run(buf, len);
+    }
+    if( runs )
+        printf("fuzz: %lu mutations ok\n", runs);
+    return 0;
+}
+#endif // !defined(FUZZ_NO_MAIN)
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Seed corpus of the fuzz target (fuzz.c), built with the frame code of
+the network server in tools/lns.
+
+  seeds.py <dir>
+
+Every file is one input: the selector byte of fuzz.c and the frame. Data
+and multicast downlinks are encrypted and MIC'd with the session of
+fuzz.c, the join accepts are plaintext (CFG_fuzz skips their decryption).
+"""
+
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "tools", "lns"))
+
+import frag            # noqa: E402
+import lns             # noqa: E402
+import lwcrypto as lc  # noqa: E402
+import mcast           # noqa: E402
+
+KEY = bytes.fromhex("2B7E151628AED2A6ABF7158809CF4F3C")
+DEVADDR = 0x26011234
+MCADDR = 0x2601AB00
+
+SEL_DATA, SEL_JACC, SEL_MCAST = 0, 1, 2
+SEL_REGION, SEL_RX2 = 0x04, 0x08   # region 0 EU868, 1 AU915 (target-config.h)
+
+
+def freq3(mhz):
+    return int(round(mhz * 10000)).to_bytes(3, "little")
+
+
+# MAC commands as lns.py queues them
+def link_adr(dr, txpow, chmask, chmaskcntl=0, nbtrans=1):
+    return bytes([0x03, dr << 4 | txpow]) + chmask.to_bytes(2, "little") + bytes([chmaskcntl << 4 | nbtrans])
+
+
+def new_channel(chidx, mhz, mindr=0, maxdr=5):
+    return bytes([0x07, chidx]) + freq3(mhz) + bytes([maxdr << 4 | mindr])
+
+
+def dl_channel(chidx, mhz):
+    return bytes([0x0A, chidx]) + freq3(mhz)
+
+
+def rx_param_setup(rx1droff, rx2dr, mhz):
+    return bytes([0x05, rx1droff << 4 | rx2dr]) + freq3(mhz)
+
+
+LINK_CHECK_ANS = bytes([0x02, 20, 2])
+DEV_STATUS_REQ = bytes([0x06])
+DUTY_CYCLE_REQ = bytes([0x04, 0])
+RX_TIMING_REQ = bytes([0x08, 1])
+DEVICE_TIME_ANS = bytes([0x0D]) + (1300000000).to_bytes(4, "little") + bytes([0x80])
+ADR_PARAM_REQ = bytes([0x0C, 0x53])
+
+
+def data(fcnt, port=None, payload=b"", fopts=b"", devaddr=DEVADDR, **kw):
+    return lns.Server.build_data(None, devaddr, KEY, KEY, fcnt, port, payload, fopts=fopts, **kw)
+
+
+def join_accept(dlset=0x00, rxdly=lns.RX_DELAY, cflist=None):
+    msg = (bytes([0x20]) + bytes([1, 2, 3]) + lns.NETID.to_bytes(3, "little")
+           + DEVADDR.to_bytes(4, "little") + bytes([dlset, rxdly]) + (cflist or b""))
+    return msg + lc.join_mic(KEY, msg)
+
+
+def seeds():
+    eu_cflist = b"".join(freq3(f) for f in lns.CFLIST_FREQS) + b"\0"
+    au_cflist = (0xFF00).to_bytes(2, "little") + bytes(8) + bytes([0x01, 0, 0, 0, 0, 1])
+    eu_channels = b"".join(new_channel(3 + i, f) for i, f in enumerate(lns.CFLIST_FREQS))
+    au_adr = link_adr(2, 0, 0xFF00, 0) + link_adr(2, 0, 0x0000, 1) + link_adr(2, 0, 0x0001, 4)
+
+    yield "data-empty", SEL_DATA, data(1)
+    yield "data-app", SEL_DATA, data(1, 1, b"hello")
+    yield "data-ack-fpending", SEL_DATA, data(2, 1, b"\x01\x02", ack=True, fpending=True)
+    yield "data-confirmed", SEL_DATA, data(3, 10, bytes(51), confirmed=True)
+    yield "data-fopts", SEL_DATA, data(4, 1, bytes(20), LINK_CHECK_ANS + link_adr(5, 0, 0x0007)
+                                       + DEV_STATUS_REQ + DUTY_CYCLE_REQ + RX_TIMING_REQ)
+    yield "data-fopts-time", SEL_DATA | SEL_RX2, data(5, None, b"", DEVICE_TIME_ANS + ADR_PARAM_REQ)
+    yield "data-port0-channels", SEL_DATA, data(6, 0, eu_channels + rx_param_setup(0, 0, 869.525)
+                                               + dl_channel(3, 867.1))
+    yield "data-port0-adr-block", SEL_DATA, data(7, 0, eu_channels + link_adr(5, 1, 0x00FF)
+                                                + link_adr(5, 1, 0x00FF))
+    yield "data-au-adr", SEL_DATA | SEL_REGION, data(8, 0, au_adr)
+    yield "data-frag-setup", SEL_DATA, data(9, frag.PORT, frag.setup_req(16, 50, 0))
+    yield "data-mcast-setup", SEL_DATA, data(10, mcast.PORT, mcast.group_setup_req(
+        KEY, 0, MCADDR, KEY, 0, 1000))
+    yield "jacc", SEL_JACC, join_accept()
+    yield "jacc-cflist", SEL_JACC, join_accept(0x00, 1, eu_cflist)
+    yield "jacc-cflist-rx2", SEL_JACC | SEL_RX2, join_accept(0x23, 5, eu_cflist)
+    yield "jacc-optneg", SEL_JACC, join_accept(0x80, 1, eu_cflist)
+    yield "jacc-au-chmask", SEL_JACC | SEL_REGION, join_accept(0x08, 1, au_cflist)
+    yield "mcast-app", SEL_MCAST, data(0, 200, b"multicast", devaddr=MCADDR)
+    yield "mcast-frag", SEL_MCAST | SEL_RX2, data(5, frag.PORT, frag.data_fragment(1, 1, bytes(50)),
+                                                  devaddr=MCADDR)
+    yield "mcast-noport", SEL_MCAST, data(1, devaddr=MCADDR)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.split("\n\n")[1])
+    os.makedirs(sys.argv[1], exist_ok=True)
+    n = 0
+    for name, sel, frame in seeds():
+        with open(os.path.join(sys.argv[1], name), "wb") as f:
+            f.write(bytes([sel]) + frame)
+        n += 1
+    print("seeds: %d inputs in %s" % (n, sys.argv[1]))
+
+
+if __name__ == "__main__":
+    main()
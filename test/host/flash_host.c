@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Host flash on RAM with power cuts (see host.h).
+ *******************************************************************************/
+
+#include "host.h"
+#include "peripherals.h"
+
+u4_t    host_flashOps;
+u4_t    host_flashCut;
+jmp_buf host_flashCutJmp;
+
+static void operation (void) {
+    if( host_flashCut && --host_flashCut == 0 )
+        longjmp(host_flashCutJmp, 1);
+    host_flashOps++;
+}
+
+// Same loop as hal/hal.cpp
+bool flash_write (void* dst, const void* src, unsigned int nwords, bool erase) {
+    const u4_t* s = (const u4_t*)src;
+    u1_t* addr = (u1_t*)dst;
+
+    ASSERT(((uintptr_t)addr & 7) == 0);
+    for( unsigned int i = 0; i < nwords; i += 2, addr += 8 ) {
+        if( erase && ((uintptr_t)addr & (FLASH_PAGE_SZ - 1)) == 0 ) {
+            operation();
+            memset(addr, 0xFF, FLASH_PAGE_SZ);
+        }
+        if( s == NULL )
+            continue;
+        u8_t dw = s[i] | ((u8_t)(i + 1 < nwords ? s[i + 1] : 0xFFFFFFFF) << 32);
+        if( dw == ~(u8_t)0 )
+            continue;
+        u8_t old;
+        memcpy(&old, addr, 8);
+        if( old != ~(u8_t)0 )
+            return false;   // programmed since the erase
+        operation();
+        memcpy(addr, &dw, 8);
+    }
+    return true;
+}
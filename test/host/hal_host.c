@@ -0,0 +1,478 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Host HAL and radio driver with a virtual clock (see host.h).
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "host.h"
+#include "aes.h"
+#include "lce.h"
+
+u8_t  host_now;
+bit_t host_idle;
+u2_t  host_upLoss;
+
+static struct {
+    int     irqlevel;
+    u1_t    batt;
+    u2_t    dnonce;
+    u4_t    rnd;
+    u1_t    txmode;         // current radio operation is a TX
+    u1_t    dnlen;          // queued downlink
+    u1_t    dnframe[MAX_LEN_FRAME];
+    osjob_t job;            // completion of the radio operation
+} H;
+
+void host_reset (void) {
+    memset(&H, 0, sizeof(H));
+    H.batt = MCMD_DEVS_BATT_NOINFO;
+    H.rnd  = 0x2545F491;
+    host_now  = 0;
+    host_idle = 0;
+}
+
+void host_runUntil (osxtime_t t) {
+    host_idle = 0;
+    while( !host_idle && (s8_t) (t - host_now) > 0 )
+        os_runstep();
+    if( (s8_t) (t - host_now) > 0 )
+        host_now = t;
+}
+
+void host_downlink (const u1_t* frame, u1_t len) {
+    H.dnlen = frame ? len : 0;
+    if( frame )
+        memcpy(H.dnframe, frame, len);
+}
+
+const u1_t host_key[16] = {
+    0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+
+const u1_t host_jacc[LEN_JAEXT] = {
+    0x20, 0x66, 0xF1, 0xE7, 0x4E, 0x08, 0x2C, 0xD4, 0x1E, 0x73, 0x85, 0x34, 0x91, 0xA7, 0x80, 0x35,
+    0x49, 0x1A, 0xD7, 0xAB, 0xFD, 0x90, 0xE8, 0x94, 0xD1, 0x19, 0xA9, 0x5C, 0x3F, 0x29, 0x48, 0x1A,
+    0xF4
+};
+
+u1_t host_buildDown (u1_t* f, u4_t devaddr, u4_t seqno, const u1_t* fopts, u1_t olen,
+                     int port, const u1_t* pl, u1_t plen) {
+    u1_t n = OFF_DAT_OPTS;
+    f[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+    os_wlsbf4(f + OFF_DAT_ADDR, devaddr);
+    f[OFF_DAT_FCT] = olen;
+    os_wlsbf2(f + OFF_DAT_SEQNO, seqno);
+    if( olen ) {
+        memcpy(f + n, fopts, olen);
+        n += olen;
+    }
+    if( port >= 0 ) {
+        f[n++] = port;
+        memcpy(f + n, pl, plen);
+        lce_cipher(port == 0 ? LCE_NWKSKEY : LCE_APPSKEY, devaddr, seqno, LCE_SCC_DN, f + n, plen);
+        n += plen;
+    }
+    // MIC with B0 of the downlink direction (see lce_verifyMic)
+    os_clearMem(AESaux, 16);
+    AESaux[0]  = 0x49;
+    AESaux[5]  = 1;
+    AESaux[15] = n;
+    os_wlsbf4(AESaux + 6, devaddr);
+    os_wlsbf4(AESaux + 10, seqno);
+    os_copyMem(AESkey, LMIC.lceCtx.nwkSKey, 16);
+    os_wmsbf4(f + n, os_aes(AES_MIC, f, n));
+    return n + 4;
+}
+
+// ----------------------------------------
+// HAL
+
+void hal_init (void* bootarg) {
+    (void)bootarg; // unused
+}
+
+void hal_watchcount (int cnt) {
+    (void)cnt; // unused
+}
+
+void hal_ant_switch (u1_t val) {
+    (void)val; // unused
+}
+
+bool hal_pin_tcxo (u1_t val) {
+    (void)val; // unused
+    return false;
+}
+
+bool hal_pin_rst (u1_t val) {
+    (void)val; // unused
+    return false;
+}
+
+void hal_pin_busy_wait (void) {
+}
+
+void hal_irqmask_set (int mask) {
+    (void)mask; // unused
+}
+
+void hal_spi_select (int on) {
+    (void)on; // unused
+}
+
+u1_t hal_spi (u1_t outval) {
+    (void)outval; // unused
+    return 0;
+}
+
+void hal_disableIRQs (void) {
+    H.irqlevel++;
+}
+
+void hal_enableIRQs (void) {
+    if( --H.irqlevel < 0 )
+        hal_failed();
+}
+
+// Jump to the target time, there is nothing to wait for
+u1_t hal_sleep (u1_t type, u4_t targettime) {
+    if( type == HAL_SLEEP_FOREVER ) {
+        host_idle = 1;
+        return 1;
+    }
+    s4_t dt = (s4_t) (targettime - (u4_t) host_now);
+    if( dt > 0 )
+        host_now += dt;
+    return 0;
+}
+
+u4_t hal_ticks (void) {
+    return (u4_t) host_now;
+}
+
+u8_t hal_xticks (void) {
+    return host_now;
+}
+
+s2_t hal_subticks (void) {
+    return 0;
+}
+
+void hal_waitUntil (u4_t time) {
+    hal_sleep(HAL_SLEEP_EXACT, time);
+}
+
+u1_t hal_getBattLevel (void) {
+    return H.batt;
+}
+
+void hal_setBattLevel (u1_t level) {
+    H.batt = level;
+}
+
+void hal_failed (void) {
+    fprintf(stderr, "hal_failed at %llu ticks\n", (unsigned long long) host_now);
+    abort();
+}
+
+u4_t hal_dnonce_next (void) {
+    return H.dnonce++;
+}
+
+void hal_logEv (uint8_t evcat, uint8_t evid, uint32_t evparam) {
+    (void)evcat; (void)evid; (void)evparam; // unused
+}
+
+// ----------------------------------------
+// RADIO
+
+static u4_t symTicks (rps_t rps) {
+    if( isFsk(rps) )
+        return us2osticks(160);
+    return ((u4_t) OSTICKS_PER_SEC << (getSf(rps) - SF7 + 7)) / (125000 << getBw(rps));
+}
+
+// ----------------------------------------
+// PACKET FORWARDER (host_forwarder())
+
+#define FWD_VERSION   2
+enum { PUSH_DATA, PUSH_ACK, PULL_DATA, PULL_RESP, PULL_ACK, TX_ACK };
+#define FWD_DNQ       4             // downlinks kept for the next RX windows
+#define FWD_WAIT_ms   1000          // wait for the answer to an uplink (real time)
+#define FWD_TOL_us    400000        // tmst of a downlink vs. the start of the RX window
+
+static const u1_t fwd_eui[8] = { 0xAA, 0x55, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static struct {
+    int     sock;           // connected UDP socket, -1 without forwarder
+    u2_t    token;
+    u4_t    lossrnd;        // host_upLoss
+    bit_t   waited;         // waited for the answer to the last uplink
+    bit_t   pullack;
+    struct {
+        u4_t tmst;
+        u4_t freq;
+        u1_t imme;
+        u1_t len;
+        u1_t frame[MAX_LEN_FRAME];
+    } dn[FWD_DNQ];
+} F = { .sock = -1, .lossrnd = 0x9E3779B9 };
+
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int b64enc (char* out, const u1_t* in, int len) {
+    int n = 0;
+    for( int i = 0; i < len; i += 3 ) {
+        u4_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+        out[n++] = b64[v >> 18];
+        out[n++] = b64[(v >> 12) & 63];
+        out[n++] = i + 1 < len ? b64[(v >> 6) & 63] : '=';
+        out[n++] = i + 2 < len ? b64[v & 63] : '=';
+    }
+    out[n] = 0;
+    return n;
+}
+
+// Decodes up to the closing quote, returns the length or -1
+static int b64dec (u1_t* out, const char* in, int max) {
+    u4_t v = 0;
+    int bits = 0, n = 0;
+    for( ; *in && *in != '"' && *in != '='; in++ ) {
+        const char* c = strchr(b64, *in);
+        if( c == NULL )
+            return -1;
+        v = v << 6 | (c - b64);
+        if( (bits += 6) >= 8 ) {
+            bits -= 8;
+            if( n == max )
+                return -1;
+            out[n++] = v >> bits;
+        }
+    }
+    return n;
+}
+
+// Value of "key" in a JSON object (lns.py writes it with json.dumps)
+static const char* jval (const char* js, const char* key) {
+    char k[16];
+    snprintf(k, sizeof(k), "\"%s\"", key);
+    const char* p = strstr(js, k);
+    if( p == NULL )
+        return NULL;
+    for( p += strlen(k); *p == ' ' || *p == ':'; p++ )
+        ;
+    return p;
+}
+
+// Gateway counter (us) at time t
+static u4_t fwd_tmst (ostime_t t) {
+    return (u4_t) ((host_now + (s4_t) (t - os_getTime())) * 1000000 / OSTICKS_PER_SEC);
+}
+
+static void fwd_send (u1_t ident, const char* body) {
+    u1_t pkt[1024];
+    int n = 12;
+    F.token++;
+    pkt[0] = FWD_VERSION;
+    pkt[1] = F.token >> 8;
+    pkt[2] = F.token;
+    pkt[3] = ident;
+    memcpy(pkt + 4, fwd_eui, 8);
+    if( body ) {
+        n += strlen(body);
+        memcpy(pkt + 12, body, n - 12);
+    }
+    if( send(F.sock, pkt, n, 0) != n )
+        perror("forwarder: send");
+}
+
+static void fwd_txpk (const char* js) {
+    const char* v;
+    int i;
+    for( i = 0; i < FWD_DNQ && F.dn[i].len; i++ )
+        ;
+    if( i == FWD_DNQ || (v = jval(js, "data")) == NULL || *v != '"' ) {
+        fprintf(stderr, "forwarder: downlink dropped\n");
+        return;
+    }
+    int len = b64dec(F.dn[i].frame, v + 1, MAX_LEN_FRAME);
+    if( len <= 0 )
+        return;
+    F.dn[i].imme = (v = jval(js, "imme")) != NULL && strncmp(v, "true", 4) == 0;
+    F.dn[i].tmst = (v = jval(js, "tmst")) ? strtoul(v, NULL, 10) : 0;
+    F.dn[i].freq = (v = jval(js, "freq")) ? (u4_t) (strtod(v, NULL) * 1e6 + 0.5) : 0;
+    F.dn[i].len  = len;
+}
+
+// Read the packets of the server, wait up to ms for a PULL_RESP.
+// Returns the number of PULL_RESPs.
+static int fwd_poll (int ms) {
+    struct pollfd pfd = { .fd = F.sock, .events = POLLIN };
+    char pkt[2048];
+    int resp = 0;
+    while( poll(&pfd, 1, resp ? 0 : ms) > 0 ) {
+        int n = recv(F.sock, pkt, sizeof(pkt) - 1, 0);
+        if( n < 4 || pkt[0] != FWD_VERSION )
+            continue;
+        pkt[n] = 0;
+        if( pkt[3] == PULL_ACK ) {
+            F.pullack = 1;
+        } else if( pkt[3] == PULL_RESP ) {
+            fwd_txpk(pkt + 4);
+            fwd_send(TX_ACK, NULL);
+            resp++;
+        }
+    }
+    return resp;
+}
+
+int host_forwarder (const char* addr, int port) {
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if( inet_pton(AF_INET, addr, &sa.sin_addr) != 1 ||
+        (F.sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        connect(F.sock, (struct sockaddr*) &sa, sizeof(sa)) < 0 ) {
+        perror("forwarder");
+        return -1;
+    }
+    // The server may still be starting up
+    for( int i = 0; i < 50 && !F.pullack; i++ ) {
+        fwd_send(PULL_DATA, NULL);
+        fwd_poll(100);
+    }
+    if( !F.pullack ) {
+        fprintf(stderr, "forwarder: no PULL_ACK from %s:%d\n", addr, port);
+        close(F.sock);
+        F.sock = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Uplink as the rxpk of a gateway that received it at the end of the TX
+static void fwd_uplink (void) {
+    char data[(MAX_LEN_FRAME + 2) / 3 * 4 + 1];
+    char body[600];
+    if( host_upLoss ) {
+        F.lossrnd ^= F.lossrnd << 13;
+        F.lossrnd ^= F.lossrnd >> 17;
+        F.lossrnd ^= F.lossrnd << 5;
+        if( F.lossrnd % 1000 < host_upLoss ) {
+            F.waited = 1;               // no answer to wait for
+            return;
+        }
+    }
+    b64enc(data, LMIC.frame, LMIC.dataLen);
+    snprintf(body, sizeof(body),
+             "{\"rxpk\":[{\"tmst\":%u,\"chan\":0,\"rfch\":0,\"freq\":%.6f,\"stat\":1,"
+             "\"modu\":\"LORA\",\"datr\":\"SF%dBW%d\",\"codr\":\"4/5\",\"rssi\":-60,"
+             "\"lsnr\":8.0,\"size\":%d,\"data\":\"%s\"}]}",
+             fwd_tmst(os_getTime() + LMIC_calcAirTime(LMIC.rps, LMIC.dataLen)),
+             LMIC.freq / 1e6, getSf(LMIC.rps) - SF7 + 7, 125 << getBw(LMIC.rps),
+             LMIC.dataLen, data);
+    fwd_send(PUSH_DATA, body);
+    F.waited = 0;
+}
+
+// Downlink of the server for the RX window at LMIC.rxtime, if any
+static void fwd_downlink (void) {
+    if( !F.waited ) {
+        fwd_poll(FWD_WAIT_ms);
+        F.waited = 1;
+    } else {
+        fwd_poll(0);
+    }
+    u4_t rx = fwd_tmst(LMIC.rxtime);
+    for( int i = 0; i < FWD_DNQ; i++ ) {
+        if( F.dn[i].len == 0 )
+            continue;
+        s4_t dt = (s4_t) (F.dn[i].tmst - rx);
+        if( F.dn[i].imme || dt < -FWD_TOL_us ) {
+            F.dn[i].len = 0;            // missed, or class C (not supported)
+        } else if( dt <= FWD_TOL_us && F.dn[i].freq / 1000 == LMIC.freq / 1000 && H.dnlen == 0 ) {
+            host_downlink(F.dn[i].frame, F.dn[i].len);
+            F.dn[i].len = 0;
+        }
+    }
+}
+
+static void radio_done (osjob_t* j) {
+    (void)j; // unused
+    radio_irq_handler(HAL_IRQMASK_DIO1, os_getTime());
+}
+
+void radio_init (bool calibrate) {
+    (void)calibrate; // unused
+    os_clearCallback(&H.job);
+}
+
+void radio_sleep (void) {
+    os_clearCallback(&H.job);
+}
+
+void radio_starttx (bool txcontinuous) {
+    H.txmode = 1;
+    if( F.sock >= 0 && !txcontinuous )
+        fwd_uplink();
+    if( !txcontinuous )
+        os_setTimedCallback(&H.job, os_getTime() + LMIC_calcAirTime(LMIC.rps, LMIC.dataLen), radio_done);
+}
+
+void radio_startrx (bool rxcontinuous) {
+    H.txmode = 0;
+    if( rxcontinuous )
+        return;     // nothing is received
+    if( F.sock >= 0 )
+        fwd_downlink();
+    ostime_t t = LMIC.rxtime + LMIC.rxsyms * symTicks(LMIC.rps);
+    if( H.dnlen )
+        t = LMIC.rxtime + LMIC_calcAirTime(LMIC.rps, H.dnlen);
+    if( t - os_getTime() < 0 )
+        t = os_getTime();
+    os_setTimedCallback(&H.job, t, radio_done);
+}
+
+bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
+    (void)diomask; // unused
+    if( H.txmode ) {
+        LMIC.txend = irqtime;
+    } else if( H.dnlen ) {
+        memcpy(LMIC.frame, H.dnframe, H.dnlen);
+        LMIC.dataLen = H.dnlen;
+        LMIC.rssi    = -60 + RSSI_OFF;
+        LMIC.snr     = 8 * SNR_SCALEUP;
+        LMIC.rxtime  = irqtime;
+        LMIC.rxtime0 = irqtime - LMIC_calcAirTime(LMIC.rps, H.dnlen);
+        H.dnlen = 0;
+    } else {
+        LMIC.dataLen = 0;   // RX timeout
+    }
+    return true;
+}
+
+void radio_cw (void) {
+}
+
+void radio_cca (void) {
+}
+
+void radio_cad (void) {
+}
+
+void radio_generate_random (u4_t* words, u1_t len) {
+    while( len-- ) {
+        H.rnd ^= H.rnd << 13;       // xorshift32, runs are repeatable
+        H.rnd ^= H.rnd >> 17;
+        H.rnd ^= H.rnd << 5;
+        *words++ = H.rnd;
+    }
+}
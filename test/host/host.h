@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Host HAL for running LMIC on a PC (benchmark, fuzz and replay targets
+ * of test/Makefile). Time is a virtual clock: hal_sleep() jumps to the
+ * next job instead of waiting, so the MAC runs at full CPU speed. The
+ * radio completes a TX after its airtime and times out every RX, unless
+ * a downlink is queued with host_downlink(). With host_forwarder() the
+ * radio is also a virtual gateway of a network server (tools/lns/lns.py).
+ *******************************************************************************/
+
+#ifndef _host_h_
+#define _host_h_
+
+#include <setjmp.h>
+#include "lmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// Virtual clock in ticks, starts at 0 with host_reset()
+extern u8_t host_now;
+// Set when the MAC has nothing scheduled (hal_sleep() forever)
+extern bit_t host_idle;
+
+void host_reset (void);
+// Run jobs until the virtual clock reaches t or nothing is scheduled
+void host_runUntil (osxtime_t t);
+// Receive frame in the next RX window (RADIO_RX), NULL clears it
+void host_downlink (const u1_t* frame, u1_t len);
+// Connect the radio to a network server with the Semtech UDP packet
+// forwarder protocol (v2): uplinks go up as PUSH_DATA, PULL_RESP downlinks
+// are received in the RX window at their tmst (the gateway counter is the
+// virtual clock in us) and frequency. After an uplink the radio waits up
+// to 1 s of real time for the answer. Immediate (class C) downlinks are
+// dropped. Returns -1 if the server does not answer PULL_DATA.
+int host_forwarder (const char* addr, int port);
+// Uplinks (per mille) the gateway does not forward, as lost on the air.
+// Chosen by a xorshift of their own, so runs are repeatable.
+extern u2_t host_upLoss;
+
+// Test session of the host programs: host_key is the NwkKey (and the
+// session keys of ABP tests), host_jacc a join accept for it with a CFList
+// (867.1 to 867.9 MHz), JoinNonce 030201, NetID 000013, DevAddr
+// HOST_DEVADDR and RX1 delay 1 s, encrypted by join_accept_encrypt() of
+// tools/lns/lwcrypto.py.
+#define HOST_DEVADDR 0x26011234
+extern const u1_t host_key[16];
+extern const u1_t host_jacc[LEN_JAEXT];
+
+// Build a data downlink for devaddr with the current session keys into f,
+// port < 0 for none. Returns the frame length.
+u1_t host_buildDown (u1_t* f, u4_t devaddr, u4_t seqno, const u1_t* fopts, u1_t olen,
+                     int port, const u1_t* pl, u1_t plen);
+
+// Flash (PERIPH_FLASH): flash_write() works on any 8-byte aligned RAM,
+// with the rules of the STM32WL: a page erase sets it to FF, a double word
+// can only be programmed once after the erase. host_flashOps counts the
+// page erases and programmed double words. host_flashCut, if not 0, counts
+// down at the start of each operation, at 0 the power is cut: flash_write()
+// jumps to host_flashCutJmp without doing the operation. So host_flashCut
+// n lets n - 1 more operations complete.
+extern u4_t    host_flashOps;
+extern u4_t    host_flashCut;
+extern jmp_buf host_flashCutJmp;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _host_h_
@@ -0,0 +1,116 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Join and uplink/downlink cycles with tools/lns/lns.py. The host radio is
+ * a virtual gateway on localhost (host_forwarder()), the device is the one
+ * of test/lns/devices.json (EUIs and key of the other host programs).
+ *
+ *   lns [-p port] [-n cycles]
+ *
+ * After the OTAA join every cycle is a confirmed uplink with a
+ * LinkCheckReq, 60 s (virtual time) apart. The program fails if the join
+ * accept, the ACK of an uplink or the LinkCheckAns is missing.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "lmic.c"
+
+#define INTERVAL  sec2osticks(60)
+#define MAXTIME   sec2osticks(3600)         // virtual time limit
+
+static unsigned  cycles = 5;
+static unsigned  done;          // uplinks acked with a LinkCheckAns
+static unsigned  sent;
+static bit_t     joined;
+static bit_t     failed;
+static osjob_t   txjob;
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+
+static void tx_func (osjob_t* job) {
+    u1_t payload[6] = { 'c', 'y', 'c', 'l', 'e', '0' + sent % 10 };
+    (void)job; // unused
+    LMIC.gwcnt = 0;
+    LMIC_askForLinkCheck();
+    if( LMIC_setTxData2(1, payload, sizeof(payload), 1) != 0 ) {
+        printf("lns: uplink %u not queued\n", sent);
+        failed = 1;
+        return;
+    }
+    sent++;
+}
+
+void onLmicEvent (ev_t ev) {
+    switch( ev ) {
+    case EV_JOINED:
+        joined = 1;
+        printf("lns: joined at %.1f s, DevAddr %08X\n", (double) host_now / OSTICKS_PER_SEC, LMIC.devaddr);
+        os_setCallback(&txjob, tx_func);
+        break;
+    case EV_TXCOMPLETE:
+        if( !joined || sent == 0 )
+            break;
+        if( (LMIC.txrxFlags & TXRX_ACK) == 0 ) {
+            printf("lns: no ACK for uplink %u\n", sent);
+            failed = 1;
+            break;
+        }
+        if( LMIC.gwcnt == 0 ) {
+            printf("lns: no LinkCheckAns for uplink %u\n", sent);
+            failed = 1;
+            break;
+        }
+        done++;
+        printf("lns: uplink %u acked in RX%d, margin %u dB\n", sent,
+               (LMIC.txrxFlags & TXRX_DNW1) ? 1 : 2, LMIC.gwmargin);
+        if( sent < cycles )
+            os_setTimedCallback(&txjob, os_getTime() + INTERVAL, tx_func);
+        break;
+    default:
+        break;
+    }
+}
+
+int main (int argc, char** argv) {
+    int port = 1700;
+    int opt;
+
+    while( (opt = getopt(argc, argv, "p:n:")) != -1 ) {
+        switch( opt ) {
+        case 'p': port = atoi(optarg); break;
+        case 'n': cycles = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-n cycles]\n", argv[0]);
+            return 2;
+        }
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_reset();
+    os_init(NULL);
+    if( host_forwarder("127.0.0.1", port) < 0 )
+        return 2;
+    LMIC_reset();
+    LMIC_startJoining();
+    while( !failed && done < cycles && !host_idle && host_now < MAXTIME )
+        host_runUntil(host_now + sec2osticks(1));
+    if( !joined ) {
+        printf("lns: no join accept\n");
+        return 1;
+    }
+    if( failed || done < cycles ) {
+        printf("lns: %u of %u cycles done\n", done, cycles);
+        return 1;
+    }
+    printf("lns: joined, %u confirmed uplinks acked\n", done);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Persistent configuration (lmic/persist.c, CFG_persist) on the host flash
+ * with a power cut before every flash operation.
+ *
+ * The area is the one of src/main.cpp: 2 pages, the second one being the
+ * EEPROM emulation page of the older firmware (EEPROM_AREA) with a valid
+ * eepromdata_t in it. The sequence is the one of readEEPROMdata(): nothing
+ * committed yet, so the EEPROM data is taken over and committed, followed
+ * by COMMITS commits of blocks of all lengths and two versions, which
+ * rotate both pages several times. It is run again for every flash
+ * operation, with the power cut before it. After the cut and a reset the
+ * block read must be the last complete commit or the one in progress;
+ * before the first commit is complete the EEPROM page must be unchanged.
+ * Then the sequence goes on from there and must end with the last block.
+ *
+ * The program prints the failed checks and returns 1 if there are any.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "lmic.c"
+#include "persist.h"
+#include "peripherals.h"
+
+#define AREA_SIZE   (2 * FLASH_PAGE_SZ)     // CONFIG_AREA_SIZE
+#define EEPROM_OFF  FLASH_PAGE_SZ           // EEPROM_AREA
+#define DATAVALID   67329752                // of src/main.cpp
+#define COMMITS     200
+
+typedef struct {
+    u2_t version;
+    u2_t len;
+    u1_t data[PERSIST_MAXLEN];
+} block_t;
+
+static u1_t    area[AREA_SIZE] __attribute__((aligned(FLASH_PAGE_SZ)));
+static block_t blocks[COMMITS + 1];     // 0: taken over from the EEPROM page
+static volatile int done;               // last complete commit, across a cut
+static int     errors;
+
+#define CHECK(c, ...) do { if( !(c) ) { errors++; printf("persist:%d: ", __LINE__); \
+                                       printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+void onLmicEvent (ev_t ev) { (void)ev; }
+
+// eepromdata_t of src/main.cpp (datavalid, fcnt, joinedFlag, devaddr,
+// nwkSKey, appSKey) and the blocks committed after it
+static void makeBlocks (void) {
+    block_t* b = &blocks[0];
+    b->version = 1;
+    b->len = 48;
+    os_wlsbf4(b->data, DATAVALID);
+    os_wlsbf4(b->data + 4, 1000);
+    b->data[8] = 1;
+    os_wlsbf4(b->data + 12, HOST_DEVADDR);
+    memcpy(b->data + 16, host_key, 16);
+    memcpy(b->data + 32, host_key, 16);
+    for( int i = 1; i <= COMMITS; i++ ) {
+        b = &blocks[i];
+        *b = blocks[0];
+        os_wlsbf4(b->data + 4, 1000 + i);      // frame counter
+        if( i % 3 != 0 ) {
+            b->version = 1 + (i / 50) % 2;
+            b->len = 8 + (i * 37) % (PERSIST_MAXLEN - 7);
+            for( int j = 8; j < b->len; j++ )
+                b->data[j] = 1 + (i + j) % 255;
+        }
+    }
+}
+
+static void fresh (void) {
+    memset(area, 0, EEPROM_OFF);        // page before, not erased
+    memset(area + EEPROM_OFF, 0xFF, FLASH_PAGE_SZ);
+    memcpy(area + EEPROM_OFF, blocks[0].data, blocks[0].len);
+}
+
+// Index of the block read, -1 for none, -2 for one that is not a commit
+static int readBlock (void) {
+    u1_t buf[PERSIST_MAXLEN];
+    u2_t v = LMIC_persistRead(buf, sizeof(buf));
+    if( v == 0 )
+        return -1;
+    for( int i = COMMITS; i >= 0; i-- ) {
+        block_t* b = &blocks[i];
+        if( b->version == v && memcmp(buf, b->data, b->len) == 0 ) {
+            int rest = 0;
+            for( int j = b->len; j < PERSIST_MAXLEN; j++ )
+                rest |= buf[j];
+            if( rest == 0 )
+                return i;
+        }
+    }
+    return -2;
+}
+
+static void commit (int i) {
+    CHECK(LMIC_persistWrite(blocks[i].data, blocks[i].len, blocks[i].version), "commit %d failed", i);
+}
+
+// readEEPROMdata() and saveEEPROMdata() of src/main.cpp, then the commits
+// after the block read. Returns the block read.
+static int boot (void) {
+    LMIC_persistInit(area, sizeof(area));
+    int got = readBlock();
+    if( got == -1 ) {
+        CHECK(memcmp(area + EEPROM_OFF, blocks[0].data, blocks[0].len) == 0,
+              "EEPROM page changed before the first commit");
+        commit(0);
+        done = 0;
+        got = 0;
+    }
+    for( int i = got + 1; i <= COMMITS; i++ ) {
+        commit(i);
+        done = i;
+    }
+    return got;
+}
+
+int main (void) {
+    int cuts = 0, k;
+    u4_t ops = 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_reset();
+    os_init(NULL);
+    makeBlocks();
+
+    for( k = 1; ; k++ ) {
+        fresh();
+        done = -1;
+        host_flashOps = 0;
+        host_flashCut = k;
+        if( setjmp(host_flashCutJmp) == 0 ) {
+            boot();
+            host_flashCut = 0;
+            ops = host_flashOps;
+            break;
+        }
+        // power cut before operation k
+        host_flashCut = 0;
+        cuts++;
+        LMIC_persistInit(area, sizeof(area));
+        int got = readBlock();
+        CHECK(got == done || got == done + 1 || (done == -1 && got == 0),
+              "cut %d: block %d read, %d was the last commit", k, got, done);
+        if( got < 0 )
+            CHECK(memcmp(area + EEPROM_OFF, blocks[0].data, blocks[0].len) == 0,
+                  "cut %d: EEPROM page changed before the first commit", k);
+        // the device goes on after the reset
+        if( boot() != got && got >= 0 )
+            CHECK(0, "cut %d: block %d read at the second boot", k, got);
+        LMIC_persistInit(area, sizeof(area));
+        CHECK(readBlock() == COMMITS, "cut %d: last block not read", k);
+        if( errors > 20 )
+            break;
+    }
+
+    // both pages rotated several times
+    u4_t seq = 0;
+    for( u4_t pg = 0; pg < AREA_SIZE; pg += FLASH_PAGE_SZ ) {
+        if( os_rlsbf4(area + pg + 4) > seq && os_rlsbf4(area + pg) == 0x47464E43 )
+            seq = os_rlsbf4(area + pg + 4);
+    }
+    CHECK(seq >= 5, "page sequence %u, the pages did not rotate", seq);
+
+    // the same block again is not written
+    LMIC_persistInit(area, sizeof(area));
+    u4_t before = host_flashOps;
+    commit(COMMITS);
+    CHECK(host_flashOps == before, "same block written again");
+
+    // a second cut while the take over is done again after the first one
+    int twice = 0;
+    for( int k1 = 1; done < 0 || k1 == 1; k1++ ) {
+        fresh();
+        done = -1;
+        host_flashCut = k1;
+        if( setjmp(host_flashCutJmp) == 0 ) {
+            boot();
+            break;
+        }
+        for( k = 1; ; k++ ) {
+            u1_t snap[AREA_SIZE];
+            memcpy(snap, area, sizeof(area));
+            host_flashCut = k;
+            if( setjmp(host_flashCutJmp) == 0 ) {
+                LMIC_persistInit(area, sizeof(area));
+                if( readBlock() == -1 )
+                    commit(0);
+                host_flashCut = 0;
+                break;
+            }
+            host_flashCut = 0;
+            twice++;
+            LMIC_persistInit(area, sizeof(area));
+            int got = readBlock();
+            CHECK(got == 0 || (got == -1 && memcmp(area + EEPROM_OFF, blocks[0].data, blocks[0].len) == 0),
+                  "cuts %d and %d of the take over: block %d read, EEPROM data lost", k1, k, got);
+            memcpy(area, snap, sizeof(area));
+        }
+    }
+
+    printf("persist: EEPROM take over and %d commits, page sequence %u, power cut before each of the %u flash operations\n",
+           COMMITS, seq, ops);
+    printf("persist: %d second cuts in the take over\n", twice);
+    if( errors ) {
+        printf("persist: %d checks failed (%d cuts)\n", errors, cuts);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*******************************************************************************
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * Record and replay of a session on the virtual clock (CFG_radiotrace).
+ * The scenario is an OTAA join with host_jacc, a downlink with LinkADRReq
+ * and DevStatusReq in FOpts after the join and three unconfirmed uplinks
+ * 60 s apart. lmic.c is included as by the other host programs.
+ *
+ *   replay -r trace.log    run it on the host radio, write the RT lines
+ *   replay trace.log       run it again with LMIC_radioReplay()
+ *
+ * The trace uses the RT lines of dump_radiotrace() in src/main.cpp, so a
+ * serial log of the board replays here as well (and tools/trace/trace2c.py
+ * reads this file). The replay passes if every uplink is bit identical to
+ * the recorded one and the whole trace is consumed. -x changes the payload
+ * of the second uplink, that replay must diverge.
+ *
+ * Record and replay are separate runs: the energy and budget modules keep
+ * their state across LMIC_reset().
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "lmic.c"
+
+#define UPLINKS   3
+#define INTERVAL  sec2osticks(60)
+#define MAXTIME   sec2osticks(600)          // virtual time limit of the scenario
+
+// LinkADRReq (DR5, channels 0-2) and DevStatusReq in the downlink after the join
+static const u1_t FOPTS[] = { MCMD_LADR_REQ, 0x50, 0x07, 0x00, 0x01, MCMD_DEVS_REQ };
+
+static bit_t     recording;
+static bit_t     perturb;
+static unsigned  sent;           // data uplinks queued
+static bit_t     joined;
+static osjob_t   txjob;
+
+static radiotrace_t trace[CFG_radiotrace_depth];
+
+void os_getJoinEui (u1_t* b) { memset(b, 0, 8); }
+void os_getDevEui (u1_t* b) { memset(b, 1, 8); }
+void os_getNwkKey (u1_t* b) { memcpy(b, host_key, 16); }
+u1_t os_getRegion (void) { return LMIC_regionCode(0); }
+
+static void tx_func (osjob_t* job) {
+    u1_t payload[8] = { 'r', 'e', 'p', 'l', 'a', 'y', '0' + sent, 0 };
+    if( perturb && sent == 1 )
+        payload[7] = 0xFF;
+    if( LMIC_setTxData2(1, payload, sizeof(payload), 0) == 0 )
+        sent++;
+    else
+        os_setTimedCallback(job, os_getTime() + sec2osticks(LMIC_budgetWait_sec(sizeof(payload), LMIC.datarate) + 1), tx_func);
+}
+
+// The last uplink and its RX windows are done
+static bit_t finished (void) {
+    return sent == UPLINKS && (LMIC.opmode & (OP_TXDATA | OP_TXRXPEND | OP_POLL)) == 0;
+}
+
+void onLmicEvent (ev_t ev) {
+    switch( ev ) {
+    case EV_JOINED: {
+        joined = 1;
+        if( recording ) {
+            u1_t f[MAX_LEN_FRAME];
+            host_downlink(f, host_buildDown(f, LMIC.devaddr, 0, FOPTS, sizeof(FOPTS), -1, NULL, 0));
+        }
+        os_setCallback(&txjob, tx_func);
+        break;
+    }
+    case EV_TXCOMPLETE:
+        // also after uplinks of the MAC alone (answers to the downlink)
+        if( sent < UPLINKS )
+            os_setTimedCallback(&txjob, os_getTime() + INTERVAL, tx_func);
+        break;
+    default:
+        break;
+    }
+}
+
+static void run (void) {
+    LMIC_reset();
+    if( recording )
+        host_downlink(host_jacc, LEN_JAEXT);
+    LMIC_startJoining();
+    while( !finished() && !host_idle && host_now < MAXTIME )
+        host_runUntil(host_now + sec2osticks(1));
+}
+
+static int record (const char* path) {
+    FILE* f = fopen(path, "w");
+    if( f == NULL ) {
+        perror(path);
+        return 2;
+    }
+    radiotrace_t rec;
+    for( u2_t i = 0; LMIC_radioTraceGet(i, &rec); i++ ) {
+        fprintf(f, "RT,%02X,%ld,%lu,%04X,%d,%d,%d,%d,",
+                rec.type, (long) rec.time, (unsigned long) rec.freq,
+                rec.rps, rec.txpow, rec.len, rec.rssi, rec.snr);
+        int n = rec.len < CFG_radiotrace_framelen ? rec.len : CFG_radiotrace_framelen;
+        for( int j = 0; j < n; j++ )
+            fprintf(f, "%02X", rec.frame[j]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    printf("replay: %u records written to %s\n", LMIC_radioTraceCount(), path);
+    return 0;
+}
+
+// RT lines of the file, other lines are skipped
+static int load (const char* path) {
+    FILE* f = fopen(path, "r");
+    if( f == NULL ) {
+        perror(path);
+        exit(2);
+    }
+    char line[1024];
+    int n = 0;
+    while( fgets(line, sizeof(line), f) ) {
+        char* p = strstr(line, "RT,");
+        unsigned type, rps;
+        long time;
+        unsigned long freq;
+        int txpow, len, rssi, snr, off;
+        if( p == NULL )
+            continue;
+        if( sscanf(p, "RT,%x,%ld,%lu,%x,%d,%d,%d,%d,%n", &type, &time, &freq, &rps,
+                   &txpow, &len, &rssi, &snr, &off) != 8 )
+            continue;
+        if( n == CFG_radiotrace_depth ) {
+            fprintf(stderr, "replay: more than %d records\n", CFG_radiotrace_depth);
+            exit(2);
+        }
+        radiotrace_t* r = &trace[n++];
+        memset(r, 0, sizeof(*r));
+        r->type  = type;
+        r->time  = time;
+        r->freq  = freq;
+        r->rps   = rps;
+        r->txpow = txpow;
+        r->len   = len;
+        r->rssi  = rssi;
+        r->snr   = snr;
+        p += off;
+        for( int j = 0; j < CFG_radiotrace_framelen && sscanf(p + 2 * j, "%2hhx", &r->frame[j]) == 1; j++ )
+            ;
+    }
+    fclose(f);
+    return n;
+}
+
+int main (int argc, char** argv) {
+    const char* out = NULL;
+    int opt;
+
+    while( (opt = getopt(argc, argv, "r:x")) != -1 ) {
+        switch( opt ) {
+        case 'r': out = optarg; recording = 1; break;
+        case 'x': perturb = 1; break;
+        default:
+            goto usage;
+        }
+    }
+    if( recording != (optind == argc) ) {
+    usage:
+        fprintf(stderr, "usage: %s -r trace.log | [-x] trace.log\n", argv[0]);
+        return 2;
+    }
+
+    host_reset();
+    os_init(NULL);
+    if( recording ) {
+        run();
+        if( !finished() ) {
+            fprintf(stderr, "replay: %u of %d uplinks sent\n", sent, UPLINKS);
+            return 1;
+        }
+        return record(out);
+    }
+
+    int n = load(argv[optind]);
+    LMIC_radioReplay(trace, n);
+    run();
+    u2_t pos;
+    int diverged = LMIC_radioReplayStatus(&pos);
+    if( diverged >= 0 ) {
+        printf("replay: diverged at record %d of %d\n", diverged, n);
+        return 1;
+    }
+    if( !joined || !finished() || pos < n ) {
+        printf("replay: stopped at record %u of %d, %u uplinks\n", pos, n, sent);
+        return 1;
+    }
+    printf("replay: %d records, %u uplinks ok\n", n, sent);
+    return 0;
+}
@@ -0,0 +1,116 @@
+//***************************************************************************************************
+// filter.cpp                                                                                       *
+//***************************************************************************************************
+// Replay of the decisions of tools/sim/report.py --decisions through ReportFilter.h.  Every        *
+// interval starts with a new filter restored from the saved words (the RTC backup registers) as    *
+// after a deep sleep, all zero before the first one (power loss).  check() must give the report    *
+// of report.py, sent() gets its ACK, and silent() and the saved words must match after it.  Every  *
+// interval also checks the all-zero restore of a power loss (no report yet: a change report is     *
+// due, whatever the readings) and that the saved words restore to the same state:                  *
+//                                                                                                  *
+//   report.py --decisions --readings trace.csv --deadband 20 100 | report                          *
+//***************************************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ReportFilter.h>
+
+#define CHANNELS 2
+
+typedef payload::ReportFilter<CHANNELS> filter_t ;
+
+static int errors ;
+
+
+//***************************************************************************************************
+//                                        F A I L                                                   *
+//***************************************************************************************************
+// Count a failed check, print the first ones.                                                      *
+//***************************************************************************************************
+static void fail ( unsigned line, const char* what, long got, long want )
+{
+  if ( errors++ < 10 )
+  {
+    fprintf ( stderr, "report: line %u: %s %ld, expected %ld\n", line, what, got, want ) ;
+  }
+}
+
+
+int main ( int argc, char** argv )
+{
+  int32_t  deadband[CHANNELS] ;
+  int      silence ;
+  char     line[256] ;
+  uint32_t words[filter_t::words] ;                       // RTC backup registers
+  uint32_t zero[filter_t::words] ;
+  unsigned n = 0, reports[3] = { 0, 0, 0 } ;
+
+  if ( argc != 1 || fgets ( line, sizeof(line), stdin ) == NULL ||
+       sscanf ( line, "# deadband %d %d silence %d", &deadband[0], &deadband[1], &silence ) != 3 )
+  {
+    fprintf ( stderr, "usage: report.py --decisions ... | %s\n", argv[0] ) ;
+    return 2 ;
+  }
+  memset ( words, 0, sizeof(words) ) ;
+  memset ( zero, 0, sizeof(zero) ) ;
+  while ( fgets ( line, sizeof(line), stdin ) )
+  {
+    int32_t  values[CHANNELS] ;
+    int      due, acked, silent ;
+    uint32_t again[filter_t::words] ;
+
+    n++ ;
+    if ( sscanf ( line, "%d,%d,%d,%d,%d", &values[0], &values[1], &due, &acked, &silent ) != 5 )
+    {
+      fprintf ( stderr, "report: line %u: %s", n + 1, line ) ;
+      return 2 ;
+    }
+    filter_t lost ( deadband, silence ) ;                 // Power loss instead of this sleep
+    lost.restore ( zero ) ;
+    if ( lost.silent() != 0 )
+    {
+      fail ( n + 1, "silent() after a power loss", lost.silent(), 0 ) ;
+    }
+    uint8_t first = lost.check ( values ) ;
+    if ( first != payload::REPORT_CHANGE )
+    {
+      fail ( n + 1, "check() after a power loss", first, payload::REPORT_CHANGE ) ;
+    }
+    filter_t filter ( deadband, silence ) ;               // New after the reset
+    filter.restore ( words ) ;
+    uint8_t got = filter.check ( values ) ;
+    if ( got != due )
+    {
+      fail ( n + 1, "check()", got, due ) ;
+    }
+    if ( got != payload::REPORT_NONE )
+    {
+      filter.sent ( acked ) ;
+    }
+    if ( filter.silent() != silent )
+    {
+      fail ( n + 1, "silent()", filter.silent(), silent ) ;
+    }
+    filter.save ( words ) ;
+    filter_t copy ( deadband, silence ) ;
+    copy.restore ( words ) ;
+    copy.save ( again ) ;
+    for ( uint8_t i = 0 ; i < filter_t::words ; i++ )
+    {
+      if ( again[i] != words[i] )
+      {
+        fail ( n + 1, "saved word restored and saved again", again[i], words[i] ) ;
+        break ;
+      }
+    }
+    reports[got]++ ;
+  }
+  if ( n == 0 || errors )
+  {
+    fprintf ( stderr, "report: %d checks failed in %u intervals\n", errors, n ) ;
+    return 1 ;
+  }
+  fprintf ( stderr, "report: %u intervals, %u change and %u heartbeat reports as report.py\n",
+            n, reports[payload::REPORT_CHANGE], reports[payload::REPORT_HEARTBEAT] ) ;
+  return 0 ;
+}
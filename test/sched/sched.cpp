@@ -0,0 +1,175 @@
+//***************************************************************************************************
+// sched.cpp                                                                                        *
+//***************************************************************************************************
+// Wakeups of lib/TaskTable/src/TaskTable.h across simulated deep sleeps, the loop of the table     *
+// scheme of tools/sim/sched.py.  Every wakeup starts with a new table restored from the saved      *
+// words (the RTC backup registers), all zero before the first one (power loss).  The RTC is set    *
+// forward or back by the clock step once a day.  The output is the one of sched.py --wakeups: a   *
+// line "RTC time, mask of the tasks run" per wakeup and the counts with the largest early and late *
+// runs against the grid of each task, so the two are compared with diff:                          *
+//                                                                                                  *
+//   sched -t sample:120:60 -t report:600:0 -o 200 -s 300 -d 3 -f 6 -w 1                           *
+//   sched.py --wakeups --task sample:120:60 --task report:600:0 --offset 200 --clock-step 300 \    *
+//            --days 3 --full-s 6 --task-s 1                                                        *
+//                                                                                                  *
+// -t name:period:slack per task, the last one sends the uplink at -o seconds into its period.      *
+// -f and -w are the lengths of a wakeup with and without the uplink, in whole seconds.             *
+//***************************************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <TaskTable.h>
+
+#define MAXTASKS 4
+
+struct taskstat_t
+{
+  unsigned runs ;
+  long     early ;                                        // Largest early run in seconds
+  long     late ;                                         // Largest late run in seconds
+} ;
+
+static sched::Task task[MAXTASKS] ;
+static char        names[MAXTASKS][16] ;
+static taskstat_t  stat[MAXTASKS] ;
+static int         ntasks ;
+static long        offset ;                               // TX time in the uplink period
+static long        clockstep ;                            // RTC step once a day
+static double      days = 7 ;
+static long        full_s = 6 ;                           // Wakeup with uplink
+static long        task_s = 1 ;                           // Other wakeups
+
+
+//***************************************************************************************************
+//                                      A C C O U N T                                               *
+//***************************************************************************************************
+// Task i runs at RTC time t, early or late against its grid.                                       *
+//***************************************************************************************************
+static void account ( int i, long t )
+{
+  long period = task[i].period ;
+  long grid   = i == ntasks - 1 ? offset : 0 ;
+  long pos    = ( ( t - grid ) % period + period ) % period ;
+  long err    = 2 * pos < period ? pos : pos - period ;
+
+  stat[i].runs++ ;
+  stat[i].early = -err > stat[i].early ? -err : stat[i].early ;
+  stat[i].late  =  err > stat[i].late  ?  err : stat[i].late ;
+}
+
+
+//***************************************************************************************************
+//                                          R U N                                                   *
+//***************************************************************************************************
+// The wakeups of one device.                                                                       *
+//***************************************************************************************************
+template <uint8_t N>
+static void run()
+{
+  uint32_t words[sched::TaskTable<N>::words] ;            // RTC backup registers
+  double   end = days * 86400 ;
+  long     real = 0, skew = 0 ;                           // The RTC is real + skew after steps
+  long     step_at = 86400 ;
+  unsigned wakes = 0, uplinks = 0 ;
+  bool     saved = false ;
+  int      up = N - 1 ;
+
+  memset ( words, 0, sizeof(words) ) ;
+  while ( real < end )
+  {
+    sched::TaskTable<N> table ( task ) ;                  // New after the reset
+    long                rtc = real + skew ;
+    table.restore ( words, rtc ) ;
+    if ( ! saved )
+    {
+      table.set ( up, rtc + offset ) ;                    // TX time of the first period
+    }
+    uint32_t due = table.due ( rtc ) ;
+    if ( due == 0 )
+    {
+      long wait = table.next ( rtc ) ;
+      real += wait > 1 ? wait : 1 ;
+      continue ;
+    }
+    wakes++ ;
+    printf ( "%ld %x\n", rtc, due ) ;
+    bool full = ( due >> up ) & 1 ;
+    uplinks += full ;
+    for ( int i = 0 ; i < N ; i++ )
+    {
+      if ( ( due >> i ) & 1 )
+      {
+        account ( i, rtc ) ;
+        table.done ( i, rtc ) ;
+      }
+    }
+    if ( full )                                           // CFG_txslot: TX time by the RTC
+    {
+      uint32_t d = table.dueAt ( up ) ;
+      table.set ( up, d - d % task[up].period + offset ) ;
+    }
+    table.save ( words ) ;
+    saved = true ;
+    real += full ? full_s : task_s ;
+    if ( clockstep != 0 && real >= step_at )
+    {
+      skew += clockstep ;                                 // RTC set by the network time
+      step_at += 86400 ;
+    }
+    rtc = real + skew ;
+    long wait = table.next ( rtc ) ;
+    real += wait > 1 ? wait : 1 ;
+  }
+  printf ( "wakeups %u uplinks %u", wakes, uplinks ) ;
+  for ( int i = 0 ; i < N ; i++ )
+  {
+    printf ( " %s %u %ld %ld", names[i], stat[i].runs, stat[i].early, stat[i].late ) ;
+  }
+  printf ( "\n" ) ;
+}
+
+
+int main ( int argc, char** argv )
+{
+  int opt ;
+
+  while ( ( opt = getopt ( argc, argv, "t:o:s:d:f:w:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 't' :
+        if ( ntasks == MAXTASKS ||
+             sscanf ( optarg, "%15[^:]:%u:%u", names[ntasks], &task[ntasks].period,
+                      &task[ntasks].slack ) != 3 || task[ntasks].period == 0 )
+        {
+          goto usage ;
+        }
+        task[ntasks].id = ntasks + 1 ;
+        ntasks++ ;
+        break ;
+      case 'o' : offset = atol ( optarg ) ; break ;
+      case 's' : clockstep = atol ( optarg ) ; break ;
+      case 'd' : days = atof ( optarg ) ; break ;
+      case 'f' : full_s = atol ( optarg ) ; break ;
+      case 'w' : task_s = atol ( optarg ) ; break ;
+      default :
+        goto usage ;
+    }
+  }
+  if ( optind != argc || ntasks == 0 )
+  {
+  usage:
+    fprintf ( stderr, "usage: %s -t name:period:slack... [-o offset] [-s clockstep] [-d days] "
+              "[-f full_s] [-w task_s]\n", argv[0] ) ;
+    return 2 ;
+  }
+  switch ( ntasks )
+  {
+    case 1 : run<1>() ; break ;
+    case 2 : run<2>() ; break ;
+    case 3 : run<3>() ; break ;
+    case 4 : run<4>() ; break ;
+  }
+  return 0 ;
+}
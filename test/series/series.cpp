@@ -0,0 +1,162 @@
+//***************************************************************************************************
+// series.cpp                                                                                       *
+//***************************************************************************************************
+// Round trip of lib/PayloadCodec/src/SeriesCodec.h on a trace.  The readings of a CSV trace (one   *
+// scaled integer per column, lines starting with # are skipped) are packed by SeriesEncoder into  *
+// frames of the given capacity and unpacked again by series_decode(), which must give the trace   *
+// back exactly.  The frames are written as hex, one per line, for tools/codec/series.py check:     *
+//                                                                                                  *
+//   series -c 51 trace.csv > frames.hex                                                            *
+//   series.py check trace.csv frames.hex -c 51                                                     *
+//***************************************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <SeriesCodec.h>
+
+static std::vector<std::vector<int32_t> > trace ;
+
+//***************************************************************************************************
+//                                      L O A D                                                     *
+//***************************************************************************************************
+// Read the trace, returns the number of channels (columns).                                        *
+//***************************************************************************************************
+static int load ( const char* path )
+{
+  FILE* f = fopen ( path, "r" ) ;
+  char  line[256] ;
+
+  if ( f == NULL )
+  {
+    perror ( path ) ;
+    exit ( 2 ) ;
+  }
+  while ( fgets ( line, sizeof(line), f ) )
+  {
+    std::vector<int32_t> rec ;
+    char*                p = line ;
+    if ( line[0] == '#' || line[0] == '\n' )
+    {
+      continue ;
+    }
+    while ( *p && *p != '\n' )
+    {
+      rec.push_back ( (int32_t)strtol ( p, &p, 10 ) ) ;
+      if ( *p == ',' )
+      {
+        p++ ;
+      }
+    }
+    if ( ! trace.empty() && rec.size() != trace[0].size() )
+    {
+      fprintf ( stderr, "series: %s: %d columns in line %d\n", path, (int)rec.size(),
+                (int)trace.size() + 1 ) ;
+      exit ( 2 ) ;
+    }
+    trace.push_back ( rec ) ;
+  }
+  fclose ( f ) ;
+  return trace.empty() ? 0 : (int)trace[0].size() ;
+}
+
+
+//***************************************************************************************************
+//                                 R O U N D T R I P                                                *
+//***************************************************************************************************
+// Encode the trace into frames of capacity bytes, print them and decode them.  Returns the number  *
+// of records that did not come back unchanged, -1 if a record does not fit into an empty frame.    *
+//***************************************************************************************************
+template <uint8_t Channels>
+static int roundtrip ( uint8_t capacity, unsigned* frames, unsigned* bytes )
+{
+  uint8_t                          buf[255] ;
+  int32_t                          out[255][Channels] ;
+  payload::SeriesEncoder<Channels> enc ( buf, capacity ) ;
+  size_t                           first = 0 ;            // First record of the frame
+  int                              bad = 0 ;
+
+  for ( size_t i = 0 ; i <= trace.size() ; i++ )
+  {
+    if ( i < trace.size() && enc.add ( trace[i].data() ) )
+    {
+      continue ;
+    }
+    if ( enc.count() == 0 )
+    {
+      if ( i == trace.size() )
+      {
+        break ;
+      }
+      return -1 ;
+    }
+    for ( uint8_t j = 0 ; j < enc.length() ; j++ )
+    {
+      printf ( "%02X", buf[j] ) ;
+    }
+    printf ( "\n" ) ;
+    (*frames)++ ;
+    *bytes += enc.length() ;
+    int n = payload::series_decode<Channels> ( buf, enc.length(), out, 255 ) ;
+    if ( n != enc.count() )
+    {
+      fprintf ( stderr, "series: frame %u: %d records decoded, %d encoded\n",
+                *frames, n, enc.count() ) ;
+      return -1 ;
+    }
+    for ( int r = 0 ; r < n ; r++ )
+    {
+      bad += memcmp ( out[r], trace[first + r].data(), sizeof(out[r]) ) != 0 ;
+    }
+    first += n ;
+    enc.reset ( capacity ) ;
+    if ( i < trace.size() )
+    {
+      i-- ;                                               // Record again into the new frame
+    }
+  }
+  return first == trace.size() ? bad : -1 ;
+}
+
+
+int main ( int argc, char** argv )
+{
+  int      capacity = 51 ;
+  unsigned frames = 0, bytes = 0 ;
+  int      opt, bad ;
+
+  while ( ( opt = getopt ( argc, argv, "c:" ) ) != -1 )
+  {
+    if ( opt != 'c' )
+    {
+      goto usage ;
+    }
+    capacity = atoi ( optarg ) ;
+  }
+  if ( optind + 1 != argc || capacity < 2 || capacity > 255 )
+  {
+  usage:
+    fprintf ( stderr, "usage: %s [-c capacity] trace.csv\n", argv[0] ) ;
+    return 2 ;
+  }
+  switch ( load ( argv[optind] ) )
+  {
+    case 1 : bad = roundtrip<1> ( capacity, &frames, &bytes ) ; break ;
+    case 2 : bad = roundtrip<2> ( capacity, &frames, &bytes ) ; break ;
+    case 3 : bad = roundtrip<3> ( capacity, &frames, &bytes ) ; break ;
+    case 4 : bad = roundtrip<4> ( capacity, &frames, &bytes ) ; break ;
+    default :
+      fprintf ( stderr, "series: 1 to 4 channels supported\n" ) ;
+      return 2 ;
+  }
+  if ( bad != 0 )
+  {
+    fprintf ( stderr, "series: capacity %d, %s\n", capacity,
+              bad < 0 ? "frames do not hold the trace" : "records changed" ) ;
+    return 1 ;
+  }
+  fprintf ( stderr, "series: %d readings in %u frames of up to %d bytes, %.2f bytes/reading\n",
+            (int)trace.size(), frames, capacity, (double)bytes / trace.size() ) ;
+  return 0 ;
+}
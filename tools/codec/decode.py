@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Decode payloads packed with lib/PayloadCodec using the JSON spec printed
+by Schema::spec(), or generate a TTN uplink payload formatter from it.
+
+  decode.py spec.json 04D24CEDC0 [...]      decode hex payloads
+  decode.py --js spec.json > formatter.js   TTN (v3) decodeUplink()
+"""
+
+import argparse
+import json
+import sys
+
+
+def decode(spec, data):
+    v = int.from_bytes(data, "big")
+    pos = len(data) * 8
+    out = {}
+    for f in spec["fields"]:
+        pos -= f["bits"]
+        raw = (v >> pos) & ((1 << f["bits"]) - 1)
+        val = (raw - f["offset"]) / f["scale"]
+        out[f["name"]] = int(val) if f["scale"] == 1 else val
+    return out
+
+
+JS = """function decodeUplink(input) {
+  var spec = %s;
+  var pos = 0, data = {};
+  for (var i = 0; i < spec.fields.length; i++) {
+    var f = spec.fields[i], raw = 0;
+    for (var b = 0; b < f.bits; b++, pos++) {
+      raw = raw * 2 + ((input.bytes[pos >> 3] >> (7 - (pos & 7))) & 1);
+    }
+    data[f.name] = (raw - f.offset) / f.scale;
+  }
+  if (input.bytes.length < spec.bytes) {
+    return { errors: ["payload too short"] };
+  }
+  return { data: data };
+}
+"""
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("spec", type=argparse.FileType("r"))
+    ap.add_argument("payload", nargs="*", help="hex payloads")
+    ap.add_argument("--js", action="store_true", help="print TTN payload formatter")
+    args = ap.parse_args()
+    spec = json.load(args.spec)
+    if args.js:
+        sys.stdout.write(JS % json.dumps(spec))
+        return
+    for p in args.payload:
+        data = bytes.fromhex(p)
+        if len(data) < spec["bytes"]:
+            print("%s: too short (%d < %d bytes)" % (p, len(data), spec["bytes"]))
+            continue
+        print(p, json.dumps(decode(spec, data[:spec["bytes"]])))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Reference encoder/decoder for lib/PayloadCodec/src/SeriesCodec.h and a
+benchmark of bytes and airtime per reading.
+
+  series.py decode 0202B003...              decode one frame (hex)
+  series.py bench [trace.csv] [--channels N]
+  series.py check trace.csv frames.hex -c 51
+
+A trace is a CSV file with one reading per line and one scaled integer per
+column (e.g. temperature in 0.1 degC, humidity in %), lines starting with
+# are comments.  Without a file a synthetic random walk is used; traces/
+has recorded ones.  check compares the frames of SeriesEncoder (written by
+test/series, make series in test/) with encode() of this file and their
+decoded readings with the trace.  The benchmark packs the trace into frames
+of LMIC_maxAppPayload() for each EU868 data rate, exactly like
+SeriesEncoder, and compares with sending 16 bit raw values.
+"""
+
+import argparse
+import csv
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from channel import airtime    # noqa: E402
+
+# EU868 REGION.dr2maxAppPload for DR0..DR5 and the SF of each DR
+MAX_APP_PAYLOAD = [51, 51, 51, 115, 242, 242]
+DR_SF = [12, 11, 10, 9, 8, 7]
+LORAWAN_OVERHEAD = 13       # MHDR, FHDR without FOpts, FPort, MIC
+
+
+def zigzag(v):
+    return ((v << 1) ^ (v >> 31)) & 0xFFFFFFFF
+
+
+def unzigzag(z):
+    v = (z >> 1) ^ -(z & 1)
+    return v - (1 << 32) if v >= (1 << 31) else v
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def wrap32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v >= (1 << 31) else v
+
+
+def encode(records, channels, capacity):
+    """Split records into frames; same result as SeriesEncoder"""
+    frames, frame, prev = [], bytearray([channels]), [0] * channels
+    for rec in records:
+        enc = b"".join(varint(zigzag(wrap32(v - p))) for v, p in zip(rec, prev))
+        if len(frame) + len(enc) > capacity:
+            if len(frame) == 1:
+                raise ValueError("record does not fit in an empty frame")
+            frames.append(bytes(frame))
+            frame, prev = bytearray([channels]), [0] * channels
+            enc = b"".join(varint(zigzag(wrap32(v))) for v in rec)
+        frame += enc
+        prev = list(rec)
+    if len(frame) > 1:
+        frames.append(bytes(frame))
+    return frames
+
+
+def decode(frame):
+    channels = frame[0]
+    recs, prev, i = [], [0] * channels, 1
+    while i < len(frame):
+        rec = []
+        for c in range(channels):
+            z, shift = 0, 0
+            while True:
+                if i >= len(frame):
+                    raise ValueError("truncated varint")
+                b = frame[i]
+                i += 1
+                z |= (b & 0x7F) << shift
+                shift += 7
+                if not b & 0x80:
+                    break
+            prev[c] = wrap32(prev[c] + unzigzag(z))
+            rec.append(prev[c])
+        recs.append(rec)
+    return recs
+
+
+def load(path, channels, n, seed):
+    if path:
+        with open(path) as f:
+            return [[int(float(x)) for x in row] for row in csv.reader(f)
+                    if row and not row[0].startswith("#")]
+    rng = random.Random(seed)
+    vals = [215, 600, 3300][:channels] + [0] * max(0, channels - 3)
+    recs = []
+    for _ in range(n):
+        vals = [v + rng.choice((-2, -1, 0, 0, 0, 1, 2)) for v in vals]
+        recs.append(list(vals))
+    return recs
+
+
+def bench(records):
+    channels = len(records[0])
+    n = len(records)
+    print("%d readings, %d channels" % (n, channels))
+    print("DR  SF  max   frames  bytes/reading  airtime/reading   raw 16 bit airtime/reading")
+    for dr, (cap, sf) in enumerate(zip(MAX_APP_PAYLOAD, DR_SF)):
+        frames = encode(records, channels, cap)
+        assert [r for f in frames for r in decode(f)] == records
+        size = sum(len(f) for f in frames)
+        air = sum(airtime(sf, len(f) + LORAWAN_OVERHEAD) for f in frames)
+        per_raw = cap // (2 * channels)
+        raw_frames = (n + per_raw - 1) // per_raw
+        raw_air = (n // per_raw) * airtime(sf, per_raw * 2 * channels + LORAWAN_OVERHEAD)
+        if n % per_raw:
+            raw_air += airtime(sf, (n % per_raw) * 2 * channels + LORAWAN_OVERHEAD)
+        print("%2d  %2d  %3d  %7d  %13.2f  %12.2f ms  %7d frames %8.2f ms" % (
+            dr, sf, cap, len(frames), size / n, air * 1000 / n, raw_frames, raw_air * 1000 / n))
+
+
+def check(records, path, capacity):
+    with open(path) as f:
+        frames = [bytes.fromhex(line.strip()) for line in f if line.strip()]
+    ref = encode(records, len(records[0]), capacity)
+    if frames != ref:
+        n = next((i for i, (a, b) in enumerate(zip(frames, ref)) if a != b), min(len(frames), len(ref)))
+        sys.exit("check: frame %d differs from encode() (%d frames, encode() %d)" % (n, len(frames), len(ref)))
+    if [r for f in frames for r in decode(f)] != records:
+        sys.exit("check: decoded readings differ from the trace")
+    print("check: %d readings in %d frames of up to %d bytes, as encode()" % (
+        len(records), len(frames), capacity))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    d = sub.add_parser("decode")
+    d.add_argument("frame", nargs="+", help="hex frames")
+    b = sub.add_parser("bench")
+    b.add_argument("trace", nargs="?")
+    b.add_argument("--channels", type=int, default=2, help="synthetic trace channels")
+    b.add_argument("-n", type=int, default=1440, help="synthetic trace readings")
+    b.add_argument("--seed", type=int, default=1)
+    c = sub.add_parser("check")
+    c.add_argument("trace")
+    c.add_argument("frames", help="hex frames of SeriesEncoder, one per line")
+    c.add_argument("-c", "--capacity", type=int, required=True, help="frame capacity")
+    args = ap.parse_args()
+    if args.cmd == "decode":
+        for h in args.frame:
+            for rec in decode(bytes.fromhex(h)):
+                print(",".join(str(v) for v in rec))
+    elif args.cmd == "check":
+        check(load(args.trace, 0, 0, 0), args.frames, args.capacity)
+    else:
+        bench(load(args.trace, args.channels, args.n, args.seed))
+
+
+if __name__ == "__main__":
+    main()
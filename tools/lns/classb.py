@@ -0,0 +1,40 @@
+"""Class B ping slots (LoRaWAN 1.0.4 class B) for lns.py.
+
+The gateway sends the beacons itself (packet forwarder "beacon_period"),
+the server only has to know when a device listens.  The slots of a
+device in the beacon period that starts at GPS time beacon_time are
+
+  pingOffset = (rand[0] + 256 * rand[1]) % pingPeriod
+  rand       = aes128_encrypt(16 x 0x00, beacon_time | DevAddr | pad16)
+  slot n     = beacon_time + 2.120 s + (pingOffset + n * pingPeriod) * 30 ms
+
+with pingPeriod = 32 * 2^p slots for a PingSlotInfoReq periodicity p
+(lmic.c rxschedInit()).
+"""
+
+import lwcrypto as lc
+
+BEACON_PERIOD = 128
+BEACON_RESERVED = 2.120
+SLOT_LEN = 0.030
+PING_FREQ = 869.525                 # EU868 defaults
+PING_DR = 3
+
+
+def ping_offset(beacon_time, devaddr, period):
+    rand = lc.aes_encrypt(bytes(16), beacon_time.to_bytes(4, "little")
+                          + devaddr.to_bytes(4, "little") + bytes(8))
+    return (rand[0] + 256 * rand[1]) % period
+
+
+def next_slot(devaddr, periodicity, after):
+    """GPS time of the first ping slot of devaddr later than after"""
+    period = 32 << periodicity
+    beacon = int(after) // BEACON_PERIOD * BEACON_PERIOD
+    while True:
+        off = ping_offset(beacon, devaddr, period)
+        for n in range(4096 // period):
+            t = beacon + BEACON_RESERVED + (off + n * period) * SLOT_LEN
+            if t > after:
+                return t
+        beacon += BEACON_PERIOD
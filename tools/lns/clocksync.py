@@ -0,0 +1,46 @@
+"""Application layer clock synchronization (LoRaWAN TS003) for lns.py.
+
+Answers the AppTimeReq of a device (lmic/timesync.c) on PORT with the
+correction from its DeviceTime to the server's GPS time at the reception
+of the uplink, and builds the requests the server can send.
+"""
+
+PORT = 202
+CS_PKG_VERSION, CS_APP_TIME, CS_PERIODICITY, CS_FORCE_RESYNC = 0, 1, 2, 3
+
+
+def uplink(payload, gps_now):
+    """Process an uplink on PORT, returns (answer or b"", log lines)"""
+    ans, out, i = b"", [], 0
+    while i < len(payload):
+        cid = payload[i]
+        if cid == CS_APP_TIME and i + 6 <= len(payload):
+            devtime = int.from_bytes(payload[i + 1:i + 5], "little")
+            param = payload[i + 5]
+            corr = int(round(gps_now - devtime))
+            out.append("AppTimeReq DeviceTime %d token %d, correction %d s" % (
+                devtime, param & 0x0F, corr))
+            if corr or param & 0x10:
+                ans += (bytes([CS_APP_TIME]) + (corr & 0xFFFFFFFF).to_bytes(4, "little")
+                        + bytes([param & 0x0F]))
+            i += 6
+        elif cid == CS_PKG_VERSION and i + 3 <= len(payload):
+            out.append("PackageVersionAns id %d version %d" % (payload[i + 1], payload[i + 2]))
+            i += 3
+        elif cid == CS_PERIODICITY and i + 6 <= len(payload):
+            out.append("DeviceAppTimePeriodicityAns status %d time %d" % (
+                payload[i + 1], int.from_bytes(payload[i + 2:i + 6], "little")))
+            i += 6
+        else:
+            out.append("unknown %s" % payload[i:].hex())
+            break
+    return ans, out
+
+
+def periodicity_req(n):
+    """AppTimeReq every 128 * 2^n s"""
+    return bytes([CS_PERIODICITY, n & 0x0F])
+
+
+def force_resync_req(nb):
+    return bytes([CS_FORCE_RESYNC, nb & 0x07])
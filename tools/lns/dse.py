@@ -0,0 +1,123 @@
+"""Data streaming engine (lmic/dse.c): frame format, encoder and decoder.
+
+Every frame carries a 6 byte header and one symbol:
+
+  stream id (1), block (2, LE), last block flag (bit 7) | K (1), ESI (1),
+  padding of the last block (1), symbol
+
+ESI < K is source symbol ESI of the block, ESI >= K the XOR of the source
+symbols selected by coeffs(block, ESI).  Any K independent frames of a
+block recover it.  The FRMPayload is ciphered with category SCC_DSE
+instead of the uplink category.
+"""
+
+HDRLEN = 6
+MAXK = 32
+SCC_DSE = 0x41
+
+
+def coeffs(block, esi):
+    x = (0x9E3779B9 ^ (block << 8 | esi)) & 0xFFFFFFFF
+    x ^= x >> 16
+    x = x * 0x85EBCA6B & 0xFFFFFFFF
+    x ^= x >> 13
+    x = x * 0xC2B2AE35 & 0xFFFFFFFF
+    x ^= x >> 16
+    return x
+
+
+def symbol_mask(block, esi, k):
+    if esi < k:
+        return 1 << esi
+    c = coeffs(block, esi) & ((1 << k) - 1)
+    return c or 1 << ((esi - k) % k)
+
+
+def encode_block(data, off, block, symsz, redundancy, stream=1):
+    """Frames of the block starting at off (same as dse.c), and the next offset"""
+    k = min(MAXK, -(-(len(data) - off) // symsz))
+    last = off + k * symsz >= len(data)
+    pad = off + k * symsz - len(data) if last else 0
+    src = [data[off + i * symsz:off + (i + 1) * symsz].ljust(symsz, b"\0") for i in range(k)]
+    hdr = bytes([stream]) + block.to_bytes(2, "little") + bytes([(0x80 if last else 0) | k])
+    frames = []
+    for esi in range(k + (k * redundancy + 99) // 100):
+        m = symbol_mask(block, esi, k)
+        sym = bytearray(symsz)
+        for i in range(k):
+            if m >> i & 1:
+                for j, b in enumerate(src[i]):
+                    sym[j] ^= b
+        frames.append(hdr + bytes([esi, pad]) + bytes(sym))
+    return frames, off + k * symsz
+
+
+def encode(data, symsz, redundancy, stream=1):
+    frames, off, block = [], 0, 0
+    while off < len(data):
+        f, off = encode_block(data, off, block, symsz, redundancy, stream)
+        frames += f
+        block += 1
+    return frames
+
+
+class Block:
+    def __init__(self, k, symsz):
+        self.k = k
+        self.symsz = symsz
+        self.rows = {}              # pivot -> [mask, data]
+
+    def add(self, m, sym):
+        sym = int.from_bytes(sym, "little")
+        for p, (rm, rd) in self.rows.items():
+            if m >> p & 1:
+                m ^= rm
+                sym ^= rd
+        if m == 0:
+            return self.complete()
+        p = (m & -m).bit_length() - 1
+        for row in self.rows.values():
+            if row[0] >> p & 1:
+                row[0] ^= m
+                row[1] ^= sym
+        self.rows[p] = [m, sym]
+        return self.complete()
+
+    def complete(self):
+        return len(self.rows) == self.k
+
+    def data(self):
+        return b"".join(self.rows[i][1].to_bytes(self.symsz, "little") for i in range(self.k))
+
+
+class Receiver:
+    """Reassembles the streams of one device"""
+    def __init__(self):
+        self.streams = {}           # stream id -> {"blocks": {}, "last": None, "pad": 0}
+        self.frames = 0
+
+    def feed(self, frame):
+        """Returns the stream data when frame completes a stream, else None"""
+        if len(frame) <= HDRLEN:
+            return None
+        self.frames += 1
+        sid, block = frame[0], int.from_bytes(frame[1:3], "little")
+        last, k, esi, pad = frame[3] & 0x80, frame[3] & 0x3F, frame[4], frame[5]
+        sym = frame[HDRLEN:]
+        st = self.streams.setdefault(sid, {"blocks": {}, "last": None, "pad": 0, "done": False})
+        if st["done"] or k == 0:
+            return None
+        b = st["blocks"].get(block)
+        if b is None or b.k != k or b.symsz != len(sym):
+            if b is not None and not last and st["last"] is not None and st["last"] >= block:
+                st["last"], st["pad"] = None, 0     # restarted with smaller symbols, not the last any more
+            b = st["blocks"][block] = Block(k, len(sym))     # new or restarted block
+        if last:
+            st["last"], st["pad"] = block, pad
+        b.add(symbol_mask(block, esi, k), sym)
+        if st["last"] is None or not all(
+                i in st["blocks"] and st["blocks"][i].complete() for i in range(st["last"] + 1)):
+            return None
+        st["done"] = True
+        data = b"".join(st["blocks"][i].data() for i in range(st["last"] + 1))
+        return data[:len(data) - st["pad"]]
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""Fragmented data block transport (LoRaWAN TS004) for lns.py.
+
+Splits a data block into fragments and appends coded (parity) fragments
+made with the TS004 parity matrix, the same one lmic/fuota.c decodes.
+Also builds the FragSessionSetupReq and decodes the device answers.
+
+Run on its own to find the number of coded fragments needed at a given
+loss rate, with the same decoder limits as the device:
+
+  frag.py --size 102400 --frag 200 --loss 0.1 --runs 20
+
+With --frames the fragments of one run (random data block, the same
+losses) are written as hex payloads on PORT, after the setup request,
+for test/fuota on the host; the data block goes to --block.
+"""
+
+import argparse
+import random
+
+PORT = 201
+FRAG_PKG_VERSION, FRAG_SESS_STATUS, FRAG_SESS_SETUP, FRAG_SESS_DELETE, FRAG_DATA = 0, 1, 2, 3, 8
+
+
+def prbs23(x):
+    b0 = x & 1
+    b1 = (x & 0x20) >> 5
+    return (x >> 1) + ((b0 ^ b1) << 22)
+
+
+def matrix_line(n, m):
+    """Bit mask of the fragments combined in coded fragment n (1, 2, ...)"""
+    x = 1 + 1001 * n
+    mod = m + (1 if m & (m - 1) == 0 else 0)
+    line = 0
+    for _ in range(m // 2):
+        while True:
+            x = prbs23(x)
+            r = x % mod
+            if r < m:
+                break
+        line |= 1 << r
+    return line
+
+
+def split(data, fragsz):
+    """Uncoded fragments and the padding of the last one"""
+    pad = -len(data) % fragsz
+    data = data + bytes(pad)
+    return [data[i:i + fragsz] for i in range(0, len(data), fragsz)], pad
+
+
+def coded(frags, n):
+    m = len(frags)
+    line = matrix_line(n, m)
+    acc = 0
+    for j in range(m):
+        if line >> j & 1:
+            acc ^= int.from_bytes(frags[j], "little")
+    return acc.to_bytes(len(frags[0]), "little")
+
+
+def data_fragment(index, n, payload):
+    return bytes([FRAG_DATA]) + ((index << 14) | n).to_bytes(2, "little") + payload
+
+
+def setup_req(nbfrag, fragsz, padding, index=0, mcgroups=0x1, descriptor=0, ackdelay=0):
+    return (bytes([FRAG_SESS_SETUP, index << 4 | mcgroups]) + nbfrag.to_bytes(2, "little")
+            + bytes([fragsz, ackdelay & 7, padding]) + descriptor.to_bytes(4, "little"))
+
+
+def status_req(index=0, all_participants=True):
+    return bytes([FRAG_SESS_STATUS, index << 1 | (1 if all_participants else 0)])
+
+
+def delete_req(index=0):
+    return bytes([FRAG_SESS_DELETE, index])
+
+
+def answers(payload):
+    """Decode an uplink on PORT into readable text"""
+    out, i = [], 0
+    while i < len(payload):
+        cid = payload[i]
+        if cid == FRAG_PKG_VERSION and i + 3 <= len(payload):
+            out.append("PackageVersionAns id %d version %d" % (payload[i + 1], payload[i + 2]))
+            i += 3
+        elif cid == FRAG_SESS_SETUP and i + 2 <= len(payload):
+            st = payload[i + 1]
+            out.append("FragSessionSetupAns index %d status %s" % (
+                st >> 6, "OK" if st & 0x0F == 0 else "%02X" % (st & 0x0F)))
+            i += 2
+        elif cid == FRAG_SESS_STATUS and i + 5 <= len(payload):
+            bm = int.from_bytes(payload[i + 1:i + 3], "little")
+            out.append("FragSessionStatusAns index %d received %d missing %d%s" % (
+                bm >> 14, bm & 0x3FFF, payload[i + 3],
+                " out of memory" if payload[i + 4] & 1 else ""))
+            i += 5
+        elif cid == FRAG_SESS_DELETE and i + 2 <= len(payload):
+            out.append("FragSessionDeleteAns index %d%s" % (
+                payload[i + 1] & 3, " no session" if payload[i + 1] & 4 else ""))
+            i += 2
+        else:
+            out.append("unknown %s" % payload[i:].hex())
+            break
+    return out
+
+
+class Decoder:
+    """Model of lmic/fuota.c: equations over the fragments missing when the
+    first coded fragment arrives, at most maxmissing of them"""
+    def __init__(self, m, maxmissing=128):
+        self.m = m
+        self.maxmissing = maxmissing
+        self.have = set()
+        self.cols = None
+        self.rows = {}              # pivot column -> equation (bit mask)
+
+    def add(self, n):
+        """Fragment n (1..) received, returns True when the block is complete"""
+        if n <= self.m:
+            j = n - 1
+            if j in self.have:
+                return self.complete()
+            self.have.add(j)
+            if self.cols is not None:
+                self.equation(1 << self.cols[j])
+        elif len(self.have) < self.m:
+            if self.cols is None:
+                missing = [j for j in range(self.m) if j not in self.have]
+                if len(missing) > self.maxmissing:
+                    return False
+                self.cols = {j: c for c, j in enumerate(missing)}
+            line = matrix_line(n - self.m, self.m)
+            v = 0
+            for j, c in self.cols.items():
+                if line >> j & 1:
+                    v |= 1 << c
+            self.equation(v)
+        return self.complete()
+
+    def equation(self, v):
+        for c, row in self.rows.items():
+            if v >> c & 1:
+                v ^= row
+        if v == 0:
+            return
+        p = (v & -v).bit_length() - 1
+        for c in self.rows:
+            if self.rows[c] >> p & 1:
+                self.rows[c] ^= v
+        self.rows[p] = v
+
+    def complete(self):
+        if self.cols is None:
+            return len(self.have) == self.m
+        return len(self.rows) == len(self.cols)
+
+
+def study(size, fragsz, loss, runs, maxmissing, seed):
+    m = -(-size // fragsz)
+    rnd = random.Random(seed)
+    extra, failed = [], 0
+    for _ in range(runs):
+        dec = Decoder(m, maxmissing)
+        sent, done = 0, False
+        while sent < 4 * m and not done:
+            sent += 1
+            if rnd.random() >= loss:
+                done = dec.add(sent)
+        if done:
+            extra.append(sent - m)
+        else:
+            failed += 1
+    return m, extra, failed
+
+
+def frames(out, block, size, fragsz, loss, maxmissing, seed):
+    """Write the frames of one run of study() and its data block"""
+    rnd = random.Random(seed)
+    data = random.Random(seed + 1).randbytes(size)
+    frags, pad = split(data, fragsz)
+    m = len(frags)
+    dec = Decoder(m, maxmissing)
+    complete = 0
+    with open(out, "w") as f:
+        f.write("%s\n" % setup_req(m, fragsz, pad, descriptor=size).hex())
+        # a few more after the model completes, to count what the device needs
+        n, end = 0, 4 * m
+        while n < end:
+            n += 1
+            if rnd.random() < loss:
+                continue
+            f.write("%s\n" % data_fragment(0, n, frags[n - 1] if n <= m
+                                           else coded(frags, n - m)).hex())
+            if not complete and dec.add(n):
+                complete = n
+                end = min(end, n + m // 10 + 8)
+        f.write("# complete %d\n" % complete)
+    with open(block, "wb") as f:
+        f.write(data)
+    return m, complete
+
+
+def main():
+    ap = argparse.ArgumentParser(description="coded fragments needed for a data block")
+    ap.add_argument("--size", type=int, default=100 * 1024, help="data block size (bytes)")
+    ap.add_argument("--frag", type=int, default=200, help="fragment size (bytes)")
+    ap.add_argument("--loss", type=float, default=0.1, help="fragment loss probability")
+    ap.add_argument("--runs", type=int, default=20)
+    ap.add_argument("--maxmissing", type=int, default=128, help="CFG_fuota_maxmissing")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--frames", help="write the frames of one run to this file")
+    ap.add_argument("--block", default="block.bin", help="data block of --frames")
+    args = ap.parse_args()
+    if args.frames:
+        m, complete = frames(args.frames, args.block, args.size, args.frag, args.loss,
+                             args.maxmissing, args.seed)
+        print("%d fragments of %d bytes, loss %.0f%%, %s" % (
+            m, args.frag, args.loss * 100,
+            "complete after %d" % complete if complete else "not complete"))
+        return
+    m, extra, failed = study(args.size, args.frag, args.loss, args.runs,
+                             args.maxmissing, args.seed)
+    print("%d fragments of %d bytes, loss %.0f%%" % (m, args.frag, args.loss * 100))
+    if extra:
+        extra.sort()
+        print("coded fragments sent until complete: min %d median %d max %d (%.1f%% overhead)" % (
+            extra[0], extra[len(extra) // 2], extra[-1], 100.0 * extra[-1] / m))
+    if failed:
+        print("%d of %d runs lost more than %d fragments (CFG_fuota_maxmissing)" % (
+            failed, args.runs, args.maxmissing))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,787 @@
+#!/usr/bin/env python3
+"""Minimal local LoRaWAN 1.0.x network server (EU868).
+
+Talks to one or more gateways with the Semtech UDP packet forwarder
+protocol (v2) and needs no external services or Python packages.  Point
+a packet forwarder (real gateway on the LAN or a virtual one on
+localhost) at this host, port 1700.
+
+Supported:
+  - OTAA join accept with CFList, ABP sessions
+  - data up/downlinks with 32 bit frame counter recovery
+  - confirmed uplinks (ACK) and confirmed downlinks, FPending; the time
+    from queueing to sending is logged per downlink and per drained
+    backlog (lmic LMIC_setDrain polls while FPending is set)
+  - MAC commands: LinkCheckAns, DeviceTimeAns, LinkADRReq (ADR),
+    NewChannelReq, RXParamSetupReq, DevStatusReq
+  - class C devices and multicast groups (immediate RX2 downlinks)
+  - class B devices: PingSlotInfoReq and downlinks in the next ping slot
+    (GPS timed, the gateway sends the beacons), see classb.py
+  - fragmented data block transport (FUOTA, port 201) with coded
+    fragments and simulated loss, see frag.py
+  - remote multicast setup (port 200): group keys and class C sessions,
+    see mcast.py
+  - application layer clock synchronization (port 202), see clocksync.py
+  - reassembly of uplink streams sent by the data streaming engine
+    (lmic/dse.c) on the port given with --dse, see dse.py
+
+Usage:
+  lns.py [-c devices.json] [-s state.json] [-p 1700] [--rx2] [--dse port]
+         [--no-console]
+
+Commands on stdin (type 'help').  Devices are identified by DevEUI or
+DevAddr (hex).  With --no-console stdin is not read and the server runs
+until it is killed (test/Makefile, make lns).
+"""
+
+import argparse
+import base64
+import json
+import os
+import random
+import socket
+import sys
+import threading
+import time
+
+import classb
+import clocksync
+import dse
+import frag
+import lwcrypto as lc
+import mcast
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from channel import airtime    # noqa: E402
+
+PROTOCOL_VERSION = 2
+PUSH_DATA, PUSH_ACK, PULL_DATA, PULL_RESP, PULL_ACK, TX_ACK = 0, 1, 2, 3, 4, 5
+
+NETID = 0x000013
+JOIN_DELAY = 5                      # JOIN_ACCEPT_DELAY1 (s)
+RX_DELAY = 1                        # RECEIVE_DELAY1 (s)
+RX2_FREQ = 869.525
+RX2_DR = 0
+DOWN_POWER = 14
+# Channels 3..7 sent in the CFList (MHz), channels 0..2 are the defaults
+CFLIST_FREQS = [867.1, 867.3, 867.5, 867.7, 867.9]
+CHMASK_ALL = 0x00FF
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+SF_REQ_SNR = {7: -7.5, 8: -10.0, 9: -12.5, 10: -15.0, 11: -17.5, 12: -20.0}
+ADR_MARGIN = 10.0                   # installation margin (dB)
+ADR_HISTORY = 20                    # uplinks used for the ADR decision
+MAX_DR = 5
+MAX_TXPOW = 7                       # EU868 TXPower index 7 = max - 14 dB
+MAX_PAYLOAD = {0: 51, 1: 51, 2: 51, 3: 115, 4: 242, 5: 242}
+RX2_DUTY = 0.1                      # duty cycle limit of the 869.4-869.65 MHz band
+
+GPS_EPOCH_OFFSET = 315964800        # 1980-01-06 in unix time
+GPS_LEAP_SECONDS = 18
+
+# MAC commands sent by the device: CID -> payload length
+UP_MCMD_LEN = {0x02: 0, 0x03: 1, 0x04: 0, 0x05: 1, 0x06: 2, 0x07: 1,
+               0x08: 0, 0x0A: 1, 0x0B: 1, 0x0C: 0, 0x0D: 0, 0x10: 1,
+               0x11: 1, 0x12: 0, 0x13: 1, 0x20: 1}
+
+
+def log(fmt, *args):
+    print(time.strftime("%H:%M:%S") + " " + (fmt % args if args else fmt), flush=True)
+
+
+def datr(dr):
+    return "SF%dBW125" % DR_SF[dr]
+
+
+def dr_of(datr_str):
+    sf = int(datr_str[2:datr_str.index("BW")])
+    for dr, s in DR_SF.items():
+        if s == sf:
+            return dr
+    raise ValueError(datr_str)
+
+
+def gps_time(unix):
+    return unix - GPS_EPOCH_OFFSET + GPS_LEAP_SECONDS
+
+
+class Device:
+    def __init__(self, cfg):
+        self.deveui = cfg.get("deveui", "").upper()
+        self.joineui = cfg.get("joineui", "").upper()
+        self.appkey = bytes.fromhex(cfg["appkey"]) if "appkey" in cfg else None
+        self.cls = cfg.get("class", "A").upper()
+        self.devaddr = int(cfg["devaddr"], 16) if "devaddr" in cfg else None
+        self.nwkskey = bytes.fromhex(cfg["nwkskey"]) if "nwkskey" in cfg else None
+        self.appskey = bytes.fromhex(cfg["appskey"]) if "appskey" in cfg else None
+        self.fcnt_up = -1
+        self.fcnt_down = 0
+        self.devnonces = []
+        self.adr_snr = []
+        self.dr = 0
+        self.txpow = 0
+        self.rx1droff = 0
+        self.rx2dr = RX2_DR
+        self.rx2freq = RX2_FREQ
+        self.last_rx = None             # (gateway, rxpk) of last uplink
+        self.classb = False             # class B bit of the last uplink
+        self.ping_period = None         # PingSlotInfoReq periodicity
+        self.app_queue = []             # [(port, payload, confirmed, queued at)]
+        self.backlog = None             # [queued at, frames] of the first frame in the queue
+        self.latency = []               # queue to send time of the last downlinks (s)
+        self.uptime = []                # (time, airtime) of the uplinks of the last 24 hours
+        self.mac_queue = bytearray()    # pending downlink MAC commands
+        self.mac_sent = []              # requests waiting for an answer
+        self.unacked = None             # confirmed downlink waiting for ACK
+        self.stats = {"joins": 0, "up": 0, "down": 0, "acks": 0, "lost": 0}
+        self.streams = dse.Receiver()
+
+    def key(self):
+        return self.deveui or "%08X" % self.devaddr
+
+    def queue(self, port, payload, confirmed=False, first=False):
+        entry = (port, payload, confirmed, time.time())
+        if first:
+            self.app_queue.insert(0, entry)
+        else:
+            self.app_queue.append(entry)
+        if self.backlog is None:
+            self.backlog = [entry[3], 0]
+
+    def to_state(self):
+        if self.devaddr is None:
+            return None
+        return {"devaddr": "%08X" % self.devaddr, "nwkskey": self.nwkskey.hex(),
+                "appskey": self.appskey.hex(), "fcnt_up": self.fcnt_up,
+                "fcnt_down": self.fcnt_down, "devnonces": self.devnonces,
+                "dr": self.dr, "txpow": self.txpow, "rx1droff": self.rx1droff,
+                "rx2dr": self.rx2dr, "rx2freq": self.rx2freq}
+
+    def from_state(self, st):
+        self.devaddr = int(st["devaddr"], 16)
+        self.nwkskey = bytes.fromhex(st["nwkskey"])
+        self.appskey = bytes.fromhex(st["appskey"])
+        for k in ("fcnt_up", "fcnt_down", "devnonces", "dr", "txpow",
+                  "rx1droff", "rx2dr", "rx2freq"):
+            setattr(self, k, st.get(k, getattr(self, k)))
+
+
+class Group:
+    """Multicast group: shared session keys, downlink only.  With "mckey"
+    the session keys are derived from it and the group can be set up on
+    the devices with the remote multicast setup package."""
+    def __init__(self, name, cfg):
+        self.name = name
+        self.id = cfg.get("id", 0)
+        self.devaddr = int(cfg["devaddr"], 16)
+        self.mckey = bytes.fromhex(cfg["mckey"]) if "mckey" in cfg else None
+        if self.mckey:
+            self.nwkskey, self.appskey = mcast.session_keys(self.mckey, self.devaddr)
+        else:
+            self.nwkskey = bytes.fromhex(cfg["nwkskey"])
+            self.appskey = bytes.fromhex(cfg["appskey"])
+        self.freq = cfg.get("freq", RX2_FREQ)
+        self.dr = cfg.get("dr", RX2_DR)
+        self.fcnt_down = cfg.get("fcnt_down", 0)
+
+
+class Server:
+    def __init__(self, cfg, state_file, port, use_rx2, dse_port=None):
+        self.lock = threading.RLock()
+        self.devices = [Device(d) for d in cfg.get("devices", [])]
+        self.groups = {n: Group(n, g) for n, g in cfg.get("multicast", {}).items()}
+        self.state_file = state_file
+        self.use_rx2 = use_rx2
+        self.dse_port = dse_port
+        self.gateways = {}              # gateway EUI -> (addr of PULL_DATA)
+        self.seen = {}                  # dedup of uplinks received by several gateways
+        self.token = random.randrange(0x10000)
+        self.fuota_stop = False
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("", port))
+        self.load_state()
+        log("listening on UDP port %d, %d devices, %d multicast groups",
+            port, len(self.devices), len(self.groups))
+
+    # ---------------------------------------------------------------- state
+    def load_state(self):
+        if not self.state_file or not os.path.exists(self.state_file):
+            return
+        with open(self.state_file) as f:
+            st = json.load(f)
+        for d in self.devices:
+            if d.key() in st.get("devices", {}):
+                d.from_state(st["devices"][d.key()])
+        for n, fc in st.get("multicast", {}).items():
+            if n in self.groups:
+                self.groups[n].fcnt_down = fc
+
+    def save_state(self):
+        if not self.state_file:
+            return
+        st = {"devices": {d.key(): d.to_state() for d in self.devices if d.devaddr is not None},
+              "multicast": {n: g.fcnt_down for n, g in self.groups.items()}}
+        tmp = self.state_file + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump(st, f, indent=1)
+        os.replace(tmp, self.state_file)
+
+    def find(self, ident):
+        ident = ident.upper()
+        for d in self.devices:
+            if d.deveui == ident or (d.devaddr is not None and "%08X" % d.devaddr == ident):
+                return d
+        return None
+
+    # ------------------------------------------------------------- UDP layer
+    def run(self):
+        while True:
+            data, addr = self.sock.recvfrom(65535)
+            if len(data) < 4 or data[0] != PROTOCOL_VERSION:
+                continue
+            token, ident = data[1:3], data[3]
+            with self.lock:
+                if ident == PUSH_DATA and len(data) >= 12:
+                    self.sock.sendto(bytes([PROTOCOL_VERSION]) + token + bytes([PUSH_ACK]), addr)
+                    self.push_data(data[4:12].hex().upper(), data[12:])
+                elif ident == PULL_DATA and len(data) >= 12:
+                    gw = data[4:12].hex().upper()
+                    if gw not in self.gateways:
+                        log("gateway %s connected from %s:%d", gw, *addr)
+                    self.gateways[gw] = addr
+                    self.sock.sendto(bytes([PROTOCOL_VERSION]) + token + bytes([PULL_ACK]), addr)
+                elif ident == TX_ACK:
+                    self.tx_ack(data[4:12].hex().upper(), data[12:])
+
+    def tx_ack(self, gw, body):
+        if not body.strip(b"\0"):
+            return
+        try:
+            err = json.loads(body.decode().rstrip("\0"))["txpk_ack"].get("error", "NONE")
+        except (ValueError, KeyError):
+            return
+        if err != "NONE":
+            log("gateway %s rejected downlink: %s", gw, err)
+
+    def push_data(self, gw, body):
+        try:
+            msg = json.loads(body.decode())
+        except ValueError:
+            return
+        for rxpk in msg.get("rxpk", []):
+            if rxpk.get("stat", 1) != 1 or rxpk.get("modu") != "LORA":
+                continue
+            frame = base64.b64decode(rxpk["data"])
+            now = time.time()
+            for k in [k for k, t in self.seen.items() if now - t > 2]:
+                del self.seen[k]
+            if frame in self.seen:
+                continue
+            self.seen[frame] = now
+            try:
+                self.uplink(gw, rxpk, frame, now)
+            except (ValueError, IndexError) as e:
+                log("bad frame from %s: %s (%s)", gw, frame.hex(), e)
+
+    def send_txpk(self, gw, txpk):
+        addr = self.gateways.get(gw)
+        if addr is None:
+            log("gateway %s has not sent PULL_DATA, downlink dropped", gw)
+            return
+        self.token = (self.token + 1) & 0xFFFF
+        pkt = (bytes([PROTOCOL_VERSION]) + self.token.to_bytes(2, "big") + bytes([PULL_RESP])
+               + json.dumps({"txpk": txpk}).encode())
+        self.sock.sendto(pkt, addr)
+
+    def schedule(self, dev, gw, rxpk, frame, delay):
+        """Answer in RX1 (same channel and DR minus offset) or RX2"""
+        if self.use_rx2:
+            freq, dr = dev.rx2freq, dev.rx2dr
+            delay += 1
+        else:
+            freq, dr = rxpk["freq"], max(0, dr_of(rxpk["datr"]) - dev.rx1droff)
+        self.send_txpk(gw, {"imme": False, "tmst": (rxpk["tmst"] + delay * 1000000) & 0xFFFFFFFF,
+                            "freq": freq, "rfch": 0, "powe": DOWN_POWER, "modu": "LORA",
+                            "datr": datr(dr), "codr": "4/5", "ipol": True,
+                            "size": len(frame), "data": base64.b64encode(frame).decode()})
+
+    def send_now(self, freq, dr, frame):
+        """Immediate downlink on all gateways (class C / multicast)"""
+        for gw in self.gateways:
+            self.send_txpk(gw, {"imme": True, "freq": freq, "rfch": 0, "powe": DOWN_POWER,
+                                "modu": "LORA", "datr": datr(dr), "codr": "4/5", "ipol": True,
+                                "size": len(frame), "data": base64.b64encode(frame).decode()})
+
+    # ---------------------------------------------------------------- uplink
+    def uplink(self, gw, rxpk, frame, now):
+        mtype = frame[0] >> 5
+        if mtype == 0 and len(frame) == 23:
+            self.join_request(gw, rxpk, frame)
+        elif mtype in (2, 4) and len(frame) >= 12:
+            self.data_uplink(gw, rxpk, frame, now)
+
+    def join_request(self, gw, rxpk, frame):
+        joineui = frame[1:9][::-1].hex().upper()
+        deveui = frame[9:17][::-1].hex().upper()
+        devnonce = int.from_bytes(frame[17:19], "little")
+        dev = self.find(deveui)
+        if dev is None or dev.appkey is None:
+            log("join request from unknown DevEUI %s", deveui)
+            return
+        if lc.join_mic(dev.appkey, frame[:-4]) != frame[-4:]:
+            log("%s join request with bad MIC", deveui)
+            return
+        if devnonce in dev.devnonces:
+            log("%s join request with reused DevNonce %04X", deveui, devnonce)
+            return
+        dev.devnonces = (dev.devnonces + [devnonce])[-32:]
+        joinnonce = random.randrange(1 << 24).to_bytes(3, "little")
+        netid = NETID.to_bytes(3, "little")
+        dev.devaddr = (NETID & 0x7F) << 25 | random.randrange(1 << 25)
+        dev.nwkskey, dev.appskey = lc.session_keys(dev.appkey, joinnonce, netid, frame[17:19])
+        dev.fcnt_up, dev.fcnt_down = -1, 0
+        dev.adr_snr, dev.mac_queue, dev.mac_sent = [], bytearray(), []
+        dev.dr, dev.txpow, dev.unacked = dr_of(rxpk["datr"]), 0, None
+        dev.rx1droff, dev.rx2dr, dev.rx2freq = 0, RX2_DR, RX2_FREQ
+        cflist = b"".join(int(round(f * 10000)).to_bytes(3, "little") for f in CFLIST_FREQS) + b"\0"
+        msg = (bytes([0x20]) + joinnonce + netid + dev.devaddr.to_bytes(4, "little")
+               + bytes([dev.rx1droff << 4 | dev.rx2dr, RX_DELAY]) + cflist)
+        msg += lc.join_mic(dev.appkey, msg)
+        self.schedule(dev, gw, rxpk, lc.join_accept_encrypt(dev.appkey, msg), JOIN_DELAY)
+        dev.stats["joins"] += 1
+        log("%s joined (JoinEUI %s), DevAddr %08X, %s %.1f dBm SNR %.1f via %s", deveui, joineui,
+            dev.devaddr, rxpk["datr"], rxpk.get("rssi", 0), rxpk.get("lsnr", 0), gw)
+        self.save_state()
+
+    def data_uplink(self, gw, rxpk, frame, now):
+        devaddr = int.from_bytes(frame[1:5], "little")
+        dev = next((d for d in self.devices if d.devaddr == devaddr), None)
+        if dev is None:
+            return                      # not ours
+        fctrl = frame[5]
+        foptslen = fctrl & 0x0F
+        fcnt16 = int.from_bytes(frame[6:8], "little")
+        # recover 32 bit counter from the 16 LSBs
+        fcnt = (max(dev.fcnt_up, 0) & ~0xFFFF) | fcnt16
+        if fcnt < dev.fcnt_up:
+            fcnt += 0x10000
+        if lc.frame_mic(dev.nwkskey, devaddr, fcnt, 0, frame[:-4]) != frame[-4:]:
+            log("%08X uplink FCnt %d with bad MIC", devaddr, fcnt)
+            return
+        confirmed = frame[0] >> 5 == 4
+        if fcnt == dev.fcnt_up and not confirmed:
+            return
+        if fcnt < dev.fcnt_up:
+            log("%08X replayed FCnt %d (last %d)", devaddr, fcnt, dev.fcnt_up)
+            return
+        if dev.fcnt_up >= 0 and fcnt > dev.fcnt_up + 1:
+            dev.stats["lost"] += fcnt - dev.fcnt_up - 1
+        retrans = fcnt == dev.fcnt_up
+        dev.fcnt_up = fcnt
+        dev.last_rx = (gw, rxpk)
+        dev.classb = bool(fctrl & 0x10)
+        dev.dr = dr_of(rxpk["datr"])
+        dev.stats["up"] += 1
+        dev.uptime = [u for u in dev.uptime if u[0] > now - 86400] + [
+            (now, airtime(DR_SF[dev.dr], len(frame)))]
+        fopts = frame[8:8 + foptslen]
+        port, payload = None, b""
+        if len(frame) > 8 + foptslen + 4:
+            port = frame[8 + foptslen]
+            key = dev.nwkskey if port == 0 else dev.appskey
+            cat = dse.SCC_DSE if port == self.dse_port else 0
+            payload = lc.frame_crypt(key, devaddr, fcnt, cat, frame[9 + foptslen:-4])
+            if port == 0:
+                fopts = payload
+        if fctrl & 0x20 and dev.unacked:
+            log("%08X confirmed downlink FCnt %d acknowledged", devaddr, dev.unacked)
+            dev.unacked = None
+            dev.stats["acks"] += 1
+        log("%08X up FCnt %d%s port %s %s [%s] %s rssi %.0f snr %.1f", devaddr, fcnt,
+            " (conf)" if confirmed else "", port, payload.hex() if port else "",
+            fopts.hex(), rxpk["datr"], rxpk.get("rssi", 0), rxpk.get("lsnr", 0))
+        if port == frag.PORT:
+            for a in frag.answers(payload):
+                log("%08X %s", devaddr, a)
+        if port == mcast.PORT:
+            for a in mcast.answers(payload):
+                log("%08X %s", devaddr, a)
+        if port == clocksync.PORT and not retrans:
+            ans, lines = clocksync.uplink(payload, gps_time(now))
+            for a in lines:
+                log("%08X %s", devaddr, a)
+            if ans:
+                dev.queue(clocksync.PORT, ans, first=True)
+        if port == self.dse_port and payload:
+            self.stream_frame(dev, payload)
+        if not retrans:
+            self.uplink_mac(dev, fopts, rxpk, now)
+            if fctrl & 0x80:
+                self.adr(dev, rxpk, fctrl & 0x40)
+        if dev.cls == "A" or confirmed or dev.mac_queue or fctrl & 0x40:
+            self.downlink(dev, gw, rxpk, ack=confirmed)
+        self.save_state()
+
+    def uplink_mac(self, dev, fopts, rxpk, now):
+        i = 0
+        while i < len(fopts):
+            cid = fopts[i]
+            n = UP_MCMD_LEN.get(cid)
+            if n is None or i + 1 + n > len(fopts):
+                log("%08X unknown or truncated MAC command %s", dev.devaddr, fopts[i:].hex())
+                return
+            arg = fopts[i + 1:i + 1 + n]
+            i += 1 + n
+            if cid == 0x02:                         # LinkCheckReq
+                sf = DR_SF[dr_of(rxpk["datr"])]
+                margin = max(0, int(rxpk.get("lsnr", 0) - SF_REQ_SNR[sf]))
+                dev.mac_queue += bytes([0x02, min(margin, 254), 1])
+            elif cid == 0x0D:                       # DeviceTimeReq
+                t = gps_time(now)
+                dev.mac_queue += (bytes([0x0D]) + int(t).to_bytes(4, "little")
+                                  + bytes([int((t % 1) * 256)]))
+            elif cid == 0x10:                       # PingSlotInfoReq
+                dev.ping_period = arg[0] & 7
+                dev.mac_queue += b"\x10"
+                log("%08X ping slot every %d s", dev.devaddr, 1 << dev.ping_period)
+            elif cid == 0x06:
+                log("%08X DevStatusAns battery %d margin %d", dev.devaddr, arg[0],
+                    (arg[1] & 0x3F) - 64 if arg[1] & 0x20 else arg[1] & 0x3F)
+            elif cid in (0x03, 0x05, 0x07):
+                self.mac_answer(dev, cid, arg[0])
+            else:
+                log("%08X MAC command %02X %s", dev.devaddr, cid, arg.hex())
+
+    def mac_answer(self, dev, cid, status):
+        """Apply the settings of an acknowledged request"""
+        req = next((r for r in dev.mac_sent if r[0] == cid), None)
+        if req is None:
+            log("%08X unsolicited answer %02X %02X", dev.devaddr, cid, status)
+            return
+        dev.mac_sent.remove(req)
+        ok = {0x03: 0x07, 0x05: 0x07, 0x07: 0x03}[cid]
+        names = {0x03: "LinkADRAns", 0x05: "RXParamSetupAns", 0x07: "NewChannelAns"}
+        log("%08X %s %02X (%s)", dev.devaddr, names[cid], status,
+            "accepted" if status & ok == ok else "rejected")
+        if status & ok != ok:
+            return
+        if cid == 0x03:
+            dev.dr, dev.txpow = req[1] >> 4, req[1] & 0x0F
+        elif cid == 0x05:
+            dev.rx1droff, dev.rx2dr = (req[1] >> 4) & 7, req[1] & 0x0F
+            dev.rx2freq = int.from_bytes(req[2:5], "little") / 10000
+
+    def queue_mac(self, dev, cmd):
+        dev.mac_queue += cmd
+        dev.mac_sent.append(bytes(cmd))
+
+    def adr(self, dev, rxpk, adrackreq):
+        dev.adr_snr = (dev.adr_snr + [rxpk.get("lsnr", 0)])[-ADR_HISTORY:]
+        if len(dev.adr_snr) < ADR_HISTORY and not adrackreq:
+            return
+        if any(c[0] == 0x03 for c in dev.mac_sent):
+            return
+        dr, txpow = dev.dr, dev.txpow
+        margin = max(dev.adr_snr) - SF_REQ_SNR[DR_SF[dr]] - ADR_MARGIN
+        steps = int(margin // 3)
+        while steps > 0 and dr < MAX_DR:
+            dr += 1
+            steps -= 1
+        while steps > 0 and txpow < MAX_TXPOW:
+            txpow += 1
+            steps -= 1
+        while steps < 0 and txpow > 0:
+            txpow -= 1
+            steps += 1
+        if (dr, txpow) == (dev.dr, dev.txpow) and not adrackreq:
+            return
+        log("%08X ADR: DR%d pow %d -> DR%d pow %d", dev.devaddr, dev.dr, dev.txpow, dr, txpow)
+        self.queue_mac(dev, bytes([0x03, dr << 4 | txpow]) + CHMASK_ALL.to_bytes(2, "little")
+                       + bytes([0x01]))
+        dev.adr_snr = []
+
+    def stream_frame(self, dev, payload):
+        data = dev.streams.feed(payload)
+        if data is None:
+            return
+        name = "dse-%08X-%d.bin" % (dev.devaddr, payload[0])
+        with open(name, "wb") as f:
+            f.write(data)
+        log("%08X stream %d complete: %d bytes in %d frames, saved as %s", dev.devaddr,
+            payload[0], len(data), dev.streams.frames, name)
+
+    # -------------------------------------------------------------- downlink
+    def build_data(self, devaddr, nwkskey, appskey, fcnt, port, payload,
+                   confirmed=False, ack=False, fpending=False, fopts=b""):
+        fctrl = 0x80 | (0x20 if ack else 0) | (0x10 if fpending else 0) | len(fopts)
+        msg = (bytes([0xA0 if confirmed else 0x60]) + devaddr.to_bytes(4, "little")
+               + bytes([fctrl]) + (fcnt & 0xFFFF).to_bytes(2, "little") + fopts)
+        if port is not None:
+            key = nwkskey if port == 0 else appskey
+            msg += bytes([port]) + lc.frame_crypt(key, devaddr, fcnt, 1, payload)
+        return msg + lc.frame_mic(nwkskey, devaddr, fcnt, 1, msg)
+
+    def next_frame(self, dev, ack=False):
+        """Next downlink for dev, None if there is nothing to send"""
+        mac = bytes(dev.mac_queue)
+        app = dev.app_queue[0] if dev.app_queue and not dev.unacked else None
+        if not (mac or app or ack):
+            return None
+        fopts, port, payload, confirmed, queued = b"", None, b"", False, None
+        if len(mac) > 15:
+            # too long for FOpts: send on port 0, application data waits
+            port, payload, app = 0, mac, None
+        else:
+            fopts = mac
+        dev.mac_queue = dev.mac_queue[len(mac):]
+        if app:
+            port, payload, confirmed, queued = app
+            dev.app_queue.pop(0)
+            if confirmed:
+                dev.unacked = dev.fcnt_down
+            dev.latency = (dev.latency + [time.time() - queued])[-100:]
+            dev.backlog[1] += 1
+        fpending = bool(dev.app_queue or dev.mac_queue)
+        frame = self.build_data(dev.devaddr, dev.nwkskey, dev.appskey, dev.fcnt_down,
+                                port, payload, confirmed, ack, fpending, fopts)
+        log("%08X down FCnt %d port %s %s [%s]%s%s%s", dev.devaddr, dev.fcnt_down, port,
+            payload.hex() if port else "", fopts.hex(), " ACK" if ack else "",
+            " FPending" if fpending else "",
+            " queued %.1f s" % dev.latency[-1] if queued else "")
+        if queued and not dev.app_queue:
+            log("%08X backlog of %d downlinks drained in %.1f s", dev.devaddr,
+                dev.backlog[1], time.time() - dev.backlog[0])
+            dev.backlog = None
+        dev.fcnt_down += 1
+        dev.stats["down"] += 1
+        return frame
+
+    def downlink(self, dev, gw, rxpk, ack=False):
+        frame = self.next_frame(dev, ack)
+        if frame:
+            self.schedule(dev, gw, rxpk, frame, RX_DELAY)
+
+    def class_c(self, dev):
+        frame = self.next_frame(dev)
+        if frame:
+            self.send_now(dev.rx2freq, dev.rx2dr, frame)
+
+    def class_b(self, dev):
+        """Queued downlinks in the next ping slots, via the gateway of the last uplink"""
+        if not dev.classb or dev.ping_period is None or dev.last_rx is None:
+            return
+        t = gps_time(time.time()) + 1.0        # time for the gateway to schedule it
+        while True:
+            frame = self.next_frame(dev)
+            if frame is None:
+                return
+            t = classb.next_slot(dev.devaddr, dev.ping_period, t)
+            self.send_txpk(dev.last_rx[0], {
+                "imme": False, "tmms": int(t * 1000), "freq": classb.PING_FREQ, "rfch": 0,
+                "powe": DOWN_POWER, "modu": "LORA", "datr": datr(classb.PING_DR), "codr": "4/5",
+                "ipol": True, "size": len(frame), "data": base64.b64encode(frame).decode()})
+            log("%08X ping slot in %.1f s", dev.devaddr, t - gps_time(time.time()))
+
+    def multicast(self, grp, port, payload, quiet=False):
+        frame = self.build_data(grp.devaddr, grp.nwkskey, grp.appskey, grp.fcnt_down,
+                                port, payload)
+        if not quiet:
+            log("multicast %s %08X FCnt %d port %d %s", grp.name, grp.devaddr, grp.fcnt_down,
+                port, payload.hex())
+        grp.fcnt_down += 1
+        self.send_now(grp.freq, grp.dr, frame)
+        self.save_state()
+
+    # ----------------------------------------------------------------- FUOTA
+    def fuota_send(self, target, payload, quiet=False):
+        if isinstance(target, Group):
+            self.multicast(target, frag.PORT, payload, quiet)
+        else:
+            target.queue(frag.PORT, payload)
+            self.class_c(target)
+
+    def fuota(self, target, data, fragsz, redundancy, loss):
+        """Send data as a fragmented data block to a multicast group or class C
+        device, followed by redundancy % coded fragments.  Fragments are
+        dropped with probability loss to exercise the decoder."""
+        name = target.name if isinstance(target, Group) else target.deveui
+        dr = target.dr if isinstance(target, Group) else target.rx2dr
+        frags, pad = frag.split(data, fragsz)
+        m = len(frags)
+        total = m + (m * redundancy + 99) // 100
+        # keep the duty cycle of the RX2 band
+        gap = airtime(DR_SF[dr], 13 + 3 + fragsz) / RX2_DUTY
+        log("fuota %s: %d bytes in %d fragments of %d bytes + %d coded, %.0f s",
+            name, len(data), m, fragsz, total - m, total * gap)
+        with self.lock:
+            self.fuota_send(target, frag.setup_req(m, fragsz, pad))
+        dropped = 0
+        for n in range(1, total + 1):
+            time.sleep(gap)
+            if self.fuota_stop:
+                log("fuota %s: stopped at fragment %d", name, n)
+                return
+            if random.random() < loss:
+                dropped += 1
+                continue
+            payload = frags[n - 1] if n <= m else frag.coded(frags, n - m)
+            with self.lock:
+                self.fuota_send(target, frag.data_fragment(0, n, payload), quiet=True)
+        log("fuota %s: %d fragments sent, %d dropped", name, total - dropped, dropped)
+        time.sleep(gap)
+        with self.lock:
+            self.fuota_send(target, frag.status_req())
+
+    # -------------------------------------------------------------- commands
+    def command(self, line):
+        a = line.split()
+        if not a:
+            return True
+        cmd = a[0]
+        if cmd in ("quit", "exit"):
+            return False
+        if cmd == "help":
+            print(HELP)
+            return True
+        if cmd == "list":
+            for d in self.devices:
+                lat = ("latency avg %.1f max %.1f s" % (sum(d.latency) / len(d.latency),
+                                                         max(d.latency)) if d.latency else "")
+                print("%-16s %-8s class %s FCnt up %d down %d DR%d pow %d queue %d %s "
+                      "airtime 24h %.1f s %s" % (
+                          d.deveui, "%08X" % d.devaddr if d.devaddr is not None else "-", d.cls,
+                          d.fcnt_up, d.fcnt_down, d.dr, d.txpow, len(d.app_queue), d.stats,
+                          sum(u[1] for u in d.uptime), lat))
+            print("gateways:", ", ".join(self.gateways) or "-")
+            return True
+        if cmd == "fuota" and len(a) >= 3:
+            target = self.groups.get(a[1]) or self.find(a[1])
+            if target is None or (isinstance(target, Device) and target.cls != "C"):
+                print("fuota needs a multicast group or a joined class C device")
+                return True
+            dr = target.dr if isinstance(target, Group) else target.rx2dr
+            try:
+                with open(a[2], "rb") as f:
+                    data = f.read()
+            except OSError as e:
+                print(e)
+                return True
+            fragsz = int(a[3]) if len(a) > 3 else MAX_PAYLOAD[dr] - 3
+            redundancy = int(a[4]) if len(a) > 4 else 10
+            loss = float(a[5]) / 100 if len(a) > 5 else 0.0
+            self.fuota_stop = False
+            threading.Thread(target=self.fuota, args=(target, data, fragsz, redundancy, loss),
+                             daemon=True).start()
+            return True
+        if cmd == "fuota-stop":
+            self.fuota_stop = True
+            return True
+        if cmd == "mc" and len(a) >= 4:
+            grp = self.groups.get(a[1])
+            if grp is None:
+                print("unknown group")
+            else:
+                self.multicast(grp, int(a[2]), bytes.fromhex(a[3]))
+            return True
+        dev = self.find(a[1]) if len(a) > 1 else None
+        if dev is None or dev.devaddr is None:
+            print("unknown or not joined device, try 'help'")
+            return True
+        if cmd == "send" and len(a) >= 4:
+            dev.queue(int(a[2]), bytes.fromhex(a[3]), "confirmed" in a[4:])
+        elif cmd == "devstatus":
+            dev.mac_queue += b"\x06"
+        elif cmd == "newch" and len(a) == 6:        # idx freq mindr maxdr
+            self.queue_mac(dev, bytes([0x07, int(a[2])]) + int(float(a[3]) * 10000).to_bytes(3, "little")
+                           + bytes([int(a[5]) << 4 | int(a[4])]))
+        elif cmd == "rxparam" and len(a) == 5:      # rx1droff rx2dr freq
+            self.queue_mac(dev, bytes([0x05, int(a[2]) << 4 | int(a[3])])
+                           + int(float(a[4]) * 10000).to_bytes(3, "little"))
+        elif cmd == "linkadr" and len(a) == 6:      # dr txpow chmask nbtrans
+            self.queue_mac(dev, bytes([0x03, int(a[2]) << 4 | int(a[3])])
+                           + int(a[4], 16).to_bytes(2, "little") + bytes([int(a[5])]))
+        elif cmd == "resync":
+            n = int(a[2]) if len(a) > 2 else 1
+            dev.queue(clocksync.PORT, clocksync.force_resync_req(n))
+        elif cmd == "timeperiod" and len(a) == 3:
+            dev.queue(clocksync.PORT, clocksync.periodicity_req(int(a[2])))
+        elif cmd == "mcstatus":
+            dev.queue(mcast.PORT, mcast.group_status_req())
+        elif cmd in ("mcsetup", "mcdelete", "mcsession") and len(a) >= 3:
+            grp = self.groups.get(a[2])
+            if grp is None or (cmd == "mcsetup" and (grp.mckey is None or dev.appkey is None)):
+                print("unknown group, or group without mckey or device without appkey")
+                return True
+            if cmd == "mcsetup":
+                req = mcast.group_setup_req(dev.appkey, grp.id, grp.devaddr, grp.mckey,
+                                            grp.fcnt_down, 0xFFFFFFFF)
+            elif cmd == "mcdelete":
+                req = mcast.group_delete_req(grp.id)
+            else:
+                delay = int(a[3]) if len(a) > 3 else 0
+                timeout = int(a[4]) if len(a) > 4 else 10
+                req = mcast.class_c_session_req(grp.id, gps_time(time.time()) + delay,
+                                                timeout, grp.freq, grp.dr)
+            dev.queue(mcast.PORT, req)
+        else:
+            print("bad command, try 'help'")
+            return True
+        if dev.cls == "C":
+            self.class_c(dev)
+        else:
+            self.class_b(dev)
+        return True
+
+
+HELP = """commands:
+  list                                  devices, counters, downlink latency, gateways
+  send <dev> <port> <hex> [confirmed]   queue application downlink
+  devstatus <dev>                       queue DevStatusReq
+  newch <dev> <idx> <MHz> <mindr> <maxdr>
+  rxparam <dev> <rx1droff> <rx2dr> <MHz>
+  linkadr <dev> <dr> <txpow> <chmask hex> <nbtrans>
+  mc <group> <port> <hex>               multicast downlink (immediate, RX2)
+  fuota <group|dev> <file> [fragsize] [redundancy %] [loss %]
+                                        send file as fragmented data block
+  fuota-stop                            stop sending fragments
+  resync <dev> [n]                      ForceDeviceResyncReq, n AppTimeReqs
+  timeperiod <dev> <n>                  AppTimeReq every 128*2^n s
+  mcsetup <dev> <group>                 set up multicast group on the device
+  mcsession <dev> <group> [delay s] [timeout 2^n s]
+                                        class C session for the group
+  mcstatus <dev>                        McGroupStatusReq
+  mcdelete <dev> <group>                delete multicast group on the device
+  quit
+Downlinks for class A devices are sent after their next uplink, class C
+devices get them immediately on RX2, class B devices in their next ping
+slot."""
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-c", "--config", default=os.path.join(os.path.dirname(__file__), "devices.json"))
+    ap.add_argument("-s", "--state", default="lns-state.json", help="session state file")
+    ap.add_argument("-p", "--port", type=int, default=1700)
+    ap.add_argument("--rx2", action="store_true", help="answer in RX2 instead of RX1")
+    ap.add_argument("--dse", type=int, metavar="PORT", help="port of data streaming engine uplinks")
+    ap.add_argument("--no-console", action="store_true", help="do not read commands from stdin")
+    args = ap.parse_args()
+    with open(args.config) as f:
+        cfg = json.load(f)
+    srv = Server(cfg, args.state, args.port, args.rx2, args.dse)
+    threading.Thread(target=srv.run, daemon=True).start()
+    try:
+        if args.no_console:
+            threading.Event().wait()
+        for line in sys.stdin:
+            with srv.lock:
+                if not srv.command(line):
+                    break
+    except KeyboardInterrupt:
+        pass
+    with srv.lock:
+        srv.save_state()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,163 @@
+"""LoRaWAN 1.0.x crypto in plain Python (AES-128, AES-CMAC, frame MIC and
+payload encryption).  No external packages needed, speed is irrelevant for
+a handful of frames per second."""
+
+SBOX = [0] * 256
+INV_SBOX = [0] * 256
+
+
+def _init_sbox():
+    p = q = 1
+    while True:
+        # multiply p by 3
+        p = p ^ ((p << 1) & 0xFF) ^ (0x1B if p & 0x80 else 0)
+        # divide q by 3
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xFF
+        if q & 0x80:
+            q ^= 0x09
+        x = q ^ _rotl(q, 1) ^ _rotl(q, 2) ^ _rotl(q, 3) ^ _rotl(q, 4) ^ 0x63
+        SBOX[p] = x
+        INV_SBOX[x] = p
+        if p == 1:
+            break
+    SBOX[0] = 0x63
+    INV_SBOX[0x63] = 0
+
+
+def _rotl(x, n):
+    return ((x << n) | (x >> (8 - n))) & 0xFF
+
+
+def _xtime(a):
+    return ((a << 1) ^ 0x1B) & 0xFF if a & 0x80 else a << 1
+
+
+def _mul(a, b):
+    r = 0
+    while b:
+        if b & 1:
+            r ^= a
+        a = _xtime(a)
+        b >>= 1
+    return r
+
+
+_init_sbox()
+
+
+def _expand(key):
+    w = list(key)
+    rcon = 1
+    for i in range(4, 44):
+        t = w[(i - 1) * 4:i * 4]
+        if i % 4 == 0:
+            t = [SBOX[t[1]] ^ rcon, SBOX[t[2]], SBOX[t[3]], SBOX[t[0]]]
+            rcon = _xtime(rcon)
+        w += [w[(i - 4) * 4 + j] ^ t[j] for j in range(4)]
+    return [w[r * 16:(r + 1) * 16] for r in range(11)]
+
+
+def aes_encrypt(key, block):
+    rk = _expand(key)
+    s = [b ^ k for b, k in zip(block, rk[0])]
+    for r in range(1, 11):
+        s = [SBOX[b] for b in s]
+        s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]          # shift rows
+        if r != 10:
+            m = []
+            for c in range(4):
+                a = s[c * 4:c * 4 + 4]
+                m += [_mul(a[0], 2) ^ _mul(a[1], 3) ^ a[2] ^ a[3],
+                      a[0] ^ _mul(a[1], 2) ^ _mul(a[2], 3) ^ a[3],
+                      a[0] ^ a[1] ^ _mul(a[2], 2) ^ _mul(a[3], 3),
+                      _mul(a[0], 3) ^ a[1] ^ a[2] ^ _mul(a[3], 2)]
+            s = m
+        s = [b ^ k for b, k in zip(s, rk[r])]
+    return bytes(s)
+
+
+def aes_decrypt(key, block):
+    rk = _expand(key)
+    s = [b ^ k for b, k in zip(block, rk[10])]
+    for r in range(9, -1, -1):
+        s = [s[(i - 4 * (i % 4)) % 16] for i in range(16)]          # inverse shift rows
+        s = [INV_SBOX[b] for b in s]
+        s = [b ^ k for b, k in zip(s, rk[r])]
+        if r != 0:
+            m = []
+            for c in range(4):
+                a = s[c * 4:c * 4 + 4]
+                m += [_mul(a[0], 14) ^ _mul(a[1], 11) ^ _mul(a[2], 13) ^ _mul(a[3], 9),
+                      _mul(a[0], 9) ^ _mul(a[1], 14) ^ _mul(a[2], 11) ^ _mul(a[3], 13),
+                      _mul(a[0], 13) ^ _mul(a[1], 9) ^ _mul(a[2], 14) ^ _mul(a[3], 11),
+                      _mul(a[0], 11) ^ _mul(a[1], 13) ^ _mul(a[2], 9) ^ _mul(a[3], 14)]
+            s = m
+    return bytes(s)
+
+
+def _shl(b):
+    v = (int.from_bytes(b, "big") << 1) & ((1 << 128) - 1)
+    return v.to_bytes(16, "big")
+
+
+def cmac(key, msg):
+    """AES-CMAC (RFC 4493)"""
+    l = aes_encrypt(key, bytes(16))
+    k1 = _shl(l)
+    if l[0] & 0x80:
+        k1 = k1[:15] + bytes([k1[15] ^ 0x87])
+    k2 = _shl(k1)
+    if k1[0] & 0x80:
+        k2 = k2[:15] + bytes([k2[15] ^ 0x87])
+    n = max(1, (len(msg) + 15) // 16)
+    last = msg[(n - 1) * 16:]
+    if len(last) == 16:
+        last = bytes(a ^ b for a, b in zip(last, k1))
+    else:
+        last = last + b"\x80" + bytes(15 - len(last))
+        last = bytes(a ^ b for a, b in zip(last, k2))
+    x = bytes(16)
+    for i in range(n - 1):
+        x = aes_encrypt(key, bytes(a ^ b for a, b in zip(x, msg[i * 16:(i + 1) * 16])))
+    return aes_encrypt(key, bytes(a ^ b for a, b in zip(x, last)))
+
+
+def frame_mic(nwkskey, devaddr, fcnt, dndir, msg):
+    """MIC of a data frame (msg is MHDR..FRMPayload)"""
+    b0 = (bytes([0x49, 0, 0, 0, 0, dndir]) + devaddr.to_bytes(4, "little")
+          + (fcnt & 0xFFFFFFFF).to_bytes(4, "little") + bytes([0, len(msg)]))
+    return cmac(nwkskey, b0 + msg)[:4]
+
+
+def frame_crypt(key, devaddr, fcnt, dndir, payload):
+    """Encrypt/decrypt FRMPayload (the operation is symmetric)"""
+    out = bytearray()
+    for i in range(0, len(payload), 16):
+        a = (bytes([0x01, 0, 0, 0, 0, dndir]) + devaddr.to_bytes(4, "little")
+             + (fcnt & 0xFFFFFFFF).to_bytes(4, "little") + bytes([0, i // 16 + 1]))
+        s = aes_encrypt(key, a)
+        out += bytes(p ^ k for p, k in zip(payload[i:i + 16], s))
+    return bytes(out)
+
+
+def join_mic(appkey, msg):
+    return cmac(appkey, msg)[:4]
+
+
+def join_accept_encrypt(appkey, msg):
+    """Join accept is 'encrypted' with AES decrypt so the device only needs AES encrypt"""
+    out = bytearray(msg[:1])
+    for i in range(1, len(msg), 16):
+        out += aes_decrypt(appkey, msg[i:i + 16])
+    return bytes(out)
+
+
+def session_keys(appkey, joinnonce, netid, devnonce):
+    """Derive (NwkSKey, AppSKey) - all values as little endian byte strings"""
+    base = joinnonce + netid + devnonce
+    pad = bytes(16 - 1 - len(base))
+    return (aes_encrypt(appkey, b"\x01" + base + pad),
+            aes_encrypt(appkey, b"\x02" + base + pad))
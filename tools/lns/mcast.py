@@ -0,0 +1,91 @@
+"""Remote multicast setup (LoRaWAN TS005) for lns.py.
+
+Builds the requests lmic/mcast.c answers on PORT and decodes the answers.
+The multicast key McKey is sent encrypted with McKEKey, which the device
+derives from its root key:
+
+  McRootKey = aes128_encrypt(AppKey, 0x00 | pad16)
+  McKEKey   = aes128_encrypt(McRootKey, 0x00 | pad16)
+  McAppSKey = aes128_encrypt(McKey, 0x01 | McAddr | pad16)
+  McNwkSKey = aes128_encrypt(McKey, 0x02 | McAddr | pad16)
+"""
+
+import lwcrypto as lc
+
+PORT = 200
+MC_PKG_VERSION, MC_GROUP_STATUS, MC_GROUP_SETUP, MC_GROUP_DELETE, MC_CLASSC_SESSION = 0, 1, 2, 3, 4
+
+
+def _pad(b):
+    return bytes(b).ljust(16, b"\0")
+
+
+def kek(appkey):
+    root = lc.aes_encrypt(appkey, _pad([0x00]))
+    return lc.aes_encrypt(root, _pad([0x00]))
+
+
+def session_keys(mckey, addr):
+    """(McNwkSKey, McAppSKey) of a group"""
+    a = addr.to_bytes(4, "little")
+    return (lc.aes_encrypt(mckey, _pad(bytes([0x02]) + a)),
+            lc.aes_encrypt(mckey, _pad(bytes([0x01]) + a)))
+
+
+def group_setup_req(appkey, gid, addr, mckey, fcnt_min, fcnt_max):
+    return (bytes([MC_GROUP_SETUP, gid & 3]) + addr.to_bytes(4, "little")
+            + lc.aes_decrypt(kek(appkey), mckey)
+            + fcnt_min.to_bytes(4, "little") + fcnt_max.to_bytes(4, "little"))
+
+
+def group_status_req(mask=0x0F):
+    return bytes([MC_GROUP_STATUS, mask])
+
+
+def group_delete_req(gid):
+    return bytes([MC_GROUP_DELETE, gid & 3])
+
+
+def class_c_session_req(gid, gps_start, timeout, freq, dr):
+    """timeout: session length 2^timeout s, freq in MHz"""
+    return (bytes([MC_CLASSC_SESSION, gid & 3]) + int(gps_start).to_bytes(4, "little")
+            + bytes([timeout & 0x0F]) + int(round(freq * 10000)).to_bytes(3, "little")
+            + bytes([dr]))
+
+
+def answers(payload):
+    """Decode an uplink on PORT into readable text"""
+    out, i = [], 0
+    while i < len(payload):
+        cid = payload[i]
+        if cid == MC_PKG_VERSION and i + 3 <= len(payload):
+            out.append("PackageVersionAns id %d version %d" % (payload[i + 1], payload[i + 2]))
+            i += 3
+        elif cid == MC_GROUP_STATUS and i + 2 <= len(payload):
+            st = payload[i + 1]
+            n = bin(st & 0x0F).count("1")
+            groups = ["%d:%08X" % (payload[j], int.from_bytes(payload[j + 1:j + 5], "little"))
+                      for j in range(i + 2, min(i + 2 + 5 * n, len(payload) - 4), 5)]
+            out.append("McGroupStatusAns %d groups %s" % (st >> 4, " ".join(groups) or "-"))
+            i += 2 + 5 * n
+        elif cid in (MC_GROUP_SETUP, MC_GROUP_DELETE) and i + 2 <= len(payload):
+            st = payload[i + 1]
+            out.append("%s group %d %s" % (
+                "McGroupSetupAns" if cid == MC_GROUP_SETUP else "McGroupDeleteAns",
+                st & 3, "error" if st & 0x04 else "OK"))
+            i += 2
+        elif cid == MC_CLASSC_SESSION and i + 2 <= len(payload):
+            st = payload[i + 1]
+            if st & 0x1C:
+                errs = [e for b, e in ((0x10, "undefined group"), (0x08, "frequency"),
+                                       (0x04, "data rate")) if st & b]
+                out.append("McClassCSessionAns group %d error: %s" % (st & 3, ", ".join(errs)))
+                i += 2
+            else:
+                start = int.from_bytes(payload[i + 2:i + 5], "little")
+                out.append("McClassCSessionAns group %d starts in %d s" % (st & 3, start))
+                i += 5
+        else:
+            out.append("unknown %s" % payload[i:].hex())
+            break
+    return out
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Generate provisioning images (personalization data records) for a fleet,
+so every device runs the same firmware image with its own identity and keys
+(hal_deveui() and friends in lib/IBM LMIC framework/src/hal/hal.cpp).
+
+  perso.py gen --joineui 121518786613A211 --count 100 --serial LE5- -o fleet
+  perso.py gen ... --uids uids.txt         DevEUI from the chip UIDs
+  perso.py show fleet/LE5-0001.bin         decode and check a record
+
+gen writes per device <serial>.bin (the raw record) and <serial>.hex (Intel
+HEX at its address: OTP slot --slot, or PERSODATA_FLASH with --flash), and
+fleet.csv with the EUIs and keys to register the devices with the network.
+--lns adds them to a tools/lns devices.json.
+
+The AppKey is random per device unless --appkey is given. The DevEUI is
+--deveui (the first device, counted up), or left blank so the device uses
+the 64-bit UID of the STM32WL. The UIDs are not known before the devices
+are read out; --uids takes them, one EUI per line as the device prints it
+at boot (MSB first), to fill in fleet.csv.
+
+OTP cannot be erased: provision a device again with the next --slot. The
+record with the highest slot that is valid is used.
+"""
+
+import argparse
+import json
+import os
+import struct
+import zlib
+
+MAGIC = 0x4F535250                  # "PRSO"
+RECORD = struct.Struct("<IIII16s8s8s16s16s")
+SIZE = RECORD.size + 8              # CRC and pad, double words
+OTP_AREA = 0x1FFF7000
+OTP_SIZE = 0x400
+PERSODATA_FLASH = 0x0803B800        # hal/target-config.h
+BLANK_EUI = b"\xff" * 8
+REGIONS = {"EU868": 1, "AS923": 2, "US915": 3, "AU915": 4, "CN470": 5, "IN865": 6}
+
+
+def pack(hwid, region, serial, deveui, joineui, nwkkey, appkey):
+    """Record as hal.cpp reads it; EUIs given MSB first, stored little endian"""
+    body = RECORD.pack(MAGIC, hwid, region, 0, serial.encode()[:16].ljust(16, b"\0"),
+                       deveui[::-1], joineui[::-1], nwkkey, appkey)
+    return body + struct.pack("<II", zlib.crc32(body), 0xFFFFFFFF)
+
+
+def unpack(rec):
+    magic, hwid, region, _, serial, deveui, joineui, nwkkey, appkey = RECORD.unpack(rec[:RECORD.size])
+    crc, = struct.unpack_from("<I", rec, RECORD.size)
+    return {"valid": magic == MAGIC and crc == zlib.crc32(rec[:RECORD.size]),
+            "hwid": hwid, "region": region, "serial": serial.rstrip(b"\0").decode(errors="replace"),
+            "deveui": "uid" if deveui == BLANK_EUI else deveui[::-1].hex().upper(),
+            "joineui": joineui[::-1].hex().upper(),
+            "nwkkey": nwkkey.hex().upper(), "appkey": appkey.hex().upper()}
+
+
+def ihex(addr, data):
+    """Intel HEX with extended linear address records"""
+    out = []
+
+    def line(typ, a, payload):
+        b = bytes([len(payload), (a >> 8) & 0xFF, a & 0xFF, typ]) + payload
+        out.append(":%s%02X" % (b.hex().upper(), -sum(b) & 0xFF))
+
+    line(4, 0, struct.pack(">H", addr >> 16))
+    for off in range(0, len(data), 16):
+        line(0, (addr + off) & 0xFFFF, data[off:off + 16])
+    line(1, 0, b"")
+    return "\n".join(out) + "\n"
+
+
+def hexbytes(s, n, what):
+    b = bytes.fromhex(s)
+    if len(b) != n:
+        raise SystemExit("%s needs %d bytes" % (what, n))
+    return b
+
+
+def gen(args):
+    joineui = hexbytes(args.joineui, 8, "--joineui")
+    if args.flash:
+        addr = PERSODATA_FLASH
+    else:
+        addr = OTP_AREA + args.slot * SIZE
+        if addr + SIZE > OTP_AREA + OTP_SIZE:
+            raise SystemExit("OTP holds %d records" % (OTP_SIZE // SIZE))
+    uids = []
+    if args.uids:
+        with open(args.uids) as f:
+            uids = [hexbytes(l.strip(), 8, "UID") for l in f if l.strip() and not l.startswith("#")]
+        args.count = len(uids)
+    first = int(args.deveui, 16) if args.deveui else None
+    os.makedirs(args.out, exist_ok=True)
+    fleet = []
+    for i in range(args.count):
+        serial = "%s%0*d" % (args.serial, args.digits, args.start + i)
+        appkey = hexbytes(args.appkey, 16, "--appkey") if args.appkey else os.urandom(16)
+        if first is not None:
+            deveui = (first + i).to_bytes(8, "big")
+            eui = deveui.hex().upper()
+        else:
+            deveui = BLANK_EUI[::-1]
+            eui = uids[i].hex().upper() if uids else "uid"
+        rec = pack(args.hwid, REGIONS[args.region], serial, deveui, joineui, appkey, appkey)
+        with open(os.path.join(args.out, serial + ".bin"), "wb") as f:
+            f.write(rec)
+        with open(os.path.join(args.out, serial + ".hex"), "w") as f:
+            f.write(ihex(addr, rec))
+        fleet.append({"serial": serial, "deveui": eui, "joineui": joineui.hex().upper(),
+                      "appkey": appkey.hex().upper()})
+    with open(os.path.join(args.out, "fleet.csv"), "w") as f:
+        f.write("serial,deveui,joineui,appkey\n")
+        for d in fleet:
+            f.write("%(serial)s,%(deveui)s,%(joineui)s,%(appkey)s\n" % d)
+    if args.lns:
+        with open(args.lns) as f:
+            cfg = json.load(f)
+        known = {d["deveui"] for d in cfg.get("devices", [])}
+        for d in fleet:
+            if d["deveui"] != "uid" and d["deveui"] not in known:
+                cfg.setdefault("devices", []).append(
+                    {"deveui": d["deveui"], "joineui": d["joineui"], "appkey": d["appkey"], "class": "A"})
+        with open(args.lns, "w") as f:
+            json.dump(cfg, f, indent=1)
+            f.write("\n")
+    print("%d records of %d bytes at 0x%08X in %s" % (len(fleet), SIZE, addr, args.out))
+    if any(d["deveui"] == "uid" for d in fleet):
+        print("DevEUI from the chip UID: read it from the boot log and register it with fleet.csv")
+
+
+def show(args):
+    for name in args.file:
+        with open(name, "rb") as f:
+            data = f.read()
+        for off in range(0, len(data) - SIZE + 1, SIZE):
+            rec = data[off:off + SIZE]
+            if rec == b"\xff" * SIZE:
+                continue
+            r = unpack(rec)
+            print("%s+%d: %s" % (name, off, " ".join("%s=%s" % kv for kv in r.items())))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    g = sub.add_parser("gen", help="generate records for a fleet")
+    g.add_argument("--joineui", required=True, help="MSB first")
+    g.add_argument("--appkey", help="same key for all devices (default: random per device)")
+    g.add_argument("--deveui", help="DevEUI of the first device, MSB first (default: chip UID)")
+    g.add_argument("--uids", help="file with the UIDs of the devices, one EUI per line")
+    g.add_argument("--count", type=int, default=1)
+    g.add_argument("--serial", default="", help="serial number prefix")
+    g.add_argument("--start", type=int, default=1, help="first serial number")
+    g.add_argument("--digits", type=int, default=4)
+    g.add_argument("--region", default="EU868", choices=REGIONS)
+    g.add_argument("--hwid", type=int, default=0)
+    g.add_argument("--slot", type=int, default=0, help="OTP record slot")
+    g.add_argument("--flash", action="store_true", help="for PERSODATA_FLASH instead of OTP")
+    g.add_argument("--lns", help="add the devices to this devices.json")
+    g.add_argument("-o", "--out", default="perso")
+    s = sub.add_parser("show", help="decode records (.bin, or an OTP dump)")
+    s.add_argument("file", nargs="+")
+    args = ap.parse_args()
+    gen(args) if args.cmd == "gen" else show(args)
+
+
+if __name__ == "__main__":
+    main()
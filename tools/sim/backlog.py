@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Store and forward of reports over network outages (backlog.c).
+
+Every --interval seconds the device sends a confirmed report. During an
+outage (gateway or backhaul down) no uplink is acked. Compared:
+
+  none       reports not acked are lost
+  single     reports not acked go to the flash ring, every wakeup with an
+             acked report sends one stored report in a frame of its own
+  packed     as main.cpp: after an acked report up to --frames frames per
+             wakeup, each packed with as many stored reports as fit the
+             payload of the DR, the next one only if the duty cycle lets
+             it go within --wait seconds
+
+Outages come from --outage START_H:LEN_H (repeatable) or at random,
+--outages per day with an exponential length of mean --outage-h hours.
+Uplinks and ACKs outside outages are lost with probability --loss.
+
+The ring is modelled byte for byte as backlog.c: --pages pages of
+FLASH_PAGE_SZ with a page header, records of a header and the data
+padded to 8 bytes, a SENT record after every acked frame, and the oldest
+page erased (its reports lost) when the ring comes around to it.
+
+Frames go in --bands sub-bands of 1 % duty cycle each, the report takes
+one of them. Reported per scheme: reports delivered and lost, the worst
+time from the end of an outage until the backlog is empty, catch-up
+frames, airtime and time awake waiting for the duty cycle per day, page
+erases per day and flash bytes (records and SENT records) per stored
+report.
+
+Example:
+  backlog.py --days 30 --interval 600 --outage 48:12 --outage 200:30 --sf 9
+"""
+
+import argparse
+import random
+
+from channel import airtime
+
+LORAWAN_OVERHEAD = 13
+PAYLOAD = 6                 # TestPayload: fcnt, life, temperature, Vdd
+MAX_APP_PLOAD = {7: 242, 8: 242, 9: 115, 10: 51, 11: 51, 12: 51}   # EU868 by SF
+DUTY = 0.01                 # EU868 sub-bands of the default and TTN channels
+RX_WINDOWS = 2.0            # RX1 delay + RX2 after a confirmed uplink (s)
+FLASH_PAGE_SZ = 2048
+PAGE_HDR = 8
+REC_HDR = 8
+
+
+def rec_size(dlen):
+    return REC_HDR + (dlen + 7) // 8 * 8
+
+
+class Ring:
+    """Pages of records as backlog.c; a record is (time, sent)"""
+
+    def __init__(self, pages):
+        self.pages = [[] for _ in range(pages)]
+        self.used = [PAGE_HDR] * pages
+        self.head = 0
+        self.erases = 1
+        self.written = 0
+        self.lost = 0
+
+    def append(self, rec, size):
+        if self.used[self.head] + size > FLASH_PAGE_SZ:
+            self.head = (self.head + 1) % len(self.pages)
+            self.lost += sum(1 for r in self.pages[self.head] if r is not None and not r[1])
+            self.pages[self.head] = []
+            self.used[self.head] = PAGE_HDR
+            self.erases += 1
+        self.pages[self.head].append(rec)
+        self.used[self.head] += size
+        self.written += size
+
+    def put(self, t):
+        self.append([t, False], rec_size(PAYLOAD))
+
+    def unsent(self):
+        """Records not sent, oldest first"""
+        out = []
+        for i in range(1, len(self.pages) + 1):
+            page = self.pages[(self.head + i) % len(self.pages)]
+            out.extend(r for r in page if r is not None and not r[1])
+        return out
+
+    def sent(self, recs):
+        for r in recs:
+            r[1] = True
+        self.append(None, REC_HDR)                  # SENT record
+
+
+def outages(args, rng):
+    """[(start_s, end_s)]"""
+    if args.outage:
+        out = []
+        for spec in args.outage:
+            start, length = (float(x) * 3600 for x in spec.split(":"))
+            out.append((start, start + length))
+        return sorted(out)
+    out, t = [], 0.0
+    end = args.days * 86400
+    while True:
+        t += rng.expovariate(args.outages / 86400.0)
+        if t >= end:
+            return out
+        length = rng.expovariate(1.0 / (args.outage_h * 3600))
+        out.append((t, t + length))
+        t += length
+
+
+def frame_len(n):
+    """Packed frame of n records (backlog.h)"""
+    return 5 + PAYLOAD + (n - 1) * (3 + PAYLOAD)
+
+
+def run(args, down, rng, scheme):
+    ring = Ring(args.pages)
+    maxp = MAX_APP_PLOAD[args.sf]
+    per_frame = 1 if scheme == "single" else 1 + (maxp - 5 - PAYLOAD) // (3 + PAYLOAD)
+    report_air = airtime(args.sf, PAYLOAD + LORAWAN_OVERHEAD)
+    delivered = lost = puts = frames = 0
+    air = awake = recover = 0.0
+    outage_end = None
+    j = 0
+    t = 0.0
+    while t < args.days * 86400:
+        while j < len(down) and down[j][1] <= t:
+            outage_end = down[j][1] if scheme != "none" else None
+            j += 1
+        up = not (j < len(down) and down[j][0] <= t < down[j][1])
+        ok = up and rng.random() >= args.loss and rng.random() >= args.loss
+        if ok:
+            delivered += 1
+        elif scheme == "none":
+            lost += 1
+        else:
+            ring.put(t)
+            puts += 1
+        if ok and scheme != "none":
+            # the report went in band 0; each band is free again after its off time
+            avail = [report_air / DUTY] + [0.0] * (args.bands - 1)
+            now = report_air + RX_WINDOWS
+            for _ in range(args.frames if scheme == "packed" else 1):
+                recs = ring.unsent()[:per_frame]
+                if not recs:
+                    break
+                b = min(range(args.bands), key=lambda i: avail[i])
+                if avail[b] - now > args.wait:
+                    break                           # duty cycle, next wakeup
+                now = max(now, avail[b])
+                a = airtime(args.sf, frame_len(len(recs)) + LORAWAN_OVERHEAD)
+                avail[b] = now + a / DUTY
+                now += a + RX_WINDOWS
+                frames += 1
+                air += a
+                if rng.random() < args.loss or rng.random() < args.loss:
+                    break                           # not acked, next wakeup
+                ring.sent(recs)
+                delivered += len(recs)
+            awake += now - report_air - RX_WINDOWS
+            if outage_end is not None and not ring.unsent():
+                recover = max(recover, t - outage_end)
+                outage_end = None
+        t += args.interval
+    lost += ring.lost
+    return (delivered, lost, recover / 3600.0, frames / args.days, air / args.days,
+            awake / args.days, ring.erases / args.days, ring.written / max(1, puts))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--days", type=float, default=30)
+    ap.add_argument("--interval", type=float, default=600, help="report interval (s)")
+    ap.add_argument("--outage", action="append", metavar="START_H:LEN_H", help="outage (hours)")
+    ap.add_argument("--outages", type=float, default=0.1, help="random outages per day")
+    ap.add_argument("--outage-h", type=float, default=12, help="mean random outage length (h)")
+    ap.add_argument("--loss", type=float, default=0.05, help="uplink and ACK loss outside outages")
+    ap.add_argument("--sf", type=int, default=9, choices=range(7, 13))
+    ap.add_argument("--frames", type=int, default=8, help="BACKLOG_FRAMES per wakeup")
+    ap.add_argument("--wait", type=float, default=5, help="BACKLOG_WAIT_MS (s)")
+    ap.add_argument("--bands", type=int, default=2, help="1%% sub-bands with enabled channels")
+    ap.add_argument("--pages", type=int, default=7, help="flash pages of the ring")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    down = outages(args, random.Random(args.seed))
+    hours = sum(e - s for s, e in down) / 3600.0
+    print("%.0f days, report every %.0f s, SF%d, %d outages of %.0f h in total, ring of %d pages" % (
+        args.days, args.interval, args.sf, len(down), hours, args.pages))
+    print("%-7s %9s %6s %9s %9s %10s %10s %9s %9s" % (
+        "scheme", "delivered", "lost", "recovery", "frames/d", "airtime/d", "waited/d",
+        "erases/d", "B/report"))
+    for scheme in ("none", "single", "packed"):
+        dl, lost, rec, fr, air, wait, er, bpr = run(args, down, random.Random(args.seed + 1), scheme)
+        print("%-7s %9d %6d %8.1fh %9.1f %9.1fs %9.1fs %9.2f %9.1f" % (
+            scheme, dl, lost, rec, fr, air, wait, er, bpr))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,218 @@
+"""Physical layer model of a LoRa channel for fleet simulations.
+
+Airtime and sensitivity follow calcAirTime() and SENSITIVITY[][] in
+lmic.c, so simulated frames occupy the air exactly as long as the stack
+thinks they do.  On top of that the model adds:
+
+  - log-distance path loss with log-normal shadowing
+  - SNR from the thermal noise floor and per-SF demodulation thresholds
+  - SF (quasi-)orthogonality: SIR thresholds between spreading factors
+  - capture effect with preamble lock timing
+  - time overlap collision detection per channel
+  - a limited number of demodulators per gateway
+
+Everything is deterministic for a given random.Random instance.
+"""
+
+import math
+import random
+
+OSTICKS_PER_SEC = 62500
+
+BW_HZ = {0: 125000, 1: 250000, 2: 500000}
+
+# lmic.c SENSITIVITY[][] (dBm): sf 7..12 x bw 125/250/500 kHz
+SENSITIVITY = {
+    7:  (-127, -124, -121),
+    8:  (-129, -126, -123),
+    9:  (-132, -129, -126),
+    10: (-135, -132, -129),
+    11: (-138, -135, -132),
+    12: (-141, -138, -135),
+}
+
+# Minimum SNR (dB) for demodulation (SX126x/SX1301 data sheets)
+SNR_MIN = {7: -7.5, 8: -10.0, 9: -12.5, 10: -15.0, 11: -17.5, 12: -20.0}
+
+# SIR thresholds (dB) for the wanted SF (row) against an interferer SF
+# (column), SF7..SF12.  Diagonal is co-SF capture, off-diagonal values
+# give the quasi-orthogonality (Croce et al., IEEE Comm. Letters 2018).
+SIR_MIN = [
+    [  1,  -8,  -9,  -9,  -9,  -9],
+    [-11,   1, -11, -12, -13, -13],
+    [-15, -13,   1, -13, -14, -15],
+    [-19, -18, -17,   1, -17, -18],
+    [-22, -22, -21, -20,   1, -20],
+    [-25, -25, -25, -24, -23,   1],
+]
+
+PREAMBLE_SYMBOLS = 8
+LOCK_SYMBOLS = 5            # symbols needed to lock onto a preamble
+
+
+def symbol_time(sf, bw=0):
+    """Symbol duration in seconds"""
+    return (1 << sf) / BW_HZ[bw]
+
+
+def airtime_ticks(sf, plen, bw=0, cr=1, crc=True, ih=False):
+    """Port of calcAirTime() for LoRa, in osticks (cr 1..4 = 4/5..4/8)"""
+    dro = 1 if (sf >= 11 and bw == 0) or (sf == 12 and bw == 1) else 0
+    sfx = 4 * sf
+    q = sfx - 8 * dro
+    tmp = 8 * plen - sfx + 28 + (16 if crc else 0) - (20 if ih else 0)
+    if tmp > 0:
+        tmp = (tmp + q - 1) // q
+        tmp *= cr + 4
+        tmp += 8
+    else:
+        tmp = 8
+    tmp = (tmp << 2) + 49
+    sfx = sf - (3 + 2) - bw
+    div = 15625
+    if sfx > 4:
+        div >>= sfx - 4
+        sfx = 4
+    return ((tmp << sfx) * OSTICKS_PER_SEC + div // 2) // div
+
+
+def airtime(sf, plen, bw=0, cr=1):
+    """Airtime in seconds"""
+    return airtime_ticks(sf, plen, bw, cr) / OSTICKS_PER_SEC
+
+
+def dbm2mw(dbm):
+    return 10 ** (dbm / 10)
+
+
+def mw2dbm(mw):
+    return 10 * math.log10(mw) if mw > 0 else -math.inf
+
+
+class Tx:
+    """One transmission as seen by one receiver"""
+    __slots__ = ("src", "start", "end", "freq", "sf", "bw", "plen", "rssi", "payload")
+
+    def __init__(self, src, start, freq, sf, plen, rssi, bw=0, payload=None):
+        self.src = src
+        self.start = start
+        self.end = start + airtime(sf, plen, bw)
+        self.freq = freq
+        self.sf = sf
+        self.bw = bw
+        self.plen = plen
+        self.rssi = rssi
+        self.payload = payload
+
+    def lock_time(self):
+        """Time at which a receiver has locked onto the preamble"""
+        return self.start + (PREAMBLE_SYMBOLS - LOCK_SYMBOLS) * symbol_time(self.sf, self.bw)
+
+    def overlaps(self, other):
+        return self.freq == other.freq and self.start < other.end and other.start < self.end
+
+
+class Channel:
+    """Propagation and reception model.
+
+    Default path loss parameters are an urban 868 MHz fit (Joerke et al.,
+    2017): 128.95 dB at 1 km, exponent 2.32, 7.8 dB shadowing.  The
+    LoRaSim indoor values (Bor et al., 2016) are pl_d0=127.41, d0=40,
+    exponent=2.08, shadowing=3.57.
+    """
+
+    def __init__(self, rng=None, pl_d0=128.95, d0=1000.0, exponent=2.32,
+                 shadowing=7.8, noise_figure=6.0, demodulators=8):
+        self.rng = rng or random.Random(0)
+        self.pl_d0 = pl_d0
+        self.d0 = d0
+        self.exponent = exponent
+        self.shadowing = shadowing
+        self.noise_figure = noise_figure
+        self.demodulators = demodulators
+
+    def path_loss(self, dist):
+        pl = self.pl_d0 + 10 * self.exponent * math.log10(max(dist, 1.0) / self.d0)
+        if self.shadowing:
+            pl += self.rng.gauss(0, self.shadowing)
+        return pl
+
+    def rssi(self, txpow, dist, gains=0.0):
+        return txpow + gains - self.path_loss(dist)
+
+    def noise_floor(self, bw=0):
+        return -174 + 10 * math.log10(BW_HZ[bw]) + self.noise_figure
+
+    def snr(self, tx, interference_mw=0.0):
+        return tx.rssi - mw2dbm(dbm2mw(self.noise_floor(tx.bw)) + interference_mw)
+
+    def demodulable(self, tx):
+        """Above sensitivity and SNR threshold, ignoring interference"""
+        return (tx.rssi >= SENSITIVITY[tx.sf][tx.bw]
+                and self.snr(tx) >= SNR_MIN[tx.sf])
+
+    def outcome(self, tx, others):
+        """Reception outcome of tx against the other transmissions on air:
+        'ok', 'sensitivity', 'captured' (receiver locked on another frame)
+        or 'interference'."""
+        if not self.demodulable(tx):
+            return "sensitivity"
+        inter_mw = [0.0] * 6
+        for o in others:
+            if o is tx or not tx.overlaps(o):
+                continue
+            if o.sf == tx.sf and o.bw == tx.bw:
+                # receiver locks onto the first preamble it detects; a
+                # later frame can only take over during the lock window
+                if o.start < tx.start and self.demodulable(o) and not (
+                        tx.rssi - o.rssi >= SIR_MIN[0][0] and tx.start < o.lock_time()):
+                    return "captured"
+            inter_mw[o.sf - 7] += dbm2mw(o.rssi)
+        for isf, mw in enumerate(inter_mw):
+            if mw and tx.rssi - mw2dbm(mw) < SIR_MIN[tx.sf - 7][isf]:
+                return "interference"
+        return "ok"
+
+    def receive(self, txs):
+        """Resolve a batch of transmissions at one gateway.
+
+        Returns {tx: outcome}; 'no_demod' if all demodulators were busy."""
+        res = {}
+        busy = []       # end times of frames occupying a demodulator
+        txs = sorted(txs, key=lambda t: t.start)
+        longest = max((t.end - t.start for t in txs), default=0)
+        lo = 0
+        for i, tx in enumerate(txs):
+            busy = [e for e in busy if e > tx.start]
+            if not self.demodulable(tx):
+                res[tx] = "sensitivity"
+                continue
+            if len(busy) >= self.demodulators:
+                res[tx] = "no_demod"
+                continue
+            busy.append(tx.end)
+            # only frames starting within one airtime can overlap
+            while txs[lo].start < tx.start - longest:
+                lo += 1
+            hi = i
+            while hi < len(txs) and txs[hi].start < tx.end:
+                hi += 1
+            res[tx] = self.outcome(tx, txs[lo:hi])
+        return res
+
+    def rx_window(self, start, symbols, sf, freq, txs, bw=0):
+        """Device side RX window (radio in single RX mode with a symbol
+        timeout): returns the received Tx or None on timeout.
+
+        A frame is detected if its preamble is locked before the timeout
+        expires and it survives the interference on air."""
+        timeout = start + symbols * symbol_time(sf, bw)
+        for tx in sorted(txs, key=lambda t: t.start):
+            if tx.sf != sf or tx.bw != bw or tx.freq != freq:
+                continue
+            if tx.end <= start or tx.lock_time() > timeout:
+                continue
+            if tx.start < start - (PREAMBLE_SYMBOLS - LOCK_SYMBOLS) * symbol_time(sf, bw):
+                continue    # preamble mostly over when the window opened
+            return tx if self.outcome(tx, txs) == "ok" else None
+        return None
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+"""Class B beacon tracking and ping slot downlinks against a beacon-emitting gateway.
+
+The gateway sends a beacon every 128 s of GPS time and a downlink in the
+first ping slot of the device one second after it was queued (tools/lns
+classb.py). The device clock runs --ppm off, wandering by --wander ppm
+per hour, and its beacon timestamps jitter by --jitter us. The device side
+is a port of the lmic.c tracking: calcBcnRxWindowFromMillis(),
+calcRxWindow(), processBeacon(), rxschedInit()/rxschedNext() in os ticks.
+The first beacon window follows a DeviceTimeAns that is --timeerr ms off.
+
+A window catches a frame when the radio is on at least 4 preamble symbols
+before the sync word and its timeout (window + RXSLOT_HDRSYMS symbols, or
+500 ms with --legacy) reaches the header. After EV_LOST_TSYNC the device
+takes one beacon period to get the network time again.
+
+Charge: the application keeps the MCU running while it tracks (--idle-ua);
+on top of that come the RX windows and the lead before each window, in
+which the radio waits in FS mode (--setup-ms plus 2 ms, 26.4 ms RX_RAMPUP
+with --legacy). Class C keeps the receiver on, or runs the LoRa-E5 RX duty
+cycle mode.
+
+Example:
+  classb.py --hours 24 --ppm 15 --wander 2 --downlinks 4 --size 20
+"""
+
+import argparse
+import random
+
+from channel import airtime
+
+TICKS = 62500                       # OSTICKS_PER_SEC
+BCN_INTV = 128 * TICKS
+BCN_RESERVE = 2120 * TICKS // 1000
+BCN_WINDOW = (128000 - 3000 - 2120) * TICKS // 1000
+SLOT_SPAN_ms = 30
+PAMBL_BCN, PAMBL = 10, 8
+MINRX_SYMS, MAX_RXSYMS, HDRSYMS = 7, 100, 16
+BCN_SF, PING_SF = 9, 9              # EU868 DR3
+BCN_AIRTIME = 0.152576
+
+# lmic/energy.h [uA]
+EN_MCU_RUN_ua = 3500
+EN_RADIO_RX_ua = 5500
+EN_RADIO_FS_ua = 2100
+EN_RADIO_SLEEP_ua = 1
+RXDC_PREAMBLE, RXDC_DETECT = 8, 3
+
+
+def us2osticks(us):
+    return int(us * TICKS / 1000000)
+
+
+def hsym(sf, n):
+    """dr2hsym(): n half symbols in ticks"""
+    return us2osticks(n << (9 + sf - 7))
+
+
+def sym_s(sf):
+    return (1 << sf) / 125e3
+
+
+class Tracker:
+    """Beacon tracking state of lmic.c (LMIC.drift, ...)"""
+    def __init__(self, args):
+        self.legacy = args.legacy
+        self.tol_ms = 13 if args.legacy else (128 * args.bcnppm + 999) // 1000
+        self.drift = self.last_ddiff = self.max_ddiff = self.missed = 0
+        self.nodrift = True
+        self.have_bcn = False
+        self.txtime = 0             # last beacon TX start (ticks)
+        self.rxtime = self.rxsyms = 0
+        self.time = 0               # GPS time of last beacon
+
+    def rx_window(self, secs, sf):
+        """calcRxWindow(): offset from the reference, sets the window width"""
+        err = self.max_ddiff * self.missed
+        if secs == 0:
+            rxoff = hsym(sf, PAMBL_BCN) + self.drift
+            err += self.last_ddiff
+        else:
+            rxoff = hsym(sf, PAMBL) + ((self.drift * secs) >> 7)
+            err += (self.last_ddiff * secs) >> 7
+        h = hsym(sf, 1)
+        rxsyms = min(127, MINRX_SYMS + (err + h - 1) // h)
+        return rxoff - hsym(sf, rxsyms), rxsyms
+
+    def window_ms(self, ms, ini):
+        """calcBcnRxWindowFromMillis()"""
+        if ini:
+            self.drift = self.max_ddiff = self.missed = 0
+            self.nodrift = True
+        h = hsym(BCN_SF, 1)
+        wsyms = max(MINRX_SYMS, (-(-ms * TICKS // 1000) + h - 1) // h)
+        self.rxsyms = wsyms
+        self.rxtime = self.txtime + BCN_INTV + hsym(BCN_SF, PAMBL_BCN) - hsym(BCN_SF, wsyms)
+
+    def device_time(self, txtime, gpstime):
+        """DeviceTimeAns: start tracking at the next beacon"""
+        self.txtime, self.time, self.have_bcn = txtime, gpstime, False
+        self.window_ms(100, True)
+
+    def beacon(self, txtime):
+        """processBeacon(), txtime None: missed. Returns False on EV_LOST_TSYNC"""
+        if txtime is not None:
+            last, self.txtime = self.txtime, txtime
+            self.time += 128
+            if not self.have_bcn:
+                self.have_bcn = True
+                self.window_ms(self.tol_ms, False)
+                return True
+            drift = txtime - last - BCN_INTV
+            if self.missed > 0:
+                drift = self.drift + int((drift - self.drift) / (self.missed + 1))
+            if not self.nodrift:
+                diff = abs(self.drift - drift)
+                self.last_ddiff = diff
+                if self.max_ddiff < diff:
+                    self.max_ddiff = diff
+                elif not self.legacy:
+                    self.max_ddiff -= (self.max_ddiff - diff) >> 3
+            self.drift = drift
+            self.missed = 0
+            self.nodrift = False
+        else:
+            self.txtime += BCN_INTV + self.drift
+            self.time += 128
+            self.missed += 1
+            if self.rxsyms > MAX_RXSYMS:
+                return False
+        off, self.rxsyms = self.rx_window(0, BCN_SF)
+        self.rxtime = self.txtime + BCN_INTV + off
+        return True
+
+    def ping_slots(self, devaddr_off, p):
+        """rxschedInit()/rxschedNext(): [(slot, rx start, rxsyms)] of this period"""
+        intv = 1 << p
+        base = self.txtime + BCN_RESERVE + SLOT_SPAN_ms * devaddr_off * TICKS // 1000
+        out = []
+        for slot in range(0, 128, intv):
+            off, syms = self.rx_window(2 + slot + intv, PING_SF)
+            out.append((slot, base + ((BCN_WINDOW * slot) >> 7) + off, syms))
+        return out
+
+
+def caught(start, syms, pre, npre, sf, legacy):
+    """Radio on from start (ticks) catches a preamble of npre symbols at pre"""
+    sym = sym_s(sf) * TICKS
+    timeout = 500e-3 * TICKS if legacy else (syms + HDRSYMS) * sym
+    return start <= pre + (npre - 4) * sym and start + timeout >= pre + (npre + 4.25) * sym
+
+
+def simulate(args, p, rng):
+    trk = Tracker(args)
+    legacy = args.legacy
+    sym_b = sym_s(BCN_SF) * TICKS
+    lead = (26.4 if legacy else args.setup_ms + 2) * 1e-3
+    n = int(args.hours * 3600 / 128)
+    rate = args.ppm
+    clock = 0.0                     # device ticks at the current beacon
+    r = {"bcn": 0, "bcn_ok": 0, "lost": 0, "slots": 0, "slots_ok": 0, "win": [],
+         "rx_s": 0.0, "fs_s": 0.0, "lat": [], "dl": 0, "dl_lost": 0}
+    arrivals, t = [], 128.0
+    while args.downlinks:
+        t += rng.expovariate(args.downlinks / 3600)
+        if t >= (n + 1) * 128:
+            break
+        arrivals.append(t)
+    queue = 0                       # index of the next downlink to send
+    a_dn = airtime(PING_SF, args.size + 13)
+    off = rng.randrange(32 << p)    # ping offset, fixed per device in this model
+    resync = True
+    for k in range(1, n + 1):
+        rate += rng.gauss(0, args.wander * (128 / 3600) ** 0.5)
+        clock += 128 * (1 + rate * 1e-6) * TICKS
+        gps = k * 128
+        if resync:
+            # DeviceTimeAns during the previous period, --timeerr ms off
+            trk.device_time(clock - BCN_INTV + rng.uniform(-1, 1) * args.timeerr * 1e-3 * TICKS,
+                            gps - 128)
+            resync = False
+        r["bcn"] += 1
+        r["fs_s"] += lead
+        ok = (caught(trk.rxtime, trk.rxsyms, clock, PAMBL_BCN, BCN_SF, legacy)
+              and rng.random() >= args.loss)
+        r["win"].append(trk.rxsyms * sym_b / TICKS * 1000)
+        if ok:
+            r["bcn_ok"] += 1
+            r["rx_s"] += max(0.0, (clock - trk.rxtime) / TICKS) + BCN_AIRTIME
+            alive = trk.beacon(int(clock + rng.gauss(0, args.jitter * 1e-6 * TICKS)))
+        else:
+            r["rx_s"] += 0.5 if legacy else (trk.rxsyms + HDRSYMS) * sym_b / TICKS
+            alive = trk.beacon(None)
+        if not alive:
+            r["lost"] += 1
+            resync = True           # no ping slots until the network time is back
+            continue
+        for slot, start, syms in trk.ping_slots(off, p):
+            r["slots"] += 1
+            r["fs_s"] += lead
+            t_slot = gps + BCN_RESERVE / TICKS + off * SLOT_SPAN_ms / 1000 + slot * 0.96
+            pre = clock + (t_slot - gps) * (1 + rate * 1e-6) * TICKS
+            hit = caught(start, syms, pre, PAMBL, PING_SF, legacy)
+            r["slots_ok"] += hit
+            frame = queue < len(arrivals) and arrivals[queue] + 1 <= t_slot
+            if frame:
+                r["dl"] += 1
+                if hit and rng.random() >= args.loss:
+                    r["lat"].append(t_slot + a_dn - arrivals[queue])
+                else:
+                    r["dl_lost"] += 1
+                queue += 1
+            if frame and hit:
+                r["rx_s"] += max(0.0, (pre - start) / TICKS) + a_dn
+            else:
+                r["rx_s"] += 0.5 if legacy else (syms + HDRSYMS) * sym_s(PING_SF)
+    return r
+
+
+def percentile(v, q):
+    return sorted(v)[min(len(v) - 1, int(q * len(v)))] if v else 0.0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--hours", type=float, default=24)
+    ap.add_argument("--ppm", type=float, default=15, help="device clock error")
+    ap.add_argument("--wander", type=float, default=2, help="clock wander, ppm per sqrt(hour)")
+    ap.add_argument("--jitter", type=float, default=50, help="beacon timestamp jitter (us)")
+    ap.add_argument("--timeerr", type=float, default=20, help="DeviceTimeAns error (ms)")
+    ap.add_argument("--loss", type=float, default=0.02, help="beacon and downlink loss")
+    ap.add_argument("--bcnppm", type=int, default=30, help="CFG_bcnppm")
+    ap.add_argument("--setup-ms", type=float, default=6, help="measured RX setup time")
+    ap.add_argument("--idle-ua", type=float, default=EN_MCU_RUN_ua, help="MCU while tracking")
+    ap.add_argument("--downlinks", type=float, default=4, help="downlinks per hour")
+    ap.add_argument("--size", type=int, default=20, help="downlink payload bytes")
+    ap.add_argument("--legacy", action="store_true",
+                    help="100 ppm, no drift diff decay, RX_RAMPUP lead, 500 ms timeouts")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    print("%.0f h, clock %+.0f ppm wandering %.1f ppm/sqrt(h), %.0f%% loss, %.1f downlinks/h%s" % (
+        args.hours, args.ppm, args.wander, args.loss * 100, args.downlinks,
+        ", legacy" if args.legacy else ""))
+    print("%-8s %7s %6s %9s %8s %10s %8s %8s %9s" % (
+        "scheme", "beacons", "lost", "window", "slots", "delivered", "lat avg", "lat p95",
+        "current"))
+    hours = args.hours
+    for p in range(8):
+        r = simulate(args, p, random.Random(args.seed))
+        extra = r["rx_s"] * EN_RADIO_RX_ua + r["fs_s"] * EN_RADIO_FS_ua
+        ua = args.idle_ua + extra / (hours * 3600)
+        print("B %-6s %6.1f%% %6d %6.1f ms %7.1f%% %9.1f%% %7.1fs %7.1fs %6.0f uA" % (
+            "%ds" % (1 << p), 100.0 * r["bcn_ok"] / r["bcn"], r["lost"],
+            sum(r["win"]) / len(r["win"]), 100.0 * r["slots_ok"] / max(1, r["slots"]),
+            100.0 * (r["dl"] - r["dl_lost"]) / max(1, r["dl"]),
+            sum(r["lat"]) / max(1, len(r["lat"])), percentile(r["lat"], 0.95), ua))
+    a_dn = airtime(PING_SF, args.size + 13)
+    share = RXDC_DETECT / (RXDC_PREAMBLE - 1.0)
+    for name, rx_ua in (("C", EN_RADIO_RX_ua),
+                        ("C rxdc", share * EN_RADIO_RX_ua + (1 - share) * EN_RADIO_SLEEP_ua)):
+        print("%-8s %7s %6s %9s %8s %9.1f%% %7.1fs %7.1fs %6.0f uA" % (
+            name, "-", "-", "-", "-", 100.0 * (1 - args.loss), a_dn, a_dn, args.idle_ua + rx_ua))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Airtime of payload-size-aware DR selection (LMIC_setDrFit).
+
+Devices at random distances up to --distance send --frames uplinks each,
+with payload sizes drawn from a --mix. Every frame goes out as:
+
+  fixed      at the device DR (--dr, or with --adr the DR the network
+             picks for a --adr-margin dB installation margin); a frame
+             too large for it is not sent (lmic.c "Frame too large")
+  fit        DRFIT_FIT: the fastest DR up to --max-dr the link allows that
+             fits the frame. Without ADR the link is judged by a
+             LinkCheckAns margin less --reserve dB (2.5 dB per DR), with
+             ADR frames keep the ADR DR unless they do not fit
+  split      DRFIT_SPLIT: as fit, but a frame too large for the link goes
+             as two frames of whole --record byte records when that takes
+             less airtime than the frame at the DR it fits
+
+A frame is delivered when one draw of the channel model (path loss with
+shadowing) is above the sensitivity of its SF. Reported per scheme: the
+frames sent, the payloads split and not sent, the average airtime of the
+payloads all schemes send and the airtime saved on them against fixed,
+and the delivery ratio of all payloads.
+
+Example:
+  drfit.py --mix logger --dr 0 --distance 5000 --reserve 6
+"""
+
+import argparse
+import random
+
+from channel import Channel, SENSITIVITY, airtime
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+MAX_APP_PLOAD = {0: 51, 1: 51, 2: 51, 3: 115, 4: 242, 5: 242}     # EU868 dr2maxAppPload
+LORAWAN_OVERHEAD = 13
+HALFDB_PER_DR = 5
+
+# payload mixes: (weight, min bytes, max bytes), logger sizes are records
+MIXES = {
+    "sensor": [(60, 2, 6), (30, 10, 20), (10, 33, 33)],         # heartbeat, reading, diagnostics
+    "logger": [(50, 1, 4), (35, 5, 12), (15, 13, 30)],          # batches of --record byte records
+    "mixed":  [(40, 2, 6), (30, 10, 24), (20, 40, 60), (10, 100, 200)],
+}
+
+
+def payload_size(args, rng):
+    weights = [m[0] for m in MIXES[args.mix]]
+    _, lo, hi = rng.choices(MIXES[args.mix], weights)[0]
+    n = rng.randint(lo, hi)
+    return n * args.record if args.mix == "logger" else n
+
+
+def air(dr, dlen):
+    return airtime(DR_SF[dr], LORAWAN_OVERHEAD + dlen)
+
+
+def fit_top(args, dev_dr, margin):
+    """lmic.c fitTop(): fastest DR the link allows"""
+    if args.adr:
+        return dev_dr
+    dr = dev_dr + int((margin - args.reserve) * 2 / HALFDB_PER_DR)
+    return max(dev_dr, min(dr, args.max_dr))
+
+
+def fit_frames(args, dev_dr, top, dlen, split):
+    """lmic.c fitDr(): [(dr, bytes)] of the frames for a payload, [] if not sent"""
+    for dr in range(top, dev_dr - 1, -1):
+        if dlen <= MAX_APP_PLOAD[dr]:
+            return [(dr, dlen)]
+    single = next((dr for dr in range(top + 1, args.max_dr + 1) if dlen <= MAX_APP_PLOAD[dr]), None)
+    if split:
+        room = MAX_APP_PLOAD[top]
+        n = room // args.record * args.record
+        if n and dlen - n <= room:
+            if single is None or air(top, n) + air(top, dlen - n) < air(single, dlen):
+                return [(top, n), (top, dlen - n)]
+    return [(single, dlen)] if single is not None else []
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--mix", choices=sorted(MIXES), default="mixed", help="payload size mix")
+    ap.add_argument("--record", type=int, default=8, help="record size of the logger mix and split unit")
+    ap.add_argument("--devices", type=int, default=200)
+    ap.add_argument("--frames", type=int, default=100, help="per device")
+    ap.add_argument("--distance", type=float, default=5000, help="max to the gateway (m)")
+    ap.add_argument("--txpow", type=float, default=14, help="EIRP (dBm)")
+    ap.add_argument("--dr", type=int, default=0, choices=range(6), help="device DR without ADR")
+    ap.add_argument("--adr", action="store_true", help="device DR set by the network (ADR)")
+    ap.add_argument("--adr-margin", type=float, default=10, help="ADR installation margin (dB)")
+    ap.add_argument("--max-dr", type=int, default=5, choices=range(6))
+    ap.add_argument("--reserve", type=float, default=6, help="link check margin kept in reserve (dB)")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    rng = random.Random(args.seed)
+    ch = Channel(rng)
+    devs = []
+    for _ in range(args.devices):
+        dist = rng.uniform(100, args.distance)
+        dr = args.dr
+        if args.adr:
+            rssi = ch.rssi(args.txpow, dist)
+            dr = max([d for d in DR_SF if rssi - SENSITIVITY[DR_SF[d]][0] >= args.adr_margin] or [0])
+        margin = ch.rssi(args.txpow, dist) - SENSITIVITY[DR_SF[dr]][0]      # LinkCheckAns
+        devs.append((dist, dr, max(0, margin), [payload_size(args, rng) for _ in range(args.frames)]))
+
+    print("%d devices up to %.0f m, %s mix, %s, max DR%d, reserve %.0f dB" % (
+        args.devices, args.distance, args.mix,
+        "ADR" if args.adr else "DR%d" % args.dr, args.max_dr, args.reserve))
+    print("%-7s %9s %7s %9s %14s %7s %10s" % (
+        "scheme", "frames", "split", "not sent", "airtime avg", "saved", "delivered"))
+    base = None
+    for name in ("fixed", "fit", "split"):
+        crng = random.Random(args.seed + 1)
+        cch = Channel(crng)
+        frames = split = dropped = ok = total = common = 0
+        spent = 0.0
+        for dist, dr, margin, sizes in devs:
+            top = dr if name == "fixed" else fit_top(args, dr, margin)
+            for dlen in sizes:
+                total += 1
+                fixed_ok = dlen <= MAX_APP_PLOAD[dr]
+                if name == "fixed":
+                    parts = [(dr, dlen)] if dlen <= MAX_APP_PLOAD[dr] else []
+                else:
+                    parts = fit_frames(args, dr, top, dlen, name == "split")
+                if not parts:
+                    dropped += 1
+                    continue
+                frames += len(parts)
+                split += len(parts) > 1
+                if fixed_ok:
+                    common += 1
+                    spent += sum(air(d, n) for d, n in parts)
+                ok += all(cch.rssi(args.txpow, dist) >= SENSITIVITY[DR_SF[d]][0] for d, _ in parts)
+        avg = spent / max(1, common) * 1000
+        if base is None:
+            base = avg
+        print("%-7s %9d %7d %8.1f%% %11.1f ms %6.0f%% %9.1f%%" % (
+            name, frames, split, 100.0 * dropped / total, avg,
+            100.0 * (1 - avg / base) if base else 0, 100.0 * ok / total))
+
+
+if __name__ == "__main__":
+    main()
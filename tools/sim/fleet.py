@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Packet delivery ratio and throughput of a fleet of class A devices.
+
+Devices are placed at random around one or more gateways, pick the
+fastest data rate with enough link margin (like ADR would) and send
+periodic uplinks on the EU868 default channels. Reception is resolved with
+the channel model in channel.py. The uplink times follow --schedule:
+
+  jitter     every period +-10 % at random
+  shutdown   main.cpp without slotting: deep sleep for the period less the
+             time awake, so the clock drift (--drift ppm) and the LMIC
+             random delay (up to --jitter s) are all that moves devices
+             apart
+  slot       lmic/txslot.c: the time in the period is a hash of the DevAddr
+             and the period number (on a --slot grid), the RTC (off by up
+             to --clock-err s) realigns every wakeup
+
+--start-spread is the window the devices start in (default: the period);
+a small one models a fleet powered up together, e.g. after a power cut.
+
+Example:
+  fleet.py -n 1000 --period 600 --duration 86400 --radius 5000
+  fleet.py -n 1000 --period 600 --duration 86400 --schedule shutdown --start-spread 10
+"""
+
+import argparse
+import math
+import random
+from collections import Counter
+
+from channel import Channel, Tx, SENSITIVITY, airtime
+
+CHANNELS = [868.1, 868.3, 868.5, 867.1, 867.3, 867.5, 867.7, 867.9]
+ADR_MARGIN = 10.0
+LORAWAN_OVERHEAD = 13
+
+
+def fmix32(x):
+    """txslot.c mix()"""
+    x ^= x >> 16
+    x = (x * 0x85EBCA6B) & 0xFFFFFFFF
+    x ^= x >> 13
+    x = (x * 0xC2B2AE35) & 0xFFFFFFFF
+    return x ^ (x >> 16)
+
+
+def slot_start(devaddr, period, slot, k):
+    """txslot.c: start of the device's slot in period number k (ms resolution)"""
+    slot_ms = max(1, int(slot * 1000))
+    nslots = max(1, int(period * 1000) // slot_ms)
+    return k * period + (fmix32(devaddr ^ fmix32(k)) % nslots) * slot_ms / 1000
+
+
+def uplink_times(args, rng, t0, devaddr, drift):
+    """Uplink times of one device according to --schedule"""
+    t = t0
+    if args.schedule == "slot":
+        k = int(t0 // args.period)
+        err = rng.uniform(-args.clock_err, args.clock_err)
+        while True:
+            t = slot_start(devaddr, args.period, args.slot, k) + err
+            k += 1
+            if t < t0:
+                continue
+            if t >= args.duration:
+                return
+            yield t
+    while t < args.duration:
+        if args.schedule == "shutdown":
+            tx = t + rng.random() * args.jitter
+            yield tx
+            t += args.period * (1 + drift)
+        else:
+            yield t
+            t += args.period * (0.9 + 0.2 * rng.random())
+
+
+def place(rng, radius):
+    r = radius * math.sqrt(rng.random())
+    a = rng.random() * 2 * math.pi
+    return (r * math.cos(a), r * math.sin(a))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-n", "--devices", type=int, default=500)
+    ap.add_argument("-g", "--gateways", type=int, default=1)
+    ap.add_argument("--period", type=float, default=600, help="uplink interval (s)")
+    ap.add_argument("--duration", type=float, default=3600, help="simulated time (s)")
+    ap.add_argument("--radius", type=float, default=3000, help="deployment radius (m)")
+    ap.add_argument("--payload", type=int, default=20, help="application payload (bytes)")
+    ap.add_argument("--txpow", type=float, default=14, help="EIRP (dBm)")
+    ap.add_argument("--sf", type=int, default=0, help="fixed SF (default: ADR like)")
+    ap.add_argument("--channels", type=int, default=3, help="number of channels used")
+    ap.add_argument("--schedule", choices=("jitter", "shutdown", "slot"), default="jitter")
+    ap.add_argument("--start-spread", type=float, default=0, help="start window (s), 0 = period")
+    ap.add_argument("--drift", type=float, default=20, help="max wakeup clock drift (ppm)")
+    ap.add_argument("--jitter", type=float, default=1.0, help="LMIC random TX delay (s)")
+    ap.add_argument("--slot", type=float, default=0, help="slot grid (s), 0 = any ms")
+    ap.add_argument("--clock-err", type=float, default=0.1, help="max RTC error (s)")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    rng = random.Random(args.seed)
+    ch = Channel(rng)
+    plen = args.payload + LORAWAN_OVERHEAD
+    gws = [place(rng, args.radius * 0.5) if i else (0.0, 0.0) for i in range(args.gateways)]
+    devs = []
+    for _ in range(args.devices):
+        pos = place(rng, args.radius)
+        dist = min(math.dist(pos, g) for g in gws)
+        # mean link budget without shadowing picks the SF
+        saved, ch.shadowing = ch.shadowing, 0
+        rssi = ch.rssi(args.txpow, dist)
+        ch.shadowing = saved
+        sf = args.sf or next((s for s in range(7, 13) if rssi - SENSITIVITY[s][0] >= ADR_MARGIN), 12)
+        start = rng.random() * (args.start_spread or args.period)
+        devs.append((pos, sf, start, rng.getrandbits(25), rng.uniform(-args.drift, args.drift) * 1e-6))
+
+    # every gateway sees every transmission with its own path loss
+    per_gw = [[] for _ in gws]
+    sent = []
+    for i, (pos, sf, t0, devaddr, drift) in enumerate(devs):
+        for t in uplink_times(args, rng, t0, devaddr, drift):
+            freq = CHANNELS[rng.randrange(args.channels)]
+            sent.append((i, t, sf))
+            for g, gpos in enumerate(gws):
+                per_gw[g].append(Tx((i, t), t, freq, sf, plen,
+                                    ch.rssi(args.txpow, math.dist(pos, gpos))))
+
+    delivered = set()
+    reasons = Counter()
+    for txs in per_gw:
+        # resolve per channel, frames on other channels never interfere
+        by_freq = {}
+        for tx in txs:
+            by_freq.setdefault(tx.freq, []).append(tx)
+        for lst in by_freq.values():
+            for tx, res in ch.receive(lst).items():
+                if res == "ok":
+                    delivered.add(tx.src)
+                else:
+                    reasons[(tx.src, res)] += 1
+
+    lost = Counter()
+    for (src, res), _ in reasons.items():
+        if src not in delivered:
+            lost[res] += 1
+    per_sf = Counter(sf for _, _, sf in sent)
+    ok_sf = Counter(sf for i, t, sf in sent if (i, t) in delivered)
+    print("devices %d gateways %d uplinks %d payload %d bytes, %s schedule" % (
+        args.devices, args.gateways, len(sent), args.payload, args.schedule))
+    print("SF  devices  uplinks   PDR    airtime/frame")
+    for sf in range(7, 13):
+        if per_sf[sf]:
+            print("%2d  %7d  %7d  %5.1f%%  %7.1f ms" % (
+                sf, sum(1 for d in devs if d[1] == sf), per_sf[sf],
+                100.0 * ok_sf[sf] / per_sf[sf], airtime(sf, plen) * 1000))
+    total = len(sent)
+    print("PDR %.1f%%  lost: %s" % (100.0 * len(delivered) / max(total, 1),
+                                   ", ".join("%s %d" % kv for kv in sorted(lost.items())) or "-"))
+    print("collisions %.1f%% of the uplinks" % (
+        100.0 * (lost["captured"] + lost["interference"]) / max(total, 1)))
+    print("throughput %.1f bit/s (%.2f frames/s)" % (
+        len(delivered) * args.payload * 8 / args.duration, len(delivered) / args.duration))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Battery lifetime projection of a device that wakes up for an uplink every
+interval and sleeps in between, with the charge model of the energy ledger.
+
+The currents are read from lmic/energy.h (EN_*_ua, EN_RXWIN_syms) and the
+TX current table from lmic/energy.c, so the projection follows the ledger
+constants of the firmware. An uplink costs what LMIC_energyUplinkModel_uC()
+computes: the frame at the TX current, both receive windows open for
+EN_RXWIN_syms symbols with the TCXO on, and the MCU running from the start
+of the frame to the end of RX2. A wakeup adds --wake-uc (boot, sensors,
+WAKE_UC in main.cpp), the interval is slept at --sleep-ua.
+
+Instead of the model, the measured charge of an uplink can be given with
+--report: the hex payload of an energy diagnostic uplink
+(LMIC_energyReport(), port 2 of main.cpp), one byte state count and the
+charge in uC per state.
+
+  lifetime.py --interval 300 600 3600 --dr 0 3 5
+  lifetime.py --interval 600 --report 0700000A2B000000010000004E...
+
+The lifetime for each interval and DR is printed in days, next to the
+share of the charge spent asleep.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+from channel import airtime
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LMIC_DIR = os.path.join(HERE, "..", "..", "lib", "IBM LMIC framework", "src", "lmic")
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+LORAWAN_OVERHEAD = 13
+
+
+def ledger_constants():
+    """EN_* defines of energy.h and the TXPOW_UA table of energy.c"""
+    with open(os.path.join(LMIC_DIR, "energy.h")) as f:
+        consts = {m.group(1): int(m.group(2)) for m in
+                  re.finditer(r"#define\s+(EN_\w+)\s+(\d+)", f.read())}
+    with open(os.path.join(LMIC_DIR, "energy.c")) as f:
+        m = re.search(r"TXPOW_UA\[\]\s*=\s*{[^}]*?\*/([^}]*)}", f.read())
+    consts["TXPOW_UA"] = [int(v) for v in m.group(1).replace(",", " ").split()]
+    return consts
+
+
+def tx_ua(c, txpow):
+    """energy.c txCurrent_ua()"""
+    txpow = min(22, max(10, txpow))
+    return c["TXPOW_UA"][(txpow - 10) // 2]
+
+
+def uplink_uc(c, plen, dr, txpow, rx1_delay, rx2_dr):
+    """LMIC_energyUplinkModel_uC()"""
+    air = airtime(DR_SF[dr], plen + LORAWAN_OVERHEAD)
+    sym1 = 2 ** DR_SF[dr] / 125e3
+    sym2 = 2 ** DR_SF[rx2_dr] / 125e3
+    rx = c["EN_RXWIN_syms"] * (sym1 + sym2)
+    run = air + rx1_delay + 1 + c["EN_RXWIN_syms"] * sym2
+    return (air * tx_ua(c, txpow) + rx * (c["EN_RADIO_RX_ua"] + c["EN_TCXO_ua"])
+            + air * c["EN_TCXO_ua"] + run * c["EN_MCU_RUN_ua"])
+
+
+def report_uc(hexstr):
+    """Total charge of an energy diagnostic payload"""
+    b = bytes.fromhex(hexstr)
+    if not b or len(b) < 1 + 4 * b[0]:
+        sys.exit("lifetime: report too short")
+    return sum(int.from_bytes(b[1 + 4 * i:5 + 4 * i], "big") for i in range(b[0]))
+
+
+def lifetime_days(capacity_mah, interval, sleep_ua, cycle_uc):
+    """LMIC_energyLifetimeHours() / 24"""
+    q = cycle_uc + sleep_ua * interval
+    return capacity_mah * 3600000 / q * interval / 86400, sleep_ua * interval / q
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--capacity", type=int, default=2600, help="battery [mAh] (BATTERY_MAH)")
+    ap.add_argument("--sleep-ua", type=float, default=4000, help="sleep current (SLEEP_UA)")
+    ap.add_argument("--wake-uc", type=float, default=500, help="charge of a wakeup besides the uplink")
+    ap.add_argument("--interval", type=int, nargs="+", default=[300, 600, 1800, 3600])
+    ap.add_argument("--dr", type=int, nargs="+", default=[0, 3, 5], choices=sorted(DR_SF))
+    ap.add_argument("--size", type=int, default=6, help="application payload [bytes]")
+    ap.add_argument("--txpow", type=int, default=14, help="TX power [dBm]")
+    ap.add_argument("--rx1-delay", type=int, default=1, help="RX1 delay [s]")
+    ap.add_argument("--rx2-dr", type=int, default=0, choices=sorted(DR_SF))
+    ap.add_argument("--report", help="measured uplink: energy diagnostic payload (hex)")
+    args = ap.parse_args()
+
+    c = ledger_constants()
+    if args.report:
+        ups = [("measured", report_uc(args.report))]
+    else:
+        ups = [("DR%d" % dr, uplink_uc(c, args.size, dr, args.txpow, args.rx1_delay, args.rx2_dr))
+               for dr in args.dr]
+    print("%-9s %10s %8s %10s %7s" % ("uplink", "uplink uC", "interval", "life days", "asleep"))
+    for name, uc in ups:
+        for interval in args.interval:
+            days, asleep = lifetime_days(args.capacity, interval, args.sleep_ua, uc + args.wake_uc)
+            print("%-9s %10.0f %8d %10.0f %6.1f%%" % (name, uc, interval, days, 100 * asleep))
+
+
+if __name__ == "__main__":
+    main()
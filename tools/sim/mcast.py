@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Latency and energy of downlink delivery to a fleet: unicast versus multicast.
+
+The network server has to deliver K frames to N devices that uplink every
+--interval seconds and deep sleep in between. Compared:
+
+  class A      one frame in RX1 after every regular uplink
+  class A poll device uplinks again at once while FPending is set
+  class C      devices switch to class C (lmic/mcast.c class C session), the
+               gateway sends the K frames to every device one by one on RX2
+  mcast        one class C multicast session, the K frames (plus coded
+               frames for --redundancy) are sent once to the group
+  mcast rxdc   same, continuous RX with the radio RX duty cycle mode
+               (radio-LoRa-E5.c: RXDC_DETECT of RXDC_PREAMBLE symbols)
+
+Class C sessions are set up with a class A downlink (McClassCSessionReq),
+so they start after every device has uplinked once. Downlinks on RX2 keep
+the 10 % duty cycle of the 869.525 MHz band. A frame is lost with
+probability --loss per device. Charge is what the delivery costs a device
+on top of its regular uplinks, with the currents of lmic/energy.h; during
+class C the MCU keeps running and the device stays in class C until the
+session times out (2^n s).
+
+Example:
+  mcast.py --devices 100 --frames 20 --size 50 --dr 3 --interval 600
+"""
+
+import argparse
+import math
+import random
+
+from channel import airtime
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+LORAWAN_OVERHEAD = 13
+RX2_DUTY = 0.1
+RX1_DELAY = 1.0
+
+# lmic/energy.h [uA]
+EN_RADIO_RX_ua = 5500
+EN_RADIO_SLEEP_ua = 1
+EN_MCU_RUN_ua = 3500
+EN_TX14_ua = 89000          # energy.c txCurrent_ua(14)
+
+RXDC_PREAMBLE = 8
+RXDC_DETECT = 3
+
+
+def session(t):
+    """Class C session length covering t, the timeout is sent as 2^n s"""
+    return 2.0 ** max(0, math.ceil(math.log2(t)))
+
+
+class Result:
+    def __init__(self):
+        self.latency = []       # per device, time of its last frame (None: incomplete)
+        self.charge = []        # per device [uAs]
+        self.downlinks = 0
+        self.gw_airtime = 0.0
+
+
+def class_a(args, rng, poll):
+    r = Result()
+    a_dn = airtime(DR_SF[args.dr], args.size + LORAWAN_OVERHEAD)
+    a_up = airtime(DR_SF[args.updr], LORAWAN_OVERHEAD)
+    for _ in range(args.devices):
+        t = rng.uniform(0, args.interval)       # first uplink
+        got, charge, tries = 0, 0.0, 0
+        while got < args.frames and tries < 4 * args.frames:
+            tries += 1
+            r.downlinks += 1
+            r.gw_airtime += a_dn
+            charge += a_dn * (EN_RADIO_RX_ua + EN_MCU_RUN_ua)
+            if rng.random() >= args.loss:
+                got += 1
+            if got == args.frames:
+                t += RX1_DELAY + a_dn
+                break
+            if poll:                            # FPending: uplink again at once
+                charge += a_up * EN_TX14_ua + RX1_DELAY * EN_MCU_RUN_ua
+                t += RX1_DELAY + a_dn + a_up
+            else:
+                t += args.interval
+        r.latency.append(t if got == args.frames else None)
+        r.charge.append(charge)
+    return r
+
+
+def class_c(args, rng, multicast, rxdc):
+    r = Result()
+    a_dn = airtime(DR_SF[args.dr], args.size + LORAWAN_OVERHEAD)
+    gap = a_dn / RX2_DUTY
+    sym = 2 ** DR_SF[args.dr] / 125e3
+    if rxdc:
+        share = RXDC_DETECT / (RXDC_PREAMBLE - 1.0)
+        rx_ua = share * EN_RADIO_RX_ua + (1 - share) * EN_RADIO_SLEEP_ua
+    else:
+        rx_ua = EN_RADIO_RX_ua
+    # session request in RX1 after each device's next uplink
+    start = args.interval + RX1_DELAY + a_dn
+    setup = a_dn * (EN_RADIO_RX_ua + EN_MCU_RUN_ua)
+    if multicast:
+        n = args.frames + (args.frames * args.redundancy + 99) // 100
+        r.downlinks = n + args.devices
+        length = session(n * gap)
+        for _ in range(args.devices):
+            got, done = 0, None
+            for i in range(n):
+                if rng.random() >= args.loss:
+                    got += 1
+                    if got == args.frames:      # coded frames make up for any lost ones
+                        done = start + i * gap + a_dn
+                        break
+            r.latency.append(done)
+            r.charge.append(setup + length * (rx_ua + EN_MCU_RUN_ua)
+                            + args.frames * a_dn * (EN_RADIO_RX_ua - rx_ua)
+                            + (RXDC_PREAMBLE * sym * EN_RADIO_RX_ua if rxdc else 0))
+    else:
+        # every device gets its frames in turn, lost ones are sent again
+        t = start
+        ends = []
+        for _ in range(args.devices):
+            got = 0
+            while got < args.frames:
+                r.downlinks += 1
+                if rng.random() >= args.loss:
+                    got += 1
+                t += gap
+            ends.append(t - gap + a_dn)
+        r.downlinks += args.devices
+        length = session(t - start)             # devices cannot leave class C early
+        for e in ends:
+            r.latency.append(e)
+            r.charge.append(setup + length * (rx_ua + EN_MCU_RUN_ua))
+    r.gw_airtime = r.downlinks * a_dn
+    return r
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--devices", type=int, default=100)
+    ap.add_argument("--frames", type=int, default=20, help="downlinks to deliver")
+    ap.add_argument("--size", type=int, default=50, help="payload bytes per downlink")
+    ap.add_argument("--dr", type=int, default=3, choices=range(6), help="downlink data rate")
+    ap.add_argument("--updr", type=int, default=5, choices=range(6), help="uplink data rate")
+    ap.add_argument("--interval", type=float, default=600, help="uplink interval (s)")
+    ap.add_argument("--loss", type=float, default=0.05, help="downlink loss per device")
+    ap.add_argument("--redundancy", type=int, default=20, help="coded multicast frames in %%")
+    ap.add_argument("--runs", type=int, default=10)
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    schemes = [("class A", lambda rng: class_a(args, rng, False)),
+               ("class A poll", lambda rng: class_a(args, rng, True)),
+               ("class C", lambda rng: class_c(args, rng, False, False)),
+               ("mcast", lambda rng: class_c(args, rng, True, False)),
+               ("mcast rxdc", lambda rng: class_c(args, rng, True, True))]
+    print("%d frames of %d bytes at DR%d to %d devices, uplink every %.0f s, %.0f%% loss" % (
+        args.frames, args.size, args.dr, args.devices, args.interval, args.loss * 100))
+    print("%-13s %9s %10s %9s %12s %11s %12s" % (
+        "scheme", "downlinks", "gw airtime", "complete", "latency avg", "latency max",
+        "charge/dev"))
+    for name, fn in schemes:
+        res = [fn(random.Random(args.seed * 1000 + i)) for i in range(args.runs)]
+        lat = [x for r in res for x in r.latency if x is not None]
+        total = sum(len(r.latency) for r in res)
+        charge = sum(sum(r.charge) for r in res) / total
+        print("%-13s %9.0f %9.0fs %8.0f%% %11.0fs %10.0fs %9.1f mAs" % (
+            name, sum(r.downlinks for r in res) / len(res),
+            sum(r.gw_airtime for r in res) / len(res), 100.0 * len(lat) / total,
+            sum(lat) / len(lat) if lat else 0, max(lat) if lat else 0, charge / 1000))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+"""Report by exception (ReportFilter.h) against an uplink every interval.
+
+Every --interval seconds the device reads its channels (MCU temperature
+in degC and supply voltage in 10 mV, as main.cpp) and either
+
+  always     sends them unconfirmed, or
+  filter     asks ReportFilter::check(): a change beyond --deadband from
+             the last acknowledged report goes confirmed (up to --attempts
+             attempts), a heartbeat goes unconfirmed after --silence
+             intervals without an uplink, otherwise no uplink at all
+
+Uplinks and ACKs are lost with probability --loss each. The readings come
+from a --trace CSV (time_s,temp_c,vdd_mv, one line per sample; no sensor
+traces ship with the repository) or a synthetic one: an indoor diurnal
+temperature with noise and occasional steps, and a slowly discharging
+battery with a temperature coefficient. --readings takes the two channels
+as scaled integers instead, one line per interval, in the format of the
+recorded traces of tools/codec/traces.
+
+Reported per scheme: uplinks per day, airtime, charge of the wakeups, the
+worst and the share of intervals with a network side error (last received
+values against the readings) beyond the dead band, and the longest time
+without a received frame.
+
+Example:
+  report.py --days 30 --interval 600 --deadband 1 5 --silence 6 --loss 0.1
+
+--decisions prints the intervals of the filter scheme instead, one line
+"readings, check(), ACK passed to sent(), silent()" per interval after a
+first line with the dead band and the heartbeat. test/report replays them
+through ReportFilter.h, saved and restored every interval, and must take
+the same decisions (make report in test/).
+"""
+
+import argparse
+import csv
+import math
+import random
+
+from channel import airtime
+
+LORAWAN_OVERHEAD = 13
+PAYLOAD = 6                 # TestPayload: fcnt, life, temperature, Vdd
+RX_WINDOWS = 2.0            # RX1 delay + RX2 without a downlink (s)
+RX_ON = 0.03                # receiver on per window without a preamble (s)
+
+# energy.h typical currents (uA), TX at 14 dBm from the SX126x data sheet
+MCU_RUN_UA = 3500
+RADIO_RX_UA = 5500
+RADIO_TX_UA = 45000
+
+
+def synthetic(args, rng):
+    """[(temp_c, vdd_10mv)] per interval"""
+    out = []
+    step = 0.0
+    for i in range(int(args.days * 86400 / args.interval)):
+        t = i * args.interval
+        if rng.random() < args.interval / 86400.0 * args.steps:
+            step = rng.choice((-1, 1)) * rng.uniform(2, 6)      # heating on/off, door, sun
+        step *= math.exp(-args.interval / 7200.0)
+        temp = 21 + 3 * math.sin(2 * math.pi * (t / 86400.0 - 0.375)) + step + rng.gauss(0, 0.3)
+        vdd = 3300 - 300 * t / (args.days * 86400) + 2 * (temp - 21) + rng.gauss(0, 8)
+        out.append((temp, vdd))
+    return out
+
+
+def from_trace(args):
+    """Resample a CSV trace to the interval: the last sample at or before each tick"""
+    rows = []
+    with open(args.trace) as f:
+        for r in csv.reader(f):
+            try:
+                rows.append((float(r[0]), float(r[1]), float(r[2])))
+            except (ValueError, IndexError):
+                continue                                        # header or comment
+    rows.sort()
+    out, j = [], 0
+    t = rows[0][0]
+    while t <= rows[-1][0]:
+        while j + 1 < len(rows) and rows[j + 1][0] <= t:
+            j += 1
+        out.append((rows[j][1], rows[j][2]))
+        t += args.interval
+    return out
+
+
+def readings(sample):
+    """ADC readings as main.cpp read_sensors(): whole degC, 10 mV"""
+    return [int(round(sample[0])), int(round(sample[1] / 10.0))]
+
+
+def from_readings(path):
+    """Scaled integer readings, one line per interval, # comments"""
+    with open(path) as f:
+        return [[int(x) for x in r[:2]] for r in csv.reader(f) if r and not r[0].startswith("#")]
+
+
+class Filter:
+    """Port of payload::ReportFilter"""
+
+    def __init__(self, deadband, silence):
+        self.deadband, self.max_silence = deadband, max(1, silence)
+        self.valid, self.silent, self.due = False, 0, None
+        self.ref = [0] * len(deadband)
+        self.pend = list(self.ref)
+
+    def check(self, values):
+        self.pend = list(values)
+        self.due = None
+        if not self.valid or any(abs(v - r) > d for v, r, d in zip(values, self.ref, self.deadband)):
+            self.due = "change"
+        elif self.silent + 1 >= self.max_silence:
+            self.due = "heartbeat"
+        else:
+            self.silent += 1
+        return self.due
+
+    def sent(self, acked):
+        self.silent = 0
+        if self.due == "change" and acked:
+            self.ref, self.valid = list(self.pend), True
+        self.due = None
+
+
+def run(args, trace, rng, scheme, log=None):
+    """log(values, due, acked, silent) is called every interval of the filter scheme"""
+    flt = Filter(args.deadband, args.silence)
+    air = airtime(args.sf, PAYLOAD + LORAWAN_OVERHEAD)
+    uplinks = frames = 0
+    charge = 0.0                                               # uC
+    server = None
+    worst = [0] * len(args.deadband)
+    over = 0
+    gap = longest = 0
+    for values in trace:
+        charge += MCU_RUN_UA * args.wake_ms / 1000.0
+        due = "heartbeat" if scheme == "always" else flt.check(values)
+        got = False
+        if due:
+            uplinks += 1
+            attempts = args.attempts if due == "change" else 1
+            acked = False
+            for _ in range(attempts):
+                frames += 1
+                charge += RADIO_TX_UA * air + MCU_RUN_UA * RX_WINDOWS + 2 * RADIO_RX_UA * RX_ON
+                up = rng.random() >= args.loss
+                got = got or up
+                if due != "change":
+                    break
+                if up and rng.random() >= args.loss:
+                    acked = True
+                    break
+            if got:
+                server = values
+            if scheme == "filter":
+                flt.sent(acked)
+        if log:
+            log(values, due, acked if due else False, flt.silent)
+        gap = 0 if got else gap + 1
+        longest = max(longest, gap)
+        if server is None:
+            over += 1
+            continue
+        err = [abs(v - s) for v, s in zip(values, server)]
+        worst = [max(w, e) for w, e in zip(worst, err)]
+        over += any(e > d for e, d in zip(err, args.deadband))
+    days = len(trace) * args.interval / 86400.0
+    return (uplinks / days, frames * air / days, charge / 1000.0 / days,
+            worst, 100.0 * over / len(trace), (longest + 1) * args.interval / 3600.0)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--trace", help="CSV time_s,temp_c,vdd_mv (default: synthetic)")
+    ap.add_argument("--readings", help="CSV of scaled integer readings, one line per interval")
+    ap.add_argument("--days", type=float, default=30, help="synthetic trace length")
+    ap.add_argument("--steps", type=float, default=2, help="synthetic temperature steps per day")
+    ap.add_argument("--interval", type=float, default=600, help="wakeup interval (s)")
+    ap.add_argument("--deadband", type=int, nargs=2, default=[1, 5], help="degC, 10 mV")
+    ap.add_argument("--silence", type=int, default=6, help="heartbeat after n intervals")
+    ap.add_argument("--attempts", type=int, default=6, help="of a confirmed change report")
+    ap.add_argument("--loss", type=float, default=0.1, help="uplink and ACK loss")
+    ap.add_argument("--sf", type=int, default=9, choices=range(7, 13))
+    ap.add_argument("--wake-ms", type=float, default=50, help="MCU run time of a wakeup without uplink")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--decisions", action="store_true", help="intervals of the filter scheme")
+    args = ap.parse_args()
+
+    if args.readings:
+        trace = from_readings(args.readings)
+    else:
+        trace = [readings(s) for s in (from_trace(args) if args.trace
+                                       else synthetic(args, random.Random(args.seed)))]
+    if args.decisions:
+        codes = {None: 0, "change": 1, "heartbeat": 2}           # REPORT_NONE, _CHANGE, _HEARTBEAT
+        print("# deadband %d %d silence %d" % (args.deadband[0], args.deadband[1], args.silence))
+        run(args, trace, random.Random(args.seed + 1), "filter",
+            lambda values, due, acked, silent: print("%d,%d,%d,%d,%d" % (
+                values[0], values[1], codes[due], acked, silent)))
+        return
+    print("%d intervals of %.0f s, SF%d, dead band %d degC %d0 mV, heartbeat %d, %.0f%% loss" % (
+        len(trace), args.interval, args.sf, args.deadband[0], args.deadband[1],
+        args.silence, args.loss * 100))
+    print("%-7s %9s %10s %10s %13s %9s %10s" % (
+        "scheme", "uplinks/d", "airtime/d", "charge/d", "max err", "over db", "max gap"))
+    for scheme in ("always", "filter"):
+        up, air, mc, worst, over, gap = run(args, trace, random.Random(args.seed + 1), scheme)
+        print("%-7s %9.1f %9.1fs %8.0fmC %4dC %4d0mV %8.1f%% %9.1fh" % (
+            scheme, up, air, mc, worst[0], worst[1], over, gap))
+
+
+if __name__ == "__main__":
+    main()
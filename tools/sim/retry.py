@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Confirmed uplinks: the fixed retry loop versus a retry policy.
+
+A device sends a confirmed message of --size bytes every --interval
+seconds at --dr. An attempt is lost according to the channel model (path
+loss with shadowing at the given distance) plus a random loss for
+collisions; the ACK in RX1 can be lost the same way. Every attempt uses the
+first of --bands sub-bands its duty cycle allows. Compared:
+
+  fixed      TXCONF_ATTEMPTS (8) attempts at the same DR, each retry at a
+             random time within RETRY_PERIOD_secs (3 s)
+  policy     lmic.c retryConf(): --attempts, one DR lower after every
+             --dr-steps unacked attempts down to --min-dr, backoff doubling
+             up to 2^--backoff, --airtime budget and --deadline
+
+Reported per message: delivered (acked), attempts, airtime, time until
+the ACK, and the messages not acked within the deadline (both schemes).
+
+Example:
+  retry.py --dr 0 --distance 6000 --loss 0.2 --attempts 6 --dr-steps 2 --min-dr 2
+"""
+
+import argparse
+import random
+
+from channel import Channel, SENSITIVITY, airtime
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+LORAWAN_OVERHEAD = 13
+RX1_DELAY = 1.0
+RX_WINDOWS = 2.0            # RX1 + RX2 without a downlink (s)
+RETRY_PERIOD_secs = 3
+TXCONF_ATTEMPTS = 8
+
+
+class Link:
+    def __init__(self, args, rng):
+        self.ch = Channel(rng)
+        self.rng = rng
+        self.args = args
+        self.avail = [0.0] * args.bands     # per sub-band duty cycle
+
+    def ok(self, sf):
+        if self.rng.random() < self.args.loss:
+            return False
+        return self.ch.rssi(self.args.txpow, self.args.distance) >= SENSITIVITY[sf][0]
+
+    def send(self, t, dr):
+        """Attempt at t or when the duty cycle allows, returns (acked, start, end, airtime)"""
+        sf = DR_SF[dr]
+        at = airtime(sf, self.args.size + LORAWAN_OVERHEAD)
+        band = min(range(len(self.avail)), key=lambda b: self.avail[b])
+        start = max(t, self.avail[band])
+        if self.args.duty > 0:
+            self.avail[band] = start + at / self.args.duty
+        acked = self.ok(sf) and self.ok(sf)
+        end = start + at + (RX1_DELAY + airtime(sf, LORAWAN_OVERHEAD) if acked else RX_WINDOWS)
+        return acked, start, end, at
+
+
+def message(args, link, t0, rng, policy):
+    """One confirmed message queued at t0: (acked, attempts, airtime, end)"""
+    dr, t, spent, n = args.dr, t0, 0.0, 0
+    deadline = t0 + args.deadline if policy and args.deadline else None
+    while True:
+        if deadline is not None and max(t, min(link.avail)) > deadline:
+            return False, n, spent, t
+        acked, _, end, at = link.send(t, dr)
+        n += 1
+        spent += at
+        if acked:
+            return True, n, spent, end
+        if not policy:
+            if n >= TXCONF_ATTEMPTS:
+                return False, n, spent, end
+            t = end + rng.uniform(0, RETRY_PERIOD_secs)
+            continue
+        if n >= args.attempts:
+            return False, n, spent, end
+        if deadline is not None and end >= deadline:
+            return False, n, spent, end
+        nxt = dr
+        if args.dr_steps and n % args.dr_steps == 0 and dr > args.min_dr:
+            nxt = dr - 1
+        size = args.size + LORAWAN_OVERHEAD
+        if args.airtime and spent + airtime(DR_SF[nxt], size) > args.airtime:
+            nxt = dr
+            if spent + airtime(DR_SF[nxt], size) > args.airtime:
+                return False, n, spent, end
+        dr = nxt
+        span = RETRY_PERIOD_secs << min(n - 1, args.backoff)
+        if deadline is not None:
+            span = min(span, max(1, int(deadline - end)))
+        t = end + rng.uniform(0, span)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--size", type=int, default=20, help="payload bytes")
+    ap.add_argument("--dr", type=int, default=0, choices=range(6), help="data rate of the 1st attempt")
+    ap.add_argument("--distance", type=float, default=6000, help="to the gateway (m)")
+    ap.add_argument("--txpow", type=float, default=14, help="EIRP (dBm)")
+    ap.add_argument("--loss", type=float, default=0.2, help="extra random frame loss")
+    ap.add_argument("--duty", type=float, default=0.01, help="duty cycle, 0 = none")
+    ap.add_argument("--bands", type=int, default=2, help="sub-bands with their own duty cycle")
+    ap.add_argument("--interval", type=float, default=600, help="between messages (s)")
+    ap.add_argument("--messages", type=int, default=2000)
+    ap.add_argument("--attempts", type=int, default=6)
+    ap.add_argument("--dr-steps", type=int, default=2, help="lower DR after every n attempts, 0 = never")
+    ap.add_argument("--min-dr", type=int, default=0, choices=range(6))
+    ap.add_argument("--backoff", type=int, default=3, help="max doubling of the retry period")
+    ap.add_argument("--airtime", type=float, default=0, help="budget per message (s), 0 = none")
+    ap.add_argument("--deadline", type=float, default=60, help="per message (s), 0 = none")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    print("%d confirmed messages of %d bytes, DR%d, %.0f m, %.0f%% loss, %.1f%% duty cycle" % (
+        args.messages, args.size, args.dr, args.distance, args.loss * 100, args.duty * 100))
+    print("%-7s %9s %9s %12s %12s %12s %10s" % (
+        "scheme", "delivered", "attempts", "airtime avg", "airtime max", "latency avg", "missed"))
+    for name, policy in (("fixed", False), ("policy", True)):
+        rng = random.Random(args.seed)
+        link = Link(args, rng)
+        res = []
+        for i in range(args.messages):
+            t0 = i * args.interval
+            acked, n, spent, end = message(args, link, t0, rng, policy)
+            late = not acked or (args.deadline and end - t0 > args.deadline)
+            res.append((acked, n, spent, end - t0, late))
+        ok = [r for r in res if r[0]]
+        print("%-7s %8.1f%% %9.2f %11.2fs %11.2fs %11.1fs %9.1f%%" % (
+            name, 100.0 * len(ok) / len(res), sum(r[1] for r in res) / len(res),
+            sum(r[2] for r in res) / len(res), max(r[2] for r in res),
+            sum(r[3] for r in ok) / len(ok) if ok else 0,
+            100.0 * sum(r[4] for r in res) / len(res)))
+
+
+if __name__ == "__main__":
+    main()
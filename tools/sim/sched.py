@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+"""Wakeups of periodic tasks across deep sleep (TaskTable.h).
+
+The devices shut down between wakeups. Each --task runs every period;
+the uplink task (the last one, "report" in main.cpp) sends at a TX time
+--offset seconds into its period (CFG_txslot, random per device if not
+given). Compared:
+
+  single     one sleep interval as the loop() before the task table: every
+             wakeup is a full one (LMIC, uplink) at the shortest period
+  separate   a wakeup for every task run, tasks due at the same second share it
+  table      sched::TaskTable: a wakeup at the earliest due time runs every
+             task due within its slack, the next due time stays one period
+             after the due time
+
+A wakeup for the uplink task costs --full-mc, one for the other tasks only
+--task-mc. --clock-step sets the RTC forward (negative: back) once a day,
+as a network time sync. Reported per device: wakeups and uplinks per day,
+the charge of the wakeups per day, and per task the runs per day and the
+largest early and late run against its own grid of RTC time.
+
+Example:
+  sched.py --task sample:120:60 --task report:600:0 --days 7
+
+--wakeups prints the wakeups of the table scheme of one device (--offset)
+instead, one line "RTC time, mask of the tasks run" per wakeup and a last
+line with the counts and the largest early and late runs. test/sched runs
+the same loop with TaskTable.h and must print the same (make sched in
+test/, with whole seconds for --full-s and --task-s).
+"""
+
+import argparse
+import random
+
+
+class TaskTable:
+    """Port of sched::TaskTable, times in seconds"""
+
+    def __init__(self, tasks):
+        self.tasks = tasks                       # [(name, period, slack)]
+        self.due_at = [None] * len(tasks)
+
+    def restore(self, saved, now):
+        for i, (_, period, slack) in enumerate(self.tasks):
+            d = saved[i] if saved else None
+            self.due_at[i] = d if d is not None and d - now <= period + slack else now
+
+    def due(self, now):
+        return [i for i, t in enumerate(self.tasks) if self.due_at[i] - now <= t[2]]
+
+    def done(self, i, now):
+        period = self.tasks[i][1]
+        late = now - self.due_at[i]
+        self.due_at[i] += (late // period + 1 if late > 0 else 1) * period
+
+    def next(self, now):
+        return max(0, min(self.due_at) - now)
+
+
+def run(args, tasks, scheme, tx_offset, log=None):
+    """[wakeups, uplinks, charge mC, {task: [runs, early, late]}]
+    log(rtc, due) is called for every wakeup of the table schemes"""
+    end = args.days * 86400
+    stats = {t[0]: [0, 0, 0] for t in tasks}
+    wakes = uplinks = 0
+    charge = 0.0
+    up = len(tasks) - 1
+    step_at = 86400 if args.clock_step else None
+    offset = [0] * up + [tx_offset]
+
+    def account(i, t):
+        """Run task i at RTC time t, early/late against its grid"""
+        period = tasks[i][1]
+        pos = (t - offset[i]) % period
+        err = pos if pos < period / 2 else pos - period
+        s = stats[tasks[i][0]]
+        s[0] += 1
+        s[1] = max(s[1], -err)
+        s[2] = max(s[2], err)
+
+    if scheme == "single":
+        period = min(t[1] for t in tasks)
+        t = 0
+        while t < end:
+            wakes += 1
+            uplinks += 1
+            charge += args.full_mc
+            for i in range(up):
+                if t % tasks[i][1] < period:
+                    account(i, t)
+            stats[tasks[up][0]][0] += 1             # the uplink goes at every wakeup
+            t += period
+        return wakes, uplinks, charge, stats
+
+    table = TaskTable(tasks)
+    saved = None
+    real = 0                # real time; the RTC is real + skew after steps
+    skew = 0
+    while real < end:
+        rtc = real + skew
+        table.restore(saved, rtc)
+        if saved is None:
+            table.due_at[up] = rtc + offset[up]     # TX time of the first period
+        due = table.due(rtc)
+        if scheme == "separate":
+            due = [i for i in due if table.due_at[i] <= rtc]
+        if not due:
+            real += max(1, table.next(rtc))
+            continue
+        wakes += 1
+        if log:
+            log(rtc, due)
+        full = up in due
+        charge += args.full_mc if full else args.task_mc
+        uplinks += full
+        for i in due:
+            account(i, rtc)
+            table.done(i, rtc)
+        if full:                                    # CFG_txslot: TX time by the RTC
+            d, period = table.due_at[up], tasks[up][1]
+            table.due_at[up] = d - d % period + offset[up]
+        saved = list(table.due_at)
+        wake = args.full_s if full else args.task_s
+        real += wake
+        if step_at is not None and real >= step_at:
+            skew += args.clock_step                 # RTC set by the network time
+            step_at += 86400
+        rtc = real + skew
+        real += max(1, table.next(rtc))
+    return wakes, uplinks, charge, stats
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--task", action="append", metavar="NAME:PERIOD:SLACK",
+                    help="periodic task (s), the last one sends the uplink "
+                         "(default sample:120:60 report:600:0)")
+    ap.add_argument("--offset", type=int, help="TX time in the uplink period (s), default random")
+    ap.add_argument("--devices", type=int, default=50, help="with random TX times")
+    ap.add_argument("--days", type=float, default=7)
+    ap.add_argument("--full-mc", type=float, default=25, help="charge of a wakeup with LMIC and uplink")
+    ap.add_argument("--task-mc", type=float, default=0.5, help="charge of a wakeup for other tasks")
+    ap.add_argument("--full-s", type=float, default=6, help="length of a wakeup with uplink")
+    ap.add_argument("--task-s", type=float, default=0.1, help="length of other wakeups")
+    ap.add_argument("--clock-step", type=int, default=0, help="RTC step once a day (s)")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--wakeups", action="store_true", help="wakeups of one device (--offset)")
+    args = ap.parse_args()
+
+    tasks = []
+    for spec in args.task or ["sample:120:60", "report:600:0"]:
+        name, period, slack = spec.split(":")
+        tasks.append((name, int(period), int(slack)))
+    if args.wakeups:
+        if args.offset is None:
+            ap.error("--wakeups needs --offset")
+        w, u, _, st = run(args, tasks, "table", args.offset,
+                          lambda rtc, due: print("%d %x" % (rtc, sum(1 << i for i in due))))
+        print("wakeups %d uplinks %d %s" % (w, u, " ".join(
+            "%s %d %d %d" % (t[0], st[t[0]][0], st[t[0]][1], st[t[0]][2]) for t in tasks)))
+        return
+    rng = random.Random(args.seed)
+    offsets = [args.offset if args.offset is not None else rng.randrange(tasks[-1][1])
+               for _ in range(1 if args.offset is not None else args.devices)]
+
+    print("%s, %s, %.0f days" % (
+        ", ".join("%s every %d s (slack %d)" % t for t in tasks),
+        "TX time %d s into the period" % args.offset if args.offset is not None
+        else "%d devices with random TX times" % len(offsets), args.days))
+    print("%-9s %9s %10s %10s  %s" % ("scheme", "wakeups/d", "uplinks/d", "charge/d",
+                                        "  ".join("%-22s" % (t[0] + " runs/d early/late") for t in tasks)))
+    for scheme in ("single", "separate", "table"):
+        wakes = uplinks = charge = 0
+        stats = {t[0]: [0, 0, 0] for t in tasks}
+        for off in offsets:
+            w, u, c, st = run(args, tasks, scheme, off)
+            wakes, uplinks, charge = wakes + w, uplinks + u, charge + c
+            for name, (runs, early, late) in st.items():
+                s = stats[name]
+                stats[name] = [s[0] + runs, max(s[1], early), max(s[2], late)]
+        n = len(offsets) * args.days
+        for s in stats.values():
+            s[0] /= len(offsets)
+        print("%-9s %9.0f %10.0f %8.0fmC  %s" % (
+            scheme, wakes / n, uplinks / n, charge / n,
+            "  ".join("%-22s" % ("%6.0f %5.0fs %5.0fs" % (
+                stats[t[0]][0] / args.days, stats[t[0]][1], stats[t[0]][2])) for t in tasks)))
+
+
+if __name__ == "__main__":
+    main()
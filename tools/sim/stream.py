@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Goodput of bulk uplinks: data streaming engine versus per frame ACKs.
+
+One device uploads a block of data at a fixed data rate. Frames are lost
+according to the channel model (path loss with shadowing at the given
+distance) plus a random loss for collisions. The device respects the
+duty cycle of its sub-band. Compared:
+
+  dse        lmic/dse.c: unconfirmed frames sent once, RX windows only at
+             the end of a block, coded frames for redundancy
+  confirmed  every frame confirmed, retransmitted until ACKed (max 8)
+  plain      unconfirmed frames without redundancy
+
+Goodput is the data delivered complete and in order per second of upload,
+acks the downlinks the gateway had to send (its own duty cycle budget).
+
+Example:
+  stream.py --size 20000 --dr 5 --distance 2000 --loss 0.05 --redundancy 10 20 40
+"""
+
+import argparse
+import os
+import random
+import sys
+
+from channel import Channel, SENSITIVITY, airtime
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "lns"))
+import dse      # noqa: E402
+
+DR_SF = {0: 12, 1: 11, 2: 10, 3: 9, 4: 8, 5: 7}
+MAX_PAYLOAD = {0: 51, 1: 51, 2: 51, 3: 115, 4: 242, 5: 242}
+LORAWAN_OVERHEAD = 13
+RX_WINDOWS = 2.0            # RX1 + RX2 after an uplink that listens (s)
+ACK_TIMEOUT = (1.0, 3.0)    # retransmission delay of unacknowledged frames (s)
+MAX_TRIES = 8
+
+
+class Link:
+    def __init__(self, args, rng):
+        self.ch = Channel(rng)
+        self.rng = rng
+        self.sf = DR_SF[args.dr]
+        self.args = args
+        self.t = 0.0                # start of next transmission
+        self.airtime = 0.0
+        self.downlinks = 0          # gateway transmissions (ACKs)
+
+    def ok(self, plen):
+        if self.rng.random() < self.args.loss:
+            return False
+        return self.ch.rssi(self.args.txpow, self.args.distance) >= SENSITIVITY[self.sf][0]
+
+    def send(self, plen, listen):
+        """Transmit, returns (received, end of transaction)"""
+        at = airtime(self.sf, plen)
+        start = self.t
+        end = start + at + (RX_WINDOWS if listen else 0)
+        self.airtime += at
+        gap = at / self.args.duty if self.args.duty > 0 else 0
+        self.t = max(end, start + gap)
+        return self.ok(plen), end
+
+
+def run_dse(args, data, redundancy, rng):
+    link = Link(args, rng)
+    rx = dse.Receiver()
+    symsz = MAX_PAYLOAD[args.dr] - dse.HDRLEN
+    frames = dse.encode(data, symsz, redundancy)
+    done = None
+    for i, f in enumerate(frames):
+        last_of_block = i + 1 == len(frames) or frames[i + 1][1:3] != f[1:3]
+        got, end = link.send(len(f) + LORAWAN_OVERHEAD, last_of_block)
+        if got and rx.feed(f) is not None:
+            done = end
+    st = rx.streams.get(1, {"blocks": {}})
+    good = 0
+    for b in range(len(st["blocks"]) + 1):          # in order prefix
+        blk = st["blocks"].get(b)
+        if blk is None or not blk.complete():
+            break
+        good += blk.k * blk.symsz
+    return min(good, len(data)), done or link.t, len(frames), link.airtime, link.downlinks
+
+
+def run_confirmed(args, data, rng, confirmed=True):
+    link = Link(args, rng)
+    size = MAX_PAYLOAD[args.dr]
+    chunks = [data[i:i + size] for i in range(0, len(data), size)]
+    good, in_order, frames = 0, True, 0
+    for c in chunks:
+        acked = False
+        for _ in range(MAX_TRIES if confirmed else 1):
+            frames += 1
+            got, end = link.send(len(c) + LORAWAN_OVERHEAD, confirmed)
+            if not confirmed:
+                acked = got
+                break
+            link.downlinks += got
+            if got and link.ok(LORAWAN_OVERHEAD):     # ACK in RX1
+                acked = True
+                break
+            link.t = max(link.t, end + rng.uniform(*ACK_TIMEOUT))
+        if acked and in_order:
+            good += len(c)
+        else:
+            in_order = False
+    return good, link.t, frames, link.airtime, link.downlinks
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--size", type=int, default=20000, help="bytes to upload")
+    ap.add_argument("--dr", type=int, default=5, choices=range(6))
+    ap.add_argument("--distance", type=float, default=1000, help="to the gateway (m)")
+    ap.add_argument("--txpow", type=float, default=14, help="EIRP (dBm)")
+    ap.add_argument("--loss", type=float, default=0.05, help="extra random frame loss")
+    ap.add_argument("--duty", type=float, default=0.01, help="duty cycle, 0 = none")
+    ap.add_argument("--redundancy", type=int, nargs="+", default=[0, 10, 20, 40],
+                    help="coded frames in %% of a block")
+    ap.add_argument("--runs", type=int, default=20)
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    rng = random.Random(args.seed)
+    data = bytes(rng.randrange(256) for _ in range(args.size))
+    schemes = [("dse %d%%" % r, lambda rng, r=r: run_dse(args, data, r, rng))
+               for r in args.redundancy]
+    schemes += [("confirmed", lambda rng: run_confirmed(args, data, rng)),
+                ("plain", lambda rng: run_confirmed(args, data, rng, confirmed=False))]
+    print("%d bytes at DR%d, %.0f m, %.0f%% extra loss, duty cycle %s" % (
+        args.size, args.dr, args.distance, args.loss * 100,
+        "%.1f%%" % (args.duty * 100) if args.duty else "off"))
+    print("%-12s %8s %8s %6s %10s %10s %10s" % (
+        "scheme", "frames", "airtime", "acks", "complete", "time (s)", "goodput"))
+    for name, fn in schemes:
+        res = [fn(random.Random(args.seed * 1000 + i)) for i in range(args.runs)]
+        complete = sum(1 for g, *_ in res if g == len(data))
+        n = len(res)
+        good = sum(r[0] for r in res) / n
+        t = sum(r[1] for r in res) / n
+        print("%-12s %8.0f %7.0fs %6.0f %9.0f%% %10.0f %8.1f B/s" % (
+            name, sum(r[2] for r in res) / n, sum(r[3] for r in res) / n,
+            sum(r[4] for r in res) / n, 100.0 * complete / n, t, good / t))
+
+
+if __name__ == "__main__":
+    main()
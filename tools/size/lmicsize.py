@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Size report of struct lmic_t (the LMIC variable) per member: offset,
+size and the padding in front of it, with the configuration of
+hal/target-config.h. Optionally the largest RAM symbols of a firmware ELF.
+
+  lmicsize.py                                 host compiler, ARM layout
+  lmicsize.py --cc arm-none-eabi-gcc --nm arm-none-eabi-nm
+  lmicsize.py -DCFG_mcast -DCFG_max_payload=115   other configuration
+  lmicsize.py --elf .pio/build/STM32WLE5/firmware.elf --top 20
+
+Compiler flags (-D, -U, -I) are passed on.
+
+The members are taken from lmic.h with their #if lines, so only the ones
+of the configuration are measured. A C file with one array per member,
+sized by sizeof and offsetof, is compiled (not linked) and the array
+sizes are read back with nm: this works with the cross compiler, no code
+runs. The host default (gcc -m32 -malign-double, needs the 32-bit libc
+headers, gcc-multilib) has the struct layout of the Cortex-M (4 byte
+pointers, 8 byte aligned 64-bit types).
+
+PlatformIO runs this after every build (pio_size.py in platformio.ini).
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LMIC_DIR = os.path.join(HERE, "..", "..", "lib", "IBM LMIC framework", "src", "lmic")
+HAL_DIR = os.path.join(HERE, "..", "..", "lib", "IBM LMIC framework", "src", "hal")
+
+DECL = re.compile(r"^\s*[A-Za-z_][\w\s\*]*?[\s\*](\w+)\s*(\[[^\]]*\])?\s*;")
+CLOSE = re.compile(r"^\s*}\s*(\w+)\s*;")
+
+
+def members(header, struct="lmic_t"):
+    """C lines that instantiate M(name) for every member, #if lines kept"""
+    with open(header) as f:
+        text = f.read()
+    start = text.index("struct %s {" % struct)
+    out, depth = [], 0
+    for line in text[start:].splitlines()[1:]:
+        code = re.sub(r"//.*", "", line).strip()
+        if code.startswith("#"):
+            out.append(code)
+            continue
+        if depth == 0 and code.startswith("}"):
+            break
+        m = CLOSE.match(code)
+        if m and depth >= 1:
+            depth -= code.count("}") - code.count("{")
+            if depth <= 1:
+                out.append("M(%s)" % m.group(1))
+            continue
+        depth += code.count("{") - code.count("}")
+        m = DECL.match(code)
+        if m and depth == 0:
+            out.append("M(%s)" % m.group(1))
+    return out
+
+
+def measure(args):
+    lines = ["#include \"lmic.h\"", "#include <stddef.h>",
+             "#define M(n) char sz_##n[sizeof(((struct lmic_t*)0)->n)]; "
+             "char off_##n[offsetof(struct lmic_t, n) + 1];"]
+    lines += members(os.path.join(LMIC_DIR, "lmic.h"))
+    lines.append("char sz__total[sizeof(struct lmic_t)];")
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "lmicsize.c")
+        obj = os.path.join(tmp, "lmicsize.o")
+        with open(src, "w") as f:
+            f.write("\n".join(lines) + "\n")
+        cmd = args.cc.split() + ["-c", "-fno-common", "-I", LMIC_DIR, "-I", HAL_DIR] + \
+            args.flags + ["-o", obj, src]
+        subprocess.run(cmd, check=True)
+        nm = subprocess.run(args.nm.split() + ["-S", "--defined-only", obj],
+                            check=True, capture_output=True, text=True).stdout
+    size, off, order = {}, {}, []
+    for l in nm.splitlines():
+        f = l.split()
+        if len(f) != 4:
+            continue
+        n = int(f[1], 16)
+        if f[3].startswith("sz_"):
+            size[f[3][3:]] = n
+            order.append(f[3][3:])
+        elif f[3].startswith("off_"):
+            off[f[3][4:]] = n - 1
+    return size.pop("_total"), sorted(((off[m], size[m], m) for m in size if m in off))
+
+
+def report(args):
+    total, rows = measure(args)
+    print("struct lmic_t: %d bytes" % total)
+    print("%6s %6s %4s  %s" % ("offset", "size", "pad", "member"))
+    end = pad = 0
+    for o, s, m in rows:
+        gap = o - end if o >= end else 0            # union members share their offset
+        pad += gap
+        print("%6d %6d %4s  %s" % (o, s, gap or "", m))
+        end = max(end, o + s)
+    pad += total - end
+    print("%6d %6s %4s  (tail)" % (end, "", total - end or ""))
+    print("padding %d bytes, largest:" % pad)
+    for o, s, m in sorted(rows, key=lambda r: -r[1])[:args.top]:
+        print("  %-16s %5d" % (m, s))
+
+
+def elf_top(args):
+    out = subprocess.run(args.nm.split() + ["-S", "--size-sort", "-C", args.elf],
+                         check=True, capture_output=True, text=True).stdout
+    ram = []
+    for l in out.splitlines():
+        f = l.split(None, 3)
+        if len(f) == 4 and f[2] in "bBdD":
+            ram.append((int(f[1], 16), f[3]))
+    print("RAM %d bytes in %d symbols, largest:" % (sum(s for s, _ in ram), len(ram)))
+    for s, n in sorted(ram, reverse=True)[:args.top]:
+        print("  %-40s %6d" % (n, s))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--cc", default="gcc -m32 -malign-double", help="compiler for the target layout")
+    ap.add_argument("--nm", default="nm")
+    ap.add_argument("--elf", help="also list the largest RAM symbols of this firmware")
+    ap.add_argument("--top", type=int, default=10)
+    args, args.flags = ap.parse_known_args()
+    for f in args.flags:
+        if f[:2] not in ("-D", "-U", "-I"):
+            ap.error("unknown argument %s" % f)
+    try:
+        report(args)
+        if args.elf:
+            elf_top(args)
+    except BrokenPipeError:
+        pass
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("lmicsize: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
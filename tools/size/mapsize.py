@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Flash and RAM footprint of the firmware by module and by symbol, from
+the map file of the GNU linker, and size budgets for the build.
+
+  mapsize.py .pio/build/STM32WLE5/firmware.map
+  mapsize.py firmware.map --symbols 40 --module lmic.c
+  mapsize.py firmware.map --budget flash=180000 --budget ram=40000 --budget lmic.c=60000
+
+Every input section the linker kept is counted: flash for code, constants
+and the initial values of .data, RAM for .data, .bss and the heap/stack
+reserve. With -ffunction-sections and -fdata-sections (as the Arduino core
+builds) an input section is one function or variable, so the symbols are
+the functions and variables; sections without a name of their own are
+listed as <object>:<section>. Modules are the object files, libraries the
+archives (and src for the sketch).
+
+A budget is NAME=BYTES: flash or ram for the whole image, a library or a
+module for its flash. The exit code is 1 if one is exceeded. PlatformIO
+checks the budgets of custom_size_budget in platformio.ini after every
+link and fails the build then (pio_size.py).
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+FLASH = (0x08000000, 0x0A000000)
+RAM = (0x20000000, 0x30000000)
+
+SECTION = re.compile(r"^ (\.\S+|COMMON)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+))?$")
+CONT = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$")
+OUTSEC = re.compile(r"^(\.\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)")
+ARCHIVE = re.compile(r"(?:^|/)lib([^/]*)\.a\((.+)\)$")
+
+
+def module(path):
+    """(library, object) of an input file"""
+    path = path.strip().replace("\\", "/")
+    m = ARCHIVE.search(path)
+    if m:
+        lib, obj = m.group(1), m.group(2)
+    else:
+        lib, obj = os.path.basename(os.path.dirname(path)) or ".", os.path.basename(path)
+    return lib, re.sub(r"\.o(bj)?$", "", obj)
+
+
+def within(addr, area):
+    return area[0] <= addr < area[1]
+
+
+def parse(name):
+    """[(symbol, library, object, flash, ram)] of the input sections"""
+    out, outsec, pending = [], None, None
+    with open(name, errors="replace") as f:
+        lines = iter(f.read().splitlines())
+    for line in lines:                          # discarded sections come first
+        if line.startswith("Linker script and memory map"):
+            break
+    for line in lines:
+        m = OUTSEC.match(line)
+        if m:
+            outsec = m.group(1)
+            continue
+        m = SECTION.match(line)
+        if m:
+            sec = m.group(1)
+            if m.group(2) is None:              # long name, address on the next line
+                pending = sec
+                continue
+            addr, size, path = int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+        elif pending:
+            m = CONT.match(line)
+            pending, sec = None, pending
+            if not m:
+                continue
+            addr, size, path = int(m.group(1), 16), int(m.group(2), 16), m.group(3)
+        else:
+            continue
+        if size == 0 or outsec is None:
+            continue
+        lib, obj = module(path)
+        flash = size if within(addr, FLASH) or outsec == ".data" else 0
+        ram = size if within(addr, RAM) else 0
+        if not flash and not ram:
+            continue                            # debug info
+        parts = sec.split(".", 2)
+        sym = parts[2] if len(parts) == 3 and parts[2] else "%s:%s" % (obj, sec)
+        out.append((sym, lib, obj, flash, ram))
+    return out
+
+
+def table(title, rows, n):
+    print(title)
+    for name, (flash, ram) in rows[:n]:
+        print("  %-44s %8d %7d" % (name[:44], flash, ram))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("map")
+    ap.add_argument("--symbols", type=int, default=20, help="largest symbols to list")
+    ap.add_argument("--modules", type=int, default=20, help="largest modules to list")
+    ap.add_argument("--module", help="list the symbols of this module only")
+    ap.add_argument("--budget", action="append", default=[], metavar="NAME=BYTES")
+    ap.add_argument("-q", "--quiet", action="store_true", help="totals and budgets only")
+    args = ap.parse_args()
+    try:
+        secs = parse(args.map)
+    except OSError as e:
+        sys.exit("mapsize: %s" % e)
+
+    total = [0, 0]
+    libs, mods, syms, only = (collections.defaultdict(lambda: [0, 0]) for _ in range(4))
+    for sym, lib, obj, flash, ram in secs:
+        for acc in (total, libs[lib], mods[obj], syms[sym]):
+            acc[0] += flash
+            acc[1] += ram
+        if args.module == obj:
+            acc = only[sym]
+            acc[0] += flash
+            acc[1] += ram
+
+    def largest(d):
+        return sorted(d.items(), key=lambda kv: (-kv[1][0], -kv[1][1]))
+
+    print("flash %d bytes, RAM %d bytes" % tuple(total))
+    if not args.quiet:
+        print("%-46s %8s %7s" % ("", "flash", "RAM"))
+        table("libraries:", largest(libs), len(libs))
+        table("modules:", largest(mods), args.modules)
+        if args.module:
+            table("symbols of %s:" % args.module, largest(only), len(only))
+        else:
+            table("symbols:", largest(syms), args.symbols)
+
+    over = 0
+    for spec in args.budget:
+        name, _, limit = spec.partition("=")
+        if name.lower() in ("flash", "ram"):
+            used = total[name.lower() == "ram"]
+        elif name in libs or name in mods:
+            used = (libs.get(name) or mods[name])[0]
+        else:
+            print("budget %s: no such library or module" % name)
+            continue
+        ok = used <= int(limit, 0)
+        over += not ok
+        print("budget %-20s %8d of %8d %s" % (name, used, int(limit, 0), "ok" if ok else "EXCEEDED"))
+    sys.exit(1 if over else 0)
+
+
+if __name__ == "__main__":
+    main()
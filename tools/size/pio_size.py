@@ -0,0 +1,47 @@
+# PlatformIO extra script (platformio.ini: extra_scripts = post:tools/size/pio_size.py).
+# After the firmware is linked, prints the sizeof breakdown of the LMIC
+# state for the configuration of the build and the largest RAM symbols,
+# and checks the size budgets (custom_size_budget) against the map file.
+# A budget exceeded fails the build.
+#
+#   pio run -t sizereport       flash and RAM by library, module and symbol
+
+import os
+import re
+
+Import("env")
+
+HERE = os.path.join(env.subst("$PROJECT_DIR"), "tools", "size")
+MAP = "$BUILD_DIR/${PROGNAME}.map"
+
+env.Append(LINKFLAGS=["-Wl,-Map," + MAP])
+
+
+def script(name):
+    return '"$PYTHONEXE" "%s"' % os.path.join(HERE, name)
+
+
+def budgets():
+    spec = env.GetProjectOption("custom_size_budget", "")
+    return " ".join("--budget " + b for b in spec.split())
+
+
+def lmic_size(source, target, env):
+    cc = env.subst("$CC")
+    nm = cc[:-3] + "nm" if cc.endswith("gcc") else "nm"
+    flags = [f for f in env.subst("$_CPPDEFFLAGS").split()        # LMIC configuration only
+             if re.match(r"-D(CFG_|DISABLE_|BRD_)\w*(=\w+)?$", f)]
+    env.Execute(" ".join([script("lmicsize.py"),
+                          "--cc", '"%s %s"' % (cc, env.subst("$CCFLAGS")), "--nm", nm,
+                          "--elf", '"%s"' % target[0].get_abspath()] + flags))
+    return env.Execute(" ".join([script("mapsize.py"), '"%s"' % env.subst(MAP), "-q", budgets()]))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", lmic_size)
+
+env.AddCustomTarget(
+    name="sizereport",
+    dependencies="$BUILD_DIR/${PROGNAME}.elf",
+    actions=[" ".join([script("mapsize.py"), '"%s"' % MAP, "--symbols 60", budgets()])],
+    title="Size report",
+    description="Flash and RAM by library, module and symbol from the map file")
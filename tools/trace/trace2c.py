@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Convert radio trace lines (RT,...) from a serial log into a C array for
+LMIC_radioReplay(), or print them as a readable timeline.
+
+  trace2c.py serial.log > trace.h          C initializer
+  trace2c.py -t serial.log                 timeline
+
+Record lines are printed by dump_radiotrace() in src/main.cpp:
+  RT,<type>,<time>,<freq>,<rps>,<txpow>,<len>,<rssi>,<snr>,<frame hex>
+"""
+
+import argparse
+import sys
+
+OSTICKS_PER_SEC = 62500
+MODES = ["STOP", "TX", "RX", "RXON", "TXCW", "CCA", "INIT", "CAD", "TXCONT"]
+
+
+def records(lines):
+    for line in lines:
+        i = line.find("RT,")
+        if i < 0:
+            continue
+        f = line[i:].strip().split(",")
+        if len(f) != 10:
+            continue
+        yield {"type": int(f[1], 16), "time": int(f[2]), "freq": int(f[3]),
+               "rps": int(f[4], 16), "txpow": int(f[5]), "len": int(f[6]),
+               "rssi": int(f[7]), "snr": int(f[8]), "frame": bytes.fromhex(f[9])}
+
+
+def name(r):
+    if r["type"] & 0xF0 == 0x00:
+        return MODES[r["type"] & 0x0F] if (r["type"] & 0x0F) < len(MODES) else "OP%d" % r["type"]
+    return "IRQ" if r["type"] & 0xF0 == 0x10 else "TIMEOUT"
+
+
+def emit_c(recs, out, var, framelen):
+    out.write("// Generated by tools/trace/trace2c.py, %d records\n" % len(recs))
+    out.write("static const radiotrace_t %s[] = {\n" % var)
+    for r in recs:
+        if len(r["frame"]) > framelen:
+            sys.exit("frame of %d bytes exceeds CFG_radiotrace_framelen %d" % (len(r["frame"]), framelen))
+        if r["len"] > len(r["frame"]):
+            sys.stderr.write("warning: %s record at %d was truncated when recorded\n" % (name(r), r["time"]))
+        frame = ", ".join("0x%02X" % b for b in r["frame"]) or "0"
+        out.write("    { %d, %d, 0x%04X, 0x%02X, %d, %d, %d, %d, { %s } },  // %s\n" % (
+            r["time"], r["freq"], r["rps"], r["type"], r["len"], r["txpow"], r["rssi"],
+            r["snr"], frame, name(r)))
+    out.write("};\n")
+
+
+def timeline(recs, out):
+    t0 = recs[0]["time"] if recs else 0
+    for r in recs:
+        out.write("%10.3f s  %-7s %9.3f MHz rps %04X len %3d rssi %4d snr %4d %s\n" % (
+            (r["time"] - t0) / OSTICKS_PER_SEC, name(r), r["freq"] / 1e6, r["rps"], r["len"],
+            r["rssi"], r["snr"], r["frame"].hex()))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    ap.add_argument("-t", "--timeline", action="store_true", help="print timeline instead of C")
+    ap.add_argument("-n", "--name", default="TRACE", help="name of the C array")
+    ap.add_argument("--framelen", type=int, default=255, help="CFG_radiotrace_framelen of the replay build")
+    args = ap.parse_args()
+    recs = list(records(args.log))
+    if args.timeline:
+        timeline(recs, sys.stdout)
+    else:
+        emit_c(recs, sys.stdout, args.name, args.framelen)
+
+
+if __name__ == "__main__":
+    main()